@@ -3,278 +3,1172 @@
 #include "../libraries/miniaudio.h"
 
 /*
- * Constructor
+ * Constructor: A null application runs the audio headless (eg: the stress test),
+ * ie: nothing is displayed.
  */
 Audio::Audio(Application* app) : pApplication(app), contextInit(false) {
-    ma_context_config config = ma_context_config_init();
+    // The recorder shares the same audio context, used once the context is initialized.
+    recorder = new Recorder(&context);
+    // So does the preview bus, which decodes on its own.
+    previewBus = new PreviewBus(&context, getDecoderConfig());
 
-    // Initialize the audio context.
-    if (ma_context_init(NULL, 0, &config, &context) == MA_SUCCESS) {
-        contextInit = true;
-        std::cerr << "Audio context initialized." << std::endl;
-    }
+    // Speed control, inserted after the decoder.
+    timeStretch = new TimeStretch(defaultOutputChannels, defaultOutputSampleRate);
+    convolver = new Convolver(defaultOutputChannels, defaultOutputSampleRate);
+    scrubber = new Scrubber(getDecoderConfig());
+
+    // Cache up to 8 files within 256MB by default.
+    pcmCache = new PcmCache(getDecoderConfig(), 256 * 1024 * 1024, 8);
+    // The scan results are displayed once they're ready.
+    silenceDetector = new SilenceDetector(getDecoderConfig(), app ? Application::silence_cb : nullptr, app);
 
     // Set the callbackData parameters used in the MiniAudio callback function.
-    callbackData.pIsPlaying = &is_playing;
     callbackData.pApplication = app;
-    callbackData.pDecoder = &decoder;
+    callbackData.pDataSource = &decoder;
     callbackData.pCursor = &cursor;
+    callbackData.pClock = &clock;
     // Store pointer to this instance.
     callbackData.pInstance = this;
+    sem_init(&loopWakeup, 0, 0);
+}
+
+/*
+ * Destructor: Uninitializes all of the audio parameters before closing the app.
+ */
+Audio::~Audio() {
+    waitForContext();
+    // It mustn't stop the device being released.
+    stopIdleWatcher();
+    uninit();
+
+    if (recorder) {
+        // Finalize a possible recording in progress.
+        delete recorder;
+    }
+
+    // Released before the context.
+    delete previewBus;
+    delete silenceDetector;
+    delete pcmCache;
+    delete timeStretch;
+    delete convolver;
+    delete scrubber;
+    sem_destroy(&loopWakeup);
+
+    if (contextInit) {
+        ma_context_uninit(&context);
+        std::cerr << "Audio context uninitialized." << std::endl;
+    }
+}
+
+/*
+ * Initializes the audio context in the background, so that the application
+ * window shows up without waiting for the backends to be probed.
+ * The backend that worked last time is tried first, which skips probing the others.
+ */
+void Audio::initContextAsync(const char *backendName)
+{
+    preferredBackend = backendName;
+    contextThread = std::thread(&Audio::initContext, this);
+}
+
+/*
+ * Note: This function is run in a thread. The application is informed through Fl::awake.
+ */
+void Audio::initContext()
+{
+    Tracer::setThreadName("Audio context");
+    Tracer::Scope trace("Init context");
+    ma_context_config config = ma_context_config_init();
+    config.allocationCallbacks = PoolAllocator::shared().getCallbacks();
+    ma_backend backend;
+
+    if (ma_get_backend_from_name(preferredBackend.c_str(), &backend) == MA_SUCCESS
+        && ma_context_init(&backend, 1, &config, &context) == MA_SUCCESS) {
+        contextInit = true;
+    }
+    // Probe all of the backends in the default order.
+    else if (ma_context_init(NULL, 0, &config, &context) == MA_SUCCESS) {
+        contextInit = true;
+    }
+
+    if (contextInit) {
+        std::cerr << "Audio context initialized (" << ma_get_backend_name(context.backend) << ")." << std::endl;
+    }
+
+    if (pApplication != nullptr) {
+        Fl::awake(Application::audio_ready_cb, pApplication);
+    }
+}
+
+/*
+ * Waits for the context initialization to complete. Returns true if the context is usable.
+ * Note: Must be called from the application thread.
+ */
+bool Audio::waitForContext()
+{
+    if (contextThread.joinable()) {
+        contextThread.join();
+    }
+
+    return contextInit;
+}
+
+/*
+ * Returns the name of the backend in use, or an empty string.
+ */
+std::string Audio::getBackendName()
+{
+    return waitForContext() ? ma_get_backend_name(context.backend) : "";
+}
+
+/*
+ * Uninitializes both output device and decoder parameters.
+ */
+void Audio::uninit()
+{
+    releaseOutputDevice();
+
+    // The loop worker uses the decoder.
+    stopLoop();
+    scrubber->close();
+
+    if (decoderInit) {
+        ma_decoder_uninit(&decoder);
+        decoderInit = false;
+    }
+
+    if (audioBufferInit) {
+        ma_audio_buffer_uninit(&audioBuffer);
+        audioBufferInit = false;
+        cachedFile.reset();
+    }
+}
+
+/*
+ * Gathers all the capture and playback device info into an array.
+ */
+std::vector<Audio::DeviceInfo> Audio::getDevices(ma_device_type deviceType) {
+    // Create a device array.
+    std::vector<DeviceInfo> devices;
+    
+    if (!waitForContext()) {
+        return devices;
+    }
+
+    // initialize some MiniAudio variables.
+    ma_device_info* pDeviceInfos = nullptr;
+    ma_uint32 deviceCount = 0;
+    ma_result result;
+
+    // Get playback or capture devices.
+    if (deviceType == ma_device_type_playback || deviceType == ma_device_type_duplex) {
+        result = ma_context_get_devices(&context, &pDeviceInfos, &deviceCount, nullptr, nullptr);
+    }
+    else {
+        result = ma_context_get_devices(&context, nullptr, nullptr, &pDeviceInfos, &deviceCount);
+    }
+
+    if (result != MA_SUCCESS) {
+        std::cerr << "Failed to retrieve devices." << std::endl;
+        return devices;
+    }
+
+    // Store the device data in the array.
+    for (ma_uint32 i = 0; i < deviceCount; ++i) {
+        DeviceInfo info;
+        info.name = pDeviceInfos[i].name;
+        info.id = pDeviceInfos[i].id;
+        info.isDefault = pDeviceInfos[i].isDefault;
+        devices.push_back(info);
+    }
+
+    return devices;
+}
+
+/* Device getters. */
+
+std::vector<Audio::DeviceInfo> Audio::getOutputDevices() {
+    return getDevices(ma_device_type_playback);
+}
+
+std::vector<Audio::DeviceInfo> Audio::getInputDevices() {
+    return getDevices(ma_device_type_capture);
+}
+
+/*
+ * Searches for the given device name and copies its id into pDeviceID.
+ */
+bool Audio::findDevice(ma_device_type deviceType, const char *deviceName, ma_device_id *pDeviceID)
+{
+    auto devices = getDevices(deviceType);
+
+    // Loop through the available devices. 
+    for (ma_uint32 i = 0; i < (ma_uint32) devices.size(); ++i) {
+        if (strcmp(devices[i].name.c_str(), deviceName) == 0) {
+            std::cout << "Found target device: " << devices[i].name << std::endl;
+            // Set the given device id.
+            memcpy(pDeviceID, &devices[i].id, sizeof(ma_device_id));
+            return true;
+        }
+    }
+
+    std::cerr << "Target device not found!" << std::endl;
+
+    return false;
+}
+
+/*
+ * Gets the member of the device id union used by the given backend. The backends
+ * naming their devices (eg: ALSA, PulseAudio) use a null terminated string.
+ * Returns false if the id can't be saved (ie: custom backends).
+ */
+static bool getDeviceIdField(ma_backend backend, ma_device_id& id, ma_uint8*& pField, size_t& size, bool& isString)
+{
+    isString = true;
+
+    switch (backend) {
+        case ma_backend_alsa:       pField = (ma_uint8*)id.alsa;          size = sizeof(id.alsa);            return true;
+        case ma_backend_pulseaudio: pField = (ma_uint8*)id.pulse;         size = sizeof(id.pulse);           return true;
+        case ma_backend_coreaudio:  pField = (ma_uint8*)id.coreaudio;     size = sizeof(id.coreaudio);       return true;
+        case ma_backend_sndio:      pField = (ma_uint8*)id.sndio;         size = sizeof(id.sndio);           return true;
+        case ma_backend_audio4:     pField = (ma_uint8*)id.audio4;        size = sizeof(id.audio4);          return true;
+        case ma_backend_oss:        pField = (ma_uint8*)id.oss;           size = sizeof(id.oss);             return true;
+        case ma_backend_webaudio:   pField = (ma_uint8*)id.webaudio;      size = sizeof(id.webaudio);        return true;
+        default: break;
+    }
+
+    // The others are saved as hexadecimal.
+    isString = false;
+
+    switch (backend) {
+        case ma_backend_wasapi:     pField = (ma_uint8*)id.wasapi;        size = sizeof(id.wasapi);          return true;
+        case ma_backend_dsound:     pField = (ma_uint8*)id.dsound;        size = sizeof(id.dsound);          return true;
+        case ma_backend_winmm:      pField = (ma_uint8*)&id.winmm;        size = sizeof(id.winmm);           return true;
+        case ma_backend_jack:       pField = (ma_uint8*)&id.jack;         size = sizeof(id.jack);            return true;
+        case ma_backend_aaudio:     pField = (ma_uint8*)&id.aaudio;       size = sizeof(id.aaudio);          return true;
+        case ma_backend_opensl:     pField = (ma_uint8*)&id.opensl;       size = sizeof(id.opensl);          return true;
+        case ma_backend_null:       pField = (ma_uint8*)&id.nullbackend;  size = sizeof(id.nullbackend);     return true;
+        default: return false;
+    }
+}
+
+/*
+ * Sets the output device id from the string returned by getOutputDeviceId.
+ * Returns false if the string doesn't fit the backend in use.
+ */
+bool Audio::parseOutputDeviceId(const std::string& idString)
+{
+    ma_uint8* pField = nullptr;
+    size_t size = 0;
+    bool isString = false;
+    memset(&outputDeviceID, 0, sizeof(ma_device_id));
+
+    if (idString.empty() || !getDeviceIdField(context.backend, outputDeviceID, pField, size, isString)) {
+        return false;
+    }
+
+    if (isString) {
+        // Room is left for the null terminator.
+        if (idString.size() >= size) {
+            return false;
+        }
+
+        memcpy(pField, idString.c_str(), idString.size());
+        return true;
+    }
+
+    if (idString.size() != size * 2 || idString.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return false;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        pField[i] = (ma_uint8)std::stoul(idString.substr(i * 2, 2), nullptr, 16);
+    }
+
+    return true;
+}
+
+/*
+ * Set the output to the given device.
+ */
+void Audio::setOutputDevice(const char *deviceName, const std::string& cachedId)
+{
+    outputDeviceName = deviceName;
+    outputDeviceCached = false;
+
+    // The id found last time spares enumerating the devices. It's checked against
+    // the device name once the device is initialized.
+    if (waitForContext() && parseOutputDeviceId(cachedId)) {
+        outputDeviceCached = true;
+    }
+    else if (!findDevice(ma_device_type_playback, deviceName, &outputDeviceID)) {
+        return;
+    }
+
+    // The output device is running (ie: a file is loaded or the input is monitored).
+    if (outputDeviceInit) {
+        restartOutputDevice();
+    }
+}
+
+/*
+ * Reinitializes the output device with the current settings. Returns false if
+ * the device can't be initialized.
+ */
+bool Audio::restartOutputDevice()
+{
+    // Stop playback and release device resources.
+    releaseOutputDevice();
+
+    if(!initializeOutputDevice()) {
+        std::cerr << "Failed to initialize output device." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Set the input (ie: recording) to the given device.
+ */
+void Audio::setInputDevice(const char *deviceName)
+{
+    // Don't switch device in the middle of a recording.
+    if (isRecording()) {
+        std::cerr << "Cannot change the input device while recording." << std::endl;
+        return;
+    }
+
+    // Looked up when first needed, which spares enumerating the capture devices at startup.
+    inputDeviceName = deviceName;
+    inputDeviceResolved = false;
+}
+
+/*
+ * Looks the selected input device up if not done yet.
+ */
+void Audio::resolveInputDevice()
+{
+    if (!inputDeviceResolved && waitForContext()) {
+        inputDeviceFound = findDevice(ma_device_type_capture, inputDeviceName.c_str(), &inputDeviceID);
+        inputDeviceResolved = true;
+    }
+}
+
+/*
+ * Set the preview output to the given device ("default" for the default one).
+ */
+void Audio::setPreviewDevice(const char *deviceName)
+{
+    // Looked up when first needed, unless a file is being previewed.
+    previewDeviceName = deviceName;
+    previewDeviceResolved = false;
+
+    if (previewBus->isOpen()) {
+        resolvePreviewDevice();
+    }
+}
+
+void Audio::resolvePreviewDevice()
+{
+    if (previewDeviceResolved || !waitForContext()) {
+        return;
+    }
+
+    ma_device_id deviceID;
+    bool found = previewDeviceName != "default" && findDevice(ma_device_type_playback, previewDeviceName.c_str(), &deviceID);
+    previewBus->setDevice(found ? &deviceID : nullptr);
+    previewDeviceResolved = true;
+}
+
+/*
+ * Plays the given file on the preview output, the main playback goes on.
+ */
+bool Audio::startPreview(const char *fileName)
+{
+    if (!waitForContext()) {
+        std::cerr << "Audio context not initialized." << std::endl;
+        return false;
+    }
+
+    resolvePreviewDevice();
+
+    return previewBus->open(fileName);
+}
+
+/*
+ * Returns the output device id as a string so that it can be saved, ie: the id
+ * given by the backend (eg: "hw:1,0" with ALSA), or the hexadecimal form of it for
+ * the backends using numbers. Empty if no device has been found.
+ */
+std::string Audio::getOutputDeviceId()
+{
+    ma_uint8* pField = nullptr;
+    size_t size = 0;
+    bool isString = false;
+
+    if (!waitForContext() || !getDeviceIdField(context.backend, outputDeviceID, pField, size, isString)) {
+        return "";
+    }
+
+    if (isString) {
+        return std::string((const char*)pField, strnlen((const char*)pField, size));
+    }
+
+    std::string id;
+    bool isEmpty = true;
+    char buffer[3];
+
+    for (size_t i = 0; i < size; i++) {
+        snprintf(buffer, sizeof(buffer), "%02x", pField[i]);
+        id += buffer;
+        isEmpty = isEmpty && pField[i] == 0;
+    }
+
+    return isEmpty ? "" : id;
+}
+
+/*
+ * Starts recording the selected input device into the given file.
+ */
+bool Audio::startRecording(const char *fileName)
+{
+    if (!waitForContext()) {
+        std::cerr << "Audio context not initialized." << std::endl;
+        return false;
+    }
+
+    resolveInputDevice();
+
+    // Use the default capture device if no input device has been selected.
+    return recorder->start(inputDeviceFound ? &inputDeviceID : NULL, fileName);
+}
+
+void Audio::stopRecording()
+{
+    if (recorder) {
+        recorder->stop();
+    }
+}
+
+/*
+ * Fills a block of float frames with the file playback (or silence), the live input
+ * and the volume applied. Returns the source position of the first frame.
+ */
+static ma_uint64 mix_block(ma_device* pDevice, AudioCallbackData* pCallbackData, float* pFrames, const float* pInput,
+                           ma_uint32 frameCount, bool isRendering, float volume)
+{
+    ma_uint32 outputChannels = pDevice->playback.channels;
+    ma_uint64 position;
+
+    // The time slider is being dragged: The grains are played instead of the file.
+    if (pCallbackData->pInstance->isScrubbing()) {
+        position = pCallbackData->pInstance->renderScrub(pFrames, frameCount);
+    }
+    else if (isRendering) {
+        // Read audio data from the decoder (or the cached file) at the current speed.
+        position = pCallbackData->pInstance->renderFrames(pFrames, frameCount);
+    }
+    // paused or stopped
+    else {
+        // Fill the audio output buffer with silence (ie: zero) when playback is paused or stopped.
+        memset(pFrames, 0, frameCount * outputChannels * sizeof(float));
+        position = pCallbackData->pCursor->load(std::memory_order_relaxed);
+    }
+
+    // Mix the live input (duplex mode) with the file playback.
+    // The input channels go to the first output channels (eg: a stereo input on a 5.1 output).
+    if (pInput != nullptr) {
+        ma_uint32 inputChannels = pDevice->capture.channels;
+        ma_uint32 channels = std::min(inputChannels, outputChannels);
+
+        for (ma_uint32 frame = 0; frame < frameCount; ++frame) {
+            for (ma_uint32 c = 0; c < channels; ++c) {
+                pFrames[frame * outputChannels + c] += pInput[frame * inputChannels + c];
+            }
+        }
+    }
+
+    // Set volume accordingly.
+    if (volume != 1.0f) {
+        Audio::applyGain(pFrames, frameCount * outputChannels, volume);
+    }
+
+    // Lets the stress test see what's output (see --stress-control).
+    if (pCallbackData->pProbe != nullptr) {
+        pCallbackData->pProbe->observe(pFrames, frameCount * outputChannels, position, isRendering);
+    }
+
+    return position;
+}
+
+/*
+ * Callback used by MiniAudio to feed audio data to the device.
+ */
+static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    AudioCallbackData* pCallbackData = (AudioCallbackData*)pDevice->pUserData;
+    // Counts the (unwanted) allocations made from here on.
+    PoolAllocator::CallbackScope allocationScope;
+    Tracer::Scope trace("Audio callback", "Audio device");
+
+    if (pCallbackData == nullptr || pCallbackData->pDataSource == nullptr) {
+        return;
+    }
+
+    // Wakeups of the device thread, which go on while paused unless the device is suspended.
+    pCallbackData->pInstance->countCallback();
+
+    // The scheduling of the device thread is requested once per device start.
+    if (pCallbackData->pInstance->isDeviceSchedulingPending()) {
+        pCallbackData->pInstance->applyDeviceScheduling();
+    }
+
+    // Apply the transport requests at the block boundary.
+    bool isRendering = pCallbackData->pInstance->applyCommands();
+    float volume = pCallbackData->pInstance->getGain();
+    OutputStage* pStage = pCallbackData->pInstance->getOutputStage();
+    // The capture side is always float.
+    const float* pInputFrames = (pInput != nullptr && pDevice->capture.format == ma_format_f32) ? (const float*)pInput : nullptr;
+    ma_uint64 position = 0;
+
+    if (pStage->isPassThrough()) {
+        position = mix_block(pDevice, pCallbackData, (float*)pOutput, pInputFrames, frameCount, isRendering, volume);
+    }
+    // Integer device: The frames are mixed in float, then dithered to the device format.
+    else {
+        ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels);
+        ma_uint32 framesDone = 0;
+
+        while (framesDone < frameCount) {
+            ma_uint32 framesToMix = std::min(OutputStage::chunkFrames, frameCount - framesDone);
+            const float* pChunkInput = pInputFrames ? pInputFrames + framesDone * pDevice->capture.channels : nullptr;
+            ma_uint64 chunkPosition = mix_block(pDevice, pCallbackData, pStage->getBuffer(), pChunkInput, framesToMix,
+                                                isRendering, volume);
+
+            if (framesDone == 0) {
+                position = chunkPosition;
+            }
+
+            pStage->process(pStage->getBuffer(), (ma_uint8*)pOutput + framesDone * bytesPerFrame, framesToMix);
+            framesDone += framesToMix;
+        }
+    }
+
+    // Timestamp the frames handed to the device.
+    pCallbackData->pClock->update(position, frameCount, isRendering, pCallbackData->pInstance->getSpeed());
+}
+
+/*
+ * Multiplies the given samples by the gain. Shared by the audio callback and the benchmark.
+ */
+void Audio::applyGain(float* pSamples, size_t sampleCount, float gain)
+{
+    for (size_t i = 0; i < sampleCount; ++i) {
+        pSamples[i] *= gain;
+    }
+}
+
+/*
+ * Loads a given audio file.
+ */
+void Audio::loadFile(const char *filename)
+{
+    Tracer::Scope trace("Audio::loadFile");
+    printf("Load audio file '%s'\n", filename);
+
+    // First ensure the file format is supported.
+    if (!isSupportedFormat(filename)) {
+        std::cerr << "Format: " << std::filesystem::path(filename).extension() << " not supported." << std::endl;
+        return;
+    }
+
+    // Check for a possible file previously loaded or a device used for monitoring.
+    if (isFileLoaded() || outputDeviceInit) {
+        Tracer::Scope trace("Unload previous file");
+        // Ensure no more callbacks are running.
+        if (outputDeviceInit) {
+            ma_device_stop(&outputDevice);  
+        }
+
+        uninit();
+    }
+
+    // The silent parts of the previous file are no longer skipped. Note: A skip
+    // computed from them belongs to the previous generation.
+    std::atomic_store(&silence, std::shared_ptr<const SilenceDetector::Result>());
+    loadGeneration.fetch_add(1);
+
+    // A recently played file is played straight from memory.
+    if (!loadCachedFile(filename)) {
+        // First store the original data file format.
+        if (!storeOriginalFileFormat(filename)) {
+            std::cerr << "Failed to load audio file." << std::endl;
+            return;
+        }
+
+        // Then initialize decoder with format conversion. The channels are kept as is
+        // (up to 7.1) and routed to the device later on.
+        sourceChannels = std::min(originalFileFormat.outputChannels, ChannelRouter::maxChannels);
+        ma_decoder_config decoderConfig = getDecoderConfig(sourceChannels);
+
+        Tracer::begin("Init decoder");
+        ma_result result = ma_decoder_init_file(filename, &decoderConfig, &decoder);
+        Tracer::end("Init decoder");
+
+        if (result != MA_SUCCESS) {
+            std::cerr << "Failed to initialize decoder with conversion." << std::endl;
+            return;
+        }
+
+        decoderInit = true;
+        callbackData.pDataSource = &decoder;
+
+        // Decode the file in memory meanwhile for the next time.
+        pcmCache->request(filename, sourceChannels, originalFileFormat.outputChannels, originalFileFormat.outputSampleRate,
+                          originalFileFormat.outputFormat);
+    }
+
+    // Reset the cursor position.
+    cursor.store(0, std::memory_order_relaxed);
+    clock.reset(0);
+    timeStretch->setChannels(sourceChannels);
+    timeStretch->requestReset();
+    // The pending requests belong to the previous file. As no callback is running,
+    // it's safe to set its state from here. A device restart keeps them.
+    flushCommands();
+
+    if(!initializeOutputDevice()) {
+        std::cerr << "Failed to initialize output device." << std::endl;
+        uninit();
+        return;
+    }
+
+    preparePlayer();
+}
+
+/*
+ * Sets up the player from the PCM cache. Returns false if the file isn't cached.
+ */
+bool Audio::loadCachedFile(const char *fileName)
+{
+    Tracer::Scope trace("Load cached file");
+    cachedFile = pcmCache->find(fileName);
+
+    if (!cachedFile) {
+        return false;
+    }
+
+    // The frames are referenced, not copied.
+    ma_audio_buffer_config bufferConfig = ma_audio_buffer_config_init(defaultOutputFormat, cachedFile->channels,
+                                                                      cachedFile->frameCount, cachedFile->data.data(), NULL);
+
+    if (ma_audio_buffer_init(&bufferConfig, &audioBuffer) != MA_SUCCESS) {
+        cachedFile.reset();
+        return false;
+    }
+
+    audioBufferInit = true;
+    callbackData.pDataSource = &audioBuffer;
+    sourceChannels = cachedFile->channels;
+
+    // No probing needed.
+    originalFileFormat.fileName = fileName;
+    originalFileFormat.outputChannels = cachedFile->originalChannels;
+    originalFileFormat.outputSampleRate = cachedFile->originalSampleRate;
+    originalFileFormat.outputFormat = cachedFile->originalFormat;
+    // Tags and duration for the display.
+    TagParser::parse(fileName, originalFileFormat.tags);
+
+    printf("Playing from cache (%llu hits, %llu misses).\n",
+           (unsigned long long)pcmCache->getHits(), (unsigned long long)pcmCache->getMisses());
+
+    return true;
+}
+
+/*
+ * Sets the PCM cache limits. A zero size disables the cache.
+ */
+void Audio::setCacheSize(size_t megabytes, size_t maxFiles)
+{
+    pcmCache->setBudget(megabytes * 1024 * 1024, maxFiles);
+}
+
+/*
+ * Sets whether the leading and trailing silences, and the long silent gaps, are skipped
+ * during playback. A new threshold (in dBFS) triggers a new scan of the current file.
+ */
+void Audio::setSilenceSkipping(bool skipLeadInAndTail, bool skipSilentGaps, float thresholdDb)
+{
+    skipSilence.store(skipLeadInAndTail);
+    skipGaps.store(skipSilentGaps);
+
+    if (thresholdDb == silenceDetector->getThreshold()) {
+        return;
+    }
+
+    silenceDetector->setThreshold(thresholdDb);
+
+    if (isFileLoaded()) {
+        updateSilence();
+
+        if (!silence) {
+            silenceDetector->request(originalFileFormat.fileName, sourceChannels, cachedFile);
+        }
+    }
+}
+
+/*
+ * Picks up the scan result of the current file.
+ * Note: Must be called from the application thread.
+ */
+void Audio::updateSilence()
+{
+    std::atomic_store(&silence, isFileLoaded() ? silenceDetector->find(originalFileFormat.fileName) : nullptr);
+}
+
+/*
+ * Checks whether the given position lies in a silent part to skip. If so, the target
+ * is set to the end of the silent part (or to the end of the file for the tail).
+ * The A-B loop is played as is.
+ */
+bool Audio::getSilenceSkip(ma_uint64 position, ma_uint64& target)
+{
+    std::shared_ptr<const SilenceDetector::Result> result = std::atomic_load(&silence);
+
+    if (!result || result->isSilent() || activeLoop.load(std::memory_order_relaxed) >= 0) {
+        return false;
+    }
+
+    if (skipSilence.load()) {
+        if (result->start > silencePaddingFrames && position + silencePaddingFrames < result->start) {
+            target = result->start - silencePaddingFrames;
+            return true;
+        }
+
+        if (position >= result->end + silencePaddingFrames && position < totalFrames) {
+            target = totalFrames;
+            return true;
+        }
+    }
+
+    if (skipGaps.load()) {
+        for (const SilenceDetector::Gap& gap : result->gaps) {
+            if (position >= gap.start + silencePaddingFrames && position + silencePaddingFrames < gap.end) {
+                target = gap.end - silencePaddingFrames;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Checks wether the format of the given file is supported.
+ */
+bool Audio::isSupportedFormat(const char *fileName)
+{
+    std::string fileFormat = std::filesystem::path(fileName).extension();
+    unsigned int size = supportedFormats.size();
+
+    for (unsigned int i = 0; i < size; i++) {
+        if (fileFormat.compare(supportedFormats[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /*
- * Destructor: Uninitializes all of the audio parameters before closing the app.
+ * Returns the decoder configuration used to convert the files to the output format
+ * with the given channel count.
  */
-Audio::~Audio() {
-    uninit();
+ma_decoder_config Audio::getDecoderConfig(ma_uint32 channels)
+{
+    ma_decoder_config config = ma_decoder_config_init(defaultOutputFormat, channels, defaultOutputSampleRate);
+    // The decoder state is recycled from one file to the next.
+    config.allocationCallbacks = PoolAllocator::shared().getCallbacks();
 
-    if (contextInit) {
-        ma_context_uninit(&context);
-        std::cerr << "Audio context uninitialized." << std::endl;
-    }
+    return config;
 }
 
 /*
- * Uninitializes both output device and decoder parameters.
+ * Initializes and starts the output device selected by the user.
  */
-void Audio::uninit()
+bool Audio::initializeOutputDevice()
 {
-    if (outputDeviceInit) {
-        ma_device_uninit(&outputDevice);
+    Tracer::Scope trace("Init output device");
+    if (!waitForContext()) {
+        return false;
     }
 
-    if (decoderInit) {
-        ma_decoder_uninit(&decoder);
+    bool isMonitoring = monitoring.load(std::memory_order_relaxed);
+
+    if (isMonitoring) {
+        resolveInputDevice();
     }
-}
 
-/*
- * Gathers all the capture and playback device info into an array.
- */
-std::vector<Audio::DeviceInfo> Audio::getDevices(ma_device_type deviceType) {
-    // Create a device array.
-    std::vector<DeviceInfo> devices;
-    
-    if (!contextInit) {
-        return devices;
+    // Configure device parameters.
+    // Note: The decoder converts the files to the default output format, so the device
+    //       can be initialized whether a file is loaded or not.
+    ma_device_config deviceConfig = ma_device_config_init(isMonitoring ? ma_device_type_duplex : ma_device_type_playback);
+    deviceConfig.playback.pDeviceID = &outputDeviceID;
+    // The native format, integer formats are converted by the output stage.
+    deviceConfig.playback.format = ma_format_unknown;
+    // Zero means the device's native channel count.
+    deviceConfig.playback.channels = requestedOutputChannels;
+    deviceConfig.sampleRate = defaultOutputSampleRate;
+    // Zero means the backend's default period size.
+    deviceConfig.periodSizeInFrames = periodSize;
+    deviceConfig.performanceProfile = ma_performance_profile_low_latency;
+    deviceConfig.dataCallback = data_callback;
+    deviceConfig.pUserData = &callbackData;
+    // The backends creating their own device thread try the real-time priority first.
+    context.threadPriority = (realtimeOptions.policy != Realtime::policyDefault) ? ma_thread_priority_realtime
+                                                                                 : ma_thread_priority_highest;
+
+    if (isMonitoring) {
+        // Use the default capture device if no input device has been selected.
+        deviceConfig.capture.pDeviceID = inputDeviceFound ? &inputDeviceID : NULL;
+        deviceConfig.capture.format = defaultOutputFormat;
+        deviceConfig.capture.channels = requestedOutputChannels;
     }
 
-    // initialize some MiniAudio variables.
-    ma_device_info* pDeviceInfos = nullptr;
-    ma_uint32 deviceCount = 0;
-    ma_result result;
+    // Initialize and start device
+    ma_result result = ma_device_init(&context, &deviceConfig, &outputDevice);
 
-    // Get playback or capture devices.
-    if (deviceType == ma_device_type_playback || deviceType == ma_device_type_duplex) {
-        result = ma_context_get_devices(&context, &pDeviceInfos, &deviceCount, nullptr, nullptr);
+    // The cached id may now belong to another device (eg: the cards have been renumbered).
+    if (result == MA_SUCCESS && outputDeviceCached && outputDeviceName != outputDevice.playback.name) {
+        std::cerr << "Cached output device id now refers to: " << outputDevice.playback.name << std::endl;
+        ma_device_uninit(&outputDevice);
+        result = MA_ERROR;
     }
-    else {
-        result = ma_context_get_devices(&context, nullptr, nullptr, &pDeviceInfos, &deviceCount);
+
+    // The cached id may be outdated (eg: the device has been unplugged), look the device up by name.
+    if (result != MA_SUCCESS && outputDeviceCached) {
+        outputDeviceCached = false;
+
+        if (findDevice(ma_device_type_playback, outputDeviceName.c_str(), &outputDeviceID)) {
+            result = ma_device_init(&context, &deviceConfig, &outputDevice);
+        }
+    }
+
+    // Larger layouts than 7.1 and the other formats (eg: u8) are left to the miniaudio converters.
+    if (result == MA_SUCCESS && (outputDevice.playback.channels > ChannelRouter::maxChannels
+                                 || !OutputStage::isSupportedFormat(outputDevice.playback.format))) {
+        deviceConfig.playback.channels = std::min(outputDevice.playback.channels, ChannelRouter::maxChannels);
+
+        if (!OutputStage::isSupportedFormat(outputDevice.playback.format)) {
+            deviceConfig.playback.format = defaultOutputFormat;
+        }
+
+        ma_device_uninit(&outputDevice);
+        result = ma_device_init(&context, &deviceConfig, &outputDevice);
     }
 
     if (result != MA_SUCCESS) {
-        std::cerr << "Failed to retrieve devices." << std::endl;
-        return devices;
+        std::cerr << "Failed to initialize playback device." << std::endl;
+        return false;
     }
 
-    // Store the device data in the array.
-    for (ma_uint32 i = 0; i < deviceCount; ++i) {
-        DeviceInfo info;
-        info.name = pDeviceInfos[i].name;
-        info.id = pDeviceInfos[i].id;
-        info.isDefault = pDeviceInfos[i].isDefault;
-        devices.push_back(info);
+    outputDeviceInit = true;
+
+    // Route the file channels to the device ones.
+    router.configure(sourceChannels, outputDevice.playback.channels, routingOptions);
+    // The impulse responses are per speaker, ie: applied to the device channels.
+    convolver->setChannels(router.getOutputChannels());
+    routeBuffer.resize(routeChunkFrames * ChannelRouter::maxChannels);
+    printf("Routing: %s\n", router.getDescription().c_str());
+    outputStage.configure(outputDevice.playback.format, outputDevice.playback.channels, ditherEnabled, noiseShapingEnabled);
+    printf("Output format: %s\n", outputStage.getDescription().c_str());
+
+    // The frames are heard once they've gone through the device buffer.
+    ma_uint32 latencyFrames = outputDevice.playback.internalPeriodSizeInFrames * outputDevice.playback.internalPeriods;
+    latencyFrames = (ma_uint32)((ma_uint64)latencyFrames * outputDevice.sampleRate / outputDevice.playback.internalSampleRate);
+    clock.configure(outputDevice.sampleRate, latencyFrames);
+    // The device thread may be a new one.
+    deviceThreadStatus.applied.store(false, std::memory_order_relaxed);
+    deviceSchedulingPending.store(true, std::memory_order_release);
+
+    {
+        // The idle watcher only suspends a started device.
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        deviceSuspended.store(false, std::memory_order_release);
+        result = ma_device_start(&outputDevice);
     }
 
-    return devices;
-}
+    if (result != MA_SUCCESS) {
+        std::cerr << "Failed to start playback device." << std::endl;
+        ma_device_uninit(&outputDevice);
+        outputDeviceInit = false;
+        return false;
+    }
 
-/* Device getters. */
+    if (isMonitoring) {
+        printf("Monitoring latency (nominal): %.2f ms\n", getNominalMonitoringLatency());
+    }
 
-std::vector<Audio::DeviceInfo> Audio::getOutputDevices() {
-    return getDevices(ma_device_type_playback);
-}
+    // The device may be idle from the start (ie: a file loaded without playing it).
+    noteActivity();
 
-std::vector<Audio::DeviceInfo> Audio::getInputDevices() {
-    return getDevices(ma_device_type_capture);
+    return true;
 }
 
 /*
- * Set the output to the given device.
+ * Enables or disables the live monitoring of the input device.
+ * The output device is reinitialized in duplex mode so that the input is processed
+ * along with the file playback within the same callback.
+ * Returns false if the monitoring can't be started, it's then left disabled.
  */
-void Audio::setOutputDevice(const char *deviceName)
+bool Audio::setMonitoring(bool enabled)
 {
-    bool found = false;
-    auto outputDevices = getOutputDevices();
+    if (!waitForContext()) {
+        return !enabled;
+    }
 
-    // Loop through the available devices. 
-    for (ma_uint32 i = 0; i < (ma_uint32) outputDevices.size(); ++i) {
-        if (strcmp(outputDevices[i].name.c_str(), deviceName) == 0) {
-            std::cout << "Found target device: " << outputDevices[i].name << std::endl;
-            // Set the given device id.
-            memcpy(&outputDeviceID, &outputDevices[i].id, sizeof(ma_device_id));
-            found = true;
-            break;
-        }
+    if (monitoring.load(std::memory_order_relaxed) == enabled) {
+        return true;
     }
 
-    if (!found) {
-        std::cerr << "Target device not found!" << std::endl;
-        return;
+    monitoring.store(enabled, std::memory_order_relaxed);
+
+    // Without any file loaded the device is only needed for monitoring.
+    if (!enabled && !isFileLoaded()) {
+        releaseOutputDevice();
+        return true;
     }
 
-    // An audio file has been loaded.
-    if (decoderInit) {
-        // Stop playback.
-        ma_device_stop(&outputDevice);      
-        // Release device resources.
-        ma_device_uninit(&outputDevice);    
+    if (restartOutputDevice() || !enabled) {
+        return true;
+    }
 
-        if(!initializeOutputDevice()) {
-            std::cerr << "Failed to initialize output device." << std::endl;
-            return;
-        }
+    // Eg: The input device is gone. Go back to the playback only device.
+    monitoring.store(false, std::memory_order_relaxed);
+
+    if (isFileLoaded()) {
+        restartOutputDevice();
     }
+
+    return false;
 }
 
 /*
- * Callback used by MiniAudio to feed audio data to the device.
+ * Sets the real-time options of the audio threads. The device is reinitialized if
+ * the scheduling changes, the loop worker takes them over with the next file.
  */
-static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+void Audio::setRealtime(const Realtime::Options& options)
 {
-    AudioCallbackData* pCallbackData = (AudioCallbackData*)pDevice->pUserData;
-
-    if (pCallbackData == nullptr || pCallbackData->pDecoder == nullptr) {
-        return;
+    if (options.lockMemory != realtimeOptions.lockMemory) {
+        memoryReport = Realtime::lockMemory(options.lockMemory);
+        printf("%s\n", memoryReport.c_str());
     }
 
-    float volume = pCallbackData->pInstance->getVolume();
+    bool restart = outputDeviceInit && (options.policy != realtimeOptions.policy || options.priority != realtimeOptions.priority
+                                        || options.cpu != realtimeOptions.cpu);
 
-    if (pCallbackData->pInstance->isPlaying() && !pCallbackData->pInstance->isEndOfFile()) {
-        // Read audio data from the decoder.
-        ma_decoder_read_pcm_frames(pCallbackData->pDecoder, pOutput, frameCount, NULL);
-        // Update cursor.
-        pCallbackData->pCursor->fetch_add(frameCount, std::memory_order_relaxed);
-    }
-    // paused or stopped
-    else {
-        // Fill the audio output buffer with silence (ie: zero) when playback is paused or stopped.
-        memset(pOutput, 0, frameCount * pDevice->playback.channels * ma_get_bytes_per_sample(pDevice->playback.format));
-
-        // The is_playing flag is still true but the cursor has reached the end of the
-        // file, so no sound is played.
-        if (pCallbackData->pInstance->isPlaying() && pCallbackData->pInstance->isEndOfFile()) {
-            // Set the is_playing flag to false.
-            // Important: This flag must be set here to prevent possible race condition problems. 
-            pCallbackData->pIsPlaying->store(false, std::memory_order_relaxed);
-            // Set the FLTK slider's cursor position at the very end of the stroke.
-            pCallbackData->pApplication->getSlider("time")->value(pCallbackData->pInstance->getTotalSeconds());
-            // Update the application toggle button.
-            pCallbackData->pApplication->updateToggleButton();
-        }
+    // The callback mustn't read the options while they change.
+    if (restart) {
+        ma_device_stop(&outputDevice);
     }
 
-    // Set volume accordingly.
-    if (volume != 1.0f && pCallbackData->pDecoder->outputFormat == ma_format_f32) {
-        float* samples = (float*)pOutput;
-        size_t sampleCount = frameCount * pCallbackData->pDecoder->outputChannels;
+    realtimeOptions = options;
 
-        for (size_t i = 0; i < sampleCount; ++i) {
-            samples[i] *= volume;
-        }
+    if (restart) {
+        restartOutputDevice();
     }
 }
 
 /*
- * Loads a given audio file.
+ * Applies the real-time options to the device thread.
+ * Note: This function is called from the device thread, once per device start.
  */
-void Audio::loadFile(const char *filename)
+void Audio::applyDeviceScheduling()
 {
-    printf("Load audio file '%s'\n", filename);
-    // First ensure the file format is supported.
-    std::string fileFormat = std::filesystem::path(filename).extension();
-    unsigned int size = supportedFormats.size();
-    bool supported = false;
+    deviceSchedulingPending.store(false, std::memory_order_relaxed);
+    Realtime::applyToCurrentThread(realtimeOptions, 0, deviceThreadStatus);
+}
 
-    // Check wether the format of the given file is supported
-    for (unsigned int i = 0; i < size; i++) {
-        if (fileFormat.compare(supportedFormats[i]) == 0) {
-            supported = true;
-            break;
-        }
+/*
+ * Returns whether the real-time requests were granted, one line per request.
+ * The device thread applies them on its first callback, which may be waited for.
+ */
+std::string Audio::getRealtimeReport(bool waitForDevice)
+{
+    for (int i = 0; waitForDevice && outputDeviceInit && i < 50 && !deviceThreadStatus.applied.load(std::memory_order_acquire); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 
-    if (!supported) {
-        std::cerr << "Format: " << fileFormat << " not supported." << std::endl;
-        return;
+    std::string report = memoryReport + "\n";
+
+    if (!outputDeviceInit) {
+        return report + "Audio device thread: not started (no file loaded)";
     }
 
-    // Check for a possible file previously loaded.
-    if (decoderInit) {
-        // Ensure no more callbacks are running.
-        ma_device_stop(&outputDevice);  
-        uninit();
-        decoderInit = false;
+    report += Realtime::describe(realtimeOptions, "Audio device thread", deviceThreadStatus);
+
+    if (loopWorkerRunning.load()) {
+        report += "\n" + Realtime::describe(realtimeOptions, "Loop worker", loopWorkerStatus);
     }
 
-    // First store the original data file format.
-    if (!storeOriginalFileFormat(filename)) {
-        std::cerr << "Failed to load audio file." << std::endl;
+    return report;
+}
+
+/*
+ * Sets the device period size in frames (zero means the backend's default).
+ */
+void Audio::setPeriodSize(ma_uint32 frames)
+{
+    if (periodSize == frames) {
         return;
     }
 
-    // Then initialize decoder with format conversion.
-    ma_decoder_config decoderConfig = ma_decoder_config_init(defaultOutputFormat, defaultOutputChannels, defaultOutputSampleRate);
+    periodSize = frames;
 
-    if (ma_decoder_init_file(filename, &decoderConfig, &decoder) != MA_SUCCESS) {
-        std::cerr << "Failed to initialize decoder with conversion." << std::endl;
-        return;
+    if (outputDeviceInit) {
+        restartOutputDevice();
     }
+}
 
-    decoderInit = true;
+/*
+ * Sets the number of output channels (zero means the device's native count) and
+ * the up/downmix options. The device is reinitialized if needed.
+ */
+void Audio::setRouting(ma_uint32 outputChannels, const ChannelRouter::Options& options)
+{
+    requestedOutputChannels = std::min(outputChannels, ChannelRouter::maxChannels);
+    routingOptions = options;
 
-    if(!initializeOutputDevice()) {
-        std::cerr << "Failed to initialize output device." << std::endl;
-        return;
+    if (outputDeviceInit) {
+        restartOutputDevice();
     }
+}
 
-    preparePlayer();
+/*
+ * Enables the dither (and the noise shaping) of the integer output formats.
+ */
+void Audio::setDither(bool dither, bool noiseShaping)
+{
+    ditherEnabled = dither;
+    noiseShapingEnabled = noiseShaping;
+
+    if (outputDeviceInit) {
+        restartOutputDevice();
+    }
 }
 
 /*
- * Initializes and starts the output device selected by the user.
+ * Returns the nominal latency (in milliseconds) added by the monitoring path, ie: the
+ * time a captured frame spends in the capture and playback buffers as configured.
+ * Note: This is not a measured round trip, the converters and the hardware add
+ *       their own (unreported) delay on top of it.
  */
-bool Audio::initializeOutputDevice()
+double Audio::getNominalMonitoringLatency()
 {
-    // Reset the cursor position.
-    cursor.store(0, std::memory_order_relaxed);
+    if (!outputDeviceInit || outputDevice.type != ma_device_type_duplex) {
+        return 0.0;
+    }
 
-    // Configure device parameters.
-    ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
-    deviceConfig.playback.pDeviceID = &outputDeviceID;
-    deviceConfig.playback.format = decoder.outputFormat;
-    deviceConfig.playback.channels = decoder.outputChannels;
-    deviceConfig.sampleRate = decoder.outputSampleRate;
-    deviceConfig.dataCallback = data_callback;
-    deviceConfig.pUserData = &callbackData;
+    double captureFrames = (double)outputDevice.capture.internalPeriodSizeInFrames * outputDevice.capture.internalPeriods;
+    double playbackFrames = (double)outputDevice.playback.internalPeriodSizeInFrames * outputDevice.playback.internalPeriods;
 
-    // Initialize and start device
-    if (ma_device_init(&context, &deviceConfig, &outputDevice) != MA_SUCCESS) {
-        std::cerr << "Failed to initialize playback device." << std::endl;
-        ma_decoder_uninit(&decoder);
-        return false;
+    // Each side is expressed in its own internal sample rate.
+    return (captureFrames / outputDevice.capture.internalSampleRate + playbackFrames / outputDevice.playback.internalSampleRate) * 1000.0;
+}
+
+/*
+ * Data used to time the callbacks while probing a period size.
+ */
+struct PeriodProbeData {
+    std::atomic<ma_uint32> callbackCount = 0;
+    std::atomic<ma_int64> lastCallback = 0;
+    std::atomic<ma_int64> maxInterval = 0;
+};
+
+static void probe_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    PeriodProbeData* pData = (PeriodProbeData*)pDevice->pUserData;
+    ma_int64 now = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count();
+    ma_int64 last = pData->lastCallback.exchange(now, std::memory_order_relaxed);
+
+    if (last != 0 && now - last > pData->maxInterval.load(std::memory_order_relaxed)) {
+        pData->maxInterval.store(now - last, std::memory_order_relaxed);
     }
 
-    ma_result result = ma_device_start(&outputDevice);
+    pData->callbackCount.fetch_add(1, std::memory_order_relaxed);
+    // Output silence.
+    memset(pOutput, 0, frameCount * ma_get_bytes_per_frame(pDevice->playback.format, pDevice->playback.channels));
+}
 
-    if (result != MA_SUCCESS) {
-        printf("Failed to get sound length.\n");
-        uninit();
-        return false;
+/*
+ * Runs a duplex device with decreasing period sizes and returns the smallest one
+ * for which the callbacks are delivered on time. Returns zero if none is stable.
+ */
+ma_uint32 Audio::probeStablePeriodSize()
+{
+    const ma_uint32 candidates[] = {1024, 512, 256, 128, 64, 32};
+    // How long each candidate is run in milliseconds.
+    const int probeLength = 500;
+    ma_uint32 stable = 0;
+
+    if (!waitForContext()) {
+        return stable;
     }
 
-    return true;
+    resolveInputDevice();
+
+    for (ma_uint32 frames : candidates) {
+        PeriodProbeData probeData;
+        ma_device probeDevice;
+        ma_device_config deviceConfig = ma_device_config_init(ma_device_type_duplex);
+        deviceConfig.playback.pDeviceID = &outputDeviceID;
+        deviceConfig.playback.format = defaultOutputFormat;
+        deviceConfig.playback.channels = defaultOutputChannels;
+        deviceConfig.capture.pDeviceID = inputDeviceFound ? &inputDeviceID : NULL;
+        deviceConfig.capture.format = defaultOutputFormat;
+        deviceConfig.capture.channels = defaultOutputChannels;
+        deviceConfig.sampleRate = defaultOutputSampleRate;
+        deviceConfig.periodSizeInFrames = frames;
+        deviceConfig.performanceProfile = ma_performance_profile_low_latency;
+        deviceConfig.dataCallback = probe_callback;
+        deviceConfig.pUserData = &probeData;
+
+        if (ma_device_init(&context, &deviceConfig, &probeDevice) != MA_SUCCESS) {
+            break;
+        }
+
+        if (ma_device_start(&probeDevice) != MA_SUCCESS) {
+            ma_device_uninit(&probeDevice);
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(probeLength));
+        ma_device_stop(&probeDevice);
+
+        // The backend may not honor the requested size.
+        ma_uint32 actualFrames = probeDevice.playback.internalPeriodSizeInFrames;
+        double periodUs = (double)actualFrames * 1000000.0 / probeDevice.playback.internalSampleRate;
+        double expectedCallbacks = probeLength * 1000.0 / periodUs;
+        ma_device_uninit(&probeDevice);
+
+        // A period is stable when no callback is late by more than one period and
+        // nearly all the expected callbacks were delivered.
+        bool isStable = probeData.maxInterval.load() < 2.0 * periodUs
+                        && probeData.callbackCount.load() >= 0.9 * expectedCallbacks;
+
+        printf("Period %u frames (actual %u): %s\n", frames, actualFrames, isStable ? "stable" : "unstable");
+
+        if (!isStable) {
+            break;
+        }
+
+        stable = frames;
+    }
+
+    return stable;
 }
 
 /*
@@ -282,15 +1176,33 @@ bool Audio::initializeOutputDevice()
  */
 void Audio::preparePlayer()
 {
+    Tracer::Scope trace("Prepare player");
     totalFrames = 0;
-    ma_decoder_get_length_in_pcm_frames(&decoder, &totalFrames);
-    // Reset the time slider flag.
-    pApplication->hasSliderMoved = false;
+    ma_data_source_get_length_in_pcm_frames(callbackData.pDataSource, &totalFrames);
 
     // Compute the file length in seconds
-    double totalSeconds = (double)totalFrames / decoder.outputSampleRate;
+    double totalSeconds = (double)totalFrames / defaultOutputSampleRate;
     printf("Sound duration: %.2f seconds\n", totalSeconds);
 
+    PoolAllocator& allocator = PoolAllocator::shared();
+    printf("Allocations: %llu (%llu reused), %llu from the audio callback.\n",
+           (unsigned long long)allocator.getAllocations(), (unsigned long long)allocator.getPoolHits(),
+           (unsigned long long)allocator.getCallbackAllocations());
+
+    // The windows to scrub are decoded on the first drag.
+    scrubber->setFile(originalFileFormat.fileName, sourceChannels, totalFrames, cachedFile);
+
+    // Look for the silent parts, unless the file has been scanned already.
+    std::atomic_store(&silence, silenceDetector->find(originalFileFormat.fileName));
+
+    if (!silence) {
+        silenceDetector->request(originalFileFormat.fileName, sourceChannels, cachedFile);
+    }
+
+    if (pApplication == nullptr) {
+        return;
+    }
+
     // Set the time slider new bounds.
     pApplication->getSlider("time")->bounds(0, totalSeconds);
     // Reset the slider's cursor value (in case of new file loading).
@@ -299,15 +1211,19 @@ void Audio::preparePlayer()
     pApplication->setDuration(totalSeconds);
     // Reset the time counter.
     Application::time_cb(pApplication->getNullWidget(), pApplication);
-
     pApplication->dispayFileInfo(getOriginalFileFormat());
 }
 
 void Audio::setVolume(float value)
 {
-    // First make sure a file is loaded.
-    if (decoderInit) {
-        volume.store(std::clamp(value, 0.0f, 1.0f), std::memory_order_relaxed);
+    // Note: The gain stage also applies to the monitored input, so the volume
+    //       is stored whether a file is loaded or not.
+    value = std::clamp(value, 0.0f, 1.0f);
+    volume.store(value, std::memory_order_relaxed);
+
+    // Otherwise the volume is taken over when the device is initialized.
+    if (outputDeviceInit) {
+        pushCommand(commandVolume, 0, value);
     }
 }
 
@@ -317,17 +1233,16 @@ void Audio::setVolume(float value)
 void Audio::toggle()
 {
     // First make sure a file is loaded.
-    if (decoderInit) {
-        // Toggle play/pause (ie: is_playing = !is_playing).
-        bool expected = is_playing.load(std::memory_order_relaxed);
-
-        while (!is_playing.compare_exchange_weak(expected, !expected, std::memory_order_relaxed)) {
-            // expected is updated automatically with current value on failure.
-            // loop until successful.
-        }
-
-        if (is_playing.load(std::memory_order_relaxed) && !isEndOfFile()) {
-            // Launch the run function as a thread.
+    if (isFileLoaded()) {
+        // Toggle play/pause, the callback follows at the next block.
+        bool play = !is_playing.load(std::memory_order_relaxed);
+        is_playing.store(play, std::memory_order_relaxed);
+        pushCommand(play ? commandPlay : commandPause);
+
+        // Note: A rewind may still be pending, so the end of file isn't checked here.
+        // Launch the run function as a thread, unless the previous one is still running
+        // (ie: it then carries on).
+        if (play && !runThreadActive.exchange(true)) {
             std::thread t(&Audio::run, this);
             t.detach();
         }
@@ -344,70 +1259,127 @@ void Audio::toggle()
  */
 void Audio::run()
 {
-    while (isPlaying()) {
-        // First get the cursor current position.
-        ma_uint64 framePosition = cursor.load(std::memory_order_relaxed);
+    Tracer::setThreadName("Playback time");
+    // Only one thread is expected at a time (checked by the stress test).
+    int threads = runThreads.fetch_add(1) + 1;
+    int maxThreads = maxRunThreads.load();
 
-        // Check for the time slider.
-        if (pApplication->hasSliderMoved) {
-            // Convert the time slider position from seconds to PCM frames
-            framePosition = (ma_uint64)(pApplication->getSlider("time")->value() * decoder.outputSampleRate);
-
-            // Synchronize the sound cursor position to the time slider's.
-            ma_result result = ma_decoder_seek_to_pcm_frame(&decoder, framePosition);
+    while (threads > maxThreads && !maxRunThreads.compare_exchange_weak(maxThreads, threads)) {
+    }
 
-            if (result != MA_SUCCESS) {
-                printf("\nFailed to seek to new position.\n");
+    while (isPlaying()) {
+        // Leave the time slider alone until a seek is applied, it would jump back otherwise.
+        // Same while it's dragged.
+        if (!isSeekPending() && !isScrubbing()) {
+            Tracer::Scope trace("Audio::run tick");
+            // Display the position being heard rather than the one being decoded.
+            seconds = clock.getSeconds();
+            ma_uint64 target;
+            // Read before the silent parts, so that a file loaded meanwhile drops the skip.
+            ma_uint64 generation = loadGeneration.load();
+
+            // Jump over the silent part being played (ie: the frames skipped are silent anyway).
+            if (getSilenceSkip((ma_uint64)(seconds * defaultOutputSampleRate), target)) {
+                pushCommand(commandSeek, target, 0.0f, generation);
             }
-            else {
-                // Synchronize the current position.
-                seconds = pApplication->getSlider("time")->value();  
-                cursor.store(framePosition, std::memory_order_relaxed);
+
+            // Nothing to display when headless.
+            if (pApplication != nullptr) {
+                printf("\rPlayback Time: ");
+                printDuration(seconds);
+                // Ensure the output updates in place
+                fflush(stdout);  
+
+                // The widgets belong to the GUI thread.
+                Tracer::begin("Wait for GUI lock");
+                Fl::lock();
+                Tracer::end("Wait for GUI lock");
+                // Update the time slider value.
+                pApplication->getSlider("time")->value(seconds);
+                // Don't pass the time slider widget as first argument as it is used to detect
+                // which widget type is calling the callback function.
+                // As the Audio class is not a widget, any widget type but Fl_Slider can be passed
+                // instead. The first argument is not used by the callback function anyway.
+                Application::time_cb(pApplication->getNullWidget(), pApplication);
+                Fl::unlock();
+                // Redraw the time slider output (ie: the time counter).
+                Fl::awake();
             }
         }
-        // The time slider is running along with the sound stream.
-        else {
-            seconds = (double)cursor.load(std::memory_order_relaxed) / decoder.outputSampleRate;
-        }
-
-        printf("\rPlayback Time: ");
-        printDuration(seconds);
-        // Ensure the output updates in place
-        fflush(stdout);  
-
-        // Update the time slider value.
-        pApplication->getSlider("time")->value(seconds);
-        // Don't pass the time slider widget as first argument as it is used to detect
-        // which widget type is calling the callback function.
-        // As the Audio class is not a widget, any widget type but Fl_Slider can be passed
-        // instead. The first argument is not used by the callback function anyway.
-        Application::time_cb(pApplication->getNullWidget(), pApplication);
-
-        // Redraw the time slider output (ie: the time counter).
-        Fl::check();
 
         // Delays the loop to avoid flooding the time slider output. 
         struct timespec ts = {.tv_sec = 0, .tv_nsec = 100 * 1000000}; // 100ms
         nanosleep(&ts, NULL);
     }
 
-    return;
+    // The callback has stopped at the end of the file.
+    if (pApplication != nullptr && isFileLoaded() && isEndOfFile()) {
+        Fl::lock();
+        // Set the FLTK slider's cursor position at the very end of the stroke.
+        pApplication->getSlider("time")->value(getTotalSeconds());
+        Application::time_cb(pApplication->getNullWidget(), pApplication);
+        // Update the application toggle button.
+        pApplication->updateToggleButton();
+        Fl::unlock();
+        Fl::awake();
+    }
+
+    runThreadActive.store(false);
+    // Paused, or stopped at the end of the file: The device may be suspended if it stays so.
+    noteActivity();
+
+    // The playback has been resumed while this thread was leaving, and toggle
+    // didn't start a new one.
+    if (isPlaying() && !runThreadActive.exchange(true)) {
+        std::thread t(&Audio::run, this);
+        t.detach();
+    }
+
+    runThreads.fetch_sub(1);
 }
 
+/*
+ * Requests a seek to the given position. Bursts of requests are coalesced
+ * by the audio callback into a single seek to the latest position.
+ */
 void Audio::setCursor(double seconds)
 {
-    if (decoderInit) {
-        ma_uint64 framePosition = (ma_uint64)(seconds * decoder.outputSampleRate);
-        cursor.store(framePosition, std::memory_order_relaxed);
+    if (isFileLoaded()) {
+        ma_uint64 framePosition = (ma_uint64)(std::max(0.0, seconds) * defaultOutputSampleRate);
+        pushCommand(commandSeek, std::min(framePosition, totalFrames));
+    }
+}
+
+/*
+ * Plays grains at the given position while the time slider is dragged, the decoder
+ * is left alone until the slider is released.
+ */
+void Audio::scrub(double seconds)
+{
+    if (isFileLoaded()) {
+        ma_uint64 framePosition = (ma_uint64)(std::max(0.0, seconds) * defaultOutputSampleRate);
+        scrubber->moveTo(std::min(framePosition, totalFrames));
+        // The grains are played by the callback.
+        noteActivity();
+        resumeDevice();
     }
 }
 
+/*
+ * Ends the scrubbing. The playback (or the pause) carries on from the given position.
+ */
+void Audio::stopScrub(double seconds)
+{
+    scrubber->stop();
+    setCursor(seconds);
+}
+
 /*
  * Returns the is_playing flag value.
  */
 bool Audio::isPlaying()
 {
-    if (decoderInit) {
+    if (isFileLoaded()) {
         return is_playing.load(std::memory_order_relaxed);
     }
 
@@ -421,8 +1393,8 @@ double Audio::getTotalSeconds()
 {
     double totalSeconds = 0;
 
-    if (decoderInit) {
-        totalSeconds = (double)totalFrames / decoder.outputSampleRate;
+    if (isFileLoaded()) {
+        totalSeconds = (double)totalFrames / defaultOutputSampleRate;
     }
 
     return totalSeconds;
@@ -433,13 +1405,14 @@ void Audio::restart()
     // Check first the end of the file is reached.
     if (!is_playing && isEndOfFile()) {
         // Reset both cursors to zero.
+        // The audio callback seeks the data source before playing on.
         setCursor(0.0);
-        pApplication->getSlider("time")->value(0.0);
 
-        // Synchronize the sound cursor position to zero.
-        ma_decoder_seek_to_pcm_frame(&decoder, 0);
-        // Set the FLTK time slider and its counter accordingly.
-        Application::time_cb(pApplication->getNullWidget(), pApplication);
+        if (pApplication != nullptr) {
+            pApplication->getSlider("time")->value(0.0);
+            // Set the FLTK time slider and its counter accordingly.
+            Application::time_cb(pApplication->getNullWidget(), pApplication);
+        }
     }
 }
 
@@ -458,13 +1431,29 @@ void Audio::printDuration(double seconds)
 
 /*
  * Probes the original file format and store its data.
+ * The headers are parsed first, the decoder is only used for the files the tag
+ * parser doesn't handle.
  */
 bool Audio::storeOriginalFileFormat(const char* filename)
 {
-    // Initialize a temporary decoder without any config data (ie: NULL).
+    Tracer::Scope trace("Probe file format");
+    originalFileFormat.tags = TagParser::Tags();
+
+    if (TagParser::parse(filename, originalFileFormat.tags) && originalFileFormat.tags.format != ma_format_unknown) {
+        originalFileFormat.fileName = filename;
+        originalFileFormat.outputChannels = originalFileFormat.tags.channels;
+        originalFileFormat.outputSampleRate = originalFileFormat.tags.sampleRate;
+        originalFileFormat.outputFormat = originalFileFormat.tags.format;
+
+        return true;
+    }
+
+    // Initialize a temporary decoder without any conversion.
     ma_decoder decoderProbe;
+    ma_decoder_config probeConfig = ma_decoder_config_init_default();
+    probeConfig.allocationCallbacks = PoolAllocator::shared().getCallbacks();
 
-    if (ma_decoder_init_file(filename, NULL, &decoderProbe) != MA_SUCCESS) {
+    if (ma_decoder_init_file(filename, &probeConfig, &decoderProbe) != MA_SUCCESS) {
         ma_decoder_uninit(&decoderProbe);  
         return false;
     }
@@ -491,9 +1480,38 @@ std::map<std::string, std::string> Audio::getOriginalFileFormat()
         {"fileName", originalFileFormat.fileName},
         {"outputChannels", std::to_string(originalFileFormat.outputChannels)},
         {"outputSampleRate", std::to_string(originalFileFormat.outputSampleRate)},
-        {"outputFormat", std::to_string(originalFileFormat.outputFormat)}
+        {"outputFormat", ma_get_format_name(originalFileFormat.outputFormat)},
+        {"title", originalFileFormat.tags.title},
+        {"artist", originalFileFormat.tags.artist},
+        {"album", originalFileFormat.tags.album},
+        {"codec", originalFileFormat.tags.codec},
+        {"duration", std::to_string(originalFileFormat.tags.duration)},
+        {"bitrate", std::to_string(originalFileFormat.tags.bitrate)},
+        {"audibleDuration", "0"},
+        {"silence", ""},
+        {"routing", router.getDescription()},
+        {"output", outputStage.getDescription()}
     };
 
+    std::shared_ptr<const SilenceDetector::Result> result = std::atomic_load(&silence);
+
+    if (result && !result->isSilent()) {
+        double rate = defaultOutputSampleRate;
+        ma_uint64 audibleFrames = result->end - result->start;
+        char description[80];
+
+        if (skipGaps.load()) {
+            for (const SilenceDetector::Gap& gap : result->gaps) {
+                audibleFrames -= gap.end - gap.start;
+            }
+        }
+
+        snprintf(description, sizeof(description), "lead-in %.1f s, tail %.1f s, %zu gap(s)", result->start / rate,
+                 (result->totalFrames - result->end) / rate, result->gaps.size());
+        original["audibleDuration"] = std::to_string(audibleFrames / rate);
+        original["silence"] = description;
+    }
+
    return original;
 }
 
@@ -503,7 +1521,7 @@ std::map<std::string, std::string> Audio::getOriginalFileFormat()
  */
 void Audio::printAllDevices()
 {
-    if (!contextInit) {
+    if (!waitForContext()) {
         std::cerr << "Audio context not initialized." << std::endl;
         return;
     }
@@ -7,17 +7,40 @@
 #include <atomic>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <time.h>
+#include <semaphore.h>
 #include "../libraries/miniaudio.h"
+#include "recorder.h"
+#include "preview_bus.h"
+#include "scrubber.h"
+#include "pcm_cache.h"
+#include "playback_clock.h"
+#include "control_probe.h"
+#include "time_stretch.h"
+#include "convolver.h"
+#include "command_queue.h"
+#include "pool_allocator.h"
+#include "channel_router.h"
+#include "output_stage.h"
+#include "tag_parser.h"
+#include "silence_detector.h"
+#include "tracer.h"
+#include "realtime.h"
 
 // Forward declaration.
 class Application;
 
 // Structure used to manipulate some Audio class members through the data_callback function.  
 struct AudioCallbackData {
-    ma_decoder *pDecoder;
+    // Either the decoder or the cached file buffer.
+    ma_data_source *pDataSource;
     std::atomic<ma_uint64> *pCursor;
-    std::atomic<bool> *pIsPlaying;
+    PlaybackClock *pClock;
+    // Only set by the control stress test.
+    ControlProbe *pProbe = nullptr;
     // Pointer to the owning class.
     class Audio* pInstance;  
     Application* pApplication;
@@ -35,35 +58,204 @@ class Audio {
             ma_device_id id;
             bool isDefault;
         };
+        // Structure that holds an A-B loop region along with its pre-decoded start.
+        struct LoopRegion {
+            ma_uint64 start = 0;
+            ma_uint64 end = 0;
+            // Number of pre-decoded frames from the loop start.
+            ma_uint64 frameCount = 0;
+            std::vector<float> frames;
+        };
+        enum LoopSeek { loopSeekNone, loopSeekRequested, loopSeekDone };
+        // Transport requests, applied by the audio callback at the block boundaries.
+        enum CommandType { commandPlay, commandPause, commandSeek, commandVolume };
+        struct Command {
+            CommandType type;
+            ma_uint64 frames;
+            float value;
+            // Load generation the request was made for.
+            ma_uint64 generation;
+        };
         struct OriginalFileFormat {
             std::string fileName;
             ma_uint32 outputChannels;
             ma_uint32 outputSampleRate;
             ma_format outputFormat;
+            TagParser::Tags tags;
         };
         ma_context context;
+        // Initializes the context in the background.
+        std::thread contextThread;
+        std::string preferredBackend;
+        void initContext();
         ma_decoder decoder;
         Application* pApplication;
         AudioCallbackData callbackData;
         bool contextInit = false;
         bool decoderInit = false;
-        bool outputDeviceInit = false;
+        bool audioBufferInit = false;
+        // Also read by the idle watcher.
+        std::atomic<bool> outputDeviceInit = false;
         ma_uint64 totalFrames;
         std::atomic<ma_uint64> cursor;
-        const ma_format defaultOutputFormat = ma_format_f32;
-        const ma_uint32 defaultOutputChannels = 2;
-        const ma_uint32 defaultOutputSampleRate = 44100;
+        // Position actually heard (ie: latency compensated).
+        PlaybackClock clock;
+        TimeStretch* timeStretch = 0;
+        // Impulse response (eg: room correction), applied after the speed control.
+        Convolver* convolver = 0;
+        // Plays the time slider position while it's dragged.
+        Scrubber* scrubber = 0;
+        static ma_uint32 readSourceFrames(void* pUserData, float* pFrames, ma_uint32 frameCount);
+        static constexpr ma_format defaultOutputFormat = ma_format_f32;
+        static constexpr ma_uint32 defaultOutputChannels = 2;
+        static constexpr ma_uint32 defaultOutputSampleRate = 44100;
+        // The files are decoded with their own channels (up to 7.1), then routed to the device channels.
+        ma_uint32 sourceChannels = defaultOutputChannels;
+        // Zero means the device's native channel count.
+        ma_uint32 requestedOutputChannels = 0;
+        ChannelRouter router;
+        ChannelRouter::Options routingOptions;
+        // Frames routed at once, at the file channel count.
+        static constexpr ma_uint32 routeChunkFrames = 1024;
+        std::vector<float> routeBuffer;
+        // Converts to the native format of integer devices.
+        OutputStage outputStage;
+        bool ditherEnabled = true;
+        bool noiseShapingEnabled = false;
+        // Requested transport state, as shown by the application.
         std::atomic<bool> is_playing = false;
         std::atomic<float> volume = 1.0f;
+        CommandQueue<Command, 1024> commands;
+        std::atomic<ma_uint64> requestedSeeks = 0;
+        std::atomic<ma_uint64> appliedSeeks = 0;
+        // Transport state owned by the audio callback (or by the thread setting up
+        // the device while it's stopped).
+        bool playing = false;
+        float gain = 1.0f;
+        bool seekPending = false;
+        ma_uint64 seekTarget = 0;
+        ma_uint64 drainedSeeks = 0;
+        // Playback time threads (see toggle and run).
+        std::atomic<bool> runThreadActive = false;
+        std::atomic<int> runThreads = 0;
+        std::atomic<int> maxRunThreads = 0;
+        void pushCommand(CommandType type, ma_uint64 frames = 0, float value = 0.0f);
+        void pushCommand(CommandType type, ma_uint64 frames, float value, ma_uint64 generation);
+        // Incremented by each load, once the previous file state is dropped. The requests
+        // computed from the previous file (ie: the silence skips) are dropped by the callback.
+        std::atomic<ma_uint64> loadGeneration = 0;
+        void flushCommands();
+        std::atomic<bool> monitoring = false;
+        // Stopped while paused for a while, see audio_idle.cpp.
+        std::atomic<bool> deviceSuspended = false;
+        // Held while the idle watcher (or a resume) stops or starts the device, and
+        // while the application thread releases it.
+        std::mutex deviceMutex;
+        // Zero disables the suspension.
+        std::atomic<double> idleSuspendSeconds = 30.0;
+        std::thread idleWatcher;
+        std::mutex idleMutex;
+        std::condition_variable idleChanged;
+        std::chrono::steady_clock::time_point lastActivity;
+        bool idleArmed = false;
+        bool idleWatcherStopping = false;
+        // Callbacks run since the device was initialized (ie: device wakeups).
+        std::atomic<ma_uint64> callbackCount = 0;
+        std::atomic<ma_uint64> suspensions = 0;
+        void watchIdleDevice();
+        void noteActivity();
+        bool suspendDevice();
+        void resumeDevice();
+        void stopIdleWatcher();
+        void releaseOutputDevice();
+        // Device period size in frames (zero means the backend's default).
+        ma_uint32 periodSize = 0;
         double seconds;
         ma_device outputDevice;
         ma_device_id outputDeviceID = {0};
+        std::string outputDeviceName;
+        // The output device id comes from the config file rather than from an enumeration.
+        bool outputDeviceCached = false;
+        bool parseOutputDeviceId(const std::string& idString);
+        ma_device_id inputDeviceID = {0};
+        bool inputDeviceFound = false;
+        std::string inputDeviceName;
+        bool inputDeviceResolved = false;
+        void resolveInputDevice();
+        Recorder* recorder = 0;
+        // Second output (eg: headphones) to audition the files on.
+        PreviewBus* previewBus = 0;
+        std::string previewDeviceName = "default";
+        bool previewDeviceResolved = false;
+        void resolvePreviewDevice();
+        PcmCache* pcmCache = 0;
+        // Finds the lead-in, tail and gaps of the files in the background.
+        SilenceDetector* silenceDetector = 0;
+        // Scan result of the file played (nullptr until the scan is done), also read by the run thread.
+        std::shared_ptr<const SilenceDetector::Result> silence;
+        std::atomic<bool> skipSilence = false;
+        std::atomic<bool> skipGaps = false;
+        // Silence kept before and after the skipped parts, so that no attack or release is cut.
+        static constexpr ma_uint32 silencePaddingFrames = defaultOutputSampleRate / 10;
+        bool getSilenceSkip(ma_uint64 position, ma_uint64& target);
+        // Plays the cached files straight from memory.
+        ma_audio_buffer audioBuffer;
+        // Keeps the cached file alive while it's played, even if evicted meanwhile.
+        std::shared_ptr<PcmCache::Entry> cachedFile;
+        bool loadCachedFile(const char *fileName);
+        // A free region is always left to fill, even while the callback reads the
+        // active one, the one it loaded before the last edit and the start of another.
+        static constexpr int loopRegionCount = 4;
+        LoopRegion loopRegions[loopRegionCount];
+        // Index of the region in use, -1 when looping is off.
+        std::atomic<int> activeLoop = -1;
+        // Index of the region read by the callback during the current block, -1 otherwise.
+        std::atomic<int> loopInUse = -1;
+        // Index of the region whose start is being played from memory, -1 otherwise.
+        std::atomic<int> prerollLoop = -1;
+        // Loop region requested by the application thread, the worker decodes its
+        // start then publishes it. The id changes with each request (or clear).
+        std::mutex loopRequestMutex;
+        bool loopRequested = false;
+        ma_uint64 loopRequestId = 0;
+        ma_uint64 requestedLoopStart = 0;
+        ma_uint64 requestedLoopEnd = 0;
+        // Audio thread only.
+        ma_uint64 prerollOffset = 0;
+        std::atomic<int> loopSeek = loopSeekNone;
+        std::atomic<ma_uint64> loopSeekTarget = 0;
+        std::thread loopWorker;
+        std::atomic<bool> loopWorkerRunning = false;
+        // Posted by the callback on a seek request (sem_post doesn't lock) and by
+        // setLoop, so the worker sleeps until there's something to do.
+        sem_t loopWakeup;
+        // Crossfade length at the loop wrap (~6ms).
+        static constexpr ma_uint32 loopFadeFrames = 256;
+        // Frames pre-decoded from the loop start. Must cover the time needed to seek.
+        static constexpr ma_uint32 loopPrerollFrames = defaultOutputSampleRate;
+        // Frames decoded at once from the loop start.
+        static constexpr ma_uint32 loopDecodeFrames = 4096;
+        void runLoopWorker(Realtime::Options options);
+        void stopLoop();
+        void seekForLoop();
+        void applyLoopRequest();
+        bool decodeLoopStart(LoopRegion& region);
+        // Scheduling, affinity and memory locking of the audio threads.
+        // Note: Only changed while the device is stopped, the callback reads them.
+        Realtime::Options realtimeOptions;
+        Realtime::ThreadStatus deviceThreadStatus;
+        Realtime::ThreadStatus loopWorkerStatus;
+        // Set when the device starts, the callback applies the options to its thread.
+        std::atomic<bool> deviceSchedulingPending = false;
+        std::string memoryReport = "Memory: not locked";
         OriginalFileFormat originalFileFormat;
         std::vector<DeviceInfo> getDevices(ma_device_type deviceType);
-        std::vector<std::string> supportedFormats = {".wav", ".WAV",".mp3", ".MP3", ".flac", ".FLAC", ".ogg", ".OGG"};
+        bool findDevice(ma_device_type deviceType, const char *deviceName, ma_device_id *pDeviceID);
+        static inline const std::vector<std::string> supportedFormats = {".wav", ".WAV",".mp3", ".MP3", ".flac", ".FLAC", ".ogg", ".OGG"};
         bool storeOriginalFileFormat(const char* filename);
         void uninit();
         bool initializeOutputDevice();
+        bool restartOutputDevice();
         void preparePlayer();
 
     public:
@@ -75,8 +267,48 @@ class Audio {
         void printAllDevices();
         void loadFile(const char *fileName);
         void setVolume(float value);
-        void setOutputDevice(const char *deviceName);
+        void initContextAsync(const char *backendName);
+        bool waitForContext();
+        std::string getBackendName();
+        void setOutputDevice(const char *deviceName, const std::string& cachedId = "");
+        std::string getOutputDeviceId();
+        void setInputDevice(const char *deviceName);
+        void setPreviewDevice(const char *deviceName);
+        bool startPreview(const char *fileName);
+        bool startRecording(const char *fileName);
+        void stopRecording();
+        bool setMonitoring(bool enabled);
+        void setPeriodSize(ma_uint32 frames);
+        void setIdleSuspend(double seconds);
+        void setRouting(ma_uint32 outputChannels, const ChannelRouter::Options& options);
+        void setDither(bool dither, bool noiseShaping);
+        void setCacheSize(size_t megabytes, size_t maxFiles);
+        void setRealtime(const Realtime::Options& options);
+        void applyDeviceScheduling();
+        std::string getRealtimeReport(bool waitForDevice);
+        void setSilenceSkipping(bool skipLeadInAndTail, bool skipSilentGaps, float thresholdDb);
+        void updateSilence();
+        bool setLoop(ma_uint64 start, ma_uint64 end);
+        void clearLoop();
+        bool getLoop(ma_uint64& start, ma_uint64& end);
+        bool applyCommands();
+        float getGain() { return gain; }
+        bool isDeviceSchedulingPending() { return deviceSchedulingPending.load(std::memory_order_acquire); }
+        bool isRealtimeRequested() { return realtimeOptions.policy != Realtime::policyDefault || realtimeOptions.cpu >= 0; }
+        bool isSeekPending() { return appliedSeeks.load(std::memory_order_acquire) < requestedSeeks.load(std::memory_order_acquire); }
+        void readFrames(void* pOutput, ma_uint32 frameCount);
+        ma_uint64 renderFrames(void* pOutput, ma_uint32 frameCount);
+        ma_uint64 renderScrub(void* pOutput, ma_uint32 frameCount);
+        void setSpeed(float value);
+        float getSpeed() { return timeStretch->getSpeed(); }
+        bool loadImpulseResponse(const std::string& fileName) { return convolver->load(fileName); }
+        void clearImpulseResponse() { convolver->clear(); }
+        const std::string& getImpulseResponse() { return convolver->getFileName(); }
+        ma_uint32 probeStablePeriodSize();
         void setCursor(double seconds);
+        void scrub(double seconds);
+        void stopScrub(double seconds);
+        bool isScrubbing() { return scrubber->isActive(); }
         void toggle();
         void run();
         void printDuration(double seconds);
@@ -84,13 +316,44 @@ class Audio {
         // Getters.
         ma_decoder getDecoder() { return decoder; }
         double getSeconds() { return seconds; }
+        ma_uint32 getSampleRate() { return defaultOutputSampleRate; }
+        PlaybackClock* getPlaybackClock() { return &clock; }
+        ma_uint64 getCursorFrames() { return cursor.load(std::memory_order_relaxed); }
+        ma_uint64 getTotalFrames() { return totalFrames; }
+        int getRunThreads() { return runThreads.load(); }
+        int getMaxRunThreads() { return maxRunThreads.load(); }
+        // Must be set while the device is stopped.
+        void setProbe(ControlProbe* pProbe) { callbackData.pProbe = pProbe; }
         double getTotalSeconds();
         std::map<std::string, std::string> getOriginalFileFormat();
-        std::vector<std::string> getSupportedFormats() { return supportedFormats; }
+        static std::vector<std::string> getSupportedFormats() { return supportedFormats; }
+        static bool isSupportedFormat(const char *fileName);
+        static ma_decoder_config getDecoderConfig(ma_uint32 channels = defaultOutputChannels);
+        static void applyGain(float* pSamples, size_t sampleCount, float gain);
+        static int benchmark(const std::vector<std::string>& files);
+        static int benchmarkLoading(const std::vector<std::string>& files);
+        static int stressControls(const std::vector<std::string>& arguments);
+        static int benchmarkIdle(const std::vector<std::string>& arguments);
         float getVolume() { return volume.load(std::memory_order_relaxed); }
-        bool isContextInit() { return contextInit; }
+        bool isContextInit() { return waitForContext(); }
+        bool isMonitoring() { return monitoring.load(std::memory_order_relaxed); }
+        bool isDeviceSuspended() { return deviceSuspended.load(std::memory_order_acquire); }
+        void countCallback() { callbackCount.fetch_add(1, std::memory_order_relaxed); }
+        ma_uint64 getCallbackCount() { return callbackCount.load(std::memory_order_relaxed); }
+        ma_uint64 getSuspensions() { return suspensions.load(std::memory_order_relaxed); }
+        double getIdleSuspend() { return idleSuspendSeconds.load(std::memory_order_relaxed); }
+        double getNominalMonitoringLatency();
+        ma_uint32 getPeriodSize() { return periodSize; }
+        std::string getRoutingDescription() { return router.getDescription(); }
+        OutputStage* getOutputStage() { return &outputStage; }
+        bool isRecording() { return recorder->isRecording(); }
+        Recorder* getRecorder() { return recorder; }
+        PreviewBus* getPreviewBus() { return previewBus; }
         bool isPlaying();
         bool isDecoderInit() { return decoderInit; }
+        bool isFileLoaded() { return decoderInit || audioBufferInit; }
+        bool isFileCached() { return audioBufferInit; }
+        PcmCache* getPcmCache() { return pcmCache; }
         bool isEndOfFile() { return cursor.load(std::memory_order_relaxed) >= totalFrames; }
         void restart();
 };
@@ -0,0 +1,626 @@
+#include "main.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ * Headless decoding workload, used as the training run of the PGO build and to
+ * compare the builds (see the makefile). The files go through the same decode,
+ * convert and gain path as the playback, one device period at a time.
+ * The control stress test and the idle benchmark drive the whole playback through
+ * the null backend.
+ */
+
+/*
+ * Writes synthetic fixtures covering the conversions done by the decoder
+ * (format, sample rate and channel count). Returns their paths.
+ */
+static std::vector<std::string> createFixtures()
+{
+    struct Fixture {
+        const char* name;
+        ma_format format;
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+    };
+
+    const Fixture fixtures[] = {
+        // Format conversion only.
+        {"s16-stereo-44100.wav", ma_format_s16, 2, 44100},
+        // Resampling.
+        {"s16-stereo-48000.wav", ma_format_s16, 2, 48000},
+        {"s24-stereo-96000.wav", ma_format_s24, 2, 96000},
+        // Channel conversion.
+        {"f32-mono-22050.wav", ma_format_f32, 1, 22050},
+    };
+
+    const ma_uint32 seconds = 30;
+    const ma_uint32 chunkFrames = 4096;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "audioplayer-fixtures";
+    std::filesystem::create_directories(directory);
+    std::vector<std::string> files;
+
+    for (const Fixture& fixture : fixtures) {
+        std::string fileName = (directory / fixture.name).string();
+        files.push_back(fileName);
+
+        if (std::filesystem::exists(fileName)) {
+            continue;
+        }
+
+        ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, fixture.format, fixture.channels, fixture.sampleRate);
+        ma_encoder encoder;
+
+        if (ma_encoder_init_file(fileName.c_str(), &encoderConfig, &encoder) != MA_SUCCESS) {
+            std::cerr << "Failed to create fixture: " << fileName << std::endl;
+            files.pop_back();
+            continue;
+        }
+
+        std::vector<float> samples(chunkFrames * fixture.channels);
+        std::vector<ma_uint8> converted(chunkFrames * ma_get_bytes_per_frame(fixture.format, fixture.channels));
+        ma_uint64 totalFrames = (ma_uint64)seconds * fixture.sampleRate;
+
+        // A chord with some noise, so that the resampler and the encoders work on real content.
+        for (ma_uint64 frame = 0; frame < totalFrames; frame += chunkFrames) {
+            ma_uint32 frameCount = (ma_uint32)std::min((ma_uint64)chunkFrames, totalFrames - frame);
+
+            for (ma_uint32 i = 0; i < frameCount; i++) {
+                float t = (float)(frame + i) / fixture.sampleRate;
+                float value = 0.3f * sinf(2.0f * (float)M_PI * 220.0f * t) + 0.2f * sinf(2.0f * (float)M_PI * 329.6f * t)
+                              + 0.05f * ((float)rand() / RAND_MAX - 0.5f);
+
+                for (ma_uint32 c = 0; c < fixture.channels; c++) {
+                    samples[i * fixture.channels + c] = value;
+                }
+            }
+
+            ma_convert_pcm_frames_format(converted.data(), fixture.format, samples.data(), ma_format_f32, frameCount,
+                                         fixture.channels, ma_dither_mode_none);
+            ma_encoder_write_pcm_frames(&encoder, converted.data(), frameCount, NULL);
+        }
+
+        ma_encoder_uninit(&encoder);
+    }
+
+    return files;
+}
+
+/*
+ * Decodes the given files (or the synthetic fixtures) and reports the decoding
+ * throughput and the time spent per device period.
+ * Usage: Player --bench-decode [FILE...]
+ */
+int Audio::benchmark(const std::vector<std::string>& files)
+{
+    std::vector<std::string> fileNames = files.empty() ? createFixtures() : files;
+    ma_uint64 callbackAllocations = PoolAllocator::shared().getCallbackAllocations();
+    // A typical period size.
+    const ma_uint32 blockFrames = 512;
+    std::vector<float> block(blockFrames * defaultOutputChannels);
+    std::vector<double> blockTimes;
+    double decodedSeconds = 0.0;
+    double elapsedSeconds = 0.0;
+
+    for (const std::string& fileName : fileNames) {
+        ma_decoder_config decoderConfig = getDecoderConfig();
+        ma_decoder decoder;
+
+        if (ma_decoder_init_file(fileName.c_str(), &decoderConfig, &decoder) != MA_SUCCESS) {
+            std::cerr << "Failed to decode: " << fileName << std::endl;
+            continue;
+        }
+
+        ma_uint64 fileFrames = 0;
+        double fileElapsed = 0.0;
+        ma_uint64 framesRead;
+
+        do {
+            // Same conditions as the audio callback, no allocation is expected.
+            PoolAllocator::CallbackScope allocationScope;
+            auto start = std::chrono::steady_clock::now();
+            framesRead = 0;
+            ma_decoder_read_pcm_frames(&decoder, block.data(), blockFrames, &framesRead);
+            applyGain(block.data(), framesRead * defaultOutputChannels, 0.8f);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            fileElapsed += elapsed;
+            fileFrames += framesRead;
+
+            if (framesRead == blockFrames) {
+                blockTimes.push_back(elapsed);
+            }
+        } while (framesRead == blockFrames);
+
+        ma_decoder_uninit(&decoder);
+
+        double fileSeconds = (double)fileFrames / defaultOutputSampleRate;
+        printf("%s: %.1f s decoded, %.1fx realtime\n", std::filesystem::path(fileName).filename().c_str(),
+               fileSeconds, fileSeconds / std::max(fileElapsed, 1e-9));
+        decodedSeconds += fileSeconds;
+        elapsedSeconds += fileElapsed;
+    }
+
+    if (blockTimes.empty()) {
+        std::cerr << "Nothing decoded." << std::endl;
+        return 1;
+    }
+
+    std::sort(blockTimes.begin(), blockTimes.end());
+    double average = std::accumulate(blockTimes.begin(), blockTimes.end(), 0.0) / blockTimes.size();
+    double p99 = blockTimes[blockTimes.size() * 99 / 100];
+    double period = (double)blockFrames / defaultOutputSampleRate;
+
+    printf("Decode throughput: %.1fx realtime\n", decodedSeconds / std::max(elapsedSeconds, 1e-9));
+    printf("Callback CPU (%u frames): avg %.1f us, p99 %.1f us, %.2f%% of the period\n", blockFrames,
+           average * 1e6, p99 * 1e6, average / period * 100.0);
+    printf("Allocations within the blocks: %llu\n",
+           (unsigned long long)(PoolAllocator::shared().getCallbackAllocations() - callbackAllocations));
+
+    return 0;
+}
+
+/*
+ * Opens and closes the given files (or the synthetic fixtures) the way loadFile does,
+ * ie: a probe decoder then a converting decoder reading the first period, with the
+ * pool allocator and then with the miniaudio default one (malloc/free).
+ * Usage: Player --bench-load [FILE...]
+ */
+int Audio::benchmarkLoading(const std::vector<std::string>& files)
+{
+    std::vector<std::string> fileNames = files.empty() ? createFixtures() : files;
+    const double runSeconds = 2.0;
+    std::vector<float> block(4096 * defaultOutputChannels);
+    PoolAllocator& allocator = PoolAllocator::shared();
+
+    if (fileNames.empty()) {
+        std::cerr << "No file to load." << std::endl;
+        return 1;
+    }
+
+    for (bool pooled : {true, false}) {
+        ma_decoder_config probeConfig = ma_decoder_config_init_default();
+        ma_decoder_config decoderConfig = getDecoderConfig();
+
+        // Zeroed callbacks mean malloc/free.
+        if (!pooled) {
+            memset(&probeConfig.allocationCallbacks, 0, sizeof(ma_allocation_callbacks));
+            memset(&decoderConfig.allocationCallbacks, 0, sizeof(ma_allocation_callbacks));
+        }
+        else {
+            probeConfig.allocationCallbacks = allocator.getCallbacks();
+        }
+
+        ma_uint64 allocations = allocator.getAllocations();
+        ma_uint64 poolHits = allocator.getPoolHits();
+        ma_uint64 cycles = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+
+        while (elapsed < runSeconds) {
+            const std::string& fileName = fileNames[cycles % fileNames.size()];
+            ma_decoder probe, decoder;
+
+            if (ma_decoder_init_file(fileName.c_str(), &probeConfig, &probe) != MA_SUCCESS) {
+                std::cerr << "Failed to decode: " << fileName << std::endl;
+                return 1;
+            }
+
+            ma_decoder_uninit(&probe);
+
+            if (ma_decoder_init_file(fileName.c_str(), &decoderConfig, &decoder) == MA_SUCCESS) {
+                ma_decoder_read_pcm_frames(&decoder, block.data(), 4096, NULL);
+                ma_decoder_uninit(&decoder);
+            }
+
+            cycles++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        printf("%s: %.0f load/unload cycles per second", pooled ? "Pool allocator" : "Default allocator", cycles / elapsed);
+
+        if (pooled) {
+            ma_uint64 count = allocator.getAllocations() - allocations;
+            printf(" (%llu allocations, %.1f%% reused)", (unsigned long long)count,
+                   count ? 100.0 * (allocator.getPoolHits() - poolHits) / count : 0.0);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the given percentile (from 0 to 1) of the sorted values.
+ */
+static double getPercentile(const std::vector<double>& sortedValues, double percentile)
+{
+    return sortedValues[std::min(sortedValues.size() - 1, (size_t)(percentile * sortedValues.size()))];
+}
+
+/*
+ * Drives the playback through the null backend with random controls, and measures
+ * the time from each control to its result in the callback output:
+ *   play:  toggle -> first non-silent block
+ *   pause: toggle -> first silent block
+ *   seek:  setCursor (the last one of a burst) -> first block at the new position
+ *   load:  loadFile + play -> first non-silent block
+ * Fails if a p99 exceeds its threshold, a control times out, the playback time
+ * threads overlap or the position goes backward without a seek (ie: a stale cursor).
+ * Usage: Player --stress-control [OPERATIONS] [--seed N] [--max-p99 MS] [FILE...]
+ */
+int Audio::stressControls(const std::vector<std::string>& arguments)
+{
+    int operations = 1000;
+    unsigned int seed = (unsigned int)time(NULL);
+    // The loads are allowed 5 times as much.
+    double maxP99 = 50.0;
+    std::vector<std::string> files;
+
+    for (size_t i = 0; i < arguments.size(); i++) {
+        if (arguments[i] == "--seed" && i + 1 < arguments.size()) {
+            seed = (unsigned int)std::stoul(arguments[++i]);
+        }
+        else if (arguments[i] == "--max-p99" && i + 1 < arguments.size()) {
+            maxP99 = std::stod(arguments[++i]);
+        }
+        else if (i == 0 && std::all_of(arguments[i].begin(), arguments[i].end(), ::isdigit)) {
+            operations = std::stoi(arguments[i]);
+        }
+        else {
+            files.push_back(arguments[i]);
+        }
+    }
+
+    std::vector<std::string> fileNames = files.empty() ? createFixtures() : files;
+
+    if (fileNames.empty()) {
+        std::cerr << "No file to load." << std::endl;
+        return 1;
+    }
+
+    Audio audio(nullptr);
+    audio.initContextAsync("null");
+
+    // Another backend would make the timings depend on the host.
+    if (audio.getBackendName() != ma_get_backend_name(ma_backend_null)) {
+        std::cerr << "The null backend isn't available." << std::endl;
+        return 1;
+    }
+
+    ControlProbe probe;
+    audio.setProbe(&probe);
+    std::mt19937 random(seed);
+    std::map<std::string, std::vector<double>> latencies;
+    std::map<std::string, int> timeouts;
+    int failedLoads = 0;
+
+    // Measures the time from the control (ie: when the probe is armed) to its result.
+    auto measure = [&](const char* name, ma_int64 armTime, double timeoutSeconds) {
+        ma_int64 hitTime = probe.wait(timeoutSeconds);
+
+        if (hitTime == 0) {
+            timeouts[name]++;
+        }
+        else {
+            latencies[name].push_back((hitTime - armTime) / 1e6);
+        }
+    };
+
+    auto load = [&]() {
+        const std::string& fileName = fileNames[random() % fileNames.size()];
+        // The previous file would meet the expectation until its device is stopped,
+        // so the new one is loaded paused and the probe armed once it's in place.
+        if (audio.isPlaying()) {
+            audio.toggle();
+        }
+
+        ma_int64 loadTime = ControlProbe::now();
+        audio.loadFile(fileName.c_str());
+
+        if (!audio.isFileLoaded()) {
+            failedLoads++;
+            return;
+        }
+
+        probe.arm(ControlProbe::expectAudible);
+        audio.toggle();
+        measure("load", loadTime, 5.0);
+    };
+
+    // The loading messages would bury the report.
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    auto start = std::chrono::steady_clock::now();
+
+    load();
+
+    for (int i = 0; i < operations && audio.isFileLoaded(); i++) {
+        int operation = random() % 100;
+        ma_uint64 totalFrames = audio.getTotalFrames();
+
+        // Start over rather than letting the playback stop at the end.
+        if (audio.getCursorFrames() + defaultOutputSampleRate * 3 > totalFrames) {
+            ma_int64 armTime = probe.arm(ControlProbe::expectPosition, 0, defaultOutputSampleRate / 10);
+            audio.setCursor(0.0);
+            measure("seek", armTime, 2.0);
+        }
+
+        if (operation < 10) {
+            load();
+        }
+        else if (operation < 45) {
+            bool playing = audio.isPlaying();
+            ma_int64 armTime = probe.arm(playing ? ControlProbe::expectSilent : ControlProbe::expectAudible);
+            audio.toggle();
+            measure(playing ? "pause" : "play", armTime, 2.0);
+        }
+        // Pause and play right away, which used to leave two playback time threads running.
+        else if (operation < 60) {
+            audio.toggle();
+            audio.toggle();
+        }
+        // A single seek or a burst (eg: slider dragging), only the last target counts.
+        else if (totalFrames > defaultOutputSampleRate * 4) {
+            int seekCount = (operation < 85) ? 1 : 5;
+            std::vector<ma_uint64> targets;
+
+            for (int s = 0; s < seekCount; s++) {
+                ma_uint64 target;
+
+                // Far enough from the position, so that the result can't be mistaken for it.
+                do {
+                    target = random() % (totalFrames - defaultOutputSampleRate * 3);
+                } while (std::llabs((ma_int64)target - (ma_int64)audio.getCursorFrames()) < defaultOutputSampleRate);
+
+                targets.push_back(target);
+            }
+
+            ma_int64 armTime = probe.arm(ControlProbe::expectPosition, targets.back(), defaultOutputSampleRate / 10);
+
+            for (ma_uint64 target : targets) {
+                audio.setCursor((double)target / defaultOutputSampleRate);
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+
+            measure("seek", armTime, 2.0);
+        }
+
+        // Random gaps, so that the controls land anywhere within the periods.
+        std::this_thread::sleep_for(std::chrono::microseconds(random() % 20000));
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Leave no playback time thread behind.
+    if (audio.isPlaying()) {
+        audio.toggle();
+    }
+
+    while (audio.getRunThreads() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(devNull);
+
+    printf("Control stress test: %d operations in %.1f s (seed %u), %llu blocks observed.\n", operations, elapsed, seed,
+           (unsigned long long)probe.getBlocks());
+    printf("Latencies to the callback output (the device buffer adds %.1f ms):\n",
+           audio.getPlaybackClock()->getLatencySeconds() * 1000.0);
+    bool failed = false;
+
+    for (const char* name : {"play", "pause", "seek", "load"}) {
+        std::vector<double>& values = latencies[name];
+        double threshold = (strcmp(name, "load") == 0) ? maxP99 * 5.0 : maxP99;
+
+        if (values.empty()) {
+            printf("  %-6s no sample, %d timeout(s)\n", name, timeouts[name]);
+            failed = failed || timeouts[name] > 0;
+            continue;
+        }
+
+        std::sort(values.begin(), values.end());
+        double p99 = getPercentile(values, 0.99);
+        bool passed = (p99 <= threshold && timeouts[name] == 0);
+        printf("  %-6s %5zu samples: p50 %6.2f ms, p95 %6.2f ms, p99 %6.2f ms, max %7.2f ms, %d timeout(s)  %s (p99 <= %.0f ms)\n",
+               name, values.size(), getPercentile(values, 0.5), getPercentile(values, 0.95), p99, values.back(),
+               timeouts[name], passed ? "ok" : "FAILED", threshold);
+        failed = failed || !passed;
+    }
+
+    int maxRunThreads = audio.getMaxRunThreads();
+    ma_uint64 backwardJumps = probe.getBackwardJumps();
+    printf("Playback time threads at once: %d  %s\n", maxRunThreads, (maxRunThreads <= 1) ? "ok" : "FAILED (overlapping run threads)");
+    printf("Position going backward without a seek: %llu  %s\n", (unsigned long long)backwardJumps,
+           (backwardJumps == 0) ? "ok" : "FAILED (stale cursor)");
+    printf("Failed loads: %d  %s\n", failedLoads, (failedLoads == 0) ? "ok" : "FAILED");
+    failed = failed || maxRunThreads > 1 || backwardJumps > 0 || failedLoads > 0;
+
+    return failed ? 1 : 0;
+}
+
+/*
+ * Returns the voluntary context switches (ie: the wakeups) of each thread of the
+ * process, but the calling one, by thread id. Empty if /proc isn't available.
+ */
+static std::map<std::string, ma_uint64> getThreadWakeups()
+{
+    std::map<std::string, ma_uint64> wakeups;
+    std::string self = std::to_string(syscall(SYS_gettid));
+    std::error_code error;
+
+    for (const auto& entry : std::filesystem::directory_iterator("/proc/self/task", error)) {
+        std::string threadId = entry.path().filename().string();
+
+        if (threadId == self) {
+            continue;
+        }
+
+        // The thread may have ended meanwhile.
+        std::ifstream status(entry.path() / "status");
+        std::string line;
+
+        while (std::getline(status, line)) {
+            if (line.rfind("voluntary_ctxt_switches:", 0) == 0) {
+                wakeups[threadId] = std::stoull(line.substr(line.find(':') + 1));
+                break;
+            }
+        }
+    }
+
+    return wakeups;
+}
+
+/*
+ * Measures the wakeups per second while paused, with the idle suspension disabled
+ * then enabled: The device ones (ie: callbacks) and the ones of all the player
+ * threads (device, loop worker, idle watcher, background workers...), read from
+ * /proc. Then measures the time from play to the first audible block once the
+ * device has been suspended. Runs on the null backend, which wakes up at the
+ * period rate like a hardware device.
+ * Usage: Player --bench-idle [SECONDS] [FILE]
+ */
+int Audio::benchmarkIdle(const std::vector<std::string>& arguments)
+{
+    double window = 3.0;
+    std::string fileName;
+
+    for (size_t i = 0; i < arguments.size(); i++) {
+        if (i == 0 && std::all_of(arguments[i].begin(), arguments[i].end(), ::isdigit)) {
+            window = std::stod(arguments[i]);
+        }
+        else {
+            fileName = arguments[i];
+        }
+    }
+
+    if (fileName.empty()) {
+        std::vector<std::string> fixtures = createFixtures();
+
+        if (fixtures.empty()) {
+            std::cerr << "No file to load." << std::endl;
+            return 1;
+        }
+
+        fileName = fixtures[0];
+    }
+
+    Audio audio(nullptr);
+    audio.initContextAsync("null");
+
+    if (audio.getBackendName() != ma_get_backend_name(ma_backend_null)) {
+        std::cerr << "The null backend isn't available." << std::endl;
+        return 1;
+    }
+
+    ControlProbe probe;
+    audio.setProbe(&probe);
+    // Measured without suspension first.
+    audio.setIdleSuspend(0.0);
+
+    // The loading messages would bury the report.
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+
+    audio.loadFile(fileName.c_str());
+
+    if (!audio.isFileLoaded()) {
+        fflush(stdout);
+        dup2(savedStdout, STDOUT_FILENO);
+        close(savedStdout);
+        close(devNull);
+        std::cerr << "Failed to load " << fileName << std::endl;
+        return 1;
+    }
+
+    struct Wakeups {
+        double callbacks;
+        double threads;
+        size_t threadCount;
+    };
+
+    // Counts the callbacks and the thread wakeups over the measurement window.
+    // The threads ended within the window aren't counted.
+    auto measureWakeups = [&]() {
+        std::map<std::string, ma_uint64> firstThreads = getThreadWakeups();
+        ma_uint64 first = audio.getCallbackCount();
+        std::this_thread::sleep_for(std::chrono::duration<double>(window));
+        Wakeups wakeups = {(double)(audio.getCallbackCount() - first) / window, 0.0, 0};
+        std::map<std::string, ma_uint64> lastThreads = getThreadWakeups();
+
+        for (const auto& thread : lastThreads) {
+            auto firstThread = firstThreads.find(thread.first);
+            ma_uint64 start = (firstThread != firstThreads.end()) ? firstThread->second : 0;
+            wakeups.threads += (double)(thread.second - start) / window;
+        }
+
+        wakeups.threadCount = lastThreads.size();
+
+        return wakeups;
+    };
+
+    // The loop worker is counted along with the other threads.
+    audio.setLoop(defaultOutputSampleRate, defaultOutputSampleRate * 10);
+    // Play a little, then pause.
+    audio.toggle();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    audio.toggle();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    Wakeups before = measureWakeups();
+
+    // Suspend after half a second of pause.
+    audio.setIdleSuspend(0.5);
+
+    for (int i = 0; i < 500 && !audio.isDeviceSuspended(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    bool suspended = audio.isDeviceSuspended();
+    Wakeups after = measureWakeups();
+    // The idle watcher may wake up once more, on the suspension itself.
+    bool parked = suspended && after.callbacks == 0.0 && after.threads * window <= 1.0;
+
+    // Resume: The play request is queued before the device restarts.
+    ma_int64 armTime = probe.arm(ControlProbe::expectAudible);
+    audio.toggle();
+    ma_int64 hitTime = probe.wait(2.0);
+    double resumeLatency = (hitTime - armTime) / 1e6;
+    bool resumed = !audio.isDeviceSuspended() && hitTime != 0;
+    double periodLength = (double)audio.outputDevice.playback.internalPeriodSizeInFrames * 1000.0
+                          / audio.outputDevice.playback.internalSampleRate;
+
+    audio.toggle();
+
+    while (audio.getRunThreads() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(devNull);
+
+    printf("Idle suspension (%.1f s windows, device period %.2f ms):\n", window, periodLength);
+    printf("  Paused, device running:   %7.1f callbacks/s, %7.1f thread wakeups/s (%zu threads)\n",
+           before.callbacks, before.threads, before.threadCount);
+    printf("  Paused, device suspended: %7.1f callbacks/s, %7.1f thread wakeups/s (%zu threads)  %s\n",
+           after.callbacks, after.threads, after.threadCount, parked ? "ok" : "FAILED (still waking up)");
+
+    if (hitTime == 0) {
+        printf("  Resume: no audible block within 2 s  FAILED\n");
+    }
+    else {
+        printf("  Resume: first audible block after %.2f ms (%s one period)\n", resumeLatency,
+               (resumeLatency <= periodLength) ? "within" : "over");
+    }
+
+    return (parked && resumed) ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include "main.h"
+
+/*
+ * Transport handling.
+ * Play, pause, seek and volume requests are pushed into a lock-free queue by
+ * any thread, then applied by the audio callback at the start of each block.
+ * The decoder is thus only ever read and seeked by the thread playing it, and a
+ * burst of seeks (eg: slider dragging) results in a single seek to the latest target.
+ */
+
+/*
+ * Queues a transport request for the file currently loaded.
+ */
+void Audio::pushCommand(CommandType type, ma_uint64 frames, float value)
+{
+    pushCommand(type, frames, value, loadGeneration.load());
+}
+
+/*
+ * Queues a transport request computed for the given load generation.
+ */
+void Audio::pushCommand(CommandType type, ma_uint64 frames, float value, ma_uint64 generation)
+{
+    if (!commands.push({type, frames, value, generation})) {
+        std::cerr << "Transport command queue full, request dropped." << std::endl;
+        return;
+    }
+
+    if (type == commandSeek) {
+        requestedSeeks.fetch_add(1, std::memory_order_release);
+    }
+
+    // A suspended device is restarted to apply the request. Since it's queued
+    // beforehand, the very first block after the restart takes it into account.
+    noteActivity();
+    resumeDevice();
+}
+
+/*
+ * Applies the pending requests. Returns true if the file is to be played during this block.
+ * Note: This function is called from the device thread.
+ */
+bool Audio::applyCommands()
+{
+    Command command;
+    ma_uint64 generation = loadGeneration.load(std::memory_order_relaxed);
+
+    while (commands.pop(command)) {
+        // Made for the previous file (eg: a silence skip computed while loading).
+        if (command.generation != generation) {
+            if (command.type == commandSeek) {
+                drainedSeeks++;
+
+                if (!seekPending) {
+                    appliedSeeks.store(drainedSeeks, std::memory_order_release);
+                }
+            }
+
+            continue;
+        }
+
+        switch (command.type) {
+            case commandPlay:
+                playing = true;
+                break;
+            case commandPause:
+                playing = false;
+                break;
+            case commandVolume:
+                gain = command.value;
+                break;
+            case commandSeek:
+                // Only the latest target matters.
+                seekTarget = command.frames;
+                seekPending = true;
+                drainedSeeks++;
+                break;
+        }
+    }
+
+    // The loop worker may be moving the decoder, the seek waits for the next block.
+    if (seekPending && loopSeek.load(std::memory_order_acquire) != loopSeekRequested) {
+        Tracer::Scope trace("Seek");
+        // Leave a possible pre-decoded loop start.
+        prerollLoop.store(-1, std::memory_order_relaxed);
+        loopSeek.store(loopSeekNone, std::memory_order_relaxed);
+        // Drop the frames stretched from the previous position.
+        timeStretch->reset();
+
+        if (ma_data_source_seek_to_pcm_frame(callbackData.pDataSource, seekTarget) == MA_SUCCESS) {
+            cursor.store(seekTarget, std::memory_order_relaxed);
+        }
+
+        // While playing, the clock follows with this very block.
+        if (!playing) {
+            clock.reset(cursor.load(std::memory_order_relaxed));
+        }
+
+        seekPending = false;
+        appliedSeeks.store(drainedSeeks, std::memory_order_release);
+    }
+
+    if (playing && !seekPending && isEndOfFile()) {
+        // The application is informed by the run thread.
+        playing = false;
+        is_playing.store(false, std::memory_order_relaxed);
+    }
+
+    return playing && !seekPending;
+}
+
+/*
+ * Drops the pending requests and takes the requested state over.
+ * Note: The device must be stopped. The pending seeks belong to the previous file.
+ */
+void Audio::flushCommands()
+{
+    Command command;
+
+    while (commands.pop(command)) {
+        if (command.type == commandSeek) {
+            drainedSeeks++;
+        }
+    }
+
+    seekPending = false;
+    appliedSeeks.store(drainedSeeks, std::memory_order_release);
+    playing = is_playing.load(std::memory_order_relaxed);
+    gain = volume.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,182 @@
+#include "main.h"
+
+/*
+ * Idle device suspension.
+ * While paused, the callback goes on outputting silence every period, which keeps
+ * the audio stack (and a core) awake for nothing. Once the playback has been idle
+ * for a while, a watcher thread stops the device. Nothing else is released: The
+ * device, the decoder and the transport state stay as they are, so resuming is a
+ * mere device start.
+ * Any transport request (or a scrub) restarts the device. The request is queued
+ * before the restart, so it's applied by the very first block rendered.
+ */
+
+/*
+ * Sets the idle time (in seconds) after which a paused device is suspended.
+ * Zero disables the suspension.
+ */
+void Audio::setIdleSuspend(double seconds)
+{
+    idleSuspendSeconds.store(std::max(0.0, seconds), std::memory_order_relaxed);
+
+    // The device is no longer expected to be suspended.
+    if (seconds <= 0.0) {
+        resumeDevice();
+    }
+
+    // Take the new delay into account.
+    noteActivity();
+}
+
+/*
+ * Restarts the idle timer. The watcher thread is launched on the first call.
+ * Note: Called from the application and playback time threads.
+ */
+void Audio::noteActivity()
+{
+    if (idleSuspendSeconds.load(std::memory_order_relaxed) <= 0.0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        lastActivity = std::chrono::steady_clock::now();
+        idleArmed = true;
+
+        if (!idleWatcher.joinable() && !idleWatcherStopping) {
+            idleWatcher = std::thread(&Audio::watchIdleDevice, this);
+        }
+    }
+
+    idleChanged.notify_one();
+}
+
+/*
+ * Waits for the playback to be idle long enough, then suspends the device.
+ * Note: This function is run in a thread. It sleeps until the deadline (or the
+ *       next activity), so it doesn't wake up periodically itself.
+ */
+void Audio::watchIdleDevice()
+{
+    Tracer::setThreadName("Idle watcher");
+    std::unique_lock<std::mutex> lock(idleMutex);
+
+    while (!idleWatcherStopping) {
+        double delay = idleSuspendSeconds.load(std::memory_order_relaxed);
+
+        if (!idleArmed || delay <= 0.0) {
+            idleChanged.wait(lock);
+            continue;
+        }
+
+        auto deadline = lastActivity + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                           std::chrono::duration<double>(delay));
+
+        if (std::chrono::steady_clock::now() < deadline) {
+            idleChanged.wait_until(lock, deadline);
+            continue;
+        }
+
+        // Rearmed by the next activity (eg: pause).
+        idleArmed = false;
+        lock.unlock();
+        suspendDevice();
+        lock.lock();
+    }
+}
+
+/*
+ * Stops the device if nothing is played. Returns true if the device has been suspended.
+ */
+bool Audio::suspendDevice()
+{
+    std::lock_guard<std::mutex> lock(deviceMutex);
+
+    if (!outputDeviceInit || deviceSuspended.load(std::memory_order_relaxed) || !ma_device_is_started(&outputDevice)) {
+        return false;
+    }
+
+    // The callback has more to do than silence (or it's about to).
+    if (is_playing.load(std::memory_order_relaxed) || isMonitoring() || isScrubbing() || isSeekPending()) {
+        return false;
+    }
+
+    // A request may come in meanwhile. As the requests note the activity before
+    // resuming, it's either seen here, or their resume sees this suspension.
+    std::lock_guard<std::mutex> idleLock(idleMutex);
+    double delay = idleSuspendSeconds.load(std::memory_order_relaxed);
+
+    if (delay <= 0.0 || std::chrono::steady_clock::now() - lastActivity < std::chrono::duration<double>(delay)) {
+        return false;
+    }
+
+    Tracer::Scope trace("Suspend device");
+
+    if (ma_device_stop(&outputDevice) != MA_SUCCESS) {
+        std::cerr << "Failed to suspend the playback device." << std::endl;
+        return false;
+    }
+
+    deviceSuspended.store(true, std::memory_order_release);
+    suspensions.fetch_add(1, std::memory_order_relaxed);
+    printf("\nPlayback device suspended (idle).\n");
+
+    return true;
+}
+
+/*
+ * Restarts the device if it's been suspended.
+ */
+void Audio::resumeDevice()
+{
+    // Nothing to do most of the time (eg: while playing).
+    if (!deviceSuspended.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(deviceMutex);
+
+    if (!deviceSuspended.load(std::memory_order_relaxed) || !outputDeviceInit) {
+        return;
+    }
+
+    Tracer::Scope trace("Resume device");
+    deviceSuspended.store(false, std::memory_order_release);
+
+    if (ma_device_start(&outputDevice) != MA_SUCCESS) {
+        std::cerr << "Failed to resume the playback device." << std::endl;
+    }
+}
+
+/*
+ * Stops the output device and releases its resources.
+ */
+void Audio::releaseOutputDevice()
+{
+    // The idle watcher mustn't stop a device being released.
+    std::lock_guard<std::mutex> lock(deviceMutex);
+
+    if (outputDeviceInit) {
+        ma_device_uninit(&outputDevice);
+        outputDeviceInit = false;
+    }
+
+    deviceSuspended.store(false, std::memory_order_release);
+}
+
+/*
+ * Ends the idle watcher thread, if any.
+ */
+void Audio::stopIdleWatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleWatcherStopping = true;
+    }
+
+    idleChanged.notify_one();
+
+    if (idleWatcher.joinable()) {
+        idleWatcher.join();
+    }
+}
@@ -0,0 +1,433 @@
+#include "main.h"
+
+/*
+ * A-B loop handling.
+ * The wrap is done within the audio callback: The last frames before the loop end
+ * are crossfaded with the pre-decoded loop start, then the callback keeps on playing
+ * the pre-decoded frames while the loop worker seeks the decoder behind them.
+ * The wrap is thus gapless whatever the file format (ie: no seek stall).
+ */
+
+/*
+ * Reads the next frames of the file into the output buffer, taking care of
+ * a possible loop region. Keeps the cursor up to date.
+ * Note: This function is called from the device thread.
+ */
+void Audio::readFrames(void* pOutput, ma_uint32 frameCount)
+{
+    Tracer::Scope trace("Read frames");
+    const ma_uint32 channels = sourceChannels;
+    float* pFrames = (float*)pOutput;
+    ma_uint32 framesDone = 0;
+    int active = activeLoop.load();
+
+    // Tell the loop worker which region is read, then make sure it's still the active one.
+    while (true) {
+        loopInUse.store(active);
+        int current = activeLoop.load();
+
+        if (current == active) {
+            break;
+        }
+
+        active = current;
+    }
+
+    while (framesDone < frameCount) {
+        float* pOut = pFrames + framesDone * channels;
+        ma_uint32 framesLeft = frameCount - framesDone;
+        int preroll = prerollLoop.load(std::memory_order_acquire);
+
+        // Play the pre-decoded loop start while the decoder is seeking.
+        if (preroll >= 0) {
+            LoopRegion& region = loopRegions[preroll];
+
+            if (prerollOffset < region.frameCount) {
+                ma_uint32 framesToCopy = (ma_uint32)std::min((ma_uint64)framesLeft, region.frameCount - prerollOffset);
+                memcpy(pOut, region.frames.data() + prerollOffset * channels, framesToCopy * channels * sizeof(float));
+                prerollOffset += framesToCopy;
+                cursor.fetch_add(framesToCopy, std::memory_order_relaxed);
+                framesDone += framesToCopy;
+                continue;
+            }
+
+            // The seek took longer than the pre-decoded frames, output silence meanwhile.
+            if (loopSeek.load(std::memory_order_acquire) != loopSeekDone) {
+                memset(pOut, 0, framesLeft * channels * sizeof(float));
+                break;
+            }
+
+            // The decoder is right behind the pre-decoded frames.
+            loopSeek.store(loopSeekNone, std::memory_order_relaxed);
+            prerollLoop.store(-1, std::memory_order_release);
+            continue;
+        }
+
+        ma_uint64 position = cursor.load(std::memory_order_relaxed);
+
+        // No loop, or the playhead is already past the loop end.
+        if (active < 0 || position >= loopRegions[active].end) {
+            ma_data_source_read_pcm_frames(callbackData.pDataSource, pOut, framesLeft, NULL);
+            cursor.fetch_add(framesLeft, std::memory_order_relaxed);
+            break;
+        }
+
+        LoopRegion& region = loopRegions[active];
+        ma_uint32 framesToRead = (ma_uint32)std::min((ma_uint64)framesLeft, region.end - position);
+        ma_data_source_read_pcm_frames(callbackData.pDataSource, pOut, framesToRead, NULL);
+
+        // Crossfade the frames before the loop end with the loop start.
+        ma_uint64 fadeStart = region.end - loopFadeFrames;
+
+        for (ma_uint32 i = 0; i < framesToRead; i++) {
+            if (position + i < fadeStart) {
+                continue;
+            }
+
+            ma_uint64 fadeFrame = position + i - fadeStart;
+            float gain = ((float)fadeFrame + 0.5f) / loopFadeFrames;
+            const float* pStart = region.frames.data() + fadeFrame * channels;
+
+            for (ma_uint32 c = 0; c < channels; c++) {
+                pOut[i * channels + c] = pOut[i * channels + c] * (1.0f - gain) + pStart[c] * gain;
+            }
+        }
+
+        framesDone += framesToRead;
+
+        if (position + framesToRead < region.end) {
+            cursor.fetch_add(framesToRead, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Wrap: The crossfaded frames of the loop start have been played already.
+        prerollOffset = loopFadeFrames;
+        cursor.store(region.start + loopFadeFrames, std::memory_order_relaxed);
+        // Ask the worker to move the decoder right after the pre-decoded frames.
+        loopSeekTarget.store(region.start + region.frameCount, std::memory_order_relaxed);
+        loopSeek.store(loopSeekRequested, std::memory_order_release);
+        prerollLoop.store(active);
+        sem_post(&loopWakeup);
+    }
+
+    // Note: The region whose start is still to be played stays marked by prerollLoop.
+    loopInUse.store(-1);
+}
+
+/*
+ * Function used by the time stretcher to pull the source frames.
+ */
+ma_uint32 Audio::readSourceFrames(void* pUserData, float* pFrames, ma_uint32 frameCount)
+{
+    ((Audio*)pUserData)->readFrames(pFrames, frameCount);
+
+    return frameCount;
+}
+
+/*
+ * Fills the output buffer at the current playback speed, routed to the device channels.
+ * Returns the source position of the first output frame, ie: the cursor minus the
+ * frames buffered by the stretcher and the convolver.
+ * Note: This function is called from the device thread.
+ */
+ma_uint64 Audio::renderFrames(void* pOutput, ma_uint32 frameCount)
+{
+    double buffered = timeStretch->getBufferedFrames() + convolver->getLatencyFrames();
+    double position = (double)cursor.load(std::memory_order_relaxed) - buffered;
+
+    if (router.isPassThrough()) {
+        timeStretch->process((float*)pOutput, frameCount, readSourceFrames, this);
+        convolver->process((float*)pOutput, frameCount);
+        return (ma_uint64)std::max(0.0, position);
+    }
+
+    // The file frames are rendered at their own channel count, then mixed into the output.
+    float* pFrames = (float*)pOutput;
+    ma_uint32 outputChannels = router.getOutputChannels();
+    ma_uint32 framesDone = 0;
+
+    while (framesDone < frameCount) {
+        ma_uint32 framesToRender = std::min(routeChunkFrames, frameCount - framesDone);
+        timeStretch->process(routeBuffer.data(), framesToRender, readSourceFrames, this);
+        router.process(routeBuffer.data(), pFrames + framesDone * outputChannels, framesToRender);
+        framesDone += framesToRender;
+    }
+
+    // Once routed, so that each speaker gets its own impulse response.
+    convolver->process(pFrames, frameCount);
+
+    return (ma_uint64)std::max(0.0, position);
+}
+
+/*
+ * Fills the output buffer with the scrub grains, routed to the device channels.
+ * Returns the scrub position.
+ * Note: This function is called from the device thread.
+ */
+ma_uint64 Audio::renderScrub(void* pOutput, ma_uint32 frameCount)
+{
+    if (router.isPassThrough()) {
+        return scrubber->render((float*)pOutput, frameCount);
+    }
+
+    float* pFrames = (float*)pOutput;
+    ma_uint32 outputChannels = router.getOutputChannels();
+    ma_uint32 framesDone = 0;
+    ma_uint64 position = 0;
+
+    while (framesDone < frameCount) {
+        ma_uint32 framesToRender = std::min(routeChunkFrames, frameCount - framesDone);
+        ma_uint64 chunkPosition = scrubber->render(routeBuffer.data(), framesToRender);
+
+        if (framesDone == 0) {
+            position = chunkPosition;
+        }
+
+        router.process(routeBuffer.data(), pFrames + framesDone * outputChannels, framesToRender);
+        framesDone += framesToRender;
+    }
+
+    return position;
+}
+
+/*
+ * Sets the playback speed (from 0.5 to 2.0), the pitch is preserved.
+ */
+void Audio::setSpeed(float value)
+{
+    timeStretch->setSpeed(value);
+}
+
+/*
+ * Seeks the decoder on behalf of the audio callback whenever the loop wraps.
+ * Note: This function is run in a thread for as long as a file is loaded. It sleeps
+ *       on the semaphore between the wraps, so it doesn't wake up while playing
+ *       without looping, or while paused.
+ *       The callback doesn't read the decoder while a seek is requested.
+ */
+void Audio::runLoopWorker(Realtime::Options options)
+{
+    Tracer::setThreadName("Loop worker");
+    // Right below the callback it seeks for.
+    Realtime::applyToCurrentThread(options, -5, loopWorkerStatus);
+
+    while (true) {
+        // Interrupted by a signal.
+        if (sem_wait(&loopWakeup) != 0) {
+            continue;
+        }
+
+        if (!loopWorkerRunning.load()) {
+            break;
+        }
+
+        seekForLoop();
+        applyLoopRequest();
+    }
+}
+
+/*
+ * Seeks the decoder if the callback has wrapped.
+ */
+void Audio::seekForLoop()
+{
+    if (loopSeek.load(std::memory_order_acquire) == loopSeekRequested) {
+        Tracer::Scope trace("Loop seek");
+        ma_data_source_seek_to_pcm_frame(callbackData.pDataSource, loopSeekTarget.load(std::memory_order_relaxed));
+        loopSeek.store(loopSeekDone, std::memory_order_release);
+    }
+}
+
+/*
+ * Fills a region with the requested loop and publishes it, unless a newer
+ * request (or a clear) has come in meanwhile.
+ * Note: This function is called from the loop worker.
+ */
+void Audio::applyLoopRequest()
+{
+    ma_uint64 requestId;
+    ma_uint64 start;
+    ma_uint64 end;
+
+    {
+        std::lock_guard<std::mutex> lock(loopRequestMutex);
+
+        if (!loopRequested) {
+            return;
+        }
+
+        loopRequested = false;
+        requestId = loopRequestId;
+        start = requestedLoopStart;
+        end = requestedLoopEnd;
+    }
+
+    // Pick a region the callback doesn't read. The one in use is read before the
+    // preroll one, as the callback marks the preroll before releasing the region.
+    // Only the active region may be marked afterwards, so the region picked stays free.
+    int inUse = loopInUse.load();
+    int preroll = prerollLoop.load();
+    int active = activeLoop.load();
+    int index = 0;
+
+    while (index == active || index == preroll || index == inUse) {
+        index++;
+    }
+
+    LoopRegion& region = loopRegions[index];
+    region.start = start;
+    region.end = end;
+    bool decoded = decodeLoopStart(region);
+    std::lock_guard<std::mutex> lock(loopRequestMutex);
+
+    if (requestId != loopRequestId) {
+        return;
+    }
+
+    if (!decoded) {
+        std::cerr << "Failed to decode the loop start." << std::endl;
+        // Looping is off, as getLoop reports.
+        requestedLoopEnd = 0;
+        activeLoop.store(-1);
+        return;
+    }
+
+    // Publish the new region.
+    activeLoop.store(index);
+}
+
+/*
+ * Decodes the first frames of the given loop region.
+ * A separate decoder is used so that the playback is not disturbed. The frames are
+ * decoded in blocks, between which a wrap of the current loop is still served.
+ * Note: This function is called from the loop worker.
+ */
+bool Audio::decodeLoopStart(LoopRegion& region)
+{
+    Tracer::Scope trace("Decode loop start");
+    // The loop may be shorter than the pre-decoded length, the last frames are
+    // then read through the crossfade.
+    region.frameCount = std::min((ma_uint64)loopPrerollFrames, region.end - region.start - loopFadeFrames);
+    // Allocated once for the largest layout, so the size never changes afterwards.
+    region.frames.resize(loopPrerollFrames * ChannelRouter::maxChannels);
+
+    // The cached files are already in memory.
+    if (cachedFile) {
+        memcpy(region.frames.data(), (float*)cachedFile->data.data() + region.start * sourceChannels,
+               region.frameCount * sourceChannels * sizeof(float));
+        return true;
+    }
+
+    ma_decoder loopDecoder;
+    ma_decoder_config decoderConfig = getDecoderConfig(sourceChannels);
+
+    if (ma_decoder_init_file(originalFileFormat.fileName.c_str(), &decoderConfig, &loopDecoder) != MA_SUCCESS) {
+        return false;
+    }
+
+    ma_uint64 framesRead = 0;
+
+    if (ma_decoder_seek_to_pcm_frame(&loopDecoder, region.start) == MA_SUCCESS) {
+        while (framesRead < region.frameCount) {
+            ma_uint64 blockRead = 0;
+            ma_decoder_read_pcm_frames(&loopDecoder, region.frames.data() + framesRead * sourceChannels,
+                                       std::min((ma_uint64)loopDecodeFrames, region.frameCount - framesRead), &blockRead);
+            framesRead += blockRead;
+            seekForLoop();
+
+            if (blockRead == 0) {
+                break;
+            }
+        }
+    }
+
+    ma_decoder_uninit(&loopDecoder);
+
+    return framesRead == region.frameCount;
+}
+
+/*
+ * Sets the loop region (in frames). Can be called while playing.
+ * The loop worker decodes the region start, the loop takes effect once it's done.
+ */
+bool Audio::setLoop(ma_uint64 start, ma_uint64 end)
+{
+    end = std::min(end, totalFrames);
+
+    // The loop must be long enough to be crossfaded.
+    if (!isFileLoaded() || end <= start + loopFadeFrames * 2) {
+        return false;
+    }
+
+    if (!loopWorkerRunning.load()) {
+        loopWorkerRunning.store(true);
+        loopWorkerStatus.applied.store(false);
+        loopWorker = std::thread(&Audio::runLoopWorker, this, realtimeOptions);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loopRequestMutex);
+        loopRequested = true;
+        loopRequestId++;
+        requestedLoopStart = start;
+        requestedLoopEnd = end;
+    }
+
+    sem_post(&loopWakeup);
+
+    return true;
+}
+
+/*
+ * Turns looping off. The playback goes on from the current position.
+ */
+void Audio::clearLoop()
+{
+    std::lock_guard<std::mutex> lock(loopRequestMutex);
+    // Drops a region being decoded as well.
+    loopRequested = false;
+    loopRequestId++;
+    requestedLoopEnd = 0;
+    activeLoop.store(-1);
+}
+
+/*
+ * Gets the last loop region set, even if its start is still being decoded.
+ * Returns false if looping is off.
+ */
+bool Audio::getLoop(ma_uint64& start, ma_uint64& end)
+{
+    std::lock_guard<std::mutex> lock(loopRequestMutex);
+
+    if (requestedLoopEnd == 0) {
+        return false;
+    }
+
+    start = requestedLoopStart;
+    end = requestedLoopEnd;
+
+    return true;
+}
+
+/*
+ * Stops the loop worker and resets the loop state (eg: a new file is loaded).
+ * Note: The device must be stopped beforehand.
+ */
+void Audio::stopLoop()
+{
+    loopWorkerRunning.store(false);
+
+    if (loopWorker.joinable()) {
+        sem_post(&loopWakeup);
+        loopWorker.join();
+    }
+
+    // Drop the wakeups left by the last wraps.
+    while (sem_trywait(&loopWakeup) == 0) {
+    }
+
+    clearLoop();
+    loopInUse.store(-1);
+    prerollLoop.store(-1);
+    loopSeek.store(loopSeekNone);
+}
@@ -9,9 +9,10 @@ void Application::audio_settings_cb(Fl_Widget *w, void *data)
 
     // Build the modal window.
     if (app->audioSettings == 0) {
-        app->audioSettings = new AudioSettings(app->x() + MODAL_WND_POS, app->y() + MODAL_WND_POS, 400, 200, "Audio Settings");
+        app->audioSettings = new AudioSettings(app->x() + MODAL_WND_POS, app->y() + MODAL_WND_POS, 400, 380, "Audio Settings");
         app->audioSettings->getSaveButton()->callback(save_audio_settings_cb, app);
         app->audioSettings->getCancelButton()->callback(cancel_audio_settings_cb, app);
+        app->audioSettings->getDetectButton()->callback(detect_period_cb, app);
     }
 
     if (!app->audio->isContextInit()) {
@@ -65,6 +66,72 @@ void Application::audio_settings_cb(Fl_Widget *w, void *data)
         // Set the device selection.
         selection = (found) ? selection : defaultSelec;
         app->audioSettings->input->value(selection);
+
+        // Select the current period size or the default one.
+        int index = app->audioSettings->period->find_index(config.periodSize.c_str());
+        app->audioSettings->period->value((index < 0) ? 0 : index);
+
+        // Channel routing.
+        const char* channels[] = {"0", "2", "6", "8"};
+        const char* lfeLevels[] = {"off", "-10", "0"};
+
+        for (int i = 0; i < 4; i++) {
+            if (config.outputChannels == channels[i]) {
+                app->audioSettings->channels->value(i);
+            }
+
+            if (i < 3 && config.lfeLevel == lfeLevels[i]) {
+                app->audioSettings->lfe->value(i);
+            }
+        }
+
+        app->audioSettings->upmix->value(config.upmix == "1");
+        app->audioSettings->dither->value(config.dither == "1");
+        app->audioSettings->noiseShaping->value(config.noiseShaping == "1");
+        app->audioSettings->skipSilence->value(config.skipSilence == "1");
+        app->audioSettings->skipGaps->value(config.skipGaps == "1");
+        index = app->audioSettings->silenceThreshold->find_index((config.silenceThreshold + " dB").c_str());
+        // -60 dB by default.
+        app->audioSettings->silenceThreshold->value((index < 0) ? 1 : index);
+
+        // Real-time options, see the options order in AudioSettings.
+        app->audioSettings->scheduling->value((int)Realtime::getPolicy(config.realtime));
+
+        if (app->audioSettings->audioCpu->size() <= 2) {
+            for (int cpu = 0; cpu < Realtime::getCpuCount(); cpu++) {
+                app->audioSettings->audioCpu->add(std::to_string(cpu).c_str());
+            }
+        }
+
+        // "Any" comes first.
+        int cpu = std::stoi(config.audioCpu);
+        app->audioSettings->audioCpu->value((cpu >= 0 && cpu < Realtime::getCpuCount()) ? cpu + 1 : 0);
+        app->audioSettings->lockMemory->value(config.lockMemory == "1");
+
+        // The default device comes first.
+        selection = 0;
+
+        for (size_t i = 0; i < outputDevices.size(); ++i) {
+            app->audioSettings->preview->add(outputDevices[i].name.c_str());
+
+            if (config.previewDevice.compare(outputDevices[i].name.c_str()) == 0) {
+                selection = i + 1;
+            }
+        }
+
+        app->audioSettings->preview->value(selection);
+        index = app->audioSettings->previewGain->find_index((config.previewGain + " dB").c_str());
+        app->audioSettings->previewGain->value((index < 0) ? 0 : index);
+
+        // See the options order in AudioSettings, 30 seconds by default.
+        const char* idleDelays[] = {"0", "10", "30", "60", "300"};
+        app->audioSettings->idleSuspend->value(2);
+
+        for (int i = 0; i < 5; i++) {
+            if (config.idleSuspend == idleDelays[i]) {
+                app->audioSettings->idleSuspend->value(i);
+            }
+        }
     }
 
     app->audioSettings->show();
@@ -80,11 +147,71 @@ void Application::save_audio_settings_cb(Fl_Widget* w, void* data)
     AppConfig config = app->loadConfig(CONFIG_FILENAME);
     config.outputDevice = app->audioSettings->output->text();
     config.inputDevice = app->audioSettings->input->text();
-    app->saveConfig(config, CONFIG_FILENAME);
+    // The first option is the backend's default period size.
+    config.periodSize = (app->audioSettings->period->value() == 0) ? "0" : app->audioSettings->period->text();
     // Update the newly selected playback device. 
+    app->audio->setPeriodSize((ma_uint32) std::stoul(config.periodSize));
     app->audio->setOutputDevice(config.outputDevice.c_str());
+    // Update the newly selected recording device. 
+    app->audio->setInputDevice(config.inputDevice.c_str());
+    // Channel routing, see the options order in AudioSettings.
+    const char* channels[] = {"0", "2", "6", "8"};
+    const char* lfeLevels[] = {"off", "-10", "0"};
+    config.outputChannels = channels[std::max(0, app->audioSettings->channels->value())];
+    config.lfeLevel = lfeLevels[std::max(0, app->audioSettings->lfe->value())];
+    config.upmix = app->audioSettings->upmix->value() ? "1" : "0";
+    config.dither = app->audioSettings->dither->value() ? "1" : "0";
+    config.noiseShaping = app->audioSettings->noiseShaping->value() ? "1" : "0";
+    app->applyRouting(config);
+    config.skipSilence = app->audioSettings->skipSilence->value() ? "1" : "0";
+    config.skipGaps = app->audioSettings->skipGaps->value() ? "1" : "0";
+    const char* thresholds[] = {"-70", "-60", "-50", "-40"};
+    config.silenceThreshold = thresholds[std::max(0, app->audioSettings->silenceThreshold->value())];
+    app->applySilenceSkipping(config);
+    const char* policies[] = {"default", "fifo", "rr"};
+    config.realtime = policies[std::max(0, app->audioSettings->scheduling->value())];
+    config.audioCpu = std::to_string(std::max(0, app->audioSettings->audioCpu->value()) - 1);
+    config.lockMemory = app->audioSettings->lockMemory->value() ? "1" : "0";
+    app->applyRealtime(config);
+    config.previewDevice = (app->audioSettings->preview->value() <= 0) ? "default" : app->audioSettings->preview->text();
+    const char* previewGains[] = {"0", "-6", "-12", "-20"};
+    config.previewGain = previewGains[std::max(0, app->audioSettings->previewGain->value())];
+    app->applyPreview(config);
+    const char* idleDelays[] = {"0", "10", "30", "60", "300"};
+    config.idleSuspend = idleDelays[std::max(0, app->audioSettings->idleSuspend->value())];
+    app->audio->setIdleSuspend(std::stod(config.idleSuspend));
+
+    if (app->audio->isFileLoaded()) {
+        app->dispayFileInfo(app->audio->getOriginalFileFormat());
+    }
+    // The id found is reused on the next launch.
+    config.backend = app->audio->getBackendName();
+    config.outputDeviceId = app->audio->getOutputDeviceId();
+    app->saveConfig(config, CONFIG_FILENAME);
 
     app->audioSettings->hide();
+
+    // Tell whether the privileges were granted.
+    if (app->audio->isRealtimeRequested() || config.lockMemory == "1") {
+        app->setMessage(app->audio->getRealtimeReport(true));
+        app->dialog_cb(app->dialogWnd, app);
+    }
+}
+
+/*
+ * Probes the selected devices and selects the smallest stable period size.
+ */
+void Application::detect_period_cb(Fl_Widget* w, void* data)
+{
+    Application* app = (Application*) data;
+    app->audioSettings->getDetectButton()->label("Wait...");
+    Fl::check();
+
+    ma_uint32 frames = app->audio->probeStablePeriodSize();
+    int index = (frames == 0) ? -1 : app->audioSettings->period->find_index(std::to_string(frames).c_str());
+    app->audioSettings->period->value((index < 0) ? 0 : index);
+
+    app->audioSettings->getDetectButton()->label("Detect");
 }
 
 void Application::cancel_audio_settings_cb(Fl_Widget* w, void* data)
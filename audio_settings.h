@@ -4,6 +4,7 @@
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Button.H>
 #include <FL/Fl_Choice.H>
+#include <FL/Fl_Check_Button.H>
 
 
 class AudioSettings : public Fl_Window 
@@ -13,13 +14,71 @@ class AudioSettings : public Fl_Window
         Fl_Button* cancelBtn;
         Fl_Choice* input;
         Fl_Choice* output;
+        Fl_Choice* period;
+        Fl_Button* detectBtn;
+        Fl_Choice* channels;
+        Fl_Choice* lfe;
+        Fl_Check_Button* upmix;
+        Fl_Check_Button* dither;
+        Fl_Check_Button* noiseShaping;
+        Fl_Check_Button* skipSilence;
+        Fl_Check_Button* skipGaps;
+        Fl_Choice* silenceThreshold;
+        Fl_Choice* scheduling;
+        Fl_Choice* audioCpu;
+        Fl_Check_Button* lockMemory;
+        Fl_Choice* preview;
+        Fl_Choice* previewGain;
+        Fl_Choice* idleSuspend;
 
         AudioSettings(int x, int y, int w, int h, const char* title = 0) : Fl_Window(x, y, w, h, title)
         {
-            saveBtn = new Fl_Button(10, 150, 80, 40, "Save");
-            cancelBtn = new Fl_Button(110, 150, 80, 40, "Cancel");
+            saveBtn = new Fl_Button(10, 330, 80, 40, "Save");
+            cancelBtn = new Fl_Button(110, 330, 80, 40, "Cancel");
             output = new Fl_Choice(80,10,300,25,"Output:");
             input = new Fl_Choice(80,50,300,25,"Input:");
+            period = new Fl_Choice(80,90,100,25,"Period:");
+            period->add("Default|32|64|128|256|512|1024");
+            period->tooltip("Device period size in frames. Smaller periods lower the monitoring latency.");
+            detectBtn = new Fl_Button(190,90,80,25,"Detect");
+            detectBtn->tooltip("Find the smallest stable period size on this host.");
+            channels = new Fl_Choice(80,130,100,25,"Channels:");
+            channels->add("Native|Stereo|5.1|7.1");
+            channels->tooltip("Output channels. Native uses all of the device channels.");
+            lfe = new Fl_Choice(220,130,80,25,"LFE:");
+            lfe->add("Off|-10 dB|0 dB");
+            lfe->tooltip("Level of the LFE mixed into the front speakers when the output has no LFE channel.");
+            upmix = new Fl_Check_Button(310,130,80,25,"Upmix");
+            upmix->tooltip("Spread stereo files over the center and surround speakers.");
+            dither = new Fl_Check_Button(80,170,80,25,"Dither");
+            dither->tooltip("TPDF dither when the device takes 16 or 24 bit samples.");
+            noiseShaping = new Fl_Check_Button(170,170,130,25,"Noise shaping");
+            noiseShaping->tooltip("Move the dither noise toward the high frequencies.");
+            skipSilence = new Fl_Check_Button(80,210,110,25,"Skip silence");
+            skipSilence->tooltip("Skip the silence at the start and at the end of the files.");
+            skipGaps = new Fl_Check_Button(190,210,90,25,"Skip gaps");
+            skipGaps->tooltip("Skip the silent gaps of more than 2 seconds within the files.");
+            silenceThreshold = new Fl_Choice(300,210,80,25);
+            silenceThreshold->add("-70 dB|-60 dB|-50 dB|-40 dB");
+            silenceThreshold->tooltip("Level under which the sound is considered silent.");
+            scheduling = new Fl_Choice(80,250,100,25,"Scheduling:");
+            scheduling->add("Default|FIFO|RR");
+            scheduling->tooltip("Real-time scheduling of the audio threads (priority set in the config file).\n"
+                                "Needs RLIMIT_RTPRIO or CAP_SYS_NICE.");
+            audioCpu = new Fl_Choice(220,250,70,25,"CPU:");
+            audioCpu->add("Any");
+            audioCpu->tooltip("Pin the audio threads to a CPU.");
+            lockMemory = new Fl_Check_Button(300,250,100,25,"Lock memory");
+            lockMemory->tooltip("Keep the process pages in RAM so that the audio never waits for a page fault.");
+            preview = new Fl_Choice(80,290,180,25,"Preview:");
+            preview->add("Default");
+            preview->tooltip("Output device to audition the files on (File/Preview), eg: headphones.");
+            previewGain = new Fl_Choice(310,290,80,25,"Gain:");
+            previewGain->add("0 dB|-6 dB|-12 dB|-20 dB");
+            previewGain->tooltip("Level of the preview output.");
+            idleSuspend = new Fl_Choice(290,338,90,25,"Suspend:");
+            idleSuspend->add("Never|10 s|30 s|60 s|5 min");
+            idleSuspend->tooltip("Stop the output device after this pause time. Playing restarts it.");
 
             end();
             set_modal();
@@ -30,6 +89,7 @@ class AudioSettings : public Fl_Window
         // Getters.
         Fl_Button* getSaveButton()const { return saveBtn; }
         Fl_Button* getCancelButton()const { return cancelBtn; }
+        Fl_Button* getDetectButton()const { return detectBtn; }
 };
 
 #endif
@@ -0,0 +1,384 @@
+#include <cstdio>
+#include "channel_router.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// -3dB, as used by the ITU-R BS.775 downmixes.
+static constexpr float minus3dB = 0.70710678f;
+
+/*
+ * Mixes the frames with the channel counts known at compile time, so that the
+ * loops are fully unrolled.
+ * The output samples of a group of frames fill whole SSE vectors (eg: 2 stereo
+ * frames, 2 5.1 frames or 1 7.1 frame), each vector being the sum of the input
+ * channels times their coefficients. See configure() for the coefficient layout.
+ */
+template <ma_uint32 In, ma_uint32 Out>
+static void mixFrames(const float* pCoefficients, const float* pInput, float* pOutput, ma_uint32 frameCount)
+{
+    ma_uint32 frame = 0;
+
+#if defined(__SSE__)
+    constexpr ma_uint32 group = (Out % 4 == 0) ? 1 : (Out % 2 == 0) ? 2 : 4;
+    constexpr ma_uint32 vectors = group * Out / 4;
+
+    for (; frame + group <= frameCount; frame += group) {
+        const float* pFrames = pInput + frame * In;
+        float* pDest = pOutput + frame * Out;
+
+        for (ma_uint32 v = 0; v < vectors; v++) {
+            __m128 sum = _mm_setzero_ps();
+
+            for (ma_uint32 i = 0; i < In; i++) {
+                // Input sample of the frame each lane belongs to.
+                __m128 samples = _mm_setr_ps(pFrames[((v * 4) / Out) * In + i], pFrames[((v * 4 + 1) / Out) * In + i],
+                                             pFrames[((v * 4 + 2) / Out) * In + i], pFrames[((v * 4 + 3) / Out) * In + i]);
+                sum = _mm_add_ps(sum, _mm_mul_ps(samples, _mm_load_ps(pCoefficients + (v * In + i) * 4)));
+            }
+
+            _mm_storeu_ps(pDest + v * 4, sum);
+        }
+    }
+#endif
+
+    // Remaining frames (or no SSE). The lanes of the first frame of a group are the output channels.
+    for (; frame < frameCount; frame++) {
+        const float* pFrame = pInput + frame * In;
+
+        for (ma_uint32 o = 0; o < Out; o++) {
+            float sum = 0.0f;
+
+            for (ma_uint32 i = 0; i < In; i++) {
+                sum += pFrame[i] * pCoefficients[((o / 4) * In + i) * 4 + (o % 4)];
+            }
+
+            pOutput[frame * Out + o] = sum;
+        }
+    }
+}
+
+template <ma_uint32 In>
+static ChannelRouter::MixProc getKernel(ma_uint32 outChannels)
+{
+    switch (outChannels) {
+        case 1: return mixFrames<In, 1>;
+        case 2: return mixFrames<In, 2>;
+        case 6: return mixFrames<In, 6>;
+        case 8: return mixFrames<In, 8>;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Returns the kernel specialized for the given layouts (mono, stereo, 5.1, 7.1),
+ * nullptr if there is none.
+ */
+static ChannelRouter::MixProc getKernel(ma_uint32 inChannels, ma_uint32 outChannels)
+{
+    switch (inChannels) {
+        case 1: return getKernel<1>(outChannels);
+        case 2: return getKernel<2>(outChannels);
+        case 6: return getKernel<6>(outChannels);
+        case 8: return getKernel<8>(outChannels);
+    }
+
+    return nullptr;
+}
+
+const char* ChannelRouter::getLayoutName(ma_uint32 channels)
+{
+    switch (channels) {
+        case 1: return "Mono";
+        case 2: return "Stereo";
+        case 3: return "3.0";
+        case 4: return "Quad";
+        case 5: return "5.0";
+        case 6: return "5.1";
+        case 7: return "6.1";
+        case 8: return "7.1";
+    }
+
+    return "Unknown";
+}
+
+/*
+ * Returns the channel playing the given role in the default layout of the given
+ * channel count (WAV/FLAC order), -1 if there is none.
+ */
+int ChannelRouter::getRoleChannel(ma_uint32 channels, Role role)
+{
+    static const Role layouts[maxChannels][maxChannels] = {
+        {roleMono},
+        {roleLeft, roleRight},
+        {roleLeft, roleRight, roleCenter},
+        {roleLeft, roleRight, roleBackLeft, roleBackRight},
+        {roleLeft, roleRight, roleCenter, roleSurroundLeft, roleSurroundRight},
+        {roleLeft, roleRight, roleCenter, roleLfe, roleSurroundLeft, roleSurroundRight},
+        {roleLeft, roleRight, roleCenter, roleLfe, roleBackCenter, roleSurroundLeft, roleSurroundRight},
+        {roleLeft, roleRight, roleCenter, roleLfe, roleBackLeft, roleBackRight, roleSurroundLeft, roleSurroundRight},
+    };
+
+    if (channels == 0 || channels > maxChannels) {
+        return -1;
+    }
+
+    for (ma_uint32 c = 0; c < channels; c++) {
+        if (layouts[channels - 1][c] == role) {
+            return c;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Adds the given input channel to the output channel playing the role, or folds
+ * it into the closest speakers if the output layout doesn't have it.
+ */
+void ChannelRouter::route(Role role, ma_uint32 inputChannel, float gain)
+{
+    int channel = getRoleChannel(outputChannels, role);
+
+    if (channel >= 0) {
+        matrix[channel][inputChannel] += gain;
+        return;
+    }
+
+    bool hasFronts = getRoleChannel(outputChannels, roleLeft) >= 0;
+
+    switch (role) {
+        case roleMono:
+            if (getRoleChannel(outputChannels, roleCenter) >= 0) {
+                route(roleCenter, inputChannel, gain);
+            }
+            else {
+                route(roleLeft, inputChannel, gain);
+                route(roleRight, inputChannel, gain);
+            }
+            break;
+        case roleLeft:
+        case roleRight:
+            route(roleMono, inputChannel, gain * minus3dB);
+            break;
+        case roleCenter:
+            if (hasFronts) {
+                route(roleLeft, inputChannel, gain * minus3dB);
+                route(roleRight, inputChannel, gain * minus3dB);
+            }
+            else {
+                route(roleMono, inputChannel, gain);
+            }
+            break;
+        case roleLfe:
+            // Most speakers can't reproduce it, so it's dropped unless asked otherwise.
+            if (options.lfeGain > 0.0f) {
+                route(hasFronts ? roleLeft : roleMono, inputChannel, gain * options.lfeGain);
+
+                if (hasFronts) {
+                    route(roleRight, inputChannel, gain * options.lfeGain);
+                }
+            }
+            break;
+        case roleSurroundLeft:
+        case roleBackLeft:
+        case roleSurroundRight:
+        case roleBackRight: {
+            bool isLeft = (role == roleSurroundLeft || role == roleBackLeft);
+            // Side and back surrounds stand in for each other (at -3dB when both are
+            // folded into the same speaker), then fold into the fronts.
+            Role other = (role == roleSurroundLeft) ? roleBackLeft : (role == roleBackLeft) ? roleSurroundLeft
+                         : (role == roleSurroundRight) ? roleBackRight : roleSurroundRight;
+
+            if (getRoleChannel(outputChannels, other) >= 0) {
+                route(other, inputChannel, (getRoleChannel(inputChannels, other) >= 0) ? gain * minus3dB : gain);
+            }
+            else {
+                route(isLeft ? roleLeft : roleRight, inputChannel, gain * minus3dB);
+            }
+            break;
+        }
+        case roleBackCenter:
+            if (getRoleChannel(outputChannels, roleBackLeft) >= 0) {
+                route(roleBackLeft, inputChannel, gain * minus3dB);
+                route(roleBackRight, inputChannel, gain * minus3dB);
+            }
+            else {
+                route(roleSurroundLeft, inputChannel, gain * minus3dB);
+                route(roleSurroundRight, inputChannel, gain * minus3dB);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Builds the mixing matrix from the input and output layouts.
+ */
+void ChannelRouter::buildMatrix()
+{
+    memset(matrix, 0, sizeof(matrix));
+
+    for (ma_uint32 i = 0; i < inputChannels; i++) {
+        for (int role = 0; role < roleCount; role++) {
+            if (getRoleChannel(inputChannels, (Role)role) == (int)i) {
+                route((Role)role, i, 1.0f);
+                break;
+            }
+        }
+    }
+
+    // Spread the stereo fronts over the speakers the file doesn't feed.
+    if (options.upmix && inputChannels == 2) {
+        const struct { Role role; float left; float right; } spread[] = {
+            {roleCenter, 0.5f, 0.5f},
+            {roleSurroundLeft, minus3dB, 0.0f}, {roleSurroundRight, 0.0f, minus3dB},
+            {roleBackLeft, minus3dB, 0.0f}, {roleBackRight, 0.0f, minus3dB},
+            {roleBackCenter, 0.5f * minus3dB, 0.5f * minus3dB},
+        };
+
+        for (const auto& speaker : spread) {
+            int channel = getRoleChannel(outputChannels, speaker.role);
+
+            if (channel >= 0) {
+                matrix[channel][0] = speaker.left;
+                matrix[channel][1] = speaker.right;
+            }
+        }
+    }
+
+    if (!options.normalize) {
+        return;
+    }
+
+    // The loudest output channel must not exceed full scale.
+    float maxSum = 0.0f;
+
+    for (ma_uint32 o = 0; o < outputChannels; o++) {
+        float sum = 0.0f;
+
+        for (ma_uint32 i = 0; i < inputChannels; i++) {
+            sum += fabsf(matrix[o][i]);
+        }
+
+        maxSum = std::max(maxSum, sum);
+    }
+
+    if (maxSum > 1.0f) {
+        for (ma_uint32 o = 0; o < outputChannels; o++) {
+            for (ma_uint32 i = 0; i < inputChannels; i++) {
+                matrix[o][i] /= maxSum;
+            }
+        }
+    }
+}
+
+/*
+ * Sets the layouts up and selects the kernel.
+ * Note: Must not be called while process() may run.
+ */
+void ChannelRouter::configure(ma_uint32 inChannels, ma_uint32 outChannels, const Options& routingOptions)
+{
+    inputChannels = std::clamp(inChannels, (ma_uint32)1, maxChannels);
+    outputChannels = std::clamp(outChannels, (ma_uint32)1, maxChannels);
+    options = routingOptions;
+    buildMatrix();
+
+    passThrough = (inputChannels == outputChannels);
+
+    for (ma_uint32 o = 0; o < outputChannels && passThrough; o++) {
+        for (ma_uint32 i = 0; i < inputChannels; i++) {
+            if (matrix[o][i] != ((o == i) ? 1.0f : 0.0f)) {
+                passThrough = false;
+                break;
+            }
+        }
+    }
+
+    // Lay the coefficients out by group vector, then input channel, then lane.
+    // Lane k of a group vector v is output channel (v * 4 + k) % outputChannels.
+    ma_uint32 group = (outputChannels % 4 == 0) ? 1 : (outputChannels % 2 == 0) ? 2 : 4;
+    ma_uint32 vectors = group * outputChannels / 4;
+    memset(coefficients, 0, sizeof(coefficients));
+
+    for (ma_uint32 v = 0; v < vectors; v++) {
+        for (ma_uint32 i = 0; i < inputChannels; i++) {
+            for (ma_uint32 lane = 0; lane < 4; lane++) {
+                coefficients[(v * inputChannels + i) * 4 + lane] = matrix[(v * 4 + lane) % outputChannels][i];
+            }
+        }
+    }
+
+    mix = passThrough ? nullptr : getKernel(inputChannels, outputChannels);
+    specialized = passThrough || mix != nullptr;
+
+    // Describe the routing for the file info.
+    description = getLayoutName(inputChannels);
+
+    if (passThrough) {
+        description += " (direct)";
+        return;
+    }
+
+    description = description + " -> " + getLayoutName(outputChannels) + " (";
+
+    if (inputChannels > outputChannels) {
+        description += "ITU downmix";
+    }
+    else if (inputChannels == 2 && options.upmix) {
+        description += "upmix";
+    }
+    else {
+        description += "direct";
+    }
+
+    if (getRoleChannel(inputChannels, roleLfe) >= 0 && getRoleChannel(outputChannels, roleLfe) < 0) {
+        char lfe[32] = ", LFE dropped";
+
+        if (options.lfeGain > 0.0f) {
+            snprintf(lfe, sizeof(lfe), ", LFE at %.0f dB", 20.0f * log10f(options.lfeGain));
+        }
+
+        description += lfe;
+    }
+
+    description += specialized ? ")" : ", generic)";
+}
+
+/*
+ * Routes frameCount frames from the input to the output buffer, which must not overlap
+ * unless the routing is a pass-through.
+ * Note: This function is called from the device thread.
+ */
+void ChannelRouter::process(const float* pInput, float* pOutput, ma_uint32 frameCount)
+{
+    if (passThrough) {
+        if (pInput != pOutput) {
+            memcpy(pOutput, pInput, (size_t)frameCount * outputChannels * sizeof(float));
+        }
+
+        return;
+    }
+
+    if (mix) {
+        mix(coefficients, pInput, pOutput, frameCount);
+        return;
+    }
+
+    // Less common layouts.
+    for (ma_uint32 frame = 0; frame < frameCount; frame++) {
+        const float* pFrame = pInput + frame * inputChannels;
+
+        for (ma_uint32 o = 0; o < outputChannels; o++) {
+            float sum = 0.0f;
+
+            for (ma_uint32 i = 0; i < inputChannels; i++) {
+                sum += pFrame[i] * matrix[o][i];
+            }
+
+            pOutput[frame * outputChannels + o] = sum;
+        }
+    }
+}
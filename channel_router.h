@@ -0,0 +1,70 @@
+#ifndef CHANNEL_ROUTER_H
+#define CHANNEL_ROUTER_H
+
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The ChannelRouter class maps the file channels onto the device channels through
+ * a mixing matrix built from the channel layouts of both sides.
+ * Downmixes follow the ITU-R BS.775 coefficients (center and surrounds at -3dB),
+ * the LFE is either dropped or folded into the fronts at a given gain, and stereo
+ * can optionally be spread over the center and surround speakers.
+ * The common layout pairs are routed by kernels specialized at compile time,
+ * the others by a generic loop. Frames are interleaved 32 bit floats.
+ */
+class ChannelRouter {
+    public:
+        static constexpr ma_uint32 maxChannels = 8;
+
+        struct Options {
+            // Spreads the stereo fronts over the center and the surrounds.
+            bool upmix = false;
+            // Level of the LFE folded into the fronts when the output has no LFE (0 = dropped).
+            float lfeGain = 0.0f;
+            // Scales the matrix down so that a downmix can't clip.
+            bool normalize = true;
+        };
+
+        // Function mixing frameCount interleaved frames with the given coefficients.
+        typedef void (*MixProc)(const float* pCoefficients, const float* pInput, float* pOutput, ma_uint32 frameCount);
+
+    private:
+        // Speaker roles. The mono channel is handled on its own.
+        enum Role { roleMono, roleLeft, roleRight, roleCenter, roleLfe, roleSurroundLeft, roleSurroundRight,
+                    roleBackLeft, roleBackRight, roleBackCenter, roleCount };
+        ma_uint32 inputChannels = 2;
+        ma_uint32 outputChannels = 2;
+        Options options;
+        // Matrix rows are the output channels, columns the input channels.
+        float matrix[maxChannels][maxChannels];
+        // Coefficients laid out the way the selected kernel reads them.
+        alignas(16) float coefficients[maxChannels * maxChannels * 4];
+        MixProc mix = nullptr;
+        bool passThrough = true;
+        bool specialized = true;
+        std::string description;
+        static int getRoleChannel(ma_uint32 channels, Role role);
+        void buildMatrix();
+        void route(Role role, ma_uint32 inputChannel, float gain);
+
+    public:
+        ChannelRouter() { configure(2, 2, Options()); }
+
+        void configure(ma_uint32 inChannels, ma_uint32 outChannels, const Options& routingOptions);
+        void process(const float* pInput, float* pOutput, ma_uint32 frameCount);
+
+        // Getters.
+        ma_uint32 getInputChannels() { return inputChannels; }
+        ma_uint32 getOutputChannels() { return outputChannels; }
+        bool isPassThrough() { return passThrough; }
+        bool isSpecialized() { return specialized; }
+        float getCoefficient(ma_uint32 outChannel, ma_uint32 inChannel) { return matrix[outChannel][inChannel]; }
+        std::string getDescription() { return description; }
+        static const char* getLayoutName(ma_uint32 channels);
+};
+
+#endif // CHANNEL_ROUTER_H
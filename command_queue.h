@@ -0,0 +1,96 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The CommandQueue class is a bounded lock-free multi-producer single-consumer queue.
+ * Any thread can push, while a single thread (eg: the audio callback) pops.
+ * Each cell holds a sequence number telling whether it's free for the producers
+ * or filled for the consumer, so neither side ever blocks nor allocates.
+ */
+template <typename T, size_t Capacity>
+class CommandQueue {
+    static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two.");
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        Cell cells[Capacity];
+        // Next position to fill, shared by the producers.
+        alignas(64) std::atomic<size_t> tail = 0;
+        // Next position to read, owned by the consumer.
+        alignas(64) size_t head = 0;
+
+    public:
+        CommandQueue()
+        {
+            for (size_t i = 0; i < Capacity; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        /*
+         * Adds an item to the queue. Returns false if the queue is full.
+         */
+        bool push(const T& data)
+        {
+            size_t position = tail.load(std::memory_order_relaxed);
+            Cell* pCell;
+
+            for (;;) {
+                pCell = &cells[position & (Capacity - 1)];
+                size_t sequence = pCell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+                // The cell is free, try to claim it.
+                if (difference == 0) {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                // The consumer hasn't read that cell yet.
+                else if (difference < 0) {
+                    return false;
+                }
+                // Another producer claimed the cell.
+                else {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            pCell->data = data;
+            // Hand the cell over to the consumer.
+            pCell->sequence.store(position + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        /*
+         * Takes the oldest item. Returns false if the queue is empty.
+         * Note: Must always be called from the same thread.
+         */
+        bool pop(T& data)
+        {
+            Cell* pCell = &cells[head & (Capacity - 1)];
+            size_t sequence = pCell->sequence.load(std::memory_order_acquire);
+
+            if ((intptr_t)sequence - (intptr_t)(head + 1) < 0) {
+                return false;
+            }
+
+            data = pCell->data;
+            // Hand the cell back to the producers for the next round.
+            pCell->sequence.store(head + Capacity, std::memory_order_release);
+            head++;
+
+            return true;
+        }
+};
+
+#endif // COMMAND_QUEUE_H
@@ -0,0 +1,133 @@
+#ifndef CONTROL_PROBE_H
+#define CONTROL_PROBE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The ControlProbe class watches the blocks output by the audio callback, so that
+ * the time from a control (play, pause, seek, load) to its audible result can be
+ * measured (see --stress-control).
+ * The controlling thread arms an expectation, then the callback timestamps the
+ * first block meeting it. The callback also flags the positions going backward
+ * while no seek is expected (ie: a stale cursor).
+ */
+class ControlProbe {
+    public:
+        enum Expectation { expectNone, expectAudible, expectSilent, expectPosition };
+
+    private:
+        std::atomic<int> expectation = expectNone;
+        std::atomic<ma_uint64> targetFrames = 0;
+        std::atomic<ma_uint64> toleranceFrames = 0;
+        std::atomic<ma_int64> hitTime = 0;
+        std::atomic<ma_uint64> hitPosition = 0;
+        // Set while a seek may move the position backward.
+        std::atomic<bool> seeking = false;
+        // Callback only.
+        ma_uint64 lastPosition = 0;
+        bool lastRendering = false;
+        std::atomic<ma_uint64> blocks = 0;
+        std::atomic<ma_uint64> backwardJumps = 0;
+
+    public:
+        /*
+         * Returns the time in the probe's time base.
+         */
+        static ma_int64 now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /*
+         * Arms an expectation and returns the time it's armed at. The position is
+         * only used by expectPosition.
+         */
+        ma_int64 arm(Expectation type, ma_uint64 position = 0, ma_uint64 tolerance = 0)
+        {
+            hitTime.store(0, std::memory_order_relaxed);
+            targetFrames.store(position, std::memory_order_relaxed);
+            toleranceFrames.store(tolerance, std::memory_order_relaxed);
+            seeking.store(type == expectPosition, std::memory_order_relaxed);
+            expectation.store(type, std::memory_order_release);
+
+            return now();
+        }
+
+        /*
+         * Waits for the armed expectation to be met. Returns the time it was met at,
+         * or zero on timeout.
+         */
+        ma_int64 wait(double timeoutSeconds)
+        {
+            ma_int64 deadline = now() + (ma_int64)(timeoutSeconds * 1e9);
+
+            while (now() < deadline) {
+                ma_int64 time = hitTime.load(std::memory_order_acquire);
+
+                if (time != 0) {
+                    return time;
+                }
+
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+
+            expectation.store(expectNone, std::memory_order_relaxed);
+
+            return 0;
+        }
+
+        /*
+         * Called from the audio callback with the block output (volume applied).
+         */
+        void observe(const float* pSamples, size_t sampleCount, ma_uint64 position, bool isRendering)
+        {
+            blocks.fetch_add(1, std::memory_order_relaxed);
+
+            if (isRendering && lastRendering && position < lastPosition && !seeking.load(std::memory_order_relaxed)) {
+                backwardJumps.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            lastPosition = position;
+            lastRendering = isRendering;
+            int type = expectation.load(std::memory_order_acquire);
+
+            if (type == expectNone) {
+                return;
+            }
+
+            bool met = false;
+
+            if (type == expectPosition) {
+                ma_uint64 target = targetFrames.load(std::memory_order_relaxed);
+                met = position >= target && position <= target + toleranceFrames.load(std::memory_order_relaxed);
+            }
+            else {
+                float peak = 0.0f;
+
+                for (size_t i = 0; i < sampleCount; i++) {
+                    peak = std::max(peak, std::fabs(pSamples[i]));
+                }
+
+                // About -80 dBFS.
+                met = (type == expectAudible) ? (isRendering && peak > 1e-4f) : !isRendering;
+            }
+
+            if (met) {
+                hitPosition.store(position, std::memory_order_relaxed);
+                hitTime.store(now(), std::memory_order_release);
+                expectation.store(expectNone, std::memory_order_relaxed);
+                seeking.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        ma_uint64 getHitPosition() { return hitPosition.load(std::memory_order_relaxed); }
+        ma_uint64 getBlocks() { return blocks.load(std::memory_order_relaxed); }
+        ma_uint64 getBackwardJumps() { return backwardJumps.load(std::memory_order_relaxed); }
+};
+
+#endif // CONTROL_PROBE_H
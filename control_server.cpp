@@ -0,0 +1,381 @@
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "control_server.h"
+
+/*
+ * Fills a socket address with the given path. Returns false if the path is too long.
+ */
+static bool setSocketAddress(const std::string& path, struct sockaddr_un& address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    return true;
+}
+
+/*
+ * Connects to the socket of a running instance. Returns -1 if there's none.
+ */
+static int connectSocket(const std::string& path)
+{
+    struct sockaddr_un address;
+
+    if (!setSocketAddress(path, address)) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Writes the whole string. Returns false if the peer went away.
+ */
+static bool sendAll(int fd, const std::string& data)
+{
+    size_t sent = 0;
+
+    while (sent < data.size()) {
+        ssize_t result = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        sent += result;
+    }
+
+    return true;
+}
+
+/*
+ * Don't let a silent client block the server forever.
+ */
+static void setReceiveTimeout(int fd, int seconds)
+{
+    struct timeval timeout = {.tv_sec = seconds, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+ * Constructor: The given handler is called on the GUI thread whenever commands are pending.
+ */
+ControlServer::ControlServer(Fl_Awake_Handler handler, void* data) : handler(handler), pHandlerData(data) {
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+/*
+ * Returns the socket path, private to the current user.
+ */
+std::string ControlServer::getSocketPath()
+{
+    const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+
+    if (runtimeDir && runtimeDir[0] != '\0') {
+        return std::string(runtimeDir) + "/audioplayer.sock";
+    }
+
+    return "/tmp/audioplayer-" + std::to_string(getuid()) + ".sock";
+}
+
+/*
+ * Starts listening. Returns false if another instance is already serving
+ * (or the socket can't be created).
+ */
+bool ControlServer::start()
+{
+    if (running.load()) {
+        return true;
+    }
+
+    socketPath = getSocketPath();
+    struct sockaddr_un address;
+
+    if (!setSocketAddress(socketPath, address)) {
+        std::cerr << "Control socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+
+    // Check first whether the socket is alive or left over by a crashed instance.
+    int fd = connectSocket(socketPath);
+
+    if (fd >= 0) {
+        close(fd);
+        std::cerr << "Another instance is already listening on " << socketPath << std::endl;
+        return false;
+    }
+
+    unlink(socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listenFd < 0) {
+        std::cerr << "Failed to create the control socket." << std::endl;
+        return false;
+    }
+
+    if (bind(listenFd, (struct sockaddr*)&address, sizeof(address)) < 0 || ::listen(listenFd, 8) < 0) {
+        std::cerr << "Failed to bind the control socket: " << strerror(errno) << std::endl;
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    // Only the current user may drive the player.
+    chmod(socketPath.c_str(), S_IRUSR | S_IWUSR);
+
+    running.store(true);
+    listener = std::thread(&ControlServer::listen, this);
+
+    return true;
+}
+
+/*
+ * Stops listening and removes the socket file.
+ */
+void ControlServer::stop()
+{
+    running.store(false);
+
+    if (listener.joinable()) {
+        listener.join();
+    }
+
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+        unlink(socketPath.c_str());
+    }
+}
+
+/*
+ * Accepts the clients one at a time.
+ * Note: This function is run in a thread for as long as the server is running.
+ */
+void ControlServer::listen()
+{
+    struct pollfd pfd = {.fd = listenFd, .events = POLLIN, .revents = 0};
+
+    while (running.load()) {
+        // Wake up regularly to check the running flag.
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+
+        int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        setReceiveTimeout(fd, 5);
+        serve(fd);
+        close(fd);
+    }
+}
+
+/*
+ * Reads the commands of a client. The complete lines received at once make a batch,
+ * the replies are sent back once the GUI thread has applied it.
+ */
+void ControlServer::serve(int fd)
+{
+    std::string buffer;
+    char chunk[4096];
+
+    while (running.load()) {
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // Error or timeout.
+        if (received < 0) {
+            return;
+        }
+
+        bool endOfStream = (received == 0);
+        buffer.append(chunk, received);
+
+        // A last command may not be terminated by a newline.
+        if (endOfStream && !buffer.empty() && buffer.back() != '\n') {
+            buffer += '\n';
+        }
+
+        Batch batch;
+        size_t end;
+
+        while ((end = buffer.find('\n')) != std::string::npos) {
+            std::string line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+
+            if (line.empty()) {
+                continue;
+            }
+
+            auto command = std::make_shared<Command>();
+            size_t space = line.find(' ');
+            command->name = line.substr(0, space);
+
+            if (space != std::string::npos) {
+                command->argument = line.substr(space + 1);
+            }
+
+            batch.push_back(command);
+        }
+
+        if (!batch.empty()) {
+            submit(batch);
+            std::string replies;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (auto& command : batch) {
+                    replies += (command->done ? command->reply : (command->taken ? "accepted" : "error: timeout")) + "\n";
+                }
+            }
+
+            if (!sendAll(fd, replies)) {
+                return;
+            }
+        }
+
+        if (endOfStream) {
+            return;
+        }
+    }
+}
+
+/*
+ * Hands a batch over to the GUI thread and waits for the replies. On timeout, the
+ * commands not taken by the GUI thread yet are withdrawn, so they're never applied.
+ */
+void ControlServer::submit(Batch& batch)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    bool wasEmpty = pending.empty();
+    pending.insert(pending.end(), batch.begin(), batch.end());
+    lock.unlock();
+
+    // A single wake up per batch, the GUI thread takes all of the pending commands at once.
+    if (wasEmpty) {
+        Fl::awake(handler, pHandlerData);
+    }
+
+    lock.lock();
+    bool done = replied.wait_for(lock, std::chrono::milliseconds(replyTimeout), [&batch] {
+        for (auto& command : batch) {
+            if (!command->done) {
+                return false;
+            }
+        }
+
+        return true;
+    });
+
+    if (!done) {
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [&batch](const std::shared_ptr<Command>& command) {
+            return std::find(batch.begin(), batch.end(), command) != batch.end();
+        }), pending.end());
+    }
+}
+
+/*
+ * Returns the pending commands. Called from the GUI thread.
+ */
+ControlServer::Batch ControlServer::takeCommands()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Batch batch;
+    batch.swap(pending);
+
+    for (auto& command : batch) {
+        command->taken = true;
+    }
+
+    return batch;
+}
+
+/*
+ * Marks the given commands as applied, their replies are set. Called from the GUI thread.
+ */
+void ControlServer::complete(Batch& batch)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& command : batch) {
+            command->done = true;
+        }
+    }
+
+    replied.notify_all();
+}
+
+/*
+ * Sends commands to the running instance. Returns false if there's none.
+ */
+bool ControlServer::send(const std::string& commands, std::string& reply)
+{
+    int fd = connectSocket(getSocketPath());
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (!sendAll(fd, commands)) {
+        close(fd);
+        return false;
+    }
+
+    // Tells the server all of the commands are sent.
+    shutdown(fd, SHUT_WR);
+    setReceiveTimeout(fd, 5);
+
+    char chunk[4096];
+    ssize_t received;
+
+    while ((received = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        reply.append(chunk, received);
+    }
+
+    close(fd);
+
+    return true;
+}
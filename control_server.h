@@ -0,0 +1,77 @@
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <FL/Fl.H>
+
+/*
+ * The ControlServer class lets local scripts drive a running instance through a
+ * Unix domain socket. The protocol is line based, one command per line:
+ *
+ *   load PATH      Loads and plays the given file.
+ *   play | pause | toggle
+ *   seek SECONDS
+ *   volume VALUE   From 0 to 1.
+ *   status         Replies the playback state.
+ *   preview PATH   Plays the given file on the preview output.
+ *   preview-seek SECONDS
+ *   preview-stop
+ *
+ * Each command gets a one line reply ("ok", "error: ..." or the status).
+ * The lines received at once are handed to the GUI thread as a single batch
+ * through Fl::awake, as the widgets and the Audio object belong to that thread.
+ * If the GUI thread doesn't reply in time, the commands it hasn't taken yet are
+ * withdrawn ("error: timeout"), the ones it's applying are replied "accepted".
+ */
+class ControlServer {
+    public:
+        // Structure that holds a command and its reply.
+        struct Command {
+            std::string name;
+            std::string argument;
+            std::string reply;
+            // Set once the GUI thread has taken the command.
+            bool taken = false;
+            bool done = false;
+        };
+
+        typedef std::vector<std::shared_ptr<Command>> Batch;
+
+    private:
+        Fl_Awake_Handler handler;
+        void* pHandlerData;
+        std::string socketPath;
+        int listenFd = -1;
+        std::thread listener;
+        std::atomic<bool> running = false;
+        std::mutex mutex;
+        std::condition_variable replied;
+        // Commands waiting for the GUI thread.
+        Batch pending;
+        // Time given to the GUI thread to reply (in milliseconds).
+        static constexpr int replyTimeout = 2000;
+        void listen();
+        void serve(int fd);
+        void submit(Batch& batch);
+
+    public:
+        ControlServer(Fl_Awake_Handler handler, void* data);
+        ~ControlServer();
+
+        bool start();
+        void stop();
+        Batch takeCommands();
+        void complete(Batch& batch);
+
+        static std::string getSocketPath();
+        static bool send(const std::string& commands, std::string& reply);
+};
+
+#endif // CONTROL_SERVER_H
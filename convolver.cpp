@@ -0,0 +1,491 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "convolver.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Constructor: Nothing is allocated until an impulse response is loaded, the frames
+ * are left as is meanwhile.
+ */
+Convolver::Convolver(ma_uint32 channels, ma_uint32 sampleRate)
+    : channels(channels), sampleRate(sampleRate), fft(partitionFrames * 2) {
+}
+
+/*
+ * Destructor: The audio callback must be stopped.
+ */
+Convolver::~Convolver() {
+    delete pCurrent;
+    delete pNext;
+    delete pending.load();
+    delete retired[0].load();
+    delete retired[1].load();
+}
+
+/*
+ * Allocates the buffers for the current channel count and clears the delay line.
+ * Note: The audio callback must not be processing meanwhile.
+ */
+void Convolver::allocate()
+{
+    inputWindows.assign((size_t)channels * partitionFrames * 2, 0.0f);
+    delayLines.assign((size_t)channels * maxPartitions * binStride * 2, 0.0f);
+    sums.assign((size_t)channels * binStride * 2, 0.0f);
+    nextSums.assign((size_t)channels * binStride * 2, 0.0f);
+    outputs.assign((size_t)channels * partitionFrames, 0.0f);
+    timeBlock.assign(partitionFrames * 2, 0.0f);
+    blockFill = 0;
+    head = 0;
+    summed = 1;
+    nextSummed = 1;
+    engagedFrames = 0;
+}
+
+/*
+ * Sets the channel count of the frames to process (eg: on a new file).
+ * Note: The audio callback must be stopped.
+ */
+void Convolver::setChannels(ma_uint32 count)
+{
+    if (count == channels) {
+        return;
+    }
+
+    channels = count;
+
+    if (isEngaged()) {
+        allocate();
+    }
+}
+
+/*
+ * Hands the given filter over to the audio callback. The filter replaced previously
+ * is freed here rather than in the callback.
+ */
+void Convolver::publish(Filter* pFilter)
+{
+    delete retired[0].exchange(nullptr, std::memory_order_acquire);
+    delete retired[1].exchange(nullptr, std::memory_order_acquire);
+    // The callback hasn't taken the previous one yet.
+    delete pending.exchange(pFilter, std::memory_order_acq_rel);
+
+    if (!isEngaged()) {
+        allocate();
+        engaged.store(true, std::memory_order_release);
+    }
+}
+
+/*
+ * Computes the partition spectra of the given interleaved taps.
+ */
+Convolver::Filter* Convolver::createFilter(const std::vector<float>& taps, ma_uint32 tapChannels, ma_uint64 tapCount)
+{
+    Filter* pFilter = new Filter();
+    pFilter->channels = tapChannels;
+    pFilter->partitionCount = (ma_uint32)((tapCount + partitionFrames - 1) / partitionFrames);
+    pFilter->spectra.assign((size_t)tapChannels * pFilter->partitionCount * binStride * 2, 0.0f);
+    // The callback uses the member one.
+    Fft filterFft(partitionFrames * 2);
+    std::vector<float> block(partitionFrames * 2);
+    // The inverse transform is scaled by its size.
+    const float scale = 1.0f / partitionFrames;
+
+    for (ma_uint32 c = 0; c < tapChannels; c++) {
+        for (ma_uint32 p = 0; p < pFilter->partitionCount; p++) {
+            // The second half stays zero (overlap-save).
+            std::fill(block.begin(), block.end(), 0.0f);
+            ma_uint64 first = (ma_uint64)p * partitionFrames;
+            ma_uint64 count = std::min((ma_uint64)partitionFrames, tapCount - first);
+
+            for (ma_uint64 i = 0; i < count; i++) {
+                block[i] = taps[(first + i) * tapChannels + c];
+            }
+
+            float* pSpectrum = (float*)pFilter->getSpectrum(c, p);
+            filterFft.forward(block.data(), pSpectrum, pSpectrum + binStride);
+
+            for (ma_uint32 k = 0; k < binStride * 2; k++) {
+                pSpectrum[k] *= scale;
+            }
+        }
+    }
+
+    return pFilter;
+}
+
+/*
+ * Loads the given impulse response (eg: a WAV file), resampled to the playback
+ * sample rate. Its channels are applied to the device channels of the same rank
+ * (eg: front left, front right...), a mono impulse response to all of them.
+ */
+bool Convolver::load(const std::string& fileName)
+{
+    ma_decoder decoder;
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, sampleRate);
+
+    if (ma_decoder_init_file(fileName.c_str(), &config, &decoder) != MA_SUCCESS) {
+        std::cerr << "Failed to open the impulse response: " << fileName << std::endl;
+        return false;
+    }
+
+    ma_uint32 fileChannels = decoder.outputChannels;
+    // One more tap to tell whether the file is too long.
+    std::vector<float> frames(((size_t)maxTaps + 1) * fileChannels);
+    ma_uint64 tapCount = 0;
+    ma_decoder_read_pcm_frames(&decoder, frames.data(), maxTaps + 1, &tapCount);
+    ma_decoder_uninit(&decoder);
+
+    if (tapCount == 0) {
+        std::cerr << "Empty impulse response: " << fileName << std::endl;
+        return false;
+    }
+
+    if (tapCount > maxTaps) {
+        std::cerr << "Impulse response truncated to " << maxTaps << " taps: " << fileName << std::endl;
+        tapCount = maxTaps;
+    }
+
+    Filter* pFilter = createFilter(frames, fileChannels, tapCount);
+    publish(pFilter);
+    this->fileName = fileName;
+    printf("Impulse response: '%s', %u channel(s), %llu taps (%.2f s), %u partitions\n", fileName.c_str(), fileChannels,
+           (unsigned long long)tapCount, (double)tapCount / sampleRate, pFilter->partitionCount);
+
+    return true;
+}
+
+/*
+ * Replaces the impulse response with a unit impulse. The frames keep going through
+ * the convolver (ie: with its latency), so that the change is crossfaded as well.
+ */
+void Convolver::clear()
+{
+    if (!isEngaged()) {
+        return;
+    }
+
+    publish(createFilter(std::vector<float>(1, 1.0f), 1, 1));
+    fileName.clear();
+}
+
+/*
+ * Multiplies the spectra A and B (real parts then imaginary parts, count bins each)
+ * and adds the product to the sum.
+ */
+void Convolver::multiplyAccumulate(const float* pA, const float* pB, float* pSum, ma_uint32 count)
+{
+    const float* pARe = pA;
+    const float* pAIm = pA + count;
+    const float* pBRe = pB;
+    const float* pBIm = pB + count;
+    float* pSumRe = pSum;
+    float* pSumIm = pSum + count;
+    ma_uint32 k = 0;
+
+#if defined(__AVX__)
+    for (; k + 8 <= count; k += 8) {
+        __m256 aRe = _mm256_loadu_ps(pARe + k);
+        __m256 aIm = _mm256_loadu_ps(pAIm + k);
+        __m256 bRe = _mm256_loadu_ps(pBRe + k);
+        __m256 bIm = _mm256_loadu_ps(pBIm + k);
+        __m256 re = _mm256_sub_ps(_mm256_mul_ps(aRe, bRe), _mm256_mul_ps(aIm, bIm));
+        __m256 im = _mm256_add_ps(_mm256_mul_ps(aRe, bIm), _mm256_mul_ps(aIm, bRe));
+        _mm256_storeu_ps(pSumRe + k, _mm256_add_ps(_mm256_loadu_ps(pSumRe + k), re));
+        _mm256_storeu_ps(pSumIm + k, _mm256_add_ps(_mm256_loadu_ps(pSumIm + k), im));
+    }
+#elif defined(__SSE__)
+    for (; k + 4 <= count; k += 4) {
+        __m128 aRe = _mm_loadu_ps(pARe + k);
+        __m128 aIm = _mm_loadu_ps(pAIm + k);
+        __m128 bRe = _mm_loadu_ps(pBRe + k);
+        __m128 bIm = _mm_loadu_ps(pBIm + k);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(aRe, bRe), _mm_mul_ps(aIm, bIm));
+        __m128 im = _mm_add_ps(_mm_mul_ps(aRe, bIm), _mm_mul_ps(aIm, bRe));
+        _mm_storeu_ps(pSumRe + k, _mm_add_ps(_mm_loadu_ps(pSumRe + k), re));
+        _mm_storeu_ps(pSumIm + k, _mm_add_ps(_mm_loadu_ps(pSumIm + k), im));
+    }
+#endif
+
+    for (; k < count; k++) {
+        pSumRe[k] += pARe[k] * pBRe[k] - pAIm[k] * pBIm[k];
+        pSumIm[k] += pARe[k] * pBIm[k] + pAIm[k] * pBRe[k];
+    }
+}
+
+/*
+ * Adds the products of the partitions from next up to end (excluded) to the sums,
+ * ie: the spectra of the blocks received that many blocks before the current one.
+ */
+void Convolver::sumPartitions(const Filter* pFilter, float* pSums, ma_uint32& next, ma_uint32 end)
+{
+    end = std::min(end, pFilter->partitionCount);
+
+    for (; next < end; next++) {
+        ma_uint32 slot = (head + maxPartitions - next) % maxPartitions;
+
+        for (ma_uint32 c = 0; c < channels; c++) {
+            multiplyAccumulate(delayLines.data() + ((size_t)c * maxPartitions + slot) * binStride * 2,
+                               pFilter->getSpectrum(c % pFilter->channels, next), pSums + (size_t)c * binStride * 2, binStride);
+        }
+    }
+}
+
+/*
+ * Takes a new filter over, if any, as a block starts.
+ */
+void Convolver::startBlock()
+{
+    // Room is needed to retire the filter replaced. Only if filters are published
+    // faster than the crossfades, as each publication frees the retired ones.
+    if (pNext != nullptr || (pCurrent != nullptr && retired[0].load(std::memory_order_acquire) != nullptr
+                             && retired[1].load(std::memory_order_acquire) != nullptr)) {
+        return;
+    }
+
+    Filter* pFilter = pending.exchange(nullptr, std::memory_order_acq_rel);
+
+    if (pFilter == nullptr) {
+        return;
+    }
+
+    // The first one is faded in from the dry frames (see process()).
+    if (pCurrent == nullptr) {
+        pCurrent = pFilter;
+    }
+    else {
+        pNext = pFilter;
+        nextSummed = 1;
+    }
+}
+
+/*
+ * Transforms the block just received and computes the output block.
+ */
+void Convolver::finishBlock()
+{
+    Tracer::Scope trace("Convolve block");
+    ma_uint32 windowFrames = partitionFrames * 2;
+
+    // The overlap-save window: The previous block then the current one.
+    for (ma_uint32 c = 0; c < channels; c++) {
+        float* pWindow = inputWindows.data() + (size_t)c * windowFrames;
+        float* pSpectrum = delayLines.data() + ((size_t)c * maxPartitions + head) * binStride * 2;
+        fft.forward(pWindow, pSpectrum, pSpectrum + binStride);
+        memcpy(pWindow, pWindow + partitionFrames, partitionFrames * sizeof(float));
+    }
+
+    for (Filter* pFilter : {pCurrent, pNext}) {
+        if (pFilter == nullptr) {
+            continue;
+        }
+
+        bool fadingIn = (pFilter == pNext);
+        float* pSums = fadingIn ? nextSums.data() : sums.data();
+        ma_uint32& next = fadingIn ? nextSummed : summed;
+        // The older partitions left, then the current block.
+        sumPartitions(pFilter, pSums, next, pFilter->partitionCount);
+        ma_uint32 first = 0;
+        sumPartitions(pFilter, pSums, first, 1);
+
+        for (ma_uint32 c = 0; c < channels; c++) {
+            float* pChannelSums = pSums + (size_t)c * binStride * 2;
+            float* pOutput = outputs.data() + (size_t)c * partitionFrames;
+            fft.inverse(pChannelSums, pChannelSums + binStride, timeBlock.data());
+            // The first half is wrapped around.
+            const float* pValid = timeBlock.data() + partitionFrames;
+
+            if (!fadingIn) {
+                memcpy(pOutput, pValid, partitionFrames * sizeof(float));
+            }
+            else {
+                for (ma_uint32 i = 0; i < partitionFrames; i++) {
+                    float gain = (i + 0.5f) / partitionFrames;
+                    pOutput[i] += (pValid[i] - pOutput[i]) * gain;
+                }
+            }
+
+            memset(pChannelSums, 0, binStride * 2 * sizeof(float));
+        }
+    }
+
+    if (pNext != nullptr) {
+        int slot = (retired[0].load(std::memory_order_acquire) == nullptr) ? 0 : 1;
+        retired[slot].store(pCurrent, std::memory_order_release);
+        pCurrent = pNext;
+        pNext = nullptr;
+    }
+
+    summed = 1;
+    head = (head + 1) % maxPartitions;
+}
+
+/*
+ * Convolves the given interleaved frames in place, delayed by partitionFrames.
+ * Note: Called from the audio callback, nothing is allocated here.
+ */
+void Convolver::process(float* pFrames, ma_uint32 frameCount)
+{
+    if (!engaged.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    ma_uint32 windowFrames = partitionFrames * 2;
+    ma_uint32 done = 0;
+
+    while (done < frameCount) {
+        if (blockFill == 0) {
+            startBlock();
+        }
+
+        ma_uint32 count = std::min(frameCount - done, partitionFrames - blockFill);
+
+        for (ma_uint32 c = 0; c < channels; c++) {
+            float* pWindow = inputWindows.data() + (size_t)c * windowFrames + partitionFrames + blockFill;
+            const float* pOutput = outputs.data() + (size_t)c * partitionFrames + blockFill;
+            float* pSample = pFrames + (size_t)done * channels + c;
+
+            for (ma_uint32 i = 0; i < count; i++, pSample += channels) {
+                pWindow[i] = *pSample;
+
+                // Once engaged, the dry frames are output for a block (the output is
+                // empty), then crossfaded with the convolved ones for another block.
+                if (engagedFrames + i < windowFrames) {
+                    float gain = std::max(0.0f, ((float)(engagedFrames + i) - partitionFrames + 0.5f) / partitionFrames);
+                    *pSample += (pOutput[i] - *pSample) * gain;
+                }
+                else {
+                    *pSample = pOutput[i];
+                }
+            }
+        }
+
+        engagedFrames = std::min(engagedFrames + count, windowFrames);
+        blockFill += count;
+        done += count;
+
+        // Spread the products of the older blocks over the block.
+        if (pCurrent != nullptr) {
+            sumPartitions(pCurrent, sums.data(), summed, 1 + (pCurrent->partitionCount - 1) * blockFill / partitionFrames);
+        }
+
+        if (pNext != nullptr) {
+            sumPartitions(pNext, nextSums.data(), nextSummed, 1 + (pNext->partitionCount - 1) * blockFill / partitionFrames);
+        }
+
+        if (blockFill == partitionFrames) {
+            finishBlock();
+            blockFill = 0;
+        }
+    }
+}
+
+/*
+ * Checks the convolution against a direct one, then measures the CPU load per
+ * channel for several impulse response lengths, at a small and a large period.
+ * Usage: Player --bench-convolver [PERIOD]
+ */
+int Convolver::benchmark(const std::vector<std::string>& arguments)
+{
+    ma_uint32 smallPeriod = arguments.empty() ? 64 : (ma_uint32)std::max(1, std::atoi(arguments[0].c_str()));
+    const ma_uint32 rate = 44100;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    int status = 0;
+
+    // Decaying noise, like a room response.
+    auto createTaps = [&](ma_uint32 count) {
+        std::vector<float> taps(count);
+
+        for (ma_uint32 i = 0; i < count; i++) {
+            taps[i] = noise(random) * expf(-6.9f * i / count) * 0.05f;
+        }
+
+        return taps;
+    };
+
+    {
+        const ma_uint32 tapCount = 3000;
+        const ma_uint32 frameCount = 20000;
+        std::vector<float> taps = createTaps(tapCount);
+        std::vector<float> input(frameCount);
+
+        for (float& sample : input) {
+            sample = noise(random);
+        }
+
+        Convolver convolver(1, rate);
+        convolver.publish(convolver.createFilter(taps, 1, tapCount));
+        std::vector<float> output = input;
+
+        // Odd periods, so that the blocks straddle them.
+        for (ma_uint32 done = 0; done < frameCount;) {
+            ma_uint32 count = std::min(frameCount - done, 37 + done % 101);
+            convolver.process(output.data() + done, count);
+            done += count;
+        }
+
+        double maxError = 0.0;
+
+        // Past the fade in, the output is the direct convolution delayed by a partition.
+        for (ma_uint32 n = partitionFrames * 2; n < frameCount; n++) {
+            ma_uint32 source = n - partitionFrames;
+            double expected = 0.0;
+
+            for (ma_uint32 k = 0; k < tapCount && k <= source; k++) {
+                expected += (double)taps[k] * input[source - k];
+            }
+
+            maxError = std::max(maxError, std::fabs(expected - output[n]));
+        }
+
+        bool passed = (maxError < 1e-4);
+        printf("Accuracy (%u taps): max error %.2g against the direct convolution  %s\n", tapCount, maxError, passed ? "ok" : "FAILED");
+        status = passed ? 0 : 1;
+    }
+
+    printf("CPU per channel at %u Hz, partitions of %u frames (latency %.1f ms):\n", rate, partitionFrames, partitionFrames * 1000.0 / rate);
+    const ma_uint32 seconds = 10;
+
+    for (ma_uint32 tapCount : {4096u, 16384u, 65536u, maxTaps}) {
+        std::vector<float> taps = createTaps(tapCount);
+
+        for (ma_uint32 period : {smallPeriod, 1024u}) {
+            Convolver convolver(1, rate);
+            convolver.publish(convolver.createFilter(taps, 1, tapCount));
+            std::vector<float> block(period);
+            double total = 0.0;
+            ma_uint32 periods = seconds * rate / period;
+            std::vector<double> times;
+            times.reserve(periods);
+
+            for (ma_uint32 i = 0; i < periods; i++) {
+                for (float& sample : block) {
+                    sample = noise(random) * 0.1f;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                convolver.process(block.data(), period);
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                total += elapsed;
+                times.push_back(elapsed);
+            }
+
+            // The spikes of a small period would show in the 99th percentile.
+            std::sort(times.begin(), times.end());
+            double p99 = times[times.size() * 99 / 100];
+            double periodSeconds = (double)period / rate;
+            printf("  %6u taps (%4.2f s), period %4u: %5.2f%% CPU, %6.1f us per period on average, p99 %6.1f us (%2.0f%% of the period), max %6.1f us\n",
+                   tapCount, (double)tapCount / rate, period, total * 100.0 / seconds, total * 1e6 / periods, p99 * 1e6,
+                   p99 * 100.0 / periodSeconds, times.back() * 1e6);
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,107 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include <string>
+#include <atomic>
+#include <vector>
+#include "../libraries/miniaudio.h"
+#include "fft.h"
+#include "tracer.h"
+
+/*
+ * The Convolver class applies an impulse response (eg: speaker or room correction,
+ * reverb) to the frames routed to the device, per speaker channel (uniformly
+ * partitioned overlap-save).
+ * The impulse response is cut into partitions of partitionFrames taps whose spectra
+ * are computed once. Each block of partitionFrames input frames is transformed and
+ * kept in a delay line, and the output block is the inverse transform of the sum of
+ * the delayed input spectra times the partition spectra. So the cost doesn't depend
+ * on the period, and the latency is a single partition.
+ * The products of the older blocks don't depend on the incoming block: They are
+ * summed as the frames of the block come in, so that a small period doesn't get
+ * the whole work of a block at once.
+ * A new impulse response is prepared on the calling thread and taken over by the
+ * audio callback at a block boundary, the output of the old and new filters being
+ * crossfaded over that block.
+ */
+class Convolver {
+    public:
+        // Latency of the convolution, about 6 ms at 44.1 kHz.
+        static constexpr ma_uint32 partitionFrames = 256;
+        // About 6 seconds at 44.1 kHz.
+        static constexpr ma_uint32 maxTaps = 262144;
+
+    private:
+        static constexpr ma_uint32 maxPartitions = maxTaps / partitionFrames;
+        // Bins 0 to partitionFrames, padded so that 8 bins are multiplied at once.
+        static constexpr ma_uint32 binStride = (partitionFrames + 1 + 7) & ~7u;
+        // Structure that holds the spectra of an impulse response.
+        struct Filter {
+            ma_uint32 channels = 0;
+            ma_uint32 partitionCount = 0;
+            // Real parts then imaginary parts (binStride each), partition after partition,
+            // channel after channel. Scaled for the inverse transform.
+            std::vector<float> spectra;
+
+            const float* getSpectrum(ma_uint32 channel, ma_uint32 partition) const {
+                return spectra.data() + ((size_t)channel * partitionCount + partition) * binStride * 2;
+            }
+        };
+
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+        Fft fft;
+        // Per channel: The input of the previous and current blocks, the delay line of the
+        // input spectra, the sums of the products, and the output block being played.
+        std::vector<float> inputWindows;
+        std::vector<float> delayLines;
+        std::vector<float> sums;
+        std::vector<float> nextSums;
+        std::vector<float> outputs;
+        std::vector<float> timeBlock;
+        // Frames of the current block received so far.
+        ma_uint32 blockFill = 0;
+        // Delay line slot of the current block.
+        ma_uint32 head = 0;
+        // Next partitions to add to the sums.
+        ma_uint32 summed = 1;
+        ma_uint32 nextSummed = 1;
+        // Frames output since the convolver was engaged, the dry frames are faded out.
+        ma_uint32 engagedFrames = 0;
+        // Owned by the audio callback.
+        Filter* pCurrent = nullptr;
+        // Faded in over the current block.
+        Filter* pNext = nullptr;
+        // Handed to the callback, and back once replaced. A filter may be published
+        // during a crossfade, so two replaced filters may wait to be freed.
+        std::atomic<Filter*> pending = nullptr;
+        std::atomic<Filter*> retired[2] = {nullptr, nullptr};
+        // Set once the buffers are allocated, the frames are left as is until then.
+        std::atomic<bool> engaged = false;
+        std::string fileName;
+        void allocate();
+        void publish(Filter* pFilter);
+        void startBlock();
+        void finishBlock();
+        void sumPartitions(const Filter* pFilter, float* pSums, ma_uint32& next, ma_uint32 end);
+        Filter* createFilter(const std::vector<float>& taps, ma_uint32 tapChannels, ma_uint64 tapCount);
+
+    public:
+        Convolver(ma_uint32 channels, ma_uint32 sampleRate);
+        ~Convolver();
+
+        bool load(const std::string& fileName);
+        void clear();
+        void setChannels(ma_uint32 count);
+        void process(float* pFrames, ma_uint32 frameCount);
+
+        // Getters.
+        bool isEngaged() { return engaged.load(std::memory_order_relaxed); }
+        ma_uint32 getLatencyFrames() { return isEngaged() ? partitionFrames : 0; }
+        const std::string& getFileName() { return fileName; }
+
+        static void multiplyAccumulate(const float* pA, const float* pB, float* pSum, ma_uint32 count);
+        static int benchmark(const std::vector<std::string>& arguments);
+};
+
+#endif // CONVOLVER_H
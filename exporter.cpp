@@ -0,0 +1,462 @@
+#include "main.h"
+#include "exporter.h"
+
+/*
+ * Constructor: The given decoder configuration sets the output file format.
+ */
+Exporter::Exporter(const ma_decoder_config& config) : decoderConfig(config) {
+    setNormalization(true);
+}
+
+/*
+ * Destructor: Stops the workers before the jobs are released.
+ */
+Exporter::~Exporter() {
+    cancel();
+    wait();
+}
+
+/*
+ * Returns true if both paths name the same file, whether it exists yet or not.
+ */
+static bool isSameFile(const std::filesystem::path& path1, const std::filesystem::path& path2)
+{
+    std::error_code error;
+
+    if (std::filesystem::equivalent(path1, path2, error)) {
+        return true;
+    }
+
+    std::filesystem::path canonical1 = std::filesystem::weakly_canonical(path1, error);
+
+    if (error) {
+        return false;
+    }
+
+    std::filesystem::path canonical2 = std::filesystem::weakly_canonical(path2, error);
+
+    return !error && canonical1 == canonical2;
+}
+
+/*
+ * Returns true if a job reads from or writes to the given file, or if it's a
+ * skipped input.
+ */
+bool Exporter::isFileUsed(const std::filesystem::path& fileName)
+{
+    for (const std::string& skippedFile : skippedFiles) {
+        if (isSameFile(skippedFile, fileName)) {
+            return true;
+        }
+    }
+
+    for (const ExportJob& job : jobs) {
+        if (isSameFile(job.inputFile, fileName) || (!job.outputFile.empty() && isSameFile(job.outputFile, fileName))) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns the name of the WAV file the given input is exported to. Files with
+ * the same name but a different format (eg: song.mp3 and song.flac) get the
+ * extension and a number appended until the name is used by no other job.
+ */
+std::string Exporter::getOutputFile(const std::filesystem::path& input, const std::filesystem::path& outputDir)
+{
+    std::filesystem::path output = outputDir / input.stem();
+    output += ".wav";
+
+    for (int count = 1; isFileUsed(output); count++) {
+        output = outputDir / input.stem();
+        output += "-" + input.extension().string().substr(1);
+
+        if (count > 1) {
+            output += "-" + std::to_string(count);
+        }
+
+        output += ".wav";
+    }
+
+    return output.string();
+}
+
+/*
+ * Adds a conversion job for the given file. The job is rejected if the export
+ * would overwrite its input file, and the output never replaces another input.
+ */
+bool Exporter::addFile(const std::string& fileName, const std::string& outputDir)
+{
+    // Jobs can't be added while the workers are running.
+    if (!workers.empty()) {
+        return false;
+    }
+
+    if (!Audio::isSupportedFormat(fileName.c_str())) {
+        std::cerr << "Format: " << std::filesystem::path(fileName).extension() << " not supported." << std::endl;
+        return false;
+    }
+
+    std::filesystem::path input(fileName);
+    std::filesystem::path output = std::filesystem::path(outputDir) / input.stem();
+    output += ".wav";
+
+    for (const ExportJob& job : jobs) {
+        if (isSameFile(job.inputFile, input)) {
+            return false;
+        }
+    }
+
+    // A WAV file exported to its own directory would be truncated while it's
+    // being read. It's skipped but no other job may write to it either.
+    bool overwritten = isSameFile(input, output);
+    ExportJob* pNewJob = nullptr;
+
+    if (overwritten) {
+        skippedFiles.push_back(fileName);
+    }
+    else {
+        pNewJob = &jobs.emplace_back();
+        pNewJob->inputFile = fileName;
+    }
+
+    // An earlier job writing to this file (eg: song.mp3 exported next to
+    // song.wav) gets another name.
+    for (ExportJob& job : jobs) {
+        if (!job.outputFile.empty() && isSameFile(job.outputFile, input)) {
+            std::filesystem::path jobOutputDir = std::filesystem::path(job.outputFile).parent_path();
+            job.outputFile.clear();
+            job.outputFile = getOutputFile(job.inputFile, jobOutputDir);
+        }
+    }
+
+    if (overwritten) {
+        std::cerr << "Skipped: " << fileName << " (the export would overwrite it)" << std::endl;
+        return false;
+    }
+
+    pNewJob->outputFile = getOutputFile(input, outputDir);
+
+    return true;
+}
+
+/*
+ * Adds a conversion job for each supported file of the given directory.
+ * Returns the number of jobs added.
+ */
+int Exporter::addDirectory(const std::string& dirName, const std::string& outputDir)
+{
+    std::vector<std::string> fileNames;
+    std::error_code error;
+
+    for (const auto& entry : std::filesystem::directory_iterator(dirName, error)) {
+        if (entry.is_regular_file() && Audio::isSupportedFormat(entry.path().c_str())) {
+            fileNames.push_back(entry.path().string());
+        }
+    }
+
+    if (error) {
+        std::cerr << "Failed to read directory: " << dirName << std::endl;
+    }
+
+    // Process the files in a predictable order.
+    std::sort(fileNames.begin(), fileNames.end());
+    int count = 0;
+
+    for (const std::string& fileName : fileNames) {
+        count += addFile(fileName, outputDir) ? 1 : 0;
+    }
+
+    return count;
+}
+
+/*
+ * Launches the worker threads. The pool size is bounded by the number of cores
+ * and the number of jobs.
+ */
+bool Exporter::start(unsigned int threadCount)
+{
+    if (!workers.empty() || jobs.empty()) {
+        return false;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    threadCount = std::min(threadCount, (unsigned int)jobs.size());
+    decoderThreads = std::max(1u, std::thread::hardware_concurrency() / threadCount);
+    startTime = std::chrono::steady_clock::now();
+    activeWorkers.store(threadCount);
+
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.emplace_back(&Exporter::work, this);
+    }
+
+    return true;
+}
+
+/*
+ * Enables or disables the peak normalization, and sets its level in dBFS.
+ * Note: The files are normalized only if the decoder outputs floating point frames.
+ */
+void Exporter::setNormalization(bool enabled, float peakDb)
+{
+    normalize = enabled && decoderConfig.format == ma_format_f32;
+    targetPeak = powf(10.0f, std::min(peakDb, 0.0f) / 20.0f);
+}
+
+/*
+ * Requests the workers to stop. The files being converted are removed.
+ */
+void Exporter::cancel()
+{
+    cancelled.store(true);
+}
+
+/*
+ * Waits for all of the workers to finish.
+ */
+void Exporter::wait()
+{
+    for (std::thread& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+/*
+ * Worker loop: Picks up the next pending job until there is no more or the
+ * export is cancelled.
+ */
+void Exporter::work()
+{
+    while (!cancelled.load()) {
+        size_t index = nextJob.fetch_add(1);
+
+        if (index >= jobs.size()) {
+            break;
+        }
+
+        process(jobs[index]);
+    }
+
+    // The last worker to finish sets the end time.
+    if (activeWorkers.fetch_sub(1) == 1) {
+        endTime = std::chrono::steady_clock::now();
+    }
+}
+
+/*
+ * Decodes the whole file and gets its peak (ie: the first pass of the normalization).
+ * Returns false if the file can't be decoded or the export is cancelled.
+ */
+bool Exporter::findPeak(ExportJob& job, float& peak)
+{
+    ParallelDecoder decoder(decoderConfig, decoderThreads);
+
+    if (!decoder.open(job.inputFile)) {
+        return false;
+    }
+
+    job.totalFrames.store(decoder.getLengthInPcmFrames());
+    const ma_uint32 channels = decoder.getOutputChannels();
+    std::vector<float> buffer(bufferFrames * channels);
+    ma_result result = MA_SUCCESS;
+    peak = 0.0f;
+
+    while (!cancelled.load() && result == MA_SUCCESS) {
+        ma_uint64 framesRead = 0;
+        result = decoder.read(buffer.data(), bufferFrames, &framesRead);
+        peak = std::max(peak, SilenceDetector::getPeak(buffer.data(), framesRead * channels));
+        job.framesScanned.fetch_add(framesRead);
+
+        if (framesRead < bufferFrames) {
+            break;
+        }
+    }
+
+    decoder.close();
+
+    return !cancelled.load() && (result == MA_SUCCESS || result == MA_AT_END);
+}
+
+/*
+ * Converts a single file by streaming it from the decoder to the encoder.
+ */
+void Exporter::process(ExportJob& job)
+{
+    job.status.store(ExportJob::running);
+    // Left as is if not normalized, or if the file is silent.
+    float gain = 1.0f;
+
+    if (normalize) {
+        float peak = 0.0f;
+
+        if (!findPeak(job, peak)) {
+            if (!cancelled.load()) {
+                std::cerr << "Failed to decode: " << job.inputFile << std::endl;
+            }
+
+            job.status.store(cancelled.load() ? ExportJob::cancelled : ExportJob::failed);
+            return;
+        }
+
+        if (peak > 0.0f) {
+            gain = targetPeak / peak;
+        }
+    }
+
+    ParallelDecoder decoder(decoderConfig, decoderThreads);
+
+    if (!decoder.open(job.inputFile)) {
+        std::cerr << "Failed to open: " << job.inputFile << std::endl;
+        job.status.store(ExportJob::failed);
+        return;
+    }
+
+    job.totalFrames.store(decoder.getLengthInPcmFrames());
+
+    ma_encoder encoder;
+    ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, decoder.getOutputFormat(),
+                                                             decoder.getOutputChannels(), decoder.getOutputSampleRate());
+
+    if (ma_encoder_init_file(job.outputFile.c_str(), &encoderConfig, &encoder) != MA_SUCCESS) {
+        std::cerr << "Failed to create: " << job.outputFile << std::endl;
+        job.status.store(ExportJob::failed);
+        return;
+    }
+
+    // The buffer is sized for the largest sample format (ie: 32 bit).
+    std::vector<ma_uint8> buffer(bufferFrames * decoder.getOutputChannels() * sizeof(ma_int32));
+    bool failed = false;
+
+    while (!cancelled.load()) {
+        ma_uint64 framesRead = 0;
+        ma_result result = decoder.read(buffer.data(), bufferFrames, &framesRead);
+
+        if (framesRead > 0) {
+            if (gain != 1.0f) {
+                float* pSamples = (float*)buffer.data();
+
+                for (ma_uint64 i = 0; i < framesRead * decoder.getOutputChannels(); i++) {
+                    pSamples[i] *= gain;
+                }
+            }
+
+            if (ma_encoder_write_pcm_frames(&encoder, buffer.data(), framesRead, NULL) != MA_SUCCESS) {
+                failed = true;
+                break;
+            }
+
+            job.framesDone.fetch_add(framesRead);
+        }
+
+        if (result != MA_SUCCESS || framesRead < bufferFrames) {
+            failed = (result != MA_SUCCESS && result != MA_AT_END);
+            break;
+        }
+    }
+
+    ma_encoder_uninit(&encoder);
+    decoder.close();
+
+    if (cancelled.load() || failed) {
+        // Don't leave partial files behind.
+        std::error_code error;
+        std::filesystem::remove(job.outputFile, error);
+        job.status.store(failed ? ExportJob::failed : ExportJob::cancelled);
+        return;
+    }
+
+    job.status.store(ExportJob::done);
+}
+
+/*
+ * Returns the number of jobs in the given status.
+ */
+size_t Exporter::getJobCount(ExportJob::Status status)
+{
+    size_t count = 0;
+
+    for (const ExportJob& job : jobs) {
+        count += (job.status.load() == status) ? 1 : 0;
+    }
+
+    return count;
+}
+
+/*
+ * Returns the overall progress between 0 and 1.
+ */
+double Exporter::getProgress()
+{
+    if (jobs.empty()) {
+        return 0.0;
+    }
+
+    double progress = 0.0;
+
+    for (const ExportJob& job : jobs) {
+        int status = job.status.load();
+        ma_uint64 totalFrames = job.totalFrames.load();
+
+        if (status == ExportJob::done || status == ExportJob::failed) {
+            progress += 1.0;
+        }
+        else if (status == ExportJob::running && totalFrames > 0) {
+            // The peak pass takes as long as the conversion itself.
+            double passes = normalize ? 2.0 : 1.0;
+            progress += std::min(1.0, (double)(job.framesScanned.load() + job.framesDone.load()) / (totalFrames * passes));
+        }
+    }
+
+    return progress / jobs.size();
+}
+
+double Exporter::getElapsedSeconds()
+{
+    if (workers.empty()) {
+        return 0.0;
+    }
+
+    auto end = isRunning() ? std::chrono::steady_clock::now() : endTime;
+
+    return std::chrono::duration<double>(end - startTime).count();
+}
+
+/*
+ * Returns the conversion speed as a multiple of real time.
+ */
+double Exporter::getThroughput()
+{
+    double elapsed = getElapsedSeconds();
+
+    if (elapsed <= 0.0) {
+        return 0.0;
+    }
+
+    ma_uint64 framesDone = 0;
+
+    for (const ExportJob& job : jobs) {
+        framesDone += job.framesDone.load();
+    }
+
+    return ((double)framesDone / decoderConfig.sampleRate) / elapsed;
+}
+
+/*
+ * Returns a one line summary of the export (eg: "Export: 42% (5/12 files) 85.3x realtime").
+ */
+std::string Exporter::getStatusText()
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "Export%s: %d%% (%zu/%zu files, %zu failed) %.1fx realtime",
+             isCancelled() ? " cancelled" : "", (int)(getProgress() * 100.0), getJobCount(ExportJob::done),
+             getJobCount(), getJobCount(ExportJob::failed), getThroughput());
+
+    return std::string(buffer);
+}
@@ -0,0 +1,89 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <string>
+#include <iostream>
+#include <filesystem>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include "../libraries/miniaudio.h"
+#include "parallel_decoder.h"
+
+/*
+ * Structure that holds the state of a single file conversion.
+ */
+struct ExportJob {
+    enum Status { pending, running, done, failed, cancelled };
+    std::string inputFile;
+    std::string outputFile;
+    std::atomic<ma_uint64> framesDone = 0;
+    // Frames gone through the peak pass (normalization only).
+    std::atomic<ma_uint64> framesScanned = 0;
+    std::atomic<ma_uint64> totalFrames = 0;
+    std::atomic<int> status = pending;
+};
+
+/*
+ * The Exporter class converts a list of audio files to WAV files in the
+ * decoder output format. The files are processed on a bounded pool of worker
+ * threads and streamed through fixed-size buffers, so memory usage doesn't
+ * depend on the file size. The cores left over by the file workers (eg: when
+ * there are fewer files than cores) decode parts of the files in parallel.
+ * The files are peak normalized by default: A first pass finds the file peak,
+ * then the second one applies the gain bringing it to the target level.
+ */
+class Exporter {
+    private:
+        ma_decoder_config decoderConfig;
+        // Note: A deque never moves its elements, so the atomics stay in place.
+        std::deque<ExportJob> jobs;
+        // Inputs rejected since their export would overwrite them.
+        std::vector<std::string> skippedFiles;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> nextJob = 0;
+        std::atomic<unsigned int> activeWorkers = 0;
+        std::atomic<bool> cancelled = false;
+        // Number of decoders per file.
+        unsigned int decoderThreads = 1;
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point endTime;
+        // Size of the conversion buffer in frames.
+        static constexpr ma_uint32 bufferFrames = 4096;
+        bool normalize = true;
+        // Linear peak level the files are normalized to.
+        float targetPeak;
+        void work();
+        void process(ExportJob& job);
+        bool findPeak(ExportJob& job, float& peak);
+        bool isFileUsed(const std::filesystem::path& fileName);
+        std::string getOutputFile(const std::filesystem::path& input, const std::filesystem::path& outputDir);
+
+    public:
+        // Leaves some headroom for the inter-sample peaks.
+        static constexpr float defaultPeakDb = -1.0f;
+
+        Exporter(const ma_decoder_config& config);
+        ~Exporter();
+
+        bool addFile(const std::string& fileName, const std::string& outputDir);
+        int addDirectory(const std::string& dirName, const std::string& outputDir);
+        bool start(unsigned int threadCount = 0);
+        void setNormalization(bool enabled, float peakDb = defaultPeakDb);
+        void cancel();
+        void wait();
+
+        // Getters.
+        bool isRunning() { return activeWorkers.load() > 0; }
+        bool isCancelled() { return cancelled.load(); }
+        size_t getJobCount() { return jobs.size(); }
+        size_t getJobCount(ExportJob::Status status);
+        double getProgress();
+        double getThroughput();
+        double getElapsedSeconds();
+        std::string getStatusText();
+};
+
+#endif // EXPORTER_H
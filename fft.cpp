@@ -0,0 +1,205 @@
+#include <cmath>
+#include "fft.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Precomputes the bit reversal permutation and the twiddle factors.
+ */
+Fft::Fft(ma_uint32 realSize) : size(realSize / 2)
+{
+    ma_uint32 bits = 0;
+
+    while ((1u << bits) < size) {
+        bits++;
+    }
+
+    bitReversal.resize(size);
+
+    for (ma_uint32 i = 0; i < size; i++) {
+        ma_uint32 reversed = 0;
+
+        for (ma_uint32 b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+
+        bitReversal[i] = reversed;
+    }
+
+    // The twiddles of the stage whose butterflies are half apart start at half - 1.
+    twiddleRe.resize(size);
+    twiddleIm.resize(size);
+
+    for (ma_uint32 half = 1; half < size; half *= 2) {
+        for (ma_uint32 j = 0; j < half; j++) {
+            double angle = -M_PI * j / half;
+            twiddleRe[half - 1 + j] = (float)cos(angle);
+            twiddleIm[half - 1 + j] = (float)sin(angle);
+        }
+    }
+
+    unpackRe.resize(size);
+    unpackIm.resize(size);
+
+    for (ma_uint32 k = 0; k < size; k++) {
+        double angle = -M_PI * k / size;
+        unpackRe[k] = (float)cos(angle);
+        unpackIm[k] = (float)sin(angle);
+    }
+
+    re.resize(size);
+    im.resize(size);
+}
+
+/*
+ * In place transform of the bit reversed values.
+ */
+void Fft::transform()
+{
+    float* pRe = re.data();
+    float* pIm = im.data();
+
+    // The first two stages as radix-4 butterflies (trivial twiddles).
+    for (ma_uint32 i = 0; i + 4 <= size; i += 4) {
+        float aRe = pRe[i] + pRe[i + 1], aIm = pIm[i] + pIm[i + 1];
+        float bRe = pRe[i] - pRe[i + 1], bIm = pIm[i] - pIm[i + 1];
+        float cRe = pRe[i + 2] + pRe[i + 3], cIm = pIm[i + 2] + pIm[i + 3];
+        float dRe = pRe[i + 2] - pRe[i + 3], dIm = pIm[i + 2] - pIm[i + 3];
+        // d * -i
+        float eRe = dIm, eIm = -dRe;
+        pRe[i] = aRe + cRe; pIm[i] = aIm + cIm;
+        pRe[i + 2] = aRe - cRe; pIm[i + 2] = aIm - cIm;
+        pRe[i + 1] = bRe + eRe; pIm[i + 1] = bIm + eIm;
+        pRe[i + 3] = bRe - eRe; pIm[i + 3] = bIm - eIm;
+    }
+
+    // The next stages, 4 butterflies at a time.
+    for (ma_uint32 half = 4; half < size; half *= 2) {
+        const float* pWRe = twiddleRe.data() + half - 1;
+        const float* pWIm = twiddleIm.data() + half - 1;
+
+        for (ma_uint32 start = 0; start < size; start += half * 2) {
+            float* pARe = pRe + start;
+            float* pAIm = pIm + start;
+            float* pBRe = pARe + half;
+            float* pBIm = pAIm + half;
+            ma_uint32 j = 0;
+
+#if defined(__SSE__)
+            for (; j < half; j += 4) {
+                __m128 wRe = _mm_loadu_ps(pWRe + j);
+                __m128 wIm = _mm_loadu_ps(pWIm + j);
+                __m128 bRe = _mm_loadu_ps(pBRe + j);
+                __m128 bIm = _mm_loadu_ps(pBIm + j);
+                __m128 tRe = _mm_sub_ps(_mm_mul_ps(bRe, wRe), _mm_mul_ps(bIm, wIm));
+                __m128 tIm = _mm_add_ps(_mm_mul_ps(bRe, wIm), _mm_mul_ps(bIm, wRe));
+                __m128 aRe = _mm_loadu_ps(pARe + j);
+                __m128 aIm = _mm_loadu_ps(pAIm + j);
+                _mm_storeu_ps(pARe + j, _mm_add_ps(aRe, tRe));
+                _mm_storeu_ps(pAIm + j, _mm_add_ps(aIm, tIm));
+                _mm_storeu_ps(pBRe + j, _mm_sub_ps(aRe, tRe));
+                _mm_storeu_ps(pBIm + j, _mm_sub_ps(aIm, tIm));
+            }
+#endif
+
+            for (; j < half; j++) {
+                float tRe = pBRe[j] * pWRe[j] - pBIm[j] * pWIm[j];
+                float tIm = pBRe[j] * pWIm[j] + pBIm[j] * pWRe[j];
+                pBRe[j] = pARe[j] - tRe;
+                pBIm[j] = pAIm[j] - tIm;
+                pARe[j] += tRe;
+                pAIm[j] += tIm;
+            }
+        }
+    }
+}
+
+/*
+ * Computes the power of the size (ie: half the real size) first bins of the given real
+ * block. The even samples go to the real part, the odd ones to the imaginary part.
+ */
+void Fft::powerSpectrum(const float* pInput, float* pPower)
+{
+    for (ma_uint32 n = 0; n < size; n++) {
+        re[bitReversal[n]] = pInput[n * 2];
+        im[bitReversal[n]] = pInput[n * 2 + 1];
+    }
+
+    transform();
+
+    // DC
+    float dc = re[0] + im[0];
+    pPower[0] = dc * dc;
+
+    for (ma_uint32 k = 1; k < size; k++) {
+        ma_uint32 m = size - k;
+        // Even and odd sample spectra.
+        float eRe = 0.5f * (re[k] + re[m]);
+        float eIm = 0.5f * (im[k] - im[m]);
+        float oRe = 0.5f * (im[k] + im[m]);
+        float oIm = -0.5f * (re[k] - re[m]);
+        float xRe = eRe + unpackRe[k] * oRe - unpackIm[k] * oIm;
+        float xIm = eIm + unpackRe[k] * oIm + unpackIm[k] * oRe;
+        pPower[k] = xRe * xRe + xIm * xIm;
+    }
+}
+
+/*
+ * Computes the spectrum (bins 0 to size) of the given real block.
+ */
+void Fft::forward(const float* pInput, float* pRe, float* pIm)
+{
+    for (ma_uint32 n = 0; n < size; n++) {
+        re[bitReversal[n]] = pInput[n * 2];
+        im[bitReversal[n]] = pInput[n * 2 + 1];
+    }
+
+    transform();
+
+    pRe[0] = re[0] + im[0];
+    pIm[0] = 0.0f;
+    pRe[size] = re[0] - im[0];
+    pIm[size] = 0.0f;
+
+    for (ma_uint32 k = 1; k < size; k++) {
+        ma_uint32 m = size - k;
+        float eRe = 0.5f * (re[k] + re[m]);
+        float eIm = 0.5f * (im[k] - im[m]);
+        float oRe = 0.5f * (im[k] + im[m]);
+        float oIm = -0.5f * (re[k] - re[m]);
+        pRe[k] = eRe + unpackRe[k] * oRe - unpackIm[k] * oIm;
+        pIm[k] = eIm + unpackRe[k] * oIm + unpackIm[k] * oRe;
+    }
+}
+
+/*
+ * Computes the real block of the given spectrum (bins 0 to size), scaled by size,
+ * ie: the caller divides by size (eg: beforehand, in the spectrum).
+ * The spectrum is packed back into a complex one of half the size, whose inverse
+ * is computed as the conjugate of the forward transform of its conjugate.
+ */
+void Fft::inverse(const float* pRe, const float* pIm, float* pOutput)
+{
+    for (ma_uint32 k = 0; k < size; k++) {
+        ma_uint32 m = size - k;
+        // Even and odd sample spectra.
+        float eRe = 0.5f * (pRe[k] + pRe[m]);
+        float eIm = 0.5f * (pIm[k] - pIm[m]);
+        float dRe = 0.5f * (pRe[k] - pRe[m]);
+        float dIm = 0.5f * (pIm[k] + pIm[m]);
+        // Times the conjugate twiddle.
+        float oRe = dRe * unpackRe[k] + dIm * unpackIm[k];
+        float oIm = dIm * unpackRe[k] - dRe * unpackIm[k];
+        // Conjugate of E + i.O
+        re[bitReversal[k]] = eRe - oIm;
+        im[bitReversal[k]] = -(eIm + oRe);
+    }
+
+    transform();
+
+    for (ma_uint32 n = 0; n < size; n++) {
+        pOutput[n * 2] = re[n];
+        pOutput[n * 2 + 1] = -im[n];
+    }
+}
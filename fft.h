@@ -0,0 +1,36 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include "../libraries/miniaudio.h"
+
+/*
+ * Radix-2 FFT of complex values stored as separate real and imaginary arrays.
+ * A real block is transformed as a complex one of half the size, then unpacked.
+ * The spectra of real blocks hold the bins 0 to size (ie: half the real size + 1).
+ */
+class Fft {
+    private:
+        ma_uint32 size;
+        std::vector<ma_uint32> bitReversal;
+        // Per stage, contiguous so that 4 butterflies are computed at once.
+        std::vector<float> twiddleRe;
+        std::vector<float> twiddleIm;
+        // Unpacking of the real transform.
+        std::vector<float> unpackRe;
+        std::vector<float> unpackIm;
+        std::vector<float> re;
+        std::vector<float> im;
+        void transform();
+
+    public:
+        Fft(ma_uint32 realSize);
+        void powerSpectrum(const float* pInput, float* pPower);
+        void forward(const float* pInput, float* pRe, float* pIm);
+        void inverse(const float* pRe, const float* pIm, float* pOutput);
+
+        // Number of complex values, ie: half the real size.
+        ma_uint32 getSize() { return size; }
+};
+
+#endif // FFT_H
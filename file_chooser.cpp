@@ -16,9 +16,36 @@ void Application::file_chooser_cb(Fl_Widget *w, void *data)
         default:   // Choice
             app->fileChooser->preset_file(app->fileChooser->filename());
             //app->fileChooser->open(app->fileChooser->filename());
-            app->audio->loadFile(app->fileChooser->filename());
+            app->loadFile(app->fileChooser->filename());
             break;
     }
 }
 
 
+
+/*
+ * Plays the chosen file on the preview output, while the main playback goes on.
+ */
+void Application::preview_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->fileChooser == 0) {
+        app->fileChooser = new FileChooser(app->audio->getSupportedFormats());
+    }
+
+    if (app->fileChooser->show() != 0) {
+        return;
+    }
+
+    if (!app->audio->startPreview(app->fileChooser->filename())) {
+        app->setMessage("Failed to open the preview device.");
+        app->dialog_cb(app->dialogWnd, app);
+    }
+}
+
+void Application::stop_preview_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    app->audio->getPreviewBus()->close();
+}
@@ -26,13 +26,41 @@ Application::Application(int w, int h, const char *l, int argc, char *argv[]) :
     toggleBtn = new Fl_Button(SPACE, HEIGHT - BUTTON_HEIGHT - SPACE, BUTTON_WIDTH, BUTTON_HEIGHT, "@>");
     toggleBtn->callback(toggle_cb, this);
 
+    // A-B loop buttons.
+    loopStartBtn = new Fl_Button(SPACE * 2 + BUTTON_WIDTH, HEIGHT - BUTTON_HEIGHT - SPACE, BUTTON_WIDTH / 2, BUTTON_HEIGHT, "A");
+    loopStartBtn->tooltip("Set the loop start at the current position.");
+    loopStartBtn->callback(loop_cb, this);
+    loopEndBtn = new Fl_Button(SPACE * 3 + BUTTON_WIDTH * 1.5, HEIGHT - BUTTON_HEIGHT - SPACE, BUTTON_WIDTH / 2, BUTTON_HEIGHT, "B");
+    loopEndBtn->tooltip("Set the loop end at the current position.");
+    loopEndBtn->callback(loop_cb, this);
+    loopClearBtn = new Fl_Button(SPACE * 4 + BUTTON_WIDTH * 2, HEIGHT - BUTTON_HEIGHT - SPACE, BUTTON_WIDTH / 2, BUTTON_HEIGHT, "@undo");
+    loopClearBtn->tooltip("Turn looping off.");
+    loopClearBtn->callback(loop_cb, this);
+
+    loopOutput = new Fl_Output(w - (BUTTON_WIDTH * 2.5) - SPACE, HEIGHT_MENUBAR + (SPACE * 3), BUTTON_WIDTH * 2.5, 30);
+    loopOutput->label("Loop");
+    loopOutput->align(FL_ALIGN_TOP);
+    loopOutput->value("Off");
+
+    // Playback speed, the pitch is preserved.
+    speed = new Fl_Value_Slider(w - (BUTTON_WIDTH * 2.5) - SPACE, HEIGHT_MENUBAR + (SPACE * 8), BUTTON_WIDTH * 2.5, 25);
+    speed->type(FL_HOR_NICE_SLIDER);
+    speed->step(0.05);
+    speed->bounds(TimeStretch::minSpeed, TimeStretch::maxSpeed);
+    speed->value(1.0);
+    speed->label("Speed");
+    speed->align(FL_ALIGN_TOP);
+    speed->tooltip("Playback speed (pitch preserved).");
+    speed->callback(speed_cb, this);
+
     time = new Fl_Slider(SPACE, HEIGHT - SPACE - (BUTTON_HEIGHT * 2), w - (SPACE * 2), (SPACE * 2));
     time->type(FL_HORIZONTAL);
     time->step(1);
     time->value(0);
     time->callback(time_cb, this);
-    // Trigger callback whenever the value changes, including dragging
-    time->when(FL_WHEN_CHANGED);
+    // Trigger callback whenever the value changes, including dragging, and when the
+    // slider is released (ie: end of the scrubbing).
+    time->when(FL_WHEN_CHANGED | FL_WHEN_RELEASE_ALWAYS);
 
     timeOutput = new Fl_Output(SPACE, HEIGHT - SPACE - (BUTTON_HEIGHT * 3), BUTTON_WIDTH, 30);
     timeOutput->value("00:00:00");
@@ -70,25 +98,290 @@ Application::Application(int w, int h, const char *l, int argc, char *argv[]) :
 
     AppConfig config = loadConfig(CONFIG_FILENAME);
 
-    // Create and initialize the Audio object.
+    // Create the Audio object, its context is initialized in the background.
+    // The output device is set once it's ready (see setupAudio).
     this->audio = new Audio(this);
+    audio->initContextAsync(config.backend.c_str());
 
-    if (!this->audio->isContextInit()) {
-        setMessage("Failed to initialize audio system.");
-        this->dialog_cb(this->dialogWnd, this);
-    }
-
-    audio->setOutputDevice(config.outputDevice.c_str());
+    // Zero means the backend's default period size.
+    audio->setPeriodSize((ma_uint32) std::stoul(config.periodSize));
+    audio->setCacheSize(std::stoul(config.cacheSize), std::stoul(config.cacheFiles));
+    audio->setIdleSuspend(std::stod(config.idleSuspend));
+    audio->setInputDevice(config.inputDevice.c_str());
+    applyRouting(config);
+    applySilenceSkipping(config);
+    applyRealtime(config);
+    applyImpulseResponse(config);
+    applyPreview(config);
     //audio->printAllDevices();
 
     // Get and set the last volume value since the app was closed.
     double volumeValue = std::stod(config.volume);
     volume->value(volumeValue);
     volume_cb(volume, this);
+
+    // Let the scripts (and the next launches) drive this instance.
+    controlServer = new ControlServer(control_cb, this);
+    controlServer->start();
+
+    for (int i = 1; i < argc; i++) {
+        // Reports the startup times then quits.
+        if (strcmp(argv[i], "--startup-time") == 0) {
+            startupTiming = true;
+        }
+        // Records the trace events from the start (see View/Export trace and SIGUSR1).
+        else if (strcmp(argv[i], "--trace") == 0) {
+            Tracer::setEnabled(true);
+            ((Fl_Menu_Item *)menu->find_item("View/Record &trace"))->set();
+        }
+        // A file given on the command line is played as soon as the audio is ready.
+        else {
+            pendingFile = argv[i];
+        }
+    }
+}
+
+/*
+ * Finishes the audio setup once the context is initialized: Sets the output device
+ * and plays a possible file given on the command line.
+ * Note: Called on the first need or when the context thread is done, whichever comes first.
+ */
+void Application::setupAudio()
+{
+    if (audioReady) {
+        return;
+    }
+
+    audioReady = true;
+
+    if (!audio->isContextInit()) {
+        setMessage("Failed to initialize audio system.");
+        this->dialog_cb(this->dialogWnd, this);
+        return;
+    }
+
+    AppConfig config = loadConfig(CONFIG_FILENAME);
+    std::string backend = audio->getBackendName();
+    // A device id is only meaningful to the backend it was found with.
+    bool isCached = (config.backend == backend && config.outputDeviceId.size() > 0);
+    audio->setOutputDevice(config.outputDevice.c_str(), isCached ? config.outputDeviceId : "");
+    //audio->printAllDevices();
+
+    // Remember what worked for the next launch.
+    if (config.backend != backend || config.outputDeviceId != audio->getOutputDeviceId()) {
+        config.backend = backend;
+        config.outputDeviceId = audio->getOutputDeviceId();
+        saveConfig(config, CONFIG_FILENAME);
+    }
+
+    if (!pendingFile.empty()) {
+        std::string fileName = pendingFile;
+        pendingFile.clear();
+        loadFile(fileName.c_str());
+
+        if (audio->isFileLoaded()) {
+            toggle_cb(toggleBtn, this);
+        }
+    }
+
+    if (startupTiming) {
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        printf("Startup: time-to-ready %.1f ms (backend: %s)\n", elapsed, backend.c_str());
+        // Done measuring.
+        hide();
+    }
+}
+
+// Used by the signal handler to cancel a command line export.
+static Exporter *runningExporter = 0;
+
+static void cancel_export(int signal)
+{
+    if (runningExporter) {
+        runningExporter->cancel();
+    }
+}
+
+/*
+ * Converts the given files and directories without creating the application window.
+ * The files are peak normalized unless --no-normalize is given.
+ * Usage: Player --export OUTPUT_DIR [--no-normalize] FILE_OR_DIR...
+ */
+static int exportFiles(int argc, char *argv[])
+{
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " --export OUTPUT_DIR [--no-normalize] FILE_OR_DIR..." << std::endl;
+        return 1;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(argv[2], error);
+    Exporter exporter(Audio::getDecoderConfig());
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--no-normalize") == 0) {
+            exporter.setNormalization(false);
+        }
+        else if (std::filesystem::is_directory(argv[i])) {
+            exporter.addDirectory(argv[i], argv[2]);
+        }
+        else {
+            exporter.addFile(argv[i], argv[2]);
+        }
+    }
+
+    if (!exporter.start()) {
+        std::cerr << "No audio file to export." << std::endl;
+        return 1;
+    }
+
+    // Ctrl+C cancels the export.
+    runningExporter = &exporter;
+    signal(SIGINT, cancel_export);
+
+    while (exporter.isRunning()) {
+        printf("\r%s", exporter.getStatusText().c_str());
+        fflush(stdout);
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = 500 * 1000000}; // 500ms
+        nanosleep(&ts, NULL);
+    }
+
+    exporter.wait();
+    runningExporter = 0;
+    printf("\r%s\n", exporter.getStatusText().c_str());
+
+    return (exporter.isCancelled() || exporter.getJobCount(ExportJob::failed) > 0) ? 1 : 0;
+}
+
+/*
+ * Sends the given commands to the running instance and prints the replies.
+ * Usage: Player --control COMMAND...
+ */
+static int sendCommands(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " --control COMMAND..." << std::endl;
+        std::cerr << "Commands: \"load PATH\", play, pause, toggle, \"seek SECONDS\", \"volume 0-1\", status" << std::endl;
+        return 1;
+    }
+
+    std::string commands;
+
+    for (int i = 2; i < argc; i++) {
+        commands += std::string(argv[i]) + "\n";
+    }
+
+    std::string reply;
+
+    if (!ControlServer::send(commands, reply)) {
+        std::cerr << "No running instance found." << std::endl;
+        return 1;
+    }
+
+    printf("%s", reply.c_str());
+
+    return (reply.find("error") == std::string::npos) ? 0 : 1;
+}
+
+/*
+ * Hands the file over to the running instance if any, which saves starting
+ * a second one. Returns false if there's no instance to hand it to.
+ */
+static bool handOff(const char *filename, int& status)
+{
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::absolute(filename, error);
+    std::string reply;
+
+    if (error || !ControlServer::send("load " + path.string() + "\n", reply)) {
+        return false;
+    }
+
+    // A load taking long is replied "accepted", it goes on in the running instance.
+    if (reply.rfind("ok", 0) != 0 && reply.rfind("accepted", 0) != 0) {
+        std::cerr << reply;
+        status = 1;
+    }
+    else {
+        status = 0;
+    }
+
+    return true;
 }
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--export") == 0) {
+        return exportFiles(argc, argv);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-decode") == 0) {
+        return Audio::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-load") == 0) {
+        return Audio::benchmarkLoading(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--stress-control") == 0) {
+        return Audio::stressControls(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-idle") == 0) {
+        return Audio::benchmarkIdle(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-stretch") == 0) {
+        TimeStretch::benchmark();
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-output") == 0) {
+        OutputStage::benchmark();
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--test-dither") == 0) {
+        return OutputStage::nullTest();
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-tags") == 0) {
+        return TagParser::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-spectrogram") == 0) {
+        return Spectrogram::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-parallel-decode") == 0) {
+        return ParallelDecoder::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-convolver") == 0) {
+        return Convolver::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--bench-realtime") == 0) {
+        return Realtime::benchmark(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--control") == 0) {
+        return sendCommands(argc, argv);
+    }
+
+    int status;
+
+    if (argc > 1 && argv[1][0] != '-' && handOff(argv[1], status)) {
+        return status;
+    }
+
+    // kill -USR1 starts tracing, then writes the trace events. Set before any thread is created.
+    Tracer::exportOnSignal(SIGUSR1);
+    Tracer::setThreadName("GUI");
+
+    // Enables Fl::awake, used by the control server.
+    Fl::lock();
+
     Application app(WIDTH, HEIGHT, "Player", argc, argv);
 
     return Fl::run();
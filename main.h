@@ -6,6 +6,7 @@
 #include <FL/Fl_Menu_Bar.H>
 #include <FL/Fl_Menu_Item.H>
 #include <FL/Fl_Slider.H>
+#include <FL/Fl_Value_Slider.H>
 #include <FL/Fl_Output.H>
 #include <iostream>
 #include <fstream>
@@ -14,6 +15,9 @@
 #include "file_chooser.h"
 #include "audio_settings.h"
 #include "audio.h"
+#include "exporter.h"
+#include "control_server.h"
+#include "spectrogram_view.h"
 #include "../libraries/json.hpp"
 #define WIDTH 600
 #define HEIGHT 400
@@ -34,12 +38,35 @@ class Application : public Fl_Double_Window
         AudioSettings *audioSettings = 0;
         FileChooser *fileChooser = 0;
         Audio *audio = 0;
+        Exporter *exporter = 0;
+        ControlServer *controlServer = 0;
+        Spectrogram *spectrogram = 0;
+        Fl_Double_Window *spectrogramWnd = 0;
+        SpectrogramView *spectrogramView = 0;
+        // Startup measurement (see --startup-time).
+        std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        bool startupTiming = false;
+        // Set on the first draw.
+        bool windowShown = false;
+        bool audioReady = false;
+        // The real-time scheduling is reported once the device thread runs.
+        bool realtimeReported = false;
+        // File given on the command line, loaded once the audio is ready.
+        std::string pendingFile;
         std::string message;
         Fl_Menu_Bar *menu;
         Fl_Menu_Item *menuItem;
         Fl_Button *toggleBtn;
+        Fl_Button *loopStartBtn;
+        Fl_Button *loopEndBtn;
+        Fl_Button *loopClearBtn;
+        Fl_Output *loopOutput;
+        // Loop points (in frames) picked by the user.
+        ma_uint64 loopStart = 0;
+        ma_uint64 loopEnd = 0;
         Fl_Slider *time;
         Fl_Slider *volume;
+        Fl_Value_Slider *speed;
         Fl_Output *timeOutput;
         Fl_Output *volumeOutput;
         Fl_Output *duration;
@@ -51,11 +78,44 @@ class Application : public Fl_Double_Window
             std::string outputDevice;
             std::string inputDevice;
             std::string volume;
+            std::string periodSize;
+            std::string cacheSize;
+            std::string cacheFiles;
+            // Backend and output device id found last time, which speed the startup up.
+            std::string backend;
+            std::string outputDeviceId;
+            // Zero means the device's native channel count.
+            std::string outputChannels;
+            std::string upmix;
+            // Level (in dB) of the LFE folded into the fronts, "off" drops it.
+            std::string lfeLevel;
+            // Integer output formats.
+            std::string dither;
+            std::string noiseShaping;
+            // Skips the leading and trailing silences, and the long silent gaps.
+            std::string skipSilence;
+            std::string skipGaps;
+            // Level (in dBFS) under which the frames are silent.
+            std::string silenceThreshold;
+            // Scheduling of the audio threads: "default", "fifo" or "rr".
+            std::string realtime;
+            std::string realtimePriority;
+            std::string lockMemory;
+            // CPU the audio threads are pinned to, -1 for any.
+            std::string audioCpu;
+            // Impulse response applied to the playback, empty for none.
+            std::string impulseResponse;
+            // Output device of the preview (eg: headphones) and its gain in dB.
+            std::string previewDevice;
+            std::string previewGain;
+            // Seconds of pause after which the output device is stopped, zero for never.
+            std::string idleSuspend;
         };
 
     public:
 
         Application(int w, int h, const char *l, int argc, char *argv[]);
+        void draw() override;
 
         void createMenu();
         // Function to save configuration to file
@@ -71,8 +131,17 @@ class Application : public Fl_Double_Window
         void saveVolume();
         void updateToggleButton();
         std::map<std::string, int> getTimeFromSeconds(double seconds);
-        bool hasSliderMoved = false;
         void dispayFileInfo(std::map<std::string, std::string> info);
+        void updateLoop();
+        void loadFile(const char *filename);
+        void setupAudio();
+        void applyRouting(const AppConfig& config);
+        void applySilenceSkipping(const AppConfig& config);
+        void applyRealtime(const AppConfig& config);
+        void applyImpulseResponse(const AppConfig& config);
+        void applyPreview(const AppConfig& config);
+        void updateSpectrogram();
+        std::string applyCommand(const ControlServer::Command& command);
 
         // Call back functions.
         static void quit_cb(Fl_Widget *w, void *data);
@@ -83,10 +152,31 @@ class Application : public Fl_Double_Window
         static void ok_cb(Fl_Widget *w, void *data);
         static void cancel_cb(Fl_Widget *w, void *data);
         static void cancel_audio_settings_cb(Fl_Widget *w, void *data);
+        static void detect_period_cb(Fl_Widget *w, void *data);
         static void save_audio_settings_cb(Fl_Widget *w, void *data);
         static void toggle_cb(Fl_Widget *w, void *data);
         static void time_cb(Fl_Widget *w, void *data);
         static void volume_cb(Fl_Widget *w, void *data);
+        static void speed_cb(Fl_Widget *w, void *data);
+        static void loop_cb(Fl_Widget *w, void *data);
+        static void record_cb(Fl_Widget *w, void *data);
+        static void monitor_cb(Fl_Widget *w, void *data);
+        static void export_cb(Fl_Widget *w, void *data);
+        static void cancel_export_cb(Fl_Widget *w, void *data);
+        static void export_progress_cb(void *data);
+        static void control_cb(void *data);
+        static void audio_ready_cb(void *data);
+        static void silence_cb(void *data);
+        static void spectrogram_cb(Fl_Widget *w, void *data);
+        static void spectrogram_progress_cb(void *data);
+        static void spectrogram_seek_cb(Fl_Widget *w, void *data);
+        static void trace_cb(Fl_Widget *w, void *data);
+        static void export_trace_cb(Fl_Widget *w, void *data);
+        static void impulse_response_cb(Fl_Widget *w, void *data);
+        static void clear_impulse_response_cb(Fl_Widget *w, void *data);
+        static void preview_cb(Fl_Widget *w, void *data);
+        static void stop_preview_cb(Fl_Widget *w, void *data);
+        static void window_shown_cb(void *data);
 };
 
 #endif
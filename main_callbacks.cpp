@@ -6,7 +6,7 @@ void Application::toggle_cb(Fl_Widget* w, void* data)
     Application* app = (Application*) data;
 
     // Check for the end of file.
-    if (app->audio->isDecoderInit() && app->audio->isEndOfFile()) {
+    if (app->audio->isFileLoaded() && app->audio->isEndOfFile()) {
         // Play the audio file from the top.
         app->audio->restart();
     }
@@ -20,25 +20,34 @@ void Application::toggle_cb(Fl_Widget* w, void* data)
  */
 void Application::time_cb(Fl_Widget *w, void *data)
 {
+    Tracer::Scope trace("time_cb");
     Application* app = (Application*) data;
-    // By default the slider goes forward while the sound is playing.
-    app->hasSliderMoved = false;
+
+    // Get the seconds elapsed (from the time value slider).
+    double seconds = app->getSlider("time")->value();
 
     // Check if the slider has been moved by the user.
     // Note: The time slider widget is passed as w parameter whenever the slider is moved.
     if (dynamic_cast<Fl_Slider*>(w)) {
-        // Set the flag to true to tell the audio class to synchronize the sound cursor
-        // with the time slider's new value (in seconds).
-        app->hasSliderMoved = true;
+        // Dragging plays the sound around the slider position, the file is only
+        // seeked once the slider is released.
+        if (Fl::event() == FL_DRAG && Fl::pushed() == w) {
+            app->audio->scrub(seconds);
+        }
+        else if (app->audio->isScrubbing()) {
+            app->audio->stopScrub(seconds);
+        }
+        // Ask the audio callback to synchronize the sound cursor with the slider's
+        // new value (in seconds), unless it's a mere click release.
+        else if (Fl::event() != FL_RELEASE) {
+            app->audio->setCursor(seconds);
+        }
     }
-
-    // Get the seconds elapsed (from the time value slider).
-    double seconds = app->getSlider("time")->value();
-
-    if (app->hasSliderMoved && app->audio->isEndOfFile()) {
-        printf("\nTime slider has been moved. %f \n", seconds);
-        app->audio->setCursor(seconds);
+    // Follow the playback on the spectrogram.
+    if (app->spectrogramView != 0) {
+        app->spectrogramView->setPosition(seconds);
     }
+
     // Convert the seconds in hours minutes seconds time format.
     std::map time = app->getTimeFromSeconds(seconds);
 
@@ -50,6 +59,33 @@ void Application::time_cb(Fl_Widget *w, void *data)
     app->timeOutput->value(buffer);
 }
 
+/*
+ * Sets the loop points at the position being heard, or turns looping off.
+ * The loop is applied as soon as both points are set.
+ */
+void Application::loop_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (!app->audio->isFileLoaded()) {
+        return;
+    }
+
+    ma_uint64 position = (ma_uint64)app->audio->getPlaybackClock()->getFrames();
+
+    if (w == app->loopStartBtn) {
+        app->loopStart = position;
+    }
+    else if (w == app->loopEndBtn) {
+        app->loopEnd = position;
+    }
+    else {
+        app->loopStart = app->loopEnd = 0;
+    }
+
+    app->updateLoop();
+}
+
 void Application::volume_cb(Fl_Widget *w, void *data)
 {
     Application* app = (Application*) data;
@@ -67,6 +103,201 @@ void Application::volume_cb(Fl_Widget *w, void *data)
     app->volumeOutput->value(buffer);
 }
 
+/*
+ * Sets the playback speed. The counter keeps on showing the file position.
+ */
+void Application::speed_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    app->audio->setSpeed((float)app->speed->value());
+}
+
+/*
+ * Applies the commands received by the control server.
+ * Note: This function is called on the GUI thread through Fl::awake.
+ */
+void Application::control_cb(void *data)
+{
+    Tracer::Scope trace("control_cb");
+    Application* app = (Application*) data;
+    ControlServer::Batch batch = app->controlServer->takeCommands();
+
+    for (auto& command : batch) {
+        command->reply = app->applyCommand(*command);
+    }
+
+    app->controlServer->complete(batch);
+}
+
+/*
+ * Called on the GUI thread once the audio context is initialized.
+ */
+void Application::audio_ready_cb(void *data)
+{
+    Application* app = (Application*) data;
+    app->setupAudio();
+}
+
+/*
+ * Called on the GUI thread once a file has been scanned for silence.
+ */
+void Application::silence_cb(void *data)
+{
+    Application* app = (Application*) data;
+
+    // The scan may be of a previous file, the result is looked up for the current one.
+    if (app->audio->isFileLoaded()) {
+        app->audio->updateSilence();
+        app->dispayFileInfo(app->audio->getOriginalFileFormat());
+    }
+}
+
+/*
+ * Called once the window has been drawn for the first time (see draw).
+ */
+void Application::window_shown_cb(void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->startupTiming) {
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - app->startTime).count();
+        printf("Startup: time-to-window %.1f ms\n", elapsed);
+    }
+}
+
+/*
+ * Starts or stops recording the selected input device.
+ */
+void Application::record_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->audio->isRecording()) {
+        app->audio->stopRecording();
+        Recorder* recorder = app->audio->getRecorder();
+
+        // Inform the user about the recording result. Long recordings are split
+        // into several files (4GB WAV limit).
+        std::string files;
+
+        for (const std::string& fileName : recorder->getFileNames()) {
+            files += "\n" + fileName;
+        }
+
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), "\nDuration: %.2f seconds\nDropped frames: %llu",
+                 recorder->getRecordedSeconds(), (unsigned long long)recorder->getDroppedFrames());
+        app->setMessage("Recording saved to:" + files + buffer);
+        app->dialog_cb(app->dialogWnd, app);
+        return;
+    }
+
+    // Build a time stamped file name (eg: recording-20240131-154500.wav).
+    char fileName[64];
+    time_t now = ::time(NULL);
+    strftime(fileName, sizeof(fileName), "recording-%Y%m%d-%H%M%S.wav", localtime(&now));
+
+    if (!app->audio->startRecording(fileName)) {
+        // Uncheck the menu item.
+        ((Fl_Menu_Item *)app->menu->find_item("File/&Record"))->clear();
+        app->setMessage("Failed to start recording.");
+        app->dialog_cb(app->dialogWnd, app);
+    }
+}
+
+/*
+ * Enables or disables the live monitoring of the input device.
+ */
+void Application::monitor_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    const Fl_Menu_Item* item = app->menu->find_item("File/&Monitor input");
+
+    // The output device must be set first.
+    app->setupAudio();
+
+    if (!app->audio->setMonitoring(item->value() != 0)) {
+        // Uncheck the menu item.
+        ((Fl_Menu_Item *)item)->clear();
+        app->setMessage("Failed to start monitoring the input device.");
+        app->dialog_cb(app->dialogWnd, app);
+    }
+
+    if (app->audio->isMonitoring()) {
+        // Display the buffer latency added by the monitoring path (not a measured round trip).
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "Player - Monitoring (%.1f ms nominal)", app->audio->getNominalMonitoringLatency());
+        app->copy_label(buffer);
+    }
+    else {
+        app->label("Player");
+    }
+}
+
+/*
+ * Starts or stops recording the trace events.
+ */
+void Application::trace_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    const Fl_Menu_Item* item = app->menu->find_item("View/Record &trace");
+    Tracer::setEnabled(item->value() != 0);
+}
+
+/*
+ * Writes the trace events recorded so far into a file of the working directory.
+ */
+void Application::export_trace_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    std::string fileName = Tracer::exportToNewFile();
+
+    if (fileName.empty()) {
+        app->setMessage("Failed to write the trace file.");
+    }
+    else {
+        app->setMessage("Trace saved to " + fileName + "\nOpen it in chrome://tracing or ui.perfetto.dev.");
+    }
+
+    app->dialog_cb(app->dialogWnd, app);
+}
+
+/*
+ * Picks an impulse response (eg: room correction) to apply to the playback.
+ */
+void Application::impulse_response_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    Fl_Native_File_Chooser chooser;
+    chooser.title("Impulse response");
+    chooser.type(Fl_Native_File_Chooser::BROWSE_FILE);
+    chooser.filter("WAV\t*.wav");
+
+    if (chooser.show() != 0) {
+        return;
+    }
+
+    if (!app->audio->loadImpulseResponse(chooser.filename())) {
+        app->setMessage(std::string("Failed to load the impulse response: ") + chooser.filename());
+        app->dialog_cb(app->dialogWnd, app);
+        return;
+    }
+
+    AppConfig config = app->loadConfig(CONFIG_FILENAME);
+    config.impulseResponse = chooser.filename();
+    app->saveConfig(config, CONFIG_FILENAME);
+}
+
+void Application::clear_impulse_response_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+    app->audio->clearImpulseResponse();
+
+    AppConfig config = app->loadConfig(CONFIG_FILENAME);
+    config.impulseResponse = "";
+    app->saveConfig(config, CONFIG_FILENAME);
+}
+
 /*
  * Prevents the escape key to close the application. 
  */
@@ -77,18 +308,104 @@ void Application::noEscapeKey_cb(Fl_Widget *w, void *data)
         return;
     }
 
-    Application* app = (Application*) data;
-    app->saveVolume();
-
     // Close the application when the "close" button is clicked.
-    exit(0);
+    quit_cb(w, data);
 }
 
 void Application::quit_cb(Fl_Widget *w, void *data)
 {
     Application* app = (Application*) data;
     app->saveVolume();
+    // Finalize a possible recording in progress.
+    app->audio->stopRecording();
+    app->controlServer->stop();
+
+    if (app->spectrogram) {
+        app->spectrogram->stop();
+    }
+
+    // The workers of an export in progress remove their partial files.
+    if (app->exporter) {
+        app->exporter->cancel();
+        app->exporter->wait();
+    }
 
     exit(0);
 }
 
+/*
+ * Converts all of the supported files of a chosen folder into the "export"
+ * subfolder. The conversion runs in the background.
+ */
+void Application::export_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    // Only one export at a time.
+    if (app->exporter != 0) {
+        return;
+    }
+
+    Fl_Native_File_Chooser chooser;
+    chooser.title("Folder to export");
+    chooser.type(Fl_Native_File_Chooser::BROWSE_DIRECTORY);
+
+    if (chooser.show() != 0) {
+        return;
+    }
+
+    std::filesystem::path outputDir = std::filesystem::path(chooser.filename()) / "export";
+    std::error_code error;
+    std::filesystem::create_directories(outputDir, error);
+
+    if (error) {
+        app->setMessage("Failed to create the export folder: " + outputDir.string());
+        app->dialog_cb(app->dialogWnd, app);
+        return;
+    }
+
+    app->exporter = new Exporter(Audio::getDecoderConfig());
+
+    if (app->exporter->addDirectory(chooser.filename(), outputDir.string()) == 0 || !app->exporter->start()) {
+        delete app->exporter;
+        app->exporter = 0;
+        app->setMessage("No audio file to export.");
+        app->dialog_cb(app->dialogWnd, app);
+        return;
+    }
+
+    ((Fl_Menu_Item *)app->menu->find_item("File/Cancel e&xport"))->activate();
+    Fl::add_timeout(0.5, export_progress_cb, app);
+}
+
+void Application::cancel_export_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->exporter != 0) {
+        app->exporter->cancel();
+    }
+}
+
+/*
+ * Displays the export progress in the window title until the export is over.
+ */
+void Application::export_progress_cb(void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->exporter->isRunning()) {
+        app->copy_label(("Player - " + app->exporter->getStatusText()).c_str());
+        Fl::repeat_timeout(0.5, export_progress_cb, app);
+        return;
+    }
+
+    app->exporter->wait();
+    app->setMessage(app->exporter->getStatusText());
+    app->dialog_cb(app->dialogWnd, app);
+
+    delete app->exporter;
+    app->exporter = 0;
+    ((Fl_Menu_Item *)app->menu->find_item("File/Cancel e&xport"))->deactivate();
+    app->label("Player");
+}
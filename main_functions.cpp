@@ -4,10 +4,32 @@
 
 void Application::saveConfig(const AppConfig& config, const std::string& filename)
 {
+    Tracer::Scope trace("Save config");
     json j;
     j["outputDevice"] = config.outputDevice;
     j["inputDevice"] = config.inputDevice;
     j["volume"] = config.volume;
+    j["periodSize"] = config.periodSize;
+    j["cacheSize"] = config.cacheSize;
+    j["cacheFiles"] = config.cacheFiles;
+    j["backend"] = config.backend;
+    j["outputDeviceId"] = config.outputDeviceId;
+    j["outputChannels"] = config.outputChannels;
+    j["upmix"] = config.upmix;
+    j["lfeLevel"] = config.lfeLevel;
+    j["dither"] = config.dither;
+    j["noiseShaping"] = config.noiseShaping;
+    j["skipSilence"] = config.skipSilence;
+    j["skipGaps"] = config.skipGaps;
+    j["silenceThreshold"] = config.silenceThreshold;
+    j["realtime"] = config.realtime;
+    j["realtimePriority"] = config.realtimePriority;
+    j["lockMemory"] = config.lockMemory;
+    j["audioCpu"] = config.audioCpu;
+    j["impulseResponse"] = config.impulseResponse;
+    j["previewDevice"] = config.previewDevice;
+    j["previewGain"] = config.previewGain;
+    j["idleSuspend"] = config.idleSuspend;
 
     std::ofstream file(filename);
     file << j.dump(4); // Pretty print with 4 spaces indentation
@@ -25,6 +47,27 @@ Application::AppConfig Application::loadConfig(const std::string& filename)
         config.outputDevice = "none";
         config.inputDevice = "none";
         config.volume = "0";
+        config.periodSize = "0";
+        config.cacheSize = "256";
+        config.cacheFiles = "8";
+        config.backend = "";
+        config.outputDeviceId = "";
+        config.outputChannels = "0";
+        config.upmix = "0";
+        config.lfeLevel = "off";
+        config.dither = "1";
+        config.noiseShaping = "0";
+        config.skipSilence = "0";
+        config.skipGaps = "0";
+        config.silenceThreshold = "-60";
+        config.realtime = "default";
+        config.realtimePriority = "70";
+        config.lockMemory = "0";
+        config.audioCpu = "-1";
+        config.impulseResponse = "";
+        config.previewDevice = "default";
+        config.previewGain = "0";
+        config.idleSuspend = "30";
         this->saveConfig(config, filename);
         return config;
     }
@@ -36,6 +79,30 @@ Application::AppConfig Application::loadConfig(const std::string& filename)
         config.outputDevice = j.value("outputDevice", "none");
         config.inputDevice = j.value("inputDevice", "none");
         config.volume = j.value("volume", "0");
+        config.periodSize = j.value("periodSize", "0");
+        // Size in MB, zero disables the decoded file cache.
+        config.cacheSize = j.value("cacheSize", "256");
+        config.cacheFiles = j.value("cacheFiles", "8");
+        // Empty means probing all of the backends.
+        config.backend = j.value("backend", "");
+        config.outputDeviceId = j.value("outputDeviceId", "");
+        config.outputChannels = j.value("outputChannels", "0");
+        config.upmix = j.value("upmix", "0");
+        config.lfeLevel = j.value("lfeLevel", "off");
+        config.dither = j.value("dither", "1");
+        config.noiseShaping = j.value("noiseShaping", "0");
+        config.skipSilence = j.value("skipSilence", "0");
+        config.skipGaps = j.value("skipGaps", "0");
+        config.silenceThreshold = j.value("silenceThreshold", "-60");
+        config.realtime = j.value("realtime", "default");
+        // From 1 to 99, most audio servers run around 80.
+        config.realtimePriority = j.value("realtimePriority", "70");
+        config.lockMemory = j.value("lockMemory", "0");
+        config.audioCpu = j.value("audioCpu", "-1");
+        config.impulseResponse = j.value("impulseResponse", "");
+        config.previewDevice = j.value("previewDevice", "default");
+        config.previewGain = j.value("previewGain", "0");
+        config.idleSuspend = j.value("idleSuspend", "30");
     }
     catch (const json::exception& e) {
         setMessage("Error parsing config: " + std::string(e.what()));
@@ -44,6 +111,20 @@ Application::AppConfig Application::loadConfig(const std::string& filename)
     return config;
 }
 
+/*
+ * Draws the window. The first draw is reported once it's on screen, ie: after the
+ * double buffer has been copied, on the next event loop iteration.
+ */
+void Application::draw()
+{
+    Fl_Double_Window::draw();
+
+    if (!windowShown) {
+        windowShown = true;
+        Fl::add_timeout(0.0, window_shown_cb, this);
+    }
+}
+
 void Application::setMessage(std::string message)
 {
     this->message = message;
@@ -108,7 +189,238 @@ void Application::updateToggleButton()
         getButton()->label("@>");
     }
 
-    Fl::check();
+    // The button is drawn by the event loop. Note: Not running the loop here
+    // (eg: with Fl::check) as the playback thread calls this function too.
+    getButton()->redraw();
+}
+
+/*
+ * Passes the channel routing and output format settings to the audio.
+ */
+void Application::applyRouting(const AppConfig& config)
+{
+    ChannelRouter::Options options;
+    options.upmix = (config.upmix == "1");
+    // Eg: -10 dB
+    options.lfeGain = (config.lfeLevel == "off") ? 0.0f : powf(10.0f, std::stof(config.lfeLevel) / 20.0f);
+
+    audio->setRouting((ma_uint32) std::stoul(config.outputChannels), options);
+    audio->setDither(config.dither == "1", config.noiseShaping == "1");
+}
+
+/*
+ * Passes the silence skipping settings to the audio.
+ */
+void Application::applySilenceSkipping(const AppConfig& config)
+{
+    audio->setSilenceSkipping(config.skipSilence == "1", config.skipGaps == "1", std::stof(config.silenceThreshold));
+}
+
+/*
+ * Passes the scheduling, affinity and memory locking settings to the audio.
+ */
+void Application::applyRealtime(const AppConfig& config)
+{
+    Realtime::Options options;
+    options.policy = Realtime::getPolicy(config.realtime);
+    options.priority = std::stoi(config.realtimePriority);
+    options.lockMemory = (config.lockMemory == "1");
+    options.cpu = std::stoi(config.audioCpu);
+
+    // The CPUs may have changed since the settings were saved.
+    if (options.cpu >= Realtime::getCpuCount()) {
+        options.cpu = -1;
+    }
+
+    audio->setRealtime(options);
+    realtimeReported = false;
+}
+
+/*
+ * Loads the impulse response of the settings, if any.
+ */
+void Application::applyImpulseResponse(const AppConfig& config)
+{
+    if (config.impulseResponse.empty()) {
+        return;
+    }
+
+    if (!audio->loadImpulseResponse(config.impulseResponse)) {
+        setMessage("Failed to load the impulse response: " + config.impulseResponse);
+    }
+}
+
+/*
+ * Passes the preview output settings to the audio.
+ */
+void Application::applyPreview(const AppConfig& config)
+{
+    audio->setPreviewDevice(config.previewDevice.c_str());
+    audio->getPreviewBus()->setGain(powf(10.0f, std::stof(config.previewGain) / 20.0f));
+}
+
+/*
+ * Applies the loop points to the audio and displays them.
+ */
+void Application::updateLoop()
+{
+    if (loopEnd <= loopStart || !audio->setLoop(loopStart, loopEnd)) {
+        audio->clearLoop();
+    }
+
+    ma_uint64 start, end;
+
+    if (!audio->getLoop(start, end)) {
+        loopOutput->value((loopStart > 0 && loopEnd == 0) ? "A set, waiting for B" : "Off");
+        return;
+    }
+
+    // Display the loop points with milliseconds.
+    double rate = audio->getSampleRate();
+    std::map a = getTimeFromSeconds(start / rate);
+    std::map b = getTimeFromSeconds(end / rate);
+    char buffer[60];
+    snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d.%03d - %02d:%02d:%02d.%03d",
+             a["hours"], a["minutes"], a["seconds"], (int)((start % (ma_uint64)rate) * 1000 / rate),
+             b["hours"], b["minutes"], b["seconds"], (int)((end % (ma_uint64)rate) * 1000 / rate));
+    loopOutput->value(buffer);
+}
+
+/*
+ * Loads the given file, the loop points belong to the previous one.
+ */
+void Application::loadFile(const char *filename)
+{
+    Tracer::Scope trace("Application::loadFile");
+    // The output device must be set first.
+    setupAudio();
+    audio->loadFile(filename);
+
+    // Tell whether the privileges were granted, once the device thread runs.
+    if (!realtimeReported && audio->isFileLoaded() && audio->isRealtimeRequested()) {
+        printf("Realtime:\n%s\n", audio->getRealtimeReport(true).c_str());
+        realtimeReported = true;
+    }
+    loopStart = loopEnd = 0;
+    updateLoop();
+    updateSpectrogram();
+}
+
+/*
+ * Parses a number argument of the control commands. Returns false if it's not a number.
+ */
+static bool parseNumber(const std::string& argument, double& value)
+{
+    char* end = nullptr;
+    value = strtod(argument.c_str(), &end);
+
+    return !argument.empty() && end && *end == '\0' && std::isfinite(value);
+}
+
+/*
+ * Applies a command received by the control server and returns the reply.
+ */
+std::string Application::applyCommand(const ControlServer::Command& command)
+{
+    if (command.name == "load") {
+        if (!std::filesystem::is_regular_file(command.argument) || !Audio::isSupportedFormat(command.argument.c_str())) {
+            return "error: unsupported file";
+        }
+
+        loadFile(command.argument.c_str());
+
+        if (!audio->isFileLoaded()) {
+            return "error: failed to load file";
+        }
+
+        if (!audio->isPlaying()) {
+            toggle_cb(toggleBtn, this);
+        }
+
+        return "ok";
+    }
+
+    if (command.name == "play" || command.name == "pause" || command.name == "toggle") {
+        if (!audio->isFileLoaded()) {
+            return "error: no file loaded";
+        }
+
+        if (command.name == "toggle" || (command.name == "play") != audio->isPlaying()) {
+            toggle_cb(toggleBtn, this);
+        }
+
+        return "ok";
+    }
+
+    if (command.name == "seek") {
+        double seconds;
+
+        if (!audio->isFileLoaded()) {
+            return "error: no file loaded";
+        }
+
+        if (!parseNumber(command.argument, seconds)) {
+            return "error: invalid position";
+        }
+
+        // Same as clicking on the spectrogram.
+        time->value(std::clamp(seconds, 0.0, audio->getTotalSeconds()));
+        audio->setCursor(time->value());
+        time_cb(nullWidget, this);
+
+        return "ok";
+    }
+
+    if (command.name == "volume") {
+        double value;
+
+        if (!parseNumber(command.argument, value)) {
+            return "error: invalid volume";
+        }
+
+        volume->value(std::clamp(value, 0.0, 1.0));
+        volume_cb(volume, this);
+
+        return "ok";
+    }
+
+    if (command.name == "preview") {
+        if (!std::filesystem::is_regular_file(command.argument) || !Audio::isSupportedFormat(command.argument.c_str())) {
+            return "error: unsupported file";
+        }
+
+        return audio->startPreview(command.argument.c_str()) ? "ok" : "error: failed to open the preview device";
+    }
+
+    if (command.name == "preview-seek") {
+        double seconds;
+
+        if (!parseNumber(command.argument, seconds) || seconds < 0.0) {
+            return "error: invalid position";
+        }
+
+        audio->getPreviewBus()->seek((ma_uint64)(seconds * audio->getPreviewBus()->getSampleRate()));
+
+        return "ok";
+    }
+
+    if (command.name == "preview-stop") {
+        audio->getPreviewBus()->close();
+
+        return "ok";
+    }
+
+    if (command.name == "status") {
+        char buffer[120];
+        snprintf(buffer, sizeof(buffer), "state=%s position=%.3f duration=%.3f volume=%.2f speed=%.2f file=",
+                 audio->isPlaying() ? "playing" : (audio->isFileLoaded() ? "paused" : "stopped"),
+                 audio->isFileLoaded() ? audio->getPlaybackClock()->getSeconds() : 0.0,
+                 audio->getTotalSeconds(), audio->getVolume(), audio->getSpeed());
+
+        return buffer + (audio->isFileLoaded() ? audio->getOriginalFileFormat()["fileName"] : "");
+    }
+
+    return "error: unknown command \"" + command.name + "\"";
 }
 
 void Application::dispayFileInfo(std::map<std::string, std::string> info)
@@ -117,9 +429,50 @@ void Application::dispayFileInfo(std::map<std::string, std::string> info)
     fileInfo->value("");
     // Concatenate data to display.
     std::string concat = "File name: " + info["fileName"] + "\n";
-    concat = concat + "Channels: " + info["outputChannels"] + "\n";
-    concat = concat + "Sample rate: " + info["outputSampleRate"] + "\n";
-    concat = concat + "Format: " + info["outputFormat"];
+
+    // Tags, if any.
+    if (!info["title"].empty()) {
+        concat = concat + "Title: " + info["title"] + "\n";
+    }
+
+    if (!info["artist"].empty()) {
+        concat = concat + "Artist: " + info["artist"] + "\n";
+    }
+
+    if (!info["album"].empty()) {
+        concat = concat + "Album: " + info["album"] + "\n";
+    }
+
+    double seconds = info["duration"].empty() ? 0.0 : std::stod(info["duration"]);
+
+    if (seconds > 0.0) {
+        std::map time = getTimeFromSeconds(seconds);
+        char buffer[60];
+        snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", time["hours"], time["minutes"], time["seconds"]);
+        concat = concat + "Duration: " + buffer;
+
+        if (info["bitrate"] != "0") {
+            concat = concat + " (" + info["bitrate"] + " kbps)";
+        }
+
+        concat += "\n";
+    }
+
+    double audibleSeconds = info["audibleDuration"].empty() ? 0.0 : std::stod(info["audibleDuration"]);
+
+    // Known once the file is scanned.
+    if (audibleSeconds > 0.0) {
+        std::map time = getTimeFromSeconds(audibleSeconds);
+        char buffer[60];
+        snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d", time["hours"], time["minutes"], time["seconds"]);
+        concat = concat + "Audible: " + buffer + " (" + info["silence"] + ")\n";
+    }
+
+    std::string codec = info["codec"].empty() ? "" : info["codec"] + ", ";
+    concat = concat + "Format: " + codec + info["outputSampleRate"] + " Hz, " + info["outputChannels"] + " channels, "
+                    + info["outputFormat"] + "\n";
+    concat = concat + "Routing: " + info["routing"] + "\n";
+    concat = concat + "Output: " + info["output"];
     // Display info.
     fileInfo->value(concat.c_str());
 }
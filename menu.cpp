@@ -7,14 +7,26 @@ void Application::createMenu()
     menu->add("File", 0, 0, 0, FL_SUBMENU);
     menu->add("File/&New", FL_ALT + 'n', 0, 0);
     menu->add("File/_&Save");
-    menu->add("File/_&Open", 0, file_chooser_cb, (void*) this);
+    menu->add("File/&Open", 0, file_chooser_cb, (void*) this);
+    menu->add("File/Pre&view...", 0, preview_cb, (void*) this);
+    menu->add("File/_S&top preview", 0, stop_preview_cb, (void*) this);
+    menu->add("File/&Record", FL_CTRL + 'r', record_cb, (void*) this, FL_MENU_TOGGLE);
+    menu->add("File/_&Monitor input", FL_CTRL + 'm', monitor_cb, (void*) this, FL_MENU_TOGGLE);
+    menu->add("File/&Export folder...", FL_CTRL + 'e', export_cb, (void*) this);
+    menu->add("File/_Cancel e&xport", 0, cancel_export_cb, (void*) this, FL_MENU_INACTIVE);
     menu->add("File/&Quit", FL_CTRL + 'q',(Fl_Callback*) quit_cb, (void*) this, 0);
     menu->add("Edit", 0, 0, 0, FL_SUBMENU);
     menu->add("Edit/&Copy", FL_CTRL + 'c',0, 0, 0);
     menu->add("Edit/&Past", FL_CTRL + 'v',0, 0, FL_MENU_INACTIVE);
     menu->add("Edit/&Cut", FL_CTRL + 'x',0, 0, 0);
     menu->add("Edit/&Toolbar", 0,0, 0, FL_MENU_TOGGLE|FL_MENU_VALUE);
+    menu->add("Edit/&Impulse response...", 0, impulse_response_cb, (void*) this);
+    menu->add("Edit/_C&lear impulse response", 0, clear_impulse_response_cb, (void*) this);
     menu->add("Edit/_&Settings", 0, audio_settings_cb, (void*) this);
+    menu->add("View", 0, 0, 0, FL_SUBMENU);
+    menu->add("View/_&Spectrogram", FL_CTRL + 'g', spectrogram_cb, (void*) this);
+    menu->add("View/Record &trace", 0, trace_cb, (void*) this, FL_MENU_TOGGLE);
+    menu->add("View/E&xport trace", 0, export_trace_cb, (void*) this);
     menu->add("Help", 0, 0, 0, FL_SUBMENU);
     menu->add("Help/Index", 0, 0, 0, 0);
     menu->add("Help/About", 0, dialog_cb, (void*) this);
@@ -0,0 +1,418 @@
+#include <iostream>
+#include <chrono>
+#include "output_stage.h"
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Constructor: The buffers are allocated for the largest chunk and layout, so that
+ * the device format can change without any allocation.
+ */
+OutputStage::OutputStage() {
+    buffer.resize(chunkFrames * maxChannels);
+    noise.resize(chunkFrames * maxChannels);
+    samples.resize(chunkFrames * maxChannels);
+}
+
+bool OutputStage::isSupportedFormat(ma_format deviceFormat)
+{
+    return deviceFormat == ma_format_s16 || deviceFormat == ma_format_s24 || deviceFormat == ma_format_s32
+           || deviceFormat == ma_format_f32;
+}
+
+/*
+ * Sets the device format up.
+ * Note: Must not be called while process() may run.
+ */
+void OutputStage::configure(ma_format deviceFormat, ma_uint32 deviceChannels, bool enableDither, bool enableNoiseShaping)
+{
+    format = isSupportedFormat(deviceFormat) ? deviceFormat : ma_format_f32;
+    channels = std::clamp(deviceChannels, (ma_uint32)1, maxChannels);
+    scale = (format == ma_format_s16) ? 32768.0f : (format == ma_format_s24) ? 8388608.0f : 2147483648.0f;
+    // One LSB of a 32 bit sample is way below the float precision, so there is nothing to dither.
+    dither = enableDither && (format == ma_format_s16 || format == ma_format_s24);
+    noiseShaping = dither && enableNoiseShaping;
+    memset(errors, 0, sizeof(errors));
+}
+
+std::string OutputStage::getDescription()
+{
+    const char* name = (format == ma_format_s16) ? "s16" : (format == ma_format_s24) ? "s24"
+                       : (format == ma_format_s32) ? "s32" : "f32";
+    std::string description = name;
+
+    if (dither) {
+        description += noiseShaping ? " (TPDF dither, noise shaping)" : " (TPDF dither)";
+    }
+
+    return description;
+}
+
+/*
+ * Fills the buffer with TPDF noise, from -1 to 1 LSB.
+ */
+void OutputStage::generateNoise(float* pNoise, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i state = _mm_load_si128((const __m128i*)seeds);
+    const __m128i one = _mm_set1_epi32(0x3f800000);
+    const __m128 three = _mm_set1_ps(3.0f);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 uniform[2];
+
+        for (int j = 0; j < 2; j++) {
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+            state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+            // The 23 upper bits as the mantissa of a float within [1, 2).
+            uniform[j] = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(state, 9), one));
+        }
+
+        _mm_storeu_ps(pNoise + i, _mm_sub_ps(_mm_add_ps(uniform[0], uniform[1]), three));
+    }
+
+    _mm_store_si128((__m128i*)seeds, state);
+#endif
+
+    for (; i < count; i++) {
+        float uniform[2];
+
+        for (int j = 0; j < 2; j++) {
+            ma_uint32 state = seeds[0];
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            seeds[0] = state;
+            ma_uint32 bits = (state >> 9) | 0x3f800000;
+            memcpy(&uniform[j], &bits, sizeof(float));
+        }
+
+        pNoise[i] = uniform[0] + uniform[1] - 3.0f;
+    }
+}
+
+/*
+ * Scales, dithers and rounds the samples into the integer buffer.
+ */
+void OutputStage::quantize(const float* pInput, size_t count)
+{
+    const float minValue = -scale;
+    // The largest float below the full scale for s32.
+    const float maxValue = (format == ma_format_s32) ? 2147483520.0f : scale - 1.0f;
+    ma_int32* pSamples = samples.data();
+
+    // The error feedback runs along the frames, so it's done sample by sample.
+    if (noiseShaping) {
+        for (size_t i = 0; i < count; i++) {
+            ma_uint32 channel = i % channels;
+            float value = pInput[i] * scale - errors[channel];
+            float quantized = std::clamp(rintf(value + noise[i]), minValue, maxValue);
+            // Keep the feedback bounded when the signal clips.
+            errors[channel] = std::clamp(quantized - value, -2.0f, 2.0f);
+            pSamples[i] = (ma_int32)quantized;
+        }
+
+        return;
+    }
+
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scaleVector = _mm_set1_ps(scale);
+    const __m128 minVector = _mm_set1_ps(minValue);
+    const __m128 maxVector = _mm_set1_ps(maxValue);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 value = _mm_mul_ps(_mm_loadu_ps(pInput + i), scaleVector);
+
+        if (dither) {
+            value = _mm_add_ps(value, _mm_loadu_ps(noise.data() + i));
+        }
+
+        value = _mm_min_ps(_mm_max_ps(value, minVector), maxVector);
+        // Rounds to the nearest integer.
+        _mm_storeu_si128((__m128i*)(pSamples + i), _mm_cvtps_epi32(value));
+    }
+#endif
+
+    for (; i < count; i++) {
+        float value = pInput[i] * scale + (dither ? noise[i] : 0.0f);
+        pSamples[i] = (ma_int32)std::clamp(rintf(value), minValue, maxValue);
+    }
+}
+
+/*
+ * Writes the integer samples in the device format.
+ */
+void OutputStage::pack(void* pOutput, size_t count)
+{
+    const ma_int32* pSamples = samples.data();
+    size_t i = 0;
+
+    if (format == ma_format_s32) {
+        memcpy(pOutput, pSamples, count * sizeof(ma_int32));
+        return;
+    }
+
+    if (format == ma_format_s16) {
+        ma_int16* pOut = (ma_int16*)pOutput;
+
+#if defined(__SSE2__)
+        for (; i + 8 <= count; i += 8) {
+            __m128i low = _mm_loadu_si128((const __m128i*)(pSamples + i));
+            __m128i high = _mm_loadu_si128((const __m128i*)(pSamples + i + 4));
+            _mm_storeu_si128((__m128i*)(pOut + i), _mm_packs_epi32(low, high));
+        }
+#endif
+
+        for (; i < count; i++) {
+            pOut[i] = (ma_int16)pSamples[i];
+        }
+
+        return;
+    }
+
+    // s24: Three bytes per sample, little endian.
+    ma_uint8* pOut = (ma_uint8*)pOutput;
+
+#if defined(__SSSE3__)
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // Each store writes 16 bytes for 12 useful ones, which the next store overwrites.
+    for (; i + 8 <= count; i += 4) {
+        __m128i packed = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pSamples + i)), shuffle);
+        _mm_storeu_si128((__m128i*)(pOut + i * 3), packed);
+    }
+#endif
+
+    for (; i < count; i++) {
+        pOut[i * 3] = (ma_uint8)(pSamples[i] & 0xFF);
+        pOut[i * 3 + 1] = (ma_uint8)((pSamples[i] >> 8) & 0xFF);
+        pOut[i * 3 + 2] = (ma_uint8)((pSamples[i] >> 16) & 0xFF);
+    }
+}
+
+/*
+ * Converts frameCount frames (chunkFrames at most) to the device format.
+ * Note: This function is called from the device thread.
+ */
+void OutputStage::process(const float* pInput, void* pOutput, ma_uint32 frameCount)
+{
+    size_t count = (size_t)std::min(frameCount, chunkFrames) * channels;
+
+    if (isPassThrough()) {
+        if (pInput != pOutput) {
+            memcpy(pOutput, pInput, count * sizeof(float));
+        }
+
+        return;
+    }
+
+    if (dither) {
+        generateNoise(noise.data(), count);
+    }
+
+    quantize(pInput, count);
+    pack(pOutput, count);
+}
+
+/*
+ * Measures the conversion cost per format, against the miniaudio conversion.
+ * Usage: Player --bench-output
+ */
+void OutputStage::benchmark()
+{
+    const ma_uint32 sampleRate = 44100;
+    const ma_uint32 blockFrames = 512;
+    const ma_uint32 benchChannels = 2;
+    const double runSeconds = 0.5;
+    std::vector<float> input(blockFrames * benchChannels);
+    std::vector<ma_uint8> output(blockFrames * benchChannels * sizeof(ma_int32));
+
+    // Music-like levels.
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = 0.5f * sinf(2.0f * (float)M_PI * 440.0f * (i / benchChannels) / sampleRate);
+    }
+
+    struct Setup {
+        const char* name;
+        ma_format format;
+        bool dither;
+        bool noiseShaping;
+        // Converted by miniaudio instead.
+        bool miniaudio;
+    };
+
+    const Setup setups[] = {
+        {"s16 miniaudio, no dither", ma_format_s16, false, false, true},
+        {"s16 miniaudio, triangle dither", ma_format_s16, true, false, true},
+        {"s16 no dither", ma_format_s16, false, false, false},
+        {"s16 TPDF", ma_format_s16, true, false, false},
+        {"s16 TPDF + noise shaping", ma_format_s16, true, true, false},
+        {"s24 miniaudio, no dither", ma_format_s24, false, false, true},
+        {"s24 TPDF", ma_format_s24, true, false, false},
+        {"s24 TPDF + noise shaping", ma_format_s24, true, true, false},
+        {"s32 miniaudio", ma_format_s32, false, false, true},
+        {"s32", ma_format_s32, false, false, false},
+    };
+
+    OutputStage stage;
+    double period = (double)blockFrames / sampleRate;
+
+    for (const Setup& setup : setups) {
+        stage.configure(setup.format, benchChannels, setup.dither, setup.noiseShaping);
+        ma_uint64 blocks = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+
+        while (elapsed < runSeconds) {
+            for (int i = 0; i < 64; i++, blocks++) {
+                if (setup.miniaudio) {
+                    ma_convert_pcm_frames_format(output.data(), setup.format, input.data(), ma_format_f32, blockFrames,
+                                                 benchChannels, setup.dither ? ma_dither_mode_triangle : ma_dither_mode_none);
+                }
+                else {
+                    stage.process(input.data(), output.data(), blockFrames);
+                }
+            }
+
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double blockTime = elapsed / blocks;
+        printf("%-32s %6.2f ns/sample, %.3f%% of a %u frame period\n", setup.name,
+               blockTime * 1e9 / (blockFrames * benchChannels), blockTime / period * 100.0, blockFrames);
+    }
+}
+
+/*
+ * Checks the conversions: Exact samples must go through undithered unchanged (null test),
+ * and the dither must have the expected statistics, whatever the signal.
+ * Returns zero if all of the checks pass.
+ * Usage: Player --test-dither
+ */
+int OutputStage::nullTest()
+{
+    const ma_uint32 testChannels = 2;
+    const ma_uint32 chunks = 512;
+    const size_t chunkSamples = chunkFrames * testChannels;
+    OutputStage stage;
+    std::vector<float> input(chunkSamples);
+    std::vector<ma_uint8> output(chunkSamples * 3);
+    int failures = 0;
+
+    auto check = [&failures](bool passed, const char* name, double value) {
+        printf("%-48s %10.5f  %s\n", name, value, passed ? "ok" : "FAILED");
+        failures += passed ? 0 : 1;
+    };
+
+    // Reads the converted sample back as an integer.
+    auto readSample = [&output](ma_format format, size_t i) -> ma_int32 {
+        if (format == ma_format_s16) {
+            return ((ma_int16*)output.data())[i];
+        }
+
+        ma_int32 value = output[i * 3] | (output[i * 3 + 1] << 8) | (output[i * 3 + 2] << 16);
+        // Sign extension.
+        return (value << 8) >> 8;
+    };
+
+    // Null test: Sample exact values at both formats, no dither.
+    for (ma_format format : {ma_format_s16, ma_format_s24}) {
+        stage.configure(format, testChannels, false, false);
+        double maxDifference = 0.0;
+
+        for (ma_uint32 chunk = 0; chunk < chunks / 8; chunk++) {
+            std::vector<ma_int32> expected(chunkSamples);
+
+            for (size_t i = 0; i < chunkSamples; i++) {
+                expected[i] = (ma_int32)((rand() % (ma_int32)(stage.scale * 2.0f)) - (ma_int32)stage.scale);
+                input[i] = expected[i] / stage.scale;
+            }
+
+            stage.process(input.data(), output.data(), chunkFrames);
+
+            for (size_t i = 0; i < chunkSamples; i++) {
+                maxDifference = std::max(maxDifference, (double)std::abs(readSample(format, i) - expected[i]));
+            }
+        }
+
+        check(maxDifference == 0.0, (format == ma_format_s16) ? "s16 null (max difference, LSB)" : "s24 null (max difference, LSB)",
+              maxDifference);
+    }
+
+    // Dither statistics at s16, for a silent, a DC and a low level sine input.
+    // The total error of a TPDF dithered quantizer has a zero mean and a variance of
+    // 1/4 LSB^2 whatever the input, where an undithered one depends on the signal.
+    const double offsets[] = {0.0, 0.25, 0.5};
+
+    for (bool noiseShaping : {false, true}) {
+        for (double offset : offsets) {
+            stage.configure(ma_format_s16, testChannels, true, noiseShaping);
+            double sum = 0.0, sumSquares = 0.0, sumLag = 0.0, sumSignal = 0.0, sumSignalSquares = 0.0;
+            double peak = 0.0, previous = 0.0;
+            size_t count = 0;
+
+            for (ma_uint32 chunk = 0; chunk < chunks; chunk++) {
+                for (size_t i = 0; i < chunkSamples; i++) {
+                    size_t frame = chunk * chunkFrames + i / testChannels;
+                    // 3 LSB sine on the left, DC on the right.
+                    double value = offset + ((i % testChannels == 0) ? 3.0 * sin(2.0 * M_PI * 1000.0 * frame / 44100.0) : 0.0);
+                    input[i] = (float)(value / stage.scale);
+                }
+
+                stage.process(input.data(), output.data(), chunkFrames);
+
+                // The left channel only, so that the lag is one frame.
+                for (size_t i = 0; i < chunkSamples; i += testChannels) {
+                    double signal = (double)input[i] * stage.scale;
+                    double error = readSample(ma_format_s16, i) - signal;
+                    sum += error;
+                    sumSquares += error * error;
+                    sumLag += error * previous;
+                    sumSignal += error * signal;
+                    sumSignalSquares += signal * signal;
+                    peak = std::max(peak, fabs(error));
+                    previous = error;
+                    count++;
+                }
+            }
+
+            double mean = sum / count;
+            double variance = sumSquares / count - mean * mean;
+            double lagCorrelation = (sumLag / count) / variance;
+            double signalCorrelation = (sumSignal / count) / sqrt(variance * sumSignalSquares / count);
+            char name[64];
+
+            snprintf(name, sizeof(name), "%s offset %.2f: mean error", noiseShaping ? "Shaped" : "TPDF", offset);
+            check(fabs(mean) < 0.01, name, mean);
+            snprintf(name, sizeof(name), "%s offset %.2f: signal correlation", noiseShaping ? "Shaped" : "TPDF", offset);
+            check(fabs(signalCorrelation) < 0.02, name, signalCorrelation);
+
+            if (!noiseShaping) {
+                snprintf(name, sizeof(name), "TPDF offset %.2f: error variance (0.25)", offset);
+                check(fabs(variance - 0.25) < 0.01, name, variance);
+                snprintf(name, sizeof(name), "TPDF offset %.2f: peak error (<= 1.5)", offset);
+                check(peak <= 1.5 + 1e-6, name, peak);
+                // White noise.
+                snprintf(name, sizeof(name), "TPDF offset %.2f: lag 1 correlation", offset);
+                check(fabs(lagCorrelation) < 0.02, name, lagCorrelation);
+            }
+            else {
+                // First-order highpass shaped: Twice the power, -0.5 lag 1 correlation.
+                snprintf(name, sizeof(name), "Shaped offset %.2f: error variance (0.5)", offset);
+                check(fabs(variance - 0.5) < 0.02, name, variance);
+                snprintf(name, sizeof(name), "Shaped offset %.2f: lag 1 correlation (-0.5)", offset);
+                check(fabs(lagCorrelation + 0.5) < 0.03, name, lagCorrelation);
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "Dither test FAILED." : "Dither test passed.");
+
+    return failures ? 1 : 0;
+}
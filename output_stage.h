@@ -0,0 +1,61 @@
+#ifndef OUTPUT_STAGE_H
+#define OUTPUT_STAGE_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The OutputStage class converts the mixed float frames to the integer format of
+ * the device (s16, s24 or s32) instead of leaving it to miniaudio, which truncates
+ * without dither.
+ * The frames are scaled, TPDF dithered (ie: the sum of two uniform random values of
+ * one LSB each) and rounded by SSE kernels. The quantization error can optionally be
+ * fed back (first-order noise shaping), which moves the noise toward the high frequencies.
+ * The frames are converted chunkFrames at most at a time. Float devices are passed through.
+ */
+class OutputStage {
+    public:
+        static constexpr ma_uint32 chunkFrames = 1024;
+        static constexpr ma_uint32 maxChannels = 8;
+
+    private:
+        ma_format format = ma_format_f32;
+        ma_uint32 channels = 2;
+        bool dither = true;
+        bool noiseShaping = false;
+        // Full scale of the format, ie: the value of one LSB is 1 / scale.
+        float scale = 1.0f;
+        // Random generator state, one per SSE lane (xorshift32).
+        alignas(16) ma_uint32 seeds[4] = {0x9e3779b9, 0x7f4a7c15, 0x94d049bb, 0x2545f491};
+        // Quantization error of the previous frame, per channel.
+        float errors[maxChannels] = {0};
+        // Frames mixed by the callback before conversion.
+        std::vector<float> buffer;
+        std::vector<float> noise;
+        std::vector<ma_int32> samples;
+        void generateNoise(float* pNoise, size_t count);
+        void quantize(const float* pInput, size_t count);
+        void pack(void* pOutput, size_t count);
+
+    public:
+        OutputStage();
+
+        void configure(ma_format deviceFormat, ma_uint32 deviceChannels, bool enableDither, bool enableNoiseShaping);
+        void process(const float* pInput, void* pOutput, ma_uint32 frameCount);
+
+        // Getters.
+        bool isPassThrough() { return format == ma_format_f32; }
+        float* getBuffer() { return buffer.data(); }
+        ma_format getFormat() { return format; }
+        std::string getDescription();
+        static bool isSupportedFormat(ma_format deviceFormat);
+
+        static void benchmark();
+        static int nullTest();
+};
+
+#endif // OUTPUT_STAGE_H
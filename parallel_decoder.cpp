@@ -0,0 +1,456 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include "parallel_decoder.h"
+
+/*
+ * Constructor: The decoder configuration sets the output format. A zero thread
+ * count uses all of the cores. The chunk size is rounded to the seek alignment.
+ */
+ParallelDecoder::ParallelDecoder(const ma_decoder_config& config, unsigned int threadCount, ma_uint64 chunkFrames)
+    : decoderConfig(config), threadCount(threadCount) {
+    this->chunkFrames = std::max((ma_uint64)1, (chunkFrames + seekAlignment / 2) / seekAlignment) * seekAlignment;
+
+    if (this->threadCount == 0) {
+        this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+ParallelDecoder::~ParallelDecoder() {
+    close();
+}
+
+/*
+ * Opens the given file and starts decoding it. Returns false if the file can't be decoded.
+ */
+bool ParallelDecoder::open(const std::string& fileName)
+{
+    close();
+    this->fileName = fileName;
+
+    // The file sample rate is needed to split the file.
+    ma_decoder probe;
+    ma_decoder_config probeConfig = decoderConfig;
+    probeConfig.sampleRate = 0;
+
+    if (ma_decoder_init_file(fileName.c_str(), &probeConfig, &probe) != MA_SUCCESS) {
+        return false;
+    }
+
+    ma_uint64 fileFrames = 0;
+    ma_decoder_get_data_format(&probe, &outputFormat, &outputChannels, &fileSampleRate, NULL, 0);
+    ma_decoder_get_length_in_pcm_frames(&probe, &fileFrames);
+    ma_decoder_uninit(&probe);
+
+    outputSampleRate = (decoderConfig.sampleRate != 0) ? decoderConfig.sampleRate : fileSampleRate;
+    lengthInFrames = (outputSampleRate == fileSampleRate) ? fileFrames
+                                                          : ma_calculate_frame_count_after_resampling(outputSampleRate, fileSampleRate, fileFrames);
+    size_t chunkCount = (size_t)((fileFrames + chunkFrames - 1) / chunkFrames);
+
+    // Nothing to split, or the length is unknown (eg: some streams).
+    if (threadCount < 2 || chunkCount < 2) {
+        if (ma_decoder_init_file(fileName.c_str(), &decoderConfig, &decoder) != MA_SUCCESS) {
+            return false;
+        }
+
+        sequential = true;
+        opened = true;
+        return true;
+    }
+
+    converting = (outputSampleRate != fileSampleRate);
+    workerConfig = decoderConfig;
+    workerConfig.channels = outputChannels;
+    workerConfig.sampleRate = fileSampleRate;
+    workerConfig.format = converting ? ma_format_f32 : outputFormat;
+    // Lets the MP3 decoder seek without decoding from the start of the file.
+    workerConfig.seekPointCount = (ma_uint32)std::min(chunkCount * 4, (size_t)65536);
+    workerBytesPerFrame = ma_get_bytes_per_frame(workerConfig.format, outputChannels);
+
+    if (converting) {
+        ma_data_converter_config converterConfig = ma_data_converter_config_init(ma_format_f32, outputFormat, outputChannels, outputChannels,
+                                                                                 fileSampleRate, outputSampleRate);
+        converterConfig.ditherMode = decoderConfig.ditherMode;
+
+        if (ma_data_converter_init(&converterConfig, NULL, &converter) != MA_SUCCESS) {
+            converting = false;
+            return false;
+        }
+
+        silence.assign(seekAlignment / 16 * workerBytesPerFrame, 0);
+    }
+
+    chunks.resize(chunkCount);
+
+    for (size_t i = 0; i < chunkCount; i++) {
+        chunks[i].start = i * chunkFrames;
+        chunks[i].frameCount = std::min(chunkFrames, fileFrames - chunks[i].start);
+    }
+
+    unsigned int workerCount = (unsigned int)std::min((size_t)threadCount, chunkCount);
+    window = workerCount + 2;
+    opened = true;
+
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&ParallelDecoder::work, this);
+    }
+
+    return true;
+}
+
+/*
+ * Worker loop: Picks up the next chunk and decodes it, as long as the chunk is
+ * within the window ahead of the consumer.
+ * Note: This function is run in a thread.
+ */
+void ParallelDecoder::work()
+{
+    Tracer::setThreadName("Parallel decode");
+    ma_decoder chunkDecoder;
+    bool initialized = (ma_decoder_init_file(fileName.c_str(), &workerConfig, &chunkDecoder) == MA_SUCCESS);
+
+    while (true) {
+        size_t index;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (stopping || nextChunk >= chunks.size()) {
+                break;
+            }
+
+            index = nextChunk++;
+            chunkConsumed.wait(lock, [this, index]() { return stopping || index < readChunk + window; });
+
+            if (stopping) {
+                break;
+            }
+        }
+
+        // The chunk belongs to the worker until it's ready.
+        bool decoded = initialized && decodeChunk(chunkDecoder, chunks[index], index == chunks.size() - 1);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunks[index].failed = !decoded;
+            chunks[index].ready = true;
+        }
+
+        chunkReady.notify_all();
+    }
+
+    if (initialized) {
+        ma_decoder_uninit(&chunkDecoder);
+    }
+}
+
+/*
+ * Decodes the frames of the given chunk. The last chunk is decoded up to the end
+ * of the file, as the reported length may be slightly off.
+ */
+bool ParallelDecoder::decodeChunk(ma_decoder& chunkDecoder, Chunk& chunk, bool last)
+{
+    Tracer::Scope trace("Decode chunk");
+    ma_uint64 cursor = 0;
+
+    // No need to seek when the worker goes on with the next chunk.
+    if ((ma_decoder_get_cursor_in_pcm_frames(&chunkDecoder, &cursor) != MA_SUCCESS || cursor != chunk.start) &&
+        ma_decoder_seek_to_pcm_frame(&chunkDecoder, chunk.start) != MA_SUCCESS) {
+        return false;
+    }
+
+    chunk.data.resize(chunk.frameCount * workerBytesPerFrame);
+    ma_decoder_read_pcm_frames(&chunkDecoder, chunk.data.data(), chunk.frameCount, &chunk.framesDecoded);
+
+    // The next chunk starts at the end of this one: A short read would silently
+    // drop frames from the middle of the stream.
+    if (!last && chunk.framesDecoded < chunk.frameCount) {
+        return false;
+    }
+
+    while (last && chunk.framesDecoded == chunk.data.size() / workerBytesPerFrame) {
+        chunk.data.resize(chunk.data.size() + seekAlignment * workerBytesPerFrame);
+        ma_uint64 framesRead = 0;
+        ma_decoder_read_pcm_frames(&chunkDecoder, chunk.data.data() + chunk.framesDecoded * workerBytesPerFrame, seekAlignment, &framesRead);
+        chunk.framesDecoded += framesRead;
+    }
+
+    return true;
+}
+
+/*
+ * Returns the chunk being read once it's decoded, or nullptr if all of the chunks
+ * have been read.
+ */
+ParallelDecoder::Chunk* ParallelDecoder::waitForChunk()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (readChunk >= chunks.size()) {
+        return nullptr;
+    }
+
+    chunkReady.wait(lock, [this]() { return chunks[readChunk].ready; });
+
+    return &chunks[readChunk];
+}
+
+/*
+ * Pushes the frames still held by the resampler once all of the chunks have been
+ * read, ie: as many as needed to reach the resampled length of the decoded frames.
+ * Returns the number of frames written.
+ */
+ma_uint64 ParallelDecoder::flushConverter(void* pFrames, ma_uint64 frameCount)
+{
+    ma_uint64 totalFramesOut = ma_calculate_frame_count_after_resampling(outputSampleRate, fileSampleRate, convertedFramesIn);
+
+    if (convertedFramesOut >= totalFramesOut) {
+        return 0;
+    }
+
+    ma_uint64 framesIn = silence.size() / workerBytesPerFrame;
+    ma_uint64 framesOut = std::min(frameCount, totalFramesOut - convertedFramesOut);
+    ma_data_converter_process_pcm_frames(&converter, silence.data(), &framesIn, pFrames, &framesOut);
+    convertedFramesOut += framesOut;
+
+    return framesOut;
+}
+
+/*
+ * Reads the next frames in order, like ma_decoder_read_pcm_frames. Blocks until
+ * the frames are decoded. Returns MA_AT_END once all of the frames have been read.
+ */
+ma_result ParallelDecoder::read(void* pFrames, ma_uint64 frameCount, ma_uint64* pFramesRead)
+{
+    if (pFramesRead != nullptr) {
+        *pFramesRead = 0;
+    }
+
+    if (!opened) {
+        return MA_INVALID_OPERATION;
+    }
+
+    if (sequential) {
+        return ma_decoder_read_pcm_frames(&decoder, pFrames, frameCount, pFramesRead);
+    }
+
+    ma_uint8* pOutput = (ma_uint8*)pFrames;
+    ma_uint32 outputBytesPerFrame = ma_get_bytes_per_frame(outputFormat, outputChannels);
+    ma_uint64 totalRead = 0;
+    ma_result result = MA_SUCCESS;
+
+    while (totalRead < frameCount) {
+        Chunk* pChunk = waitForChunk();
+
+        if (pChunk == nullptr) {
+            ma_uint64 framesOut = converting ? flushConverter(pOutput + totalRead * outputBytesPerFrame, frameCount - totalRead) : 0;
+            totalRead += framesOut;
+
+            if (framesOut == 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (pChunk->failed) {
+            result = MA_ERROR;
+            break;
+        }
+
+        const ma_uint8* pInput = pChunk->data.data() + readFrame * workerBytesPerFrame;
+        ma_uint64 framesIn = pChunk->framesDecoded - readFrame;
+        ma_uint64 framesOut = frameCount - totalRead;
+
+        if (converting) {
+            ma_data_converter_process_pcm_frames(&converter, pInput, &framesIn, pOutput + totalRead * outputBytesPerFrame, &framesOut);
+            convertedFramesIn += framesIn;
+            convertedFramesOut += framesOut;
+        }
+        else {
+            framesIn = framesOut = std::min(framesIn, framesOut);
+            memcpy(pOutput + totalRead * outputBytesPerFrame, pInput, framesIn * workerBytesPerFrame);
+        }
+
+        readFrame += framesIn;
+        totalRead += framesOut;
+
+        // Give the chunk memory back and let the workers go on.
+        if (readFrame >= pChunk->framesDecoded) {
+            std::vector<ma_uint8>().swap(pChunk->data);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                readChunk++;
+                readFrame = 0;
+            }
+
+            chunkConsumed.notify_all();
+        }
+        // Safety net, the converter takes all of the input as long as there is output room.
+        else if (framesIn == 0 && framesOut == 0) {
+            break;
+        }
+    }
+
+    if (pFramesRead != nullptr) {
+        *pFramesRead = totalRead;
+    }
+
+    if (result == MA_SUCCESS && totalRead == 0 && frameCount > 0) {
+        return MA_AT_END;
+    }
+
+    return result;
+}
+
+/*
+ * Stops the workers and releases the file. Can be called while the file is being decoded.
+ */
+void ParallelDecoder::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    chunkConsumed.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    workers.clear();
+    chunks.clear();
+
+    if (sequential) {
+        ma_decoder_uninit(&decoder);
+    }
+
+    if (converting) {
+        ma_data_converter_uninit(&converter, NULL);
+    }
+
+    sequential = false;
+    converting = false;
+    convertedFramesIn = 0;
+    convertedFramesOut = 0;
+    opened = false;
+    nextChunk = 0;
+    readChunk = 0;
+    readFrame = 0;
+    stopping = false;
+}
+
+/*
+ * Decodes the given files with a single decoder, then in parallel, and checks that
+ * both give the same frames.
+ * The files are decoded to 32 bit float at 48 kHz, ie: with the resampling of the
+ * 44.1 kHz files.
+ * Usage: Player --bench-parallel-decode [--threads N] FILE...
+ */
+int ParallelDecoder::benchmark(const std::vector<std::string>& arguments)
+{
+    unsigned int threads = 0;
+    std::vector<std::string> files;
+
+    for (size_t i = 0; i < arguments.size(); i++) {
+        if (arguments[i] == "--threads" && i + 1 < arguments.size()) {
+            threads = (unsigned int)std::atoi(arguments[++i].c_str());
+        }
+        else {
+            files.push_back(arguments[i]);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "Usage: Player --bench-parallel-decode [--threads N] FILE..." << std::endl;
+        return 1;
+    }
+
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 0, 48000);
+    const ma_uint64 blockFrames = 65536;
+    int status = 0;
+
+    for (const std::string& file : files) {
+        ma_decoder single;
+
+        if (ma_decoder_init_file(file.c_str(), &config, &single) != MA_SUCCESS) {
+            std::cerr << "Failed to open: " << file << std::endl;
+            status = 1;
+            continue;
+        }
+
+        std::vector<float> block(blockFrames * single.outputChannels);
+        std::vector<float> parallelBlock(block.size());
+        ma_uint64 singleFrames = 0;
+        ma_uint64 framesRead = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        while (ma_decoder_read_pcm_frames(&single, block.data(), blockFrames, &framesRead) == MA_SUCCESS && framesRead > 0) {
+            singleFrames += framesRead;
+        }
+
+        double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ParallelDecoder parallel(config, threads);
+        ma_uint64 parallelFrames = 0;
+        start = std::chrono::steady_clock::now();
+
+        if (!parallel.open(file)) {
+            std::cerr << "Failed to open: " << file << std::endl;
+            ma_decoder_uninit(&single);
+            status = 1;
+            continue;
+        }
+
+        while (parallel.read(block.data(), blockFrames, &framesRead) == MA_SUCCESS && framesRead > 0) {
+            parallelFrames += framesRead;
+        }
+
+        double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        unsigned int decoders = parallel.getThreadCount();
+
+        // Untimed pass, both decoders side by side.
+        ma_decoder_seek_to_pcm_frame(&single, 0);
+        parallel.open(file);
+        float maxDifference = 0.0f;
+
+        while (true) {
+            ma_uint64 singleRead = 0;
+            ma_uint64 parallelRead = 0;
+            ma_decoder_read_pcm_frames(&single, block.data(), blockFrames, &singleRead);
+            parallel.read(parallelBlock.data(), blockFrames, &parallelRead);
+
+            for (ma_uint64 i = 0; i < std::min(singleRead, parallelRead) * single.outputChannels; i++) {
+                maxDifference = std::max(maxDifference, std::fabs(block[i] - parallelBlock[i]));
+            }
+
+            if (singleRead < blockFrames || parallelRead < blockFrames) {
+                break;
+            }
+        }
+
+        ma_decoder_uninit(&single);
+        double duration = (double)singleFrames / config.sampleRate;
+        // Note: The single decoder doesn't flush its resampler, so it may miss the
+        // last few frames the parallel one gives.
+        bool identical = ((singleFrames == parallelFrames || parallelFrames == parallel.getLengthInPcmFrames()) &&
+                          maxDifference <= 1e-6f);
+        printf("%s: %.0f s of audio\n", file.c_str(), duration);
+        printf("  1 decoder:   %7.3f s (%.0fx real time)\n", singleSeconds, duration / singleSeconds);
+        printf("  %u decoders: %7.3f s (%.0fx real time), %.2fx speedup\n", decoders, parallelSeconds, duration / parallelSeconds,
+               singleSeconds / parallelSeconds);
+        printf("  Frames: %llu / %llu, max sample difference %g  %s\n", (unsigned long long)singleFrames,
+               (unsigned long long)parallelFrames, maxDifference, identical ? "ok" : "MISMATCH");
+
+        if (!identical) {
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,109 @@
+#ifndef PARALLEL_DECODER_H
+#define PARALLEL_DECODER_H
+
+#include <string>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "../libraries/miniaudio.h"
+#include "tracer.h"
+
+/*
+ * The ParallelDecoder class decodes a whole file for the offline jobs (export,
+ * analysis) on several cores.
+ * The file is split into ranges of frames, each worker decodes the ranges it picks
+ * up with its own decoder (seeked to the start of the range), and the consumer
+ * pulls the frames in order with read(), like from a ma_decoder.
+ * The ranges are decoded at the file sample rate, as the resampler keeps a state
+ * across the ranges: The consumer resamples the reassembled frames on its own, so
+ * that there is no discontinuity at the range boundaries.
+ * The files whose length is unknown, or which are too short to be split, are
+ * decoded by a single decoder.
+ */
+class ParallelDecoder {
+    public:
+        // The range starts are multiples of this number of frames, ie: a whole number
+        // of MP3 frames (1152) and of 4096 frame FLAC blocks, so that a worker starts
+        // decoding on a frame boundary.
+        static constexpr ma_uint64 seekAlignment = 36864;
+        // About 6 seconds at 48 kHz.
+        static constexpr ma_uint64 defaultChunkFrames = seekAlignment * 8;
+
+    private:
+        // Structure that holds a range of frames.
+        struct Chunk {
+            ma_uint64 start = 0;
+            ma_uint64 frameCount = 0;
+            // Decoded frames, in the worker format.
+            std::vector<ma_uint8> data;
+            ma_uint64 framesDecoded = 0;
+            // Set by the worker once the frames can be read.
+            bool ready = false;
+            bool failed = false;
+        };
+
+        ma_decoder_config decoderConfig;
+        unsigned int threadCount;
+        ma_uint64 chunkFrames;
+        std::string fileName;
+        bool opened = false;
+        // Used when the file isn't split.
+        ma_decoder decoder;
+        bool sequential = false;
+        // Format of the frames decoded by the workers.
+        ma_decoder_config workerConfig;
+        ma_uint32 workerBytesPerFrame = 0;
+        ma_data_converter converter;
+        bool converting = false;
+        ma_uint32 fileSampleRate = 0;
+        // Frames gone in and out of the converter, to know how many are still held
+        // by the resampler at the end of the file.
+        ma_uint64 convertedFramesIn = 0;
+        ma_uint64 convertedFramesOut = 0;
+        // Silence pushing the last frames out of the resampler.
+        std::vector<ma_uint8> silence;
+        ma_format outputFormat = ma_format_unknown;
+        ma_uint32 outputChannels = 0;
+        ma_uint32 outputSampleRate = 0;
+        ma_uint64 lengthInFrames = 0;
+        std::vector<Chunk> chunks;
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        // Signaled when a chunk is ready.
+        std::condition_variable chunkReady;
+        // Signaled when the consumer is done with a chunk.
+        std::condition_variable chunkConsumed;
+        size_t nextChunk = 0;
+        // Chunk being read by the consumer, and its read position in frames.
+        size_t readChunk = 0;
+        ma_uint64 readFrame = 0;
+        // Maximum number of chunks decoded ahead of the consumer, which bounds the memory.
+        size_t window = 0;
+        bool stopping = false;
+        void work();
+        bool decodeChunk(ma_decoder& chunkDecoder, Chunk& chunk, bool last);
+        Chunk* waitForChunk();
+        ma_uint64 flushConverter(void* pFrames, ma_uint64 frameCount);
+
+    public:
+        ParallelDecoder(const ma_decoder_config& config, unsigned int threadCount = 0, ma_uint64 chunkFrames = defaultChunkFrames);
+        ~ParallelDecoder();
+
+        bool open(const std::string& fileName);
+        ma_result read(void* pFrames, ma_uint64 frameCount, ma_uint64* pFramesRead);
+        void close();
+        static int benchmark(const std::vector<std::string>& arguments);
+
+        // Getters.
+        ma_format getOutputFormat() { return outputFormat; }
+        ma_uint32 getOutputChannels() { return outputChannels; }
+        ma_uint32 getOutputSampleRate() { return outputSampleRate; }
+        // In output frames, the actual count may be slightly off for some formats.
+        ma_uint64 getLengthInPcmFrames() { return lengthInFrames; }
+        // Number of decoders working at once.
+        unsigned int getThreadCount() { return sequential ? 1 : (unsigned int)workers.size(); }
+};
+
+#endif // PARALLEL_DECODER_H
@@ -0,0 +1,242 @@
+#include "pcm_cache.h"
+
+/*
+ * Constructor: The decoder configuration sets the format and sample rate the files are cached in.
+ */
+PcmCache::PcmCache(const ma_decoder_config& config, size_t budgetBytes, size_t maxFiles)
+    : decoderConfig(config), budget(budgetBytes), maxFiles(maxFiles) {
+}
+
+PcmCache::~PcmCache() {
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        stopping = true;
+        requestedEntry.reset();
+        requestCount.fetch_add(1);
+    }
+
+    requestReady.notify_one();
+
+    if (populateThread.joinable()) {
+        populateThread.join();
+    }
+}
+
+/*
+ * Drops the pending request and makes the worker give up the file being decoded.
+ * Doesn't wait for the worker.
+ */
+void PcmCache::cancel()
+{
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requestedEntry.reset();
+    requestCount.fetch_add(1);
+}
+
+/*
+ * Returns the cached entry of the given file or nullptr if the file isn't cached.
+ */
+std::shared_ptr<PcmCache::Entry> PcmCache::find(const std::string& fileName)
+{
+    std::error_code error;
+    auto lastWriteTime = std::filesystem::last_write_time(fileName, error);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if ((*it)->fileName != fileName) {
+            continue;
+        }
+
+        // The file has been modified since it was cached.
+        if (error || (*it)->lastWriteTime != lastWriteTime) {
+            usedBytes -= (*it)->data.size();
+            entries.erase(it);
+            break;
+        }
+
+        // Move the entry to the front (ie: most recently used).
+        entries.splice(entries.begin(), entries, it);
+        hits.fetch_add(1);
+
+        return entries.front();
+    }
+
+    misses.fetch_add(1);
+
+    return nullptr;
+}
+
+/*
+ * Starts decoding the given file in the background. The original format data are
+ * stored along with the frames so that the file doesn't need probing on a hit.
+ * The files are decoded with their own channel count (decodedChannels), which the
+ * player routes to the device channels.
+ */
+void PcmCache::request(const std::string& fileName, ma_uint32 decodedChannels, ma_uint32 channels, ma_uint32 sampleRate, ma_format format)
+{
+    if (budget == 0 || maxFiles == 0) {
+        return;
+    }
+
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->fileName = fileName;
+    entry->channels = decodedChannels;
+    entry->originalChannels = channels;
+    entry->originalSampleRate = sampleRate;
+    entry->originalFormat = format;
+
+    std::error_code error;
+    entry->lastWriteTime = std::filesystem::last_write_time(fileName, error);
+
+    if (error) {
+        return;
+    }
+
+    {
+        // Only one file is decoded at a time, the latest request wins.
+        std::lock_guard<std::mutex> lock(requestMutex);
+        requestedEntry = entry;
+        requestCount.fetch_add(1);
+
+        // The worker is launched on the first request.
+        if (!populateThread.joinable()) {
+            populateThread = std::thread(&PcmCache::runWorker, this);
+        }
+    }
+
+    requestReady.notify_one();
+}
+
+/*
+ * Waits for the requests and decodes the files one after another.
+ * Note: This function is run in a thread, concurrently with the playback decoder.
+ */
+void PcmCache::runWorker()
+{
+    Tracer::setThreadName("PCM cache");
+    std::unique_lock<std::mutex> lock(requestMutex);
+
+    while (true) {
+        requestReady.wait(lock, [this] { return requestedEntry != nullptr || stopping; });
+
+        if (stopping) {
+            break;
+        }
+
+        std::shared_ptr<Entry> entry = std::move(requestedEntry);
+        requestedEntry.reset();
+        ma_uint64 request = requestCount.load();
+        lock.unlock();
+        populate(entry, request);
+        lock.lock();
+    }
+}
+
+/*
+ * Decodes the whole file then inserts it in the cache, unless another request
+ * comes in meanwhile.
+ */
+void PcmCache::populate(std::shared_ptr<Entry> entry, ma_uint64 request)
+{
+    ma_decoder decoder;
+    ma_decoder_config config = decoderConfig;
+    config.channels = entry->channels;
+
+    if (ma_decoder_init_file(entry->fileName.c_str(), &config, &decoder) != MA_SUCCESS) {
+        return;
+    }
+
+    ma_uint64 totalFrames = 0;
+    ma_decoder_get_length_in_pcm_frames(&decoder, &totalFrames);
+    ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(decoder.outputFormat, decoder.outputChannels);
+
+    // Files that are too long for the budget are never cached.
+    if (totalFrames == 0 || totalFrames * bytesPerFrame > budget) {
+        ma_decoder_uninit(&decoder);
+        return;
+    }
+
+    // Allocate the whole buffer at once, the length is known.
+    entry->data.resize(totalFrames * bytesPerFrame);
+
+    while (requestCount.load() == request && entry->frameCount < totalFrames) {
+        ma_uint64 framesToRead = std::min((ma_uint64)chunkFrames, totalFrames - entry->frameCount);
+        ma_uint64 framesRead = 0;
+        Tracer::Scope trace("Cache decode");
+        ma_decoder_read_pcm_frames(&decoder, entry->data.data() + entry->frameCount * bytesPerFrame, framesToRead, &framesRead);
+
+        if (framesRead == 0) {
+            break;
+        }
+
+        entry->frameCount += framesRead;
+    }
+
+    ma_decoder_uninit(&decoder);
+
+    if (requestCount.load() != request || entry->frameCount == 0) {
+        return;
+    }
+
+    // The reported length may be slightly off for some formats.
+    entry->data.resize(entry->frameCount * bytesPerFrame);
+    entry->data.shrink_to_fit();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Replace a possible stale entry of the same file.
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if ((*it)->fileName == entry->fileName) {
+            usedBytes -= (*it)->data.size();
+            entries.erase(it);
+            break;
+        }
+    }
+
+    entries.push_front(entry);
+    usedBytes += entry->data.size();
+    evict();
+}
+
+/*
+ * Removes the least recently used entries until the cache fits its limits.
+ * Note: The mutex must be locked by the caller. An entry still in use by the
+ *       player stays alive until it's released (shared pointer).
+ */
+void PcmCache::evict()
+{
+    while (!entries.empty() && (usedBytes > budget || entries.size() > maxFiles)) {
+        usedBytes -= entries.back()->data.size();
+        entries.pop_back();
+        evictions.fetch_add(1);
+    }
+}
+
+/*
+ * Sets the cache limits. A zero budget disables and empties the cache.
+ */
+void PcmCache::setBudget(size_t budgetBytes, size_t maxFiles)
+{
+    if (budgetBytes == 0) {
+        cancel();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = budgetBytes;
+    this->maxFiles = maxFiles;
+    evict();
+}
+
+size_t PcmCache::getUsedBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return usedBytes;
+}
+
+size_t PcmCache::getFileCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return entries.size();
+}
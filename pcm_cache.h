@@ -0,0 +1,85 @@
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <string>
+#include <iostream>
+#include <filesystem>
+#include <atomic>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "../libraries/miniaudio.h"
+#include "tracer.h"
+
+/*
+ * The PcmCache class keeps the most recently played files fully decoded in memory
+ * so that they can be reopened and seeked instantly.
+ * Files are decoded on a background thread and the least recently used ones are
+ * evicted whenever the memory budget or the maximum number of files is exceeded.
+ * The requests are handed to a single worker, a new one cancels the file being
+ * decoded, so that the caller (ie: the GUI thread) never waits.
+ */
+class PcmCache {
+    public:
+        // Structure that holds a decoded file.
+        struct Entry {
+            std::string fileName;
+            // Used to detect files modified since they were cached.
+            std::filesystem::file_time_type lastWriteTime;
+            // Interleaved frames in the decoder output format.
+            std::vector<ma_uint8> data;
+            ma_uint64 frameCount = 0;
+            // Number of channels of the decoded frames.
+            ma_uint32 channels = 0;
+            ma_uint32 originalChannels = 0;
+            ma_uint32 originalSampleRate = 0;
+            ma_format originalFormat = ma_format_unknown;
+        };
+
+    private:
+        ma_decoder_config decoderConfig;
+        std::mutex mutex;
+        // The most recently used entry comes first.
+        std::list<std::shared_ptr<Entry>> entries;
+        std::atomic<size_t> budget;
+        std::atomic<size_t> maxFiles;
+        size_t usedBytes = 0;
+        std::atomic<ma_uint64> hits = 0;
+        std::atomic<ma_uint64> misses = 0;
+        std::atomic<ma_uint64> evictions = 0;
+        std::thread populateThread;
+        // Requests handed to the worker, the latest one wins.
+        std::mutex requestMutex;
+        std::condition_variable requestReady;
+        std::shared_ptr<Entry> requestedEntry;
+        bool stopping = false;
+        // Incremented by each request (or cancellation), the file being decoded is
+        // dropped as soon as it changes.
+        std::atomic<ma_uint64> requestCount = 0;
+        // Number of frames decoded at once while populating.
+        static constexpr ma_uint32 chunkFrames = 16384;
+        void runWorker();
+        void populate(std::shared_ptr<Entry> entry, ma_uint64 request);
+        void evict();
+        void cancel();
+
+    public:
+        PcmCache(const ma_decoder_config& config, size_t budgetBytes, size_t maxFiles);
+        ~PcmCache();
+
+        std::shared_ptr<Entry> find(const std::string& fileName);
+        void request(const std::string& fileName, ma_uint32 decodedChannels, ma_uint32 channels, ma_uint32 sampleRate, ma_format format);
+        void setBudget(size_t budgetBytes, size_t maxFiles);
+
+        // Getters.
+        ma_uint64 getHits() { return hits.load(); }
+        ma_uint64 getMisses() { return misses.load(); }
+        ma_uint64 getEvictions() { return evictions.load(); }
+        size_t getUsedBytes();
+        size_t getFileCount();
+};
+
+#endif // PCM_CACHE_H
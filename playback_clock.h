@@ -0,0 +1,125 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The PlaybackClock class gives the position actually heard by the listener.
+ * The audio callback timestamps the frames it hands to the device, then any
+ * thread can compute the current position by compensating the device latency
+ * and interpolating from that timestamp at the playback speed.
+ * The snapshot is published through a sequence lock, so the audio thread never
+ * waits for the readers.
+ */
+class PlaybackClock {
+    private:
+        // Incremented before and after each write, odd while writing.
+        std::atomic<ma_uint32> sequence = 0;
+        std::atomic<ma_uint64> snapshotFrames = 0;
+        std::atomic<ma_int64> snapshotTime = 0;
+        std::atomic<ma_uint32> snapshotLength = 0;
+        std::atomic<bool> advancing = false;
+        // Source frames per output frame.
+        std::atomic<float> snapshotSpeed = 1.0f;
+        std::atomic<ma_uint32> latencyFrames = 0;
+        std::atomic<ma_uint32> sampleRate = 44100;
+
+        static ma_int64 now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void write(ma_uint64 frames, ma_int64 time, ma_uint32 length, bool isAdvancing, float speed)
+        {
+            ma_uint32 seq = sequence.load(std::memory_order_relaxed);
+            sequence.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            snapshotFrames.store(frames, std::memory_order_relaxed);
+            snapshotTime.store(time, std::memory_order_relaxed);
+            snapshotLength.store(length, std::memory_order_relaxed);
+            advancing.store(isAdvancing, std::memory_order_relaxed);
+            snapshotSpeed.store(speed, std::memory_order_relaxed);
+            sequence.store(seq + 2, std::memory_order_release);
+        }
+
+    public:
+        /*
+         * Sets the device parameters. Called whenever the device is (re)initialized.
+         */
+        void configure(ma_uint32 rate, ma_uint32 latency)
+        {
+            sampleRate.store(rate, std::memory_order_relaxed);
+            latencyFrames.store(latency, std::memory_order_relaxed);
+        }
+
+        /*
+         * Called from the audio callback with the cursor position of the first frame
+         * of the block (in source time). isAdvancing is false when silence is output (ie: paused).
+         */
+        void update(ma_uint64 frames, ma_uint32 frameCount, bool isAdvancing, float speed = 1.0f)
+        {
+            // While paused, the snapshot is only rewritten on a state or position change,
+            // otherwise the position would jump back at each silent callback.
+            if (!isAdvancing && !advancing.load(std::memory_order_relaxed)
+                && snapshotFrames.load(std::memory_order_relaxed) == frames) {
+                return;
+            }
+
+            write(frames, now(), frameCount, isAdvancing, speed);
+        }
+
+        /*
+         * Sets the position right away (eg: seek while paused).
+         */
+        void reset(ma_uint64 frames)
+        {
+            // Date the snapshot back by the latency so that it's already heard.
+            ma_int64 latency = (ma_int64)latencyFrames.load(std::memory_order_relaxed) * 1000000000 / sampleRate.load(std::memory_order_relaxed);
+            write(frames, now() - latency, 0, false, 1.0f);
+        }
+
+        /*
+         * Returns the position (in frames, possibly fractional) being heard right now.
+         * Safe to call from any thread.
+         */
+        double getFrames()
+        {
+            ma_uint64 frames;
+            ma_int64 time;
+            ma_uint32 length;
+            bool isAdvancing;
+            float speed;
+            ma_uint32 seq;
+
+            // Retry until a consistent snapshot is read.
+            do {
+                seq = sequence.load(std::memory_order_acquire);
+                frames = snapshotFrames.load(std::memory_order_relaxed);
+                time = snapshotTime.load(std::memory_order_relaxed);
+                length = snapshotLength.load(std::memory_order_relaxed);
+                isAdvancing = advancing.load(std::memory_order_relaxed);
+                speed = snapshotSpeed.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) || seq != sequence.load(std::memory_order_relaxed));
+
+            double rate = sampleRate.load(std::memory_order_relaxed);
+            double latency = latencyFrames.load(std::memory_order_relaxed);
+            double elapsed = (double)(now() - time) * rate / 1000000000.0;
+
+            // While playing, don't extrapolate further than a late callback would justify.
+            // While paused, the frames still in the device buffer are played out.
+            elapsed = std::min(elapsed, isAdvancing ? 2.0 * length : latency);
+
+            // The device latency and the elapsed time are in output frames.
+            return std::max(0.0, (double)frames + (elapsed - latency) * speed);
+        }
+
+        double getSeconds() { return getFrames() / sampleRate.load(std::memory_order_relaxed); }
+        double getLatencySeconds() { return (double)latencyFrames.load(std::memory_order_relaxed) / sampleRate.load(std::memory_order_relaxed); }
+};
+
+#endif // PLAYBACK_CLOCK_H
@@ -0,0 +1,217 @@
+#include "pool_allocator.h"
+#include <new>
+
+thread_local bool PoolAllocator::inCallback = false;
+std::atomic<ma_uint64> PoolAllocator::callbackAllocations = 0;
+
+/*
+ * Destructor: Gives the pooled blocks back to the system.
+ */
+PoolAllocator::~PoolAllocator() {
+    trim();
+}
+
+/*
+ * Note: The allocator is never destroyed, as the threads still running at exit
+ * (eg: the device or the PCM cache ones) may release their blocks after the
+ * static objects are destroyed.
+ */
+PoolAllocator& PoolAllocator::shared()
+{
+    static PoolAllocator* pAllocator = new PoolAllocator;
+
+    return *pAllocator;
+}
+
+/*
+ * Returns the size class of a block (header included), classCount if it's too large to be pooled.
+ */
+ma_uint32 PoolAllocator::getSizeClass(size_t size)
+{
+    size_t classSize = minClassSize;
+
+    for (ma_uint32 i = 0; i < classCount; i++, classSize *= 2) {
+        if (size <= classSize) {
+            return i;
+        }
+    }
+
+    return classCount;
+}
+
+void* PoolAllocator::allocate(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    noteAllocation();
+
+    ma_uint32 sizeClass = getSizeClass(size + sizeof(Header));
+    Header* pHeader = nullptr;
+
+    if (sizeClass < classCount) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!freeBlocks[sizeClass].empty()) {
+            pHeader = (Header*)freeBlocks[sizeClass].back();
+            freeBlocks[sizeClass].pop_back();
+            pooledBytes -= minClassSize << sizeClass;
+            poolHits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (pHeader == nullptr) {
+        size_t blockSize = (sizeClass < classCount) ? (minClassSize << sizeClass) : size + sizeof(Header);
+        pHeader = (Header*)malloc(blockSize);
+        systemAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        if (pHeader == nullptr) {
+            return nullptr;
+        }
+    }
+
+    pHeader->sizeClass = sizeClass;
+    pHeader->size = size;
+    bytesInUse.fetch_add(size, std::memory_order_relaxed);
+
+    return pHeader + 1;
+}
+
+void* PoolAllocator::reallocate(void* p, size_t size)
+{
+    if (p == nullptr) {
+        return allocate(size);
+    }
+
+    Header* pHeader = (Header*)p - 1;
+
+    // The block is large enough already.
+    if (pHeader->sizeClass < classCount && size + sizeof(Header) <= (minClassSize << pHeader->sizeClass)) {
+        bytesInUse.fetch_add(size - pHeader->size, std::memory_order_relaxed);
+        pHeader->size = size;
+        return p;
+    }
+
+    void* pNew = allocate(size);
+
+    if (pNew == nullptr) {
+        return nullptr;
+    }
+
+    memcpy(pNew, p, std::min(size, pHeader->size));
+    release(p);
+
+    return pNew;
+}
+
+void PoolAllocator::release(void* p)
+{
+    if (p == nullptr) {
+        return;
+    }
+
+    Header* pHeader = (Header*)p - 1;
+    bytesInUse.fetch_sub(pHeader->size, std::memory_order_relaxed);
+
+    if (pHeader->sizeClass < classCount) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t blockSize = minClassSize << pHeader->sizeClass;
+
+        // Keep the block for the next load.
+        if (pooledBytes + blockSize <= maxPooledBytes) {
+            freeBlocks[pHeader->sizeClass].push_back(pHeader);
+            pooledBytes += blockSize;
+            return;
+        }
+    }
+
+    free(pHeader);
+}
+
+/*
+ * Gives the pooled blocks back to the system.
+ */
+void PoolAllocator::trim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (ma_uint32 i = 0; i < classCount; i++) {
+        for (void* pBlock : freeBlocks[i]) {
+            free(pBlock);
+        }
+
+        freeBlocks[i].clear();
+    }
+
+    pooledBytes = 0;
+}
+
+size_t PoolAllocator::getPooledBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return pooledBytes;
+}
+
+/*
+ * Returns the callbacks to pass to the miniaudio configs.
+ */
+ma_allocation_callbacks PoolAllocator::getCallbacks()
+{
+    ma_allocation_callbacks callbacks;
+    callbacks.pUserData = this;
+    callbacks.onMalloc = onMalloc;
+    callbacks.onRealloc = onRealloc;
+    callbacks.onFree = onFree;
+
+    return callbacks;
+}
+
+void* PoolAllocator::onMalloc(size_t size, void* pUserData)
+{
+    return ((PoolAllocator*)pUserData)->allocate(size);
+}
+
+void* PoolAllocator::onRealloc(void* p, size_t size, void* pUserData)
+{
+    return ((PoolAllocator*)pUserData)->reallocate(p, size);
+}
+
+void PoolAllocator::onFree(void* p, void* pUserData)
+{
+    ((PoolAllocator*)pUserData)->release(p);
+}
+
+/*
+ * Replacements of the global operator new and delete, so that the C++ allocations
+ * made from the audio callback (eg: a growing std::vector) are counted too.
+ * Note: The array and nothrow versions call these ones.
+ */
+void* operator new(size_t size)
+{
+    PoolAllocator::noteAllocation();
+
+    while (true) {
+        void* p = malloc(size > 0 ? size : 1);
+
+        if (p != nullptr) {
+            return p;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t size) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,81 @@
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The PoolAllocator class serves the miniaudio allocations (decoders, resamplers,
+ * dr_* backends, context) from size classes whose freed blocks are kept for reuse.
+ * Loading file after file thus ends up recycling the same blocks instead of going
+ * through malloc/free each time.
+ * It also counts the allocations made from the audio callback, which must stay at zero.
+ * Both the miniaudio and the C++ allocations (ie: operator new) are counted, the
+ * direct malloc calls are not.
+ */
+class PoolAllocator {
+    private:
+        // Stored in front of each block. Keeps the blocks 16 byte aligned.
+        struct alignas(16) Header {
+            ma_uint32 sizeClass;
+            size_t size;
+        };
+
+        // Classes from 64 bytes to 1MB (powers of two), larger blocks are not pooled.
+        static constexpr size_t minClassSize = 64;
+        static constexpr ma_uint32 classCount = 15;
+        // Upper limit of the memory kept in the free lists.
+        static constexpr size_t maxPooledBytes = 64 * 1024 * 1024;
+        std::mutex mutex;
+        std::vector<void*> freeBlocks[classCount];
+        size_t pooledBytes = 0;
+        std::atomic<ma_uint64> allocations = 0;
+        std::atomic<ma_uint64> poolHits = 0;
+        std::atomic<ma_uint64> systemAllocations = 0;
+        std::atomic<size_t> bytesInUse = 0;
+        static std::atomic<ma_uint64> callbackAllocations;
+        static thread_local bool inCallback;
+        static ma_uint32 getSizeClass(size_t size);
+        static void* onMalloc(size_t size, void* pUserData);
+        static void* onRealloc(void* p, size_t size, void* pUserData);
+        static void onFree(void* p, void* pUserData);
+
+    public:
+        ~PoolAllocator();
+
+        void* allocate(size_t size);
+        void* reallocate(void* p, size_t size);
+        void release(void* p);
+        void trim();
+        ma_allocation_callbacks getCallbacks();
+
+        // The allocator shared by all of the miniaudio objects.
+        static PoolAllocator& shared();
+        // Called for each allocation, counts the ones made from the audio callback.
+        static void noteAllocation() {
+            if (inCallback) {
+                callbackAllocations.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        // Marks the current thread as running the audio callback for the scope lifetime.
+        struct CallbackScope {
+            CallbackScope() { inCallback = true; }
+            ~CallbackScope() { inCallback = false; }
+        };
+
+        // Getters.
+        ma_uint64 getAllocations() { return allocations.load(std::memory_order_relaxed); }
+        ma_uint64 getPoolHits() { return poolHits.load(std::memory_order_relaxed); }
+        ma_uint64 getSystemAllocations() { return systemAllocations.load(std::memory_order_relaxed); }
+        ma_uint64 getCallbackAllocations() { return callbackAllocations.load(std::memory_order_relaxed); }
+        size_t getBytesInUse() { return bytesInUse.load(std::memory_order_relaxed); }
+        size_t getPooledBytes();
+};
+
+#endif // POOL_ALLOCATOR_H
@@ -0,0 +1,443 @@
+#include "preview_bus.h"
+
+/*
+ * Constructor: The preview bus shares the audio context of the Audio class, used
+ * once the context is initialized.
+ */
+PreviewBus::PreviewBus(ma_context* context, const ma_decoder_config& config) : pContext(context), decoderConfig(config) {
+    // The callback copies the frames as is.
+    decoderConfig.format = ma_format_f32;
+    memset(&deviceID, 0, sizeof(ma_device_id));
+
+    // The ring buffer is allocated once and never grows.
+    ma_uint32 bufferSizeInFrames = decoderConfig.sampleRate * bufferLength / 1000;
+
+    if (ma_pcm_rb_init(decoderConfig.format, decoderConfig.channels, bufferSizeInFrames, NULL, NULL, &ringBuffer) == MA_SUCCESS) {
+        ringBufferInit = true;
+    }
+    else {
+        std::cerr << "Failed to initialize the preview buffer." << std::endl;
+    }
+}
+
+/*
+ * Destructor: Closes the device first, so that the callback is done with the
+ * ring buffer, then stops the feeder.
+ */
+PreviewBus::~PreviewBus() {
+    uninitDevice();
+
+    if (feeder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            stopping = true;
+        }
+
+        requestReady.notify_one();
+        feeder.join();
+    }
+
+    if (decoderInit) {
+        ma_decoder_uninit(&decoder);
+        decoderInit = false;
+    }
+
+    if (ringBufferInit) {
+        ma_pcm_rb_uninit(&ringBuffer);
+        ringBufferInit = false;
+    }
+}
+
+void PreviewBus::data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    PreviewBus* pBus = (PreviewBus*)pDevice->pUserData;
+
+    if (pBus == nullptr || pOutput == nullptr) {
+        return;
+    }
+
+    pBus->render((float*)pOutput, frameCount);
+}
+
+/*
+ * Copies the decoded frames to the device, gain applied.
+ * Note: This function is called from the device thread so it must never block
+ *       nor allocate. The output is silenced by miniaudio beforehand.
+ */
+void PreviewBus::render(float* pOutput, ma_uint32 frameCount)
+{
+    // The frames queued before a seek or another file are dropped.
+    if (flushRequested.load(std::memory_order_acquire)) {
+        ma_pcm_rb_seek_read(&ringBuffer, ma_pcm_rb_available_read(&ringBuffer));
+        fadeFrames = 0;
+        flushRequested.store(false, std::memory_order_release);
+    }
+
+    if (!playing.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Read before the frames, so that the last frames decoded aren't left behind.
+    ma_uint64 served = servedCount.load(std::memory_order_acquire);
+    bool ended = endReached.load(std::memory_order_acquire);
+    float level = gain.load(std::memory_order_relaxed);
+    ma_uint32 channels = decoderConfig.channels;
+    ma_uint32 framesDone = 0;
+
+    // The ring buffer may wrap around, so the copy can take two passes.
+    while (framesDone < frameCount) {
+        ma_uint32 framesToRead = frameCount - framesDone;
+        void* pBuffer;
+
+        if (ma_pcm_rb_acquire_read(&ringBuffer, &framesToRead, &pBuffer) != MA_SUCCESS || framesToRead == 0) {
+            break;
+        }
+
+        const float* pFrames = (const float*)pBuffer;
+        float* pSamples = pOutput + (size_t)framesDone * channels;
+
+        for (ma_uint32 i = 0; i < framesToRead; i++) {
+            float frameGain = level;
+
+            if (fadeFrames < fadeLength) {
+                frameGain *= (float)fadeFrames / fadeLength;
+                fadeFrames++;
+            }
+
+            for (ma_uint32 c = 0; c < channels; c++) {
+                pSamples[i * channels + c] = pFrames[i * channels + c] * frameGain;
+            }
+        }
+
+        ma_pcm_rb_commit_read(&ringBuffer, framesToRead);
+        framesDone += framesToRead;
+    }
+
+    position.fetch_add(framesDone, std::memory_order_relaxed);
+
+    if (framesDone < frameCount) {
+        // The whole file has been played.
+        if (ended && served == requestCount.load(std::memory_order_acquire)) {
+            playing.store(false, std::memory_order_relaxed);
+        }
+        // The buffer is empty right after a seek, which isn't counted, nor is the end of the file.
+        else if (fadeFrames > 0 && !endReached.load(std::memory_order_relaxed)) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Serves the requests and keeps the ring buffer filled.
+ * Note: This function is run in a thread, the decoder belongs to it.
+ */
+void PreviewBus::feed()
+{
+    Tracer::setThreadName("Preview feeder");
+    bool busy = false;
+
+    while (true) {
+        std::string fileName;
+        bool openFile = false;
+        bool closeFile = false;
+        ma_int64 seekTarget = -1;
+        ma_uint64 count;
+
+        {
+            std::unique_lock<std::mutex> lock(requestMutex);
+            auto hasRequest = [this] { return openRequested || closeRequested || requestedSeek >= 0 || stopping; };
+
+            // Nothing to decode: Wait for the next request.
+            if (!decoderInit || endReached.load(std::memory_order_relaxed)) {
+                requestReady.wait(lock, hasRequest);
+            }
+            // The buffer is full: Wait for the callback to drain it.
+            else if (!busy) {
+                requestReady.wait_for(lock, std::chrono::milliseconds(10), hasRequest);
+            }
+
+            if (stopping) {
+                break;
+            }
+
+            fileName = requestedFile;
+            openFile = openRequested;
+            closeFile = closeRequested;
+            seekTarget = requestedSeek;
+            openRequested = false;
+            closeRequested = false;
+            requestedSeek = -1;
+            count = requestCount.load(std::memory_order_relaxed);
+        }
+
+        if (openFile || closeFile) {
+            flush();
+
+            if (decoderInit) {
+                ma_decoder_uninit(&decoder);
+                decoderInit = false;
+            }
+
+            opened.store(false, std::memory_order_relaxed);
+            lengthInFrames.store(0, std::memory_order_relaxed);
+        }
+
+        if (openFile) {
+            Tracer::Scope trace("Open preview");
+
+            if (ma_decoder_init_file(fileName.c_str(), &decoderConfig, &decoder) == MA_SUCCESS) {
+                decoderInit = true;
+                ma_uint64 length = 0;
+                ma_decoder_get_length_in_pcm_frames(&decoder, &length);
+                lengthInFrames.store(length, std::memory_order_relaxed);
+                opened.store(true, std::memory_order_relaxed);
+                printf("Preview: %s\n", fileName.c_str());
+            }
+            else {
+                std::cerr << "Failed to open the preview file: " << fileName << std::endl;
+            }
+        }
+
+        if (seekTarget >= 0 && decoderInit && !openFile) {
+            Tracer::Scope trace("Seek preview");
+            flush();
+
+            if (ma_decoder_seek_to_pcm_frame(&decoder, (ma_uint64)seekTarget) != MA_SUCCESS) {
+                std::cerr << "Failed to seek the preview file." << std::endl;
+            }
+        }
+
+        // The buffer is empty at this point, the next frames start from the new position.
+        if (openFile || closeFile || seekTarget >= 0) {
+            position.store(openFile ? 0 : (ma_uint64)std::max<ma_int64>(seekTarget, 0), std::memory_order_relaxed);
+            endReached.store(!decoderInit, std::memory_order_relaxed);
+            servedCount.store(count, std::memory_order_release);
+        }
+
+        busy = decoderInit && fill();
+    }
+}
+
+/*
+ * Decodes the next frames into the ring buffer. Returns false if there is no room
+ * for them (or the file is over).
+ */
+bool PreviewBus::fill()
+{
+    if (ma_pcm_rb_available_write(&ringBuffer) < fillFrames) {
+        return false;
+    }
+
+    ma_uint32 framesDone = 0;
+
+    // The ring buffer may wrap around, so the copy can take two passes.
+    while (framesDone < fillFrames) {
+        ma_uint32 framesToWrite = fillFrames - framesDone;
+        void* pBuffer;
+
+        if (ma_pcm_rb_acquire_write(&ringBuffer, &framesToWrite, &pBuffer) != MA_SUCCESS || framesToWrite == 0) {
+            break;
+        }
+
+        ma_uint64 framesRead = 0;
+        ma_result result = ma_decoder_read_pcm_frames(&decoder, pBuffer, framesToWrite, &framesRead);
+        ma_pcm_rb_commit_write(&ringBuffer, (ma_uint32)framesRead);
+        framesDone += (ma_uint32)framesRead;
+
+        // Set once the frames are committed, so that the callback plays them out.
+        if (result != MA_SUCCESS || framesRead < framesToWrite) {
+            endReached.store(true, std::memory_order_release);
+            break;
+        }
+    }
+
+    return framesDone > 0;
+}
+
+/*
+ * Empties the ring buffer.
+ * Note: Only the callback may read the buffer while the device runs, so it's asked
+ *       to drop the frames. Otherwise the buffer is reset from here.
+ */
+void PreviewBus::flush()
+{
+    flushRequested.store(true, std::memory_order_release);
+
+    while (flushRequested.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(deviceMutex);
+
+            // Also covers a device stopped by the backend (eg: unplugged).
+            if (!deviceStarted || !ma_device_is_started(&device)) {
+                ma_pcm_rb_reset(&ringBuffer);
+                flushRequested.store(false, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/*
+ * Opens and starts the preview device.
+ * Note: Must be called from the application thread, as the main device.
+ */
+bool PreviewBus::initDevice()
+{
+    if (!ringBufferInit) {
+        return false;
+    }
+
+    ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.pDeviceID = useDefaultDevice ? NULL : &deviceID;
+    deviceConfig.playback.format = decoderConfig.format;
+    deviceConfig.playback.channels = decoderConfig.channels;
+    deviceConfig.sampleRate = decoderConfig.sampleRate;
+    // The latency doesn't matter much here, larger periods spare the CPU.
+    deviceConfig.performanceProfile = ma_performance_profile_conservative;
+    deviceConfig.dataCallback = data_callback;
+    deviceConfig.pUserData = this;
+
+    if (ma_device_init(pContext, &deviceConfig, &device) != MA_SUCCESS) {
+        std::cerr << "Failed to initialize preview device." << std::endl;
+        return false;
+    }
+
+    deviceInit = true;
+    // The buffer may have been reset meanwhile, the callback isn't running yet.
+    fadeFrames = 0;
+    std::lock_guard<std::mutex> lock(deviceMutex);
+
+    if (ma_device_start(&device) != MA_SUCCESS) {
+        std::cerr << "Failed to start preview device." << std::endl;
+        ma_device_uninit(&device);
+        deviceInit = false;
+        return false;
+    }
+
+    deviceStarted = true;
+
+    return true;
+}
+
+/*
+ * Stops and closes the preview device. The queued frames are kept.
+ */
+void PreviewBus::uninitDevice()
+{
+    if (!deviceInit) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        // Waits for the callback to return.
+        ma_device_stop(&device);
+        deviceStarted = false;
+    }
+
+    ma_device_uninit(&device);
+    deviceInit = false;
+}
+
+/*
+ * Plays the given file from the start, the file is opened by the feeder thread.
+ * Returns false if the device can't be opened.
+ */
+bool PreviewBus::open(const std::string& fileName)
+{
+    // The device keeps running from one file to the next.
+    if (!deviceInit && !initDevice()) {
+        return false;
+    }
+
+    if (!feeder.joinable()) {
+        feeder = std::thread(&PreviewBus::feed, this);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        requestedFile = fileName;
+        openRequested = true;
+        closeRequested = false;
+        // Meant for the previous file.
+        requestedSeek = -1;
+        requestCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    requestReady.notify_one();
+    playing.store(true, std::memory_order_relaxed);
+
+    return true;
+}
+
+void PreviewBus::seek(ma_uint64 frames)
+{
+    if (!feeder.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        requestedSeek = (ma_int64)frames;
+        requestCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    requestReady.notify_one();
+}
+
+/*
+ * Stops the preview and releases its device.
+ */
+void PreviewBus::close()
+{
+    playing.store(false, std::memory_order_relaxed);
+    uninitDevice();
+
+    if (!feeder.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        closeRequested = true;
+        openRequested = false;
+        requestedSeek = -1;
+        requestCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    requestReady.notify_one();
+}
+
+void PreviewBus::setPlaying(bool play)
+{
+    if (play && (!isOpen() || (!deviceInit && !initDevice()))) {
+        return;
+    }
+
+    // Play again from the start once the file is over.
+    if (play && !isPlaying() && endReached.load(std::memory_order_relaxed)) {
+        seek(0);
+    }
+
+    playing.store(play, std::memory_order_relaxed);
+}
+
+/*
+ * Moves the preview to the given device (null for the default one).
+ */
+void PreviewBus::setDevice(const ma_device_id* pDeviceID)
+{
+    useDefaultDevice = (pDeviceID == nullptr);
+
+    if (pDeviceID != nullptr) {
+        memcpy(&deviceID, pDeviceID, sizeof(ma_device_id));
+    }
+
+    // The preview goes on with the new device.
+    if (deviceInit) {
+        uninitDevice();
+        initDevice();
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef PREVIEW_BUS_H
+#define PREVIEW_BUS_H
+
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../libraries/miniaudio.h"
+#include "tracer.h"
+
+/*
+ * The PreviewBus class plays a file on a second output device (eg: headphones),
+ * independently of the main playback, so that the next file can be auditioned
+ * while the program goes on.
+ * It shares the audio context of the Audio class but nothing else: It has its own
+ * decoder, ring buffer and device. A feeder thread opens, seeks and decodes the
+ * file into the ring buffer, and the device callback only copies the frames out,
+ * so the disk reads and the decoder setup never run on an audio thread.
+ * The device itself is opened and closed from the application thread, like the
+ * main one, as miniaudio doesn't allow initializing the devices of a context from
+ * several threads at once.
+ */
+class PreviewBus {
+    private:
+        ma_context* pContext;
+        ma_decoder_config decoderConfig;
+        ma_device device;
+        ma_device_id deviceID;
+        bool useDefaultDevice = true;
+        bool deviceInit = false;
+        // Held while the device is started or stopped, so that the feeder knows
+        // whether the callback may be reading the ring buffer.
+        std::mutex deviceMutex;
+        bool deviceStarted = false;
+        // Feeder thread only.
+        ma_decoder decoder;
+        bool decoderInit = false;
+        ma_pcm_rb ringBuffer;
+        bool ringBufferInit = false;
+        std::thread feeder;
+        // Requests handed to the feeder, the last one of a kind wins.
+        std::mutex requestMutex;
+        std::condition_variable requestReady;
+        std::string requestedFile;
+        bool openRequested = false;
+        bool closeRequested = false;
+        ma_int64 requestedSeek = -1;
+        bool stopping = false;
+        // Requests made and served, the end of the file only stops the playback
+        // once the feeder has caught up.
+        std::atomic<ma_uint64> requestCount = 0;
+        std::atomic<ma_uint64> servedCount = 0;
+        // Set by the feeder, the callback drops the queued frames and clears it.
+        std::atomic<bool> flushRequested = false;
+        std::atomic<bool> endReached = false;
+        std::atomic<bool> opened = false;
+        std::atomic<bool> playing = false;
+        std::atomic<float> gain = 1.0f;
+        // Position of the frames played.
+        std::atomic<ma_uint64> position = 0;
+        std::atomic<ma_uint64> lengthInFrames = 0;
+        std::atomic<ma_uint64> underruns = 0;
+        // Callback only: Frames played since the last flush, the first ones are faded in.
+        ma_uint32 fadeFrames = 0;
+        // Ring buffer length in milliseconds.
+        static constexpr ma_uint32 bufferLength = 500;
+        // Frames decoded at once, so that the requests are served quickly.
+        static constexpr ma_uint32 fillFrames = 4096;
+        // Fade in after a seek (~6ms).
+        static constexpr ma_uint32 fadeLength = 256;
+        static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount);
+        void render(float* pOutput, ma_uint32 frameCount);
+        void feed();
+        bool fill();
+        void flush();
+        bool initDevice();
+        void uninitDevice();
+
+    public:
+        PreviewBus(ma_context* context, const ma_decoder_config& config);
+        ~PreviewBus();
+
+        bool open(const std::string& fileName);
+        void seek(ma_uint64 frames);
+        void close();
+        void setPlaying(bool play);
+        void setDevice(const ma_device_id* pDeviceID);
+        void setGain(float value) { gain.store(value, std::memory_order_relaxed); }
+
+        // Getters.
+        bool isOpen() { return opened.load(std::memory_order_relaxed); }
+        bool isPlaying() { return playing.load(std::memory_order_relaxed); }
+        ma_uint64 getPosition() { return position.load(std::memory_order_relaxed); }
+        ma_uint64 getLengthInPcmFrames() { return lengthInFrames.load(std::memory_order_relaxed); }
+        ma_uint32 getSampleRate() { return decoderConfig.sampleRate; }
+        double getSeconds() { return (double)getPosition() / decoderConfig.sampleRate; }
+        // Blocks the device had to play short, outside of the seeks.
+        ma_uint64 getUnderruns() { return underruns.load(std::memory_order_relaxed); }
+};
+
+#endif // PREVIEW_BUS_H
@@ -0,0 +1,274 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "realtime.h"
+
+/*
+ * Sets the scheduling policy and the CPU affinity of the calling thread.
+ * The priority offset ranks the helper threads below the audio callback.
+ * Note: Called from the audio callback, so nothing is allocated nor printed here.
+ */
+void Realtime::applyToCurrentThread(const Options& options, int priorityOffset, ThreadStatus& status)
+{
+    int schedulingError = 0;
+    int affinityError = 0;
+    int priority = 0;
+
+    if (options.policy != policyDefault) {
+        int policy = (options.policy == policyFifo) ? SCHED_FIFO : SCHED_RR;
+        priority = std::clamp(options.priority + priorityOffset, sched_get_priority_min(policy), sched_get_priority_max(policy));
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        // Returns the error rather than setting errno.
+        schedulingError = pthread_setschedparam(pthread_self(), policy, &param);
+    }
+
+    if (options.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpu, &cpus);
+        affinityError = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    status.schedulingError.store(schedulingError, std::memory_order_relaxed);
+    status.affinityError.store(affinityError, std::memory_order_relaxed);
+    status.priority.store(priority, std::memory_order_relaxed);
+    status.applied.store(true, std::memory_order_release);
+}
+
+/*
+ * Returns a line telling whether the requests of the given thread were granted.
+ */
+std::string Realtime::describe(const Options& options, const char* threadName, const ThreadStatus& status)
+{
+    std::string report = std::string(threadName) + ": ";
+
+    if (options.policy == policyDefault && options.cpu < 0) {
+        return report + "default scheduling";
+    }
+
+    if (!status.applied.load(std::memory_order_acquire)) {
+        return report + "pending (the thread hasn't run yet)";
+    }
+
+    char buffer[200];
+    int error = status.schedulingError.load(std::memory_order_relaxed);
+
+    if (options.policy == policyDefault) {
+        report += "default scheduling";
+    }
+    else if (error == 0) {
+        snprintf(buffer, sizeof(buffer), "%s priority %d granted", getPolicyName(options.policy),
+                 status.priority.load(std::memory_order_relaxed));
+        report += buffer;
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), "%s denied (%s)%s", getPolicyName(options.policy), strerror(error),
+                 (error == EPERM) ? ", raise RLIMIT_RTPRIO (eg: @audio - rtprio 95) or grant CAP_SYS_NICE" : "");
+        report += buffer;
+    }
+
+    if (options.cpu >= 0) {
+        error = status.affinityError.load(std::memory_order_relaxed);
+
+        if (error == 0) {
+            snprintf(buffer, sizeof(buffer), ", pinned to CPU %d", options.cpu);
+        }
+        else {
+            snprintf(buffer, sizeof(buffer), ", CPU %d pinning denied (%s)", options.cpu, strerror(error));
+        }
+
+        report += buffer;
+    }
+
+    return report;
+}
+
+/*
+ * Locks (or unlocks) the process pages in memory and returns the report.
+ * The future allocations are locked only if the limit allows it, as they would
+ * fail past the limit otherwise.
+ */
+std::string Realtime::lockMemory(bool enable)
+{
+    if (!enable) {
+        munlockall();
+        return "Memory: not locked";
+    }
+
+    struct rlimit limit;
+    bool unlimited = (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+
+    if (mlockall(unlimited ? (MCL_CURRENT | MCL_FUTURE) : MCL_CURRENT) != 0) {
+        char buffer[200];
+        snprintf(buffer, sizeof(buffer), "Memory: locking denied (%s), raise RLIMIT_MEMLOCK (%llu KB) or grant CAP_IPC_LOCK",
+                 strerror(errno), (unsigned long long)(limit.rlim_cur / 1024));
+        return buffer;
+    }
+
+    return unlimited ? "Memory: locked" : "Memory: current pages locked (RLIMIT_MEMLOCK is limited, the new ones aren't)";
+}
+
+int Realtime::getCpuCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+const char* Realtime::getPolicyName(Policy policy)
+{
+    switch (policy) {
+        case policyFifo:
+            return "SCHED_FIFO";
+        case policyRoundRobin:
+            return "SCHED_RR";
+        default:
+            return "default";
+    }
+}
+
+/*
+ * Eg: "fifo" or "rr", anything else is the default policy.
+ */
+Realtime::Policy Realtime::getPolicy(const std::string& name)
+{
+    if (name == "fifo") {
+        return policyFifo;
+    }
+
+    if (name == "rr") {
+        return policyRoundRobin;
+    }
+
+    return policyDefault;
+}
+
+/*
+ * Wakes up every millisecond (ie: like an audio thread with a 1 ms period) while
+ * the other threads load the CPUs, and returns the wakeup latencies in microseconds.
+ */
+static std::vector<double> measureWakeups(const Realtime::Options& options, Realtime::ThreadStatus& status, int seconds)
+{
+    std::vector<double> latencies;
+    latencies.reserve(seconds * 1000);
+
+    std::thread measure([&]() {
+        Realtime::applyToCurrentThread(options, 0, status);
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+
+        for (int i = 0; i < seconds * 1000; i++) {
+            next.tv_nsec += 1000000;
+
+            if (next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            latencies.push_back((now.tv_sec - next.tv_sec) * 1e6 + (now.tv_nsec - next.tv_nsec) / 1e3);
+        }
+    });
+
+    measure.join();
+    std::sort(latencies.begin(), latencies.end());
+
+    return latencies;
+}
+
+/*
+ * Compares the wakeup latency of a thread with the default scheduling and with the
+ * requested one, while all of the CPUs are busy.
+ * Usage: Player --bench-realtime [fifo|rr] [PRIORITY] [CPU] [--lock]
+ */
+int Realtime::benchmark(const std::vector<std::string>& arguments)
+{
+    Options options;
+    options.policy = policyFifo;
+    std::vector<std::string> values;
+
+    for (const std::string& argument : arguments) {
+        if (argument == "--lock") {
+            options.lockMemory = true;
+        }
+        else {
+            values.push_back(argument);
+        }
+    }
+
+    if (values.size() > 0) {
+        options.policy = getPolicy(values[0]);
+    }
+
+    if (values.size() > 1) {
+        options.priority = std::atoi(values[1].c_str());
+    }
+
+    if (values.size() > 2) {
+        options.cpu = std::atoi(values[2].c_str());
+    }
+
+    if (options.lockMemory) {
+        printf("%s\n", lockMemory(true).c_str());
+    }
+
+    const int seconds = 5;
+    int loadThreads = getCpuCount() * 2;
+    std::atomic<bool> loading = true;
+    std::vector<std::thread> load;
+
+    // Busy threads, churning memory so that the caches are disturbed as well.
+    for (int i = 0; i < loadThreads; i++) {
+        load.emplace_back([&loading]() {
+            std::vector<char> memory(4 * 1024 * 1024);
+            size_t position = 0;
+
+            while (loading.load(std::memory_order_relaxed)) {
+                memory[position] += 1;
+                position = (position + 4096 + 64) % memory.size();
+            }
+        });
+    }
+
+    printf("Wakeup latency every 1 ms for %d s, %d load threads on %d CPUs:\n", seconds, loadThreads, getCpuCount());
+    int status = 0;
+    Options defaultOptions;
+    defaultOptions.cpu = options.cpu;
+
+    for (const Options* pOptions : {&defaultOptions, &options}) {
+        ThreadStatus threadStatus;
+        std::vector<double> latencies = measureWakeups(*pOptions, threadStatus, seconds);
+
+        if (latencies.empty()) {
+            continue;
+        }
+
+        auto percentile = [&latencies](double p) { return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+        size_t late = latencies.end() - std::upper_bound(latencies.begin(), latencies.end(), 1000.0);
+        printf("  %-10s p50 %7.1f us, p99 %7.1f us, p99.9 %8.1f us, max %8.1f us, %zu wakeups later than a period\n",
+               getPolicyName(pOptions->policy), percentile(0.5), percentile(0.99), percentile(0.999), latencies.back(), late);
+        printf("             %s\n", describe(*pOptions, "Thread", threadStatus).c_str());
+
+        if (pOptions->policy != policyDefault && threadStatus.schedulingError.load() != 0) {
+            status = 1;
+        }
+    }
+
+    loading.store(false);
+
+    for (std::thread& thread : load) {
+        thread.join();
+    }
+
+    return status;
+}
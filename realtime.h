@@ -0,0 +1,47 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <string>
+#include <atomic>
+#include <vector>
+
+/*
+ * The Realtime class requests the real-time scheduling and the CPU affinity of the
+ * audio threads, and locks the process memory so that the audio path doesn't
+ * stall on page faults.
+ * Each request is done by the thread itself (eg: from the first audio callback),
+ * which keeps its outcome in a ThreadStatus read later on to report whether the
+ * privileges were granted.
+ */
+class Realtime {
+    public:
+        enum Policy { policyDefault, policyFifo, policyRoundRobin };
+
+        struct Options {
+            Policy policy = policyDefault;
+            // From 1 to 99.
+            int priority = 70;
+            bool lockMemory = false;
+            // -1 lets the threads run on any CPU.
+            int cpu = -1;
+        };
+
+        // Written by the thread itself, read by the others.
+        struct ThreadStatus {
+            std::atomic<bool> applied = false;
+            // errno values, zero means granted.
+            std::atomic<int> schedulingError = 0;
+            std::atomic<int> affinityError = 0;
+            std::atomic<int> priority = 0;
+        };
+
+        static void applyToCurrentThread(const Options& options, int priorityOffset, ThreadStatus& status);
+        static std::string describe(const Options& options, const char* threadName, const ThreadStatus& status);
+        static std::string lockMemory(bool enable);
+        static int getCpuCount();
+        static const char* getPolicyName(Policy policy);
+        static Policy getPolicy(const std::string& name);
+        static int benchmark(const std::vector<std::string>& arguments);
+};
+
+#endif // REALTIME_H
@@ -0,0 +1,264 @@
+#include "recorder.h"
+
+/*
+ * Constructor: The recorder shares the audio context of the Audio class.
+ */
+Recorder::Recorder(ma_context* context) : pContext(context) {
+}
+
+/*
+ * Destructor: Makes sure the recording is properly finalized before closing the app.
+ */
+Recorder::~Recorder() {
+    stop();
+}
+
+/*
+ * Uninitializes the capture device, the encoder and the ring buffer.
+ */
+void Recorder::uninit()
+{
+    if (captureDeviceInit) {
+        ma_device_uninit(&captureDevice);
+        captureDeviceInit = false;
+    }
+
+    if (encoderInit) {
+        // Note: The WAV header is finalized when the encoder is uninitialized.
+        ma_encoder_uninit(&encoder);
+        encoderInit = false;
+    }
+
+    if (ringBufferInit) {
+        ma_pcm_rb_uninit(&ringBuffer);
+        ringBufferInit = false;
+    }
+}
+
+/*
+ * Callback used by MiniAudio to hand the captured frames over.
+ */
+static void capture_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    Recorder* pRecorder = (Recorder*)pDevice->pUserData;
+
+    if (pRecorder == nullptr || pInput == nullptr) {
+        return;
+    }
+
+    pRecorder->push(pInput, frameCount);
+}
+
+/*
+ * Copies the captured frames into the ring buffer.
+ * Note: This function is called from the device thread so it must never block
+ *       nor allocate. Frames that don't fit are dropped and counted.
+ */
+void Recorder::push(const void* pInput, ma_uint32 frameCount)
+{
+    const ma_uint8* pFrames = (const ma_uint8*)pInput;
+    ma_uint32 bytesPerFrame = ma_get_bytes_per_frame(captureFormat, captureChannels);
+    ma_uint32 framesLeft = frameCount;
+
+    // The ring buffer may wrap around, so the copy can take two passes.
+    while (framesLeft > 0) {
+        ma_uint32 framesToWrite = framesLeft;
+        void* pBuffer;
+
+        if (ma_pcm_rb_acquire_write(&ringBuffer, &framesToWrite, &pBuffer) != MA_SUCCESS || framesToWrite == 0) {
+            break;
+        }
+
+        memcpy(pBuffer, pFrames, framesToWrite * bytesPerFrame);
+        ma_pcm_rb_commit_write(&ringBuffer, framesToWrite);
+
+        pFrames += framesToWrite * bytesPerFrame;
+        framesLeft -= framesToWrite;
+    }
+
+    if (framesLeft > 0) {
+        droppedFrames.fetch_add(framesLeft, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Drains the ring buffer into the encoder until the recording is stopped.
+ * Note: This function is run in a thread so that the disk writes never
+ *       hold the capture callback.
+ */
+void Recorder::write()
+{
+    while (true) {
+        // Check the flag before draining so that the frames captured before stop() are written.
+        bool recording = isRecording();
+        ma_uint32 framesToRead = ma_pcm_rb_available_read(&ringBuffer);
+
+        if (framesToRead == 0) {
+            if (!recording) {
+                break;
+            }
+
+            // Wait for the capture callback to fill the buffer.
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = 10 * 1000000}; // 10ms
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        ma_uint64 maxFileFrames = maxFileBytes / ma_get_bytes_per_frame(captureFormat, captureChannels);
+
+        // The current file is full.
+        if (fileFrames >= maxFileFrames) {
+            if (!rollOver()) {
+                // The capture goes on until stopped, the frames are then dropped.
+                break;
+            }
+
+            continue;
+        }
+
+        framesToRead = (ma_uint32)std::min((ma_uint64)framesToRead, maxFileFrames - fileFrames);
+        void* pBuffer;
+
+        if (ma_pcm_rb_acquire_read(&ringBuffer, &framesToRead, &pBuffer) != MA_SUCCESS) {
+            break;
+        }
+
+        ma_uint64 framesWritten = 0;
+        ma_encoder_write_pcm_frames(&encoder, pBuffer, framesToRead, &framesWritten);
+        ma_pcm_rb_commit_read(&ringBuffer, framesToRead);
+
+        fileFrames += framesToRead;
+        writtenFrames.fetch_add(framesWritten, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Creates the WAV file to write into.
+ */
+bool Recorder::initEncoder(const std::string& name)
+{
+    // Note: MiniAudio only supports WAV encoding.
+    ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, captureFormat, captureChannels, captureSampleRate);
+
+    if (ma_encoder_init_file(name.c_str(), &encoderConfig, &encoder) != MA_SUCCESS) {
+        std::cerr << "Failed to create the recording file: " << name << std::endl;
+        return false;
+    }
+
+    encoderInit = true;
+    fileFrames = 0;
+    fileNames.push_back(name);
+
+    return true;
+}
+
+/*
+ * Closes the current file, which is about to reach the WAV size limit, and goes
+ * on in a new one (eg: recording-2.wav).
+ * Note: Called from the writer thread.
+ */
+bool Recorder::rollOver()
+{
+    // Finalizes the WAV header.
+    ma_encoder_uninit(&encoder);
+    encoderInit = false;
+
+    std::string name = fileName;
+    size_t extension = name.rfind('.');
+    std::string suffix = "-" + std::to_string(fileNames.size() + 1);
+    name.insert((extension == std::string::npos) ? name.size() : extension, suffix);
+
+    printf("\nRecording: '%s' is full (4GB WAV limit), going on in '%s'\n", fileNames.back().c_str(), name.c_str());
+
+    if (!initEncoder(name)) {
+        std::cerr << "Recording stopped: " << fileNames.size() << " file(s) written." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Opens the given capture device and starts recording into the given file.
+ */
+bool Recorder::start(const ma_device_id* pDeviceID, const char* filename)
+{
+    if (isRecording()) {
+        std::cerr << "A recording is already in progress." << std::endl;
+        return false;
+    }
+
+    droppedFrames.store(0, std::memory_order_relaxed);
+    writtenFrames.store(0, std::memory_order_relaxed);
+    fileName = filename;
+    fileNames.clear();
+
+    // The ring buffer is allocated once per recording and never grows.
+    ma_uint32 bufferSizeInFrames = captureSampleRate * bufferLength / 1000;
+
+    if (ma_pcm_rb_init(captureFormat, captureChannels, bufferSizeInFrames, NULL, NULL, &ringBuffer) != MA_SUCCESS) {
+        std::cerr << "Failed to initialize the recording buffer." << std::endl;
+        return false;
+    }
+
+    ringBufferInit = true;
+
+    if (!initEncoder(fileName)) {
+        uninit();
+        return false;
+    }
+
+    // Configure capture device parameters.
+    ma_device_config deviceConfig = ma_device_config_init(ma_device_type_capture);
+    deviceConfig.capture.pDeviceID = pDeviceID;
+    deviceConfig.capture.format = captureFormat;
+    deviceConfig.capture.channels = captureChannels;
+    deviceConfig.sampleRate = captureSampleRate;
+    deviceConfig.dataCallback = capture_callback;
+    deviceConfig.pUserData = this;
+
+    if (ma_device_init(pContext, &deviceConfig, &captureDevice) != MA_SUCCESS) {
+        std::cerr << "Failed to initialize capture device." << std::endl;
+        uninit();
+        return false;
+    }
+
+    captureDeviceInit = true;
+    is_recording.store(true, std::memory_order_relaxed);
+    // Launch the writer before the device so that the buffer is drained from the start.
+    writer = std::thread(&Recorder::write, this);
+
+    if (ma_device_start(&captureDevice) != MA_SUCCESS) {
+        std::cerr << "Failed to start capture device." << std::endl;
+        stop();
+        return false;
+    }
+
+    printf("Recording to '%s'\n", filename);
+
+    return true;
+}
+
+/*
+ * Stops the capture device, flushes the remaining frames and closes the file.
+ */
+void Recorder::stop()
+{
+    if (!captureDeviceInit) {
+        return;
+    }
+
+    // Ensure no more callbacks are running.
+    ma_device_stop(&captureDevice);
+    is_recording.store(false, std::memory_order_relaxed);
+
+    // Wait for the writer thread to drain the ring buffer.
+    if (writer.joinable()) {
+        writer.join();
+    }
+
+    uninit();
+
+    printf("Recording stopped: %.2f seconds written, %llu frames dropped.\n",
+           getRecordedSeconds(), (unsigned long long)getDroppedFrames());
+}
@@ -0,0 +1,72 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <time.h>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The Recorder class captures the selected input device into a file.
+ * The capture callback only pushes frames into a lock-free ring buffer, while a
+ * writer thread drains that buffer into the encoder. Memory usage is thus
+ * constant whatever the recording length.
+ * A WAV file can't exceed 4GB (about 6.7 hours at the recording format), so the
+ * recording goes on in a new file (eg: recording-2.wav) before the limit.
+ */
+class Recorder {
+    private:
+        ma_context* pContext;
+        ma_device captureDevice;
+        ma_encoder encoder;
+        ma_pcm_rb ringBuffer;
+        std::thread writer;
+        bool captureDeviceInit = false;
+        bool encoderInit = false;
+        bool ringBufferInit = false;
+        std::atomic<bool> is_recording = false;
+        // Frames that couldn't fit in the ring buffer (ie: the writer thread is late).
+        std::atomic<ma_uint64> droppedFrames = 0;
+        std::atomic<ma_uint64> writtenFrames = 0;
+        std::string fileName;
+        // Files written so far, the first one included. Set by the writer thread.
+        std::vector<std::string> fileNames;
+        // Frames written into the current file.
+        ma_uint64 fileFrames = 0;
+        // Recording parameters.
+        const ma_format captureFormat = ma_format_s16;
+        const ma_uint32 captureChannels = 2;
+        const ma_uint32 captureSampleRate = 44100;
+        // Ring buffer length in milliseconds.
+        const ma_uint32 bufferLength = 2000;
+        // Data bytes per file: The RIFF sizes are 32 bit, with some room for the header.
+        const ma_uint64 maxFileBytes = 0xFFFFFFFFull - 4096;
+        void uninit();
+        void write();
+        bool initEncoder(const std::string& name);
+        bool rollOver();
+
+    public:
+        Recorder(ma_context* context);
+        ~Recorder();
+
+        bool start(const ma_device_id* pDeviceID, const char* filename);
+        void stop();
+        void push(const void* pInput, ma_uint32 frameCount);
+
+        // Getters.
+        bool isRecording() { return is_recording.load(std::memory_order_relaxed); }
+        ma_uint64 getDroppedFrames() { return droppedFrames.load(std::memory_order_relaxed); }
+        ma_uint64 getWrittenFrames() { return writtenFrames.load(std::memory_order_relaxed); }
+        double getRecordedSeconds() { return (double)getWrittenFrames() / captureSampleRate; }
+        std::string getFileName() { return fileName; }
+        // Note: Only to be read once the recording is stopped.
+        const std::vector<std::string>& getFileNames() { return fileNames; }
+};
+
+#endif // RECORDER_H
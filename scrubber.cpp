@@ -0,0 +1,342 @@
+#include "scrubber.h"
+
+/*
+ * Constructor: The frames are decoded at the playback format (the channel count is
+ * set per file).
+ */
+Scrubber::Scrubber(const ma_decoder_config& config) : decoderConfig(config) {
+    decoderConfig.format = ma_format_f32;
+    sampleRate = config.sampleRate;
+    windowFrames = (ma_uint64)sampleRate * 6;
+
+    // Periodic window, so that the grains overlapping by half add up to a constant level.
+    hann.resize(grainFrames);
+
+    for (ma_uint32 i = 0; i < grainFrames; i++) {
+        hann[i] = 0.5f - 0.5f * std::cos(2.0f * (float)M_PI * i / grainFrames);
+    }
+}
+
+Scrubber::~Scrubber() {
+    close();
+}
+
+/*
+ * Sets the file to scrub. The window decoder is only opened on the first drag.
+ * Note: The callback mustn't be scrubbing.
+ */
+void Scrubber::setFile(const std::string& fileName, ma_uint32 channels, ma_uint64 totalFrames,
+                       std::shared_ptr<PcmCache::Entry> cachedFile)
+{
+    close();
+
+    this->fileName = fileName;
+    this->channels = channels;
+    this->totalFrames = totalFrames;
+    this->cachedFile = cachedFile;
+    decoderConfig.channels = channels;
+}
+
+/*
+ * Stops the worker and forgets the file.
+ * Note: The callback mustn't be scrubbing.
+ */
+void Scrubber::close()
+{
+    active.store(false, std::memory_order_relaxed);
+
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        windowRequested.notify_one();
+        worker.join();
+        stopping = false;
+    }
+
+    requested = false;
+    requestedStart = 0;
+    requestedEnd = 0;
+    activeWindow.store(-1);
+    windowInUse.store(-1);
+    cachedFile.reset();
+    fileName.clear();
+    totalFrames = 0;
+}
+
+/*
+ * Returns the first frame of the window centred (as much as possible) on the given position.
+ */
+ma_uint64 Scrubber::getWindowStart(ma_uint64 centre)
+{
+    if (totalFrames <= windowFrames) {
+        return 0;
+    }
+
+    ma_uint64 start = (centre > windowFrames / 2) ? centre - windowFrames / 2 : 0;
+
+    return std::min(start, totalFrames - windowFrames);
+}
+
+/*
+ * Asks the worker for a window around the given position. Only the latest request
+ * is served.
+ */
+void Scrubber::requestWindow(ma_uint64 position)
+{
+    requestedStart = getWindowStart(position);
+    requestedEnd = std::min(requestedStart + windowFrames, totalFrames);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requestedCentre = position;
+        requested = true;
+    }
+
+    if (!worker.joinable()) {
+        worker = std::thread(&Scrubber::run, this);
+    }
+
+    windowRequested.notify_one();
+}
+
+/*
+ * Moves the scrub position as the slider is dragged, and works the speed out from
+ * the previous drag events.
+ * Note: Called from the application thread.
+ */
+void Scrubber::moveTo(ma_uint64 position)
+{
+    if (fileName.empty() || totalFrames == 0) {
+        return;
+    }
+
+    position = std::min(position, totalFrames);
+    ma_int64 time = now();
+
+    // First drag event: The grains start as soon as the mouse moves on.
+    if (!isActive()) {
+        lastPosition = position;
+        lastTime = time;
+        smoothedSpeed = 0.0f;
+        dragSpeed.store(0.0f, std::memory_order_relaxed);
+        sessions.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        double elapsed = (double)(time - lastTime) / 1e9;
+
+        // The events too close to each other give a meaningless speed, they're merged.
+        if (elapsed >= 0.005) {
+            float speed = (float)(((double)position - (double)lastPosition) / (elapsed * sampleRate));
+            smoothedSpeed = 0.5f * smoothedSpeed + 0.5f * std::clamp(speed, -maxSpeed, maxSpeed);
+            lastPosition = position;
+            lastTime = time;
+            dragSpeed.store(smoothedSpeed, std::memory_order_relaxed);
+        }
+    }
+
+    dragPosition.store(position, std::memory_order_relaxed);
+    dragTime.store(time, std::memory_order_release);
+
+    // A new window is decoded before the drag gets out of the current one.
+    ma_uint64 margin = windowFrames / 4;
+    bool nearStart = requestedStart > 0 && position < requestedStart + margin;
+    bool nearEnd = requestedEnd < totalFrames && position + margin > requestedEnd;
+
+    if (!cachedFile && (requestedEnd == 0 || nearStart || nearEnd)) {
+        requestWindow(position);
+    }
+
+    active.store(true, std::memory_order_release);
+}
+
+/*
+ * Ends the scrubbing, the grains being played are dropped.
+ */
+void Scrubber::stop()
+{
+    active.store(false, std::memory_order_release);
+}
+
+/*
+ * Decodes the windows requested while dragging.
+ * Note: This function is run in a thread, the decoder belongs to it.
+ */
+void Scrubber::run()
+{
+    Tracer::setThreadName("Scrub worker");
+    ma_decoder decoder;
+    bool decoderInit = false;
+
+    while (true) {
+        ma_uint64 centre;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            windowRequested.wait(lock, [this] { return requested || stopping; });
+
+            if (stopping) {
+                break;
+            }
+
+            centre = requestedCentre;
+            requested = false;
+        }
+
+        // Fill the window not in use by the callback.
+        int active = activeWindow.load();
+        int index = (active == 0) ? 1 : 0;
+
+        // The callback may still be reading it (ie: it's just been replaced).
+        while (windowInUse.load() == index) {
+            std::this_thread::yield();
+        }
+
+        if (decodeWindow(decoder, decoderInit, windows[index], centre)) {
+            activeWindow.store(index);
+        }
+    }
+
+    if (decoderInit) {
+        ma_decoder_uninit(&decoder);
+    }
+}
+
+/*
+ * Decodes the window around the given position. A single seek is done per window.
+ */
+bool Scrubber::decodeWindow(ma_decoder& decoder, bool& decoderInit, Window& window, ma_uint64 centre)
+{
+    Tracer::Scope trace("Decode scrub window");
+
+    if (!decoderInit) {
+        if (ma_decoder_init_file(fileName.c_str(), &decoderConfig, &decoder) != MA_SUCCESS) {
+            std::cerr << "Failed to initialize the scrub decoder." << std::endl;
+            return false;
+        }
+
+        decoderInit = true;
+    }
+
+    window.start = getWindowStart(centre);
+    // Allocated once per channel count, the size doesn't change from a window to the next.
+    window.frames.resize(windowFrames * channels);
+    ma_uint64 framesRead = 0;
+
+    if (ma_decoder_seek_to_pcm_frame(&decoder, window.start) != MA_SUCCESS) {
+        return false;
+    }
+
+    ma_decoder_read_pcm_frames(&decoder, window.frames.data(), windowFrames, &framesRead);
+    window.frameCount = framesRead;
+
+    return framesRead > 0;
+}
+
+/*
+ * Fills the given buffer (at the file channel count) with the grains. Returns the
+ * scrub position.
+ * Note: This function is called from the device thread. The grains falling out of
+ *       the decoded window (ie: it's being decoded) are silent.
+ */
+ma_uint64 Scrubber::render(float* pFrames, ma_uint32 frameCount)
+{
+    memset(pFrames, 0, (size_t)frameCount * channels * sizeof(float));
+
+    // A new drag: The grains of the previous one are dropped.
+    ma_uint64 session = sessions.load(std::memory_order_relaxed);
+
+    if (session != renderedSession) {
+        renderedSession = session;
+        grains[0].frame = grainFrames;
+        grains[1].frame = grainFrames;
+        hopOffset = 0;
+    }
+
+    const float* pSource = nullptr;
+    ma_uint64 sourceStart = 0;
+    ma_uint64 sourceCount = 0;
+
+    if (cachedFile) {
+        pSource = (const float*)cachedFile->data.data();
+        sourceCount = cachedFile->frameCount;
+    }
+    else {
+        int index = activeWindow.load();
+
+        // Tell the worker which window is read, then make sure it's still the active one.
+        while (index >= 0) {
+            windowInUse.store(index);
+            int current = activeWindow.load();
+
+            if (current == index) {
+                break;
+            }
+
+            index = current;
+        }
+
+        if (index >= 0) {
+            pSource = windows[index].frames.data();
+            sourceStart = windows[index].start;
+            sourceCount = windows[index].frameCount;
+        }
+    }
+
+    double speed = dragSpeed.load(std::memory_order_relaxed);
+    double position = (double)dragPosition.load(std::memory_order_relaxed);
+    double age = (double)(now() - dragTime.load(std::memory_order_acquire)) / 1e9;
+
+    // The mouse is still, the grains die out.
+    if (age > holdSeconds) {
+        speed = 0.0;
+    }
+    // Carry on at the drag speed since the last event, so that the grains follow each other.
+    else {
+        position += speed * age * sampleRate;
+    }
+
+    for (ma_uint32 i = 0; i < frameCount; i++) {
+        if (hopOffset == 0 && std::fabs(speed) >= minSpeed) {
+            Grain& grain = grains[nextGrain];
+            nextGrain ^= 1;
+            grain.position = position + speed * i;
+            grain.step = speed;
+            grain.frame = 0;
+        }
+
+        hopOffset = (hopOffset + 1) % hopFrames;
+        float* pOut = pFrames + (size_t)i * channels;
+
+        for (Grain& grain : grains) {
+            if (grain.frame >= grainFrames) {
+                continue;
+            }
+
+            double offset = grain.position - (double)sourceStart;
+            float weight = hann[grain.frame];
+            grain.position += grain.step;
+            grain.frame++;
+
+            if (pSource == nullptr || offset < 0.0 || offset + 1.0 >= (double)sourceCount) {
+                continue;
+            }
+
+            // Linear interpolation between the source frames.
+            ma_uint64 frame = (ma_uint64)offset;
+            float fraction = (float)(offset - (double)frame);
+            const float* pA = pSource + frame * channels;
+            const float* pB = pA + channels;
+
+            for (ma_uint32 c = 0; c < channels; c++) {
+                pOut[c] += (pA[c] + (pB[c] - pA[c]) * fraction) * weight;
+            }
+        }
+    }
+
+    windowInUse.store(-1, std::memory_order_release);
+
+    return (ma_uint64)std::clamp(position, 0.0, (double)totalFrames);
+}
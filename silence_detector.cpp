@@ -0,0 +1,249 @@
+#include <cmath>
+#include <chrono>
+#include "silence_detector.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Constructor: The decoder configuration sets the format and sample rate the files are
+ * scanned in (ie: the frame positions match the player ones). The handler is called
+ * on the GUI thread once a scan is done.
+ */
+SilenceDetector::SilenceDetector(const ma_decoder_config& config, Fl_Awake_Handler handler, void* data)
+    : decoderConfig(config), handler(handler), pHandlerData(data) {
+}
+
+SilenceDetector::~SilenceDetector() {
+    stopScanThread();
+}
+
+/*
+ * Cancels and waits for a possible scan in progress.
+ */
+void SilenceDetector::stopScanThread()
+{
+    stopScanning.store(true);
+
+    if (scanThread.joinable()) {
+        scanThread.join();
+    }
+
+    stopScanning.store(false);
+}
+
+/*
+ * Sets the level (in dBFS) under which the frames are silent. The results found with
+ * another threshold are ignored, ie: the files are scanned again on the next request.
+ */
+void SilenceDetector::setThreshold(float decibels)
+{
+    thresholdDb.store(decibels);
+}
+
+/*
+ * Returns the scan result of the given file with the current threshold, or nullptr if
+ * the file hasn't been scanned (yet).
+ */
+std::shared_ptr<const SilenceDetector::Result> SilenceDetector::find(const std::string& fileName)
+{
+    std::error_code error;
+    auto lastWriteTime = std::filesystem::last_write_time(fileName, error);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = results.begin(); it != results.end(); ++it) {
+        if ((*it)->fileName != fileName || (*it)->thresholdDb != thresholdDb.load()) {
+            continue;
+        }
+
+        // The file has been modified since it was scanned.
+        if (error || (*it)->lastWriteTime != lastWriteTime) {
+            results.erase(it);
+            return nullptr;
+        }
+
+        // Move the result to the front (ie: most recently used).
+        results.splice(results.begin(), results, it);
+
+        return results.front();
+    }
+
+    return nullptr;
+}
+
+/*
+ * Starts scanning the given file in the background, at the given channel count.
+ * The frames of a cached file are scanned in place.
+ */
+void SilenceDetector::request(const std::string& fileName, ma_uint32 channels, std::shared_ptr<PcmCache::Entry> cachedFile)
+{
+    // Only one file is scanned at a time, the latest request wins.
+    stopScanThread();
+
+    std::shared_ptr<Result> result = std::make_shared<Result>();
+    result->fileName = fileName;
+    result->thresholdDb = thresholdDb.load();
+
+    std::error_code error;
+    result->lastWriteTime = std::filesystem::last_write_time(fileName, error);
+
+    if (error) {
+        return;
+    }
+
+    scanThread = std::thread(&SilenceDetector::run, this, result, channels, cachedFile);
+}
+
+/*
+ * Returns the highest absolute value of the given samples.
+ */
+float SilenceDetector::getPeak(const float* pSamples, size_t sampleCount)
+{
+    size_t i = 0;
+    float peak = 0.0f;
+
+#if defined(__SSE__)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 peak0 = _mm_setzero_ps();
+    __m128 peak1 = _mm_setzero_ps();
+    __m128 peak2 = _mm_setzero_ps();
+    __m128 peak3 = _mm_setzero_ps();
+
+    // Four independent maxima so that the loads aren't serialized.
+    for (; i + 16 <= sampleCount; i += 16) {
+        peak0 = _mm_max_ps(peak0, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i)));
+        peak1 = _mm_max_ps(peak1, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i + 4)));
+        peak2 = _mm_max_ps(peak2, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i + 8)));
+        peak3 = _mm_max_ps(peak3, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i + 12)));
+    }
+
+    for (; i + 4 <= sampleCount; i += 4) {
+        peak0 = _mm_max_ps(peak0, _mm_andnot_ps(signMask, _mm_loadu_ps(pSamples + i)));
+    }
+
+    __m128 peaks = _mm_max_ps(_mm_max_ps(peak0, peak1), _mm_max_ps(peak2, peak3));
+    peaks = _mm_max_ps(peaks, _mm_movehl_ps(peaks, peaks));
+    peaks = _mm_max_ss(peaks, _mm_shuffle_ps(peaks, peaks, 1));
+    peak = _mm_cvtss_f32(peaks);
+#endif
+
+    for (; i < sampleCount; i++) {
+        peak = std::max(peak, std::fabs(pSamples[i]));
+    }
+
+    return peak;
+}
+
+/*
+ * Compares the peak of each window of the given frames with the threshold and keeps
+ * track of the audible and silent runs.
+ */
+void SilenceDetector::scanWindows(State& state, const float* pFrames, ma_uint64 frameCount, ma_uint32 channels, Result& result)
+{
+    for (ma_uint64 frame = 0; frame < frameCount; frame += windowFrames, state.window++) {
+        ma_uint64 framesInWindow = std::min((ma_uint64)windowFrames, frameCount - frame);
+        float peak = getPeak(pFrames + frame * channels, framesInWindow * channels);
+        bool audible = peak >= (state.audible ? state.closeLevel : state.openLevel);
+
+        if (audible) {
+            if (!state.found) {
+                state.found = true;
+                state.firstAudible = state.window;
+            }
+            // The sound is back after a long enough silence.
+            else if (!state.audible && state.window - state.silenceStart >= state.minGapWindows) {
+                result.gaps.push_back({state.silenceStart * windowFrames, state.window * windowFrames});
+            }
+
+            state.lastAudible = state.window;
+        }
+        else if (state.audible) {
+            state.silenceStart = state.window;
+        }
+
+        state.audible = audible;
+    }
+}
+
+/*
+ * Scans the whole file then stores the result.
+ * Note: This function is run in a thread.
+ */
+void SilenceDetector::run(std::shared_ptr<Result> result, ma_uint32 channels, std::shared_ptr<PcmCache::Entry> cachedFile)
+{
+    Tracer::setThreadName("Silence scan");
+    Tracer::Scope trace("Silence scan");
+    auto startTime = std::chrono::steady_clock::now();
+    State state;
+    state.openLevel = powf(10.0f, result->thresholdDb / 20.0f);
+    state.closeLevel = powf(10.0f, (result->thresholdDb - hysteresisDb) / 20.0f);
+    state.minGapWindows = (ma_uint64)(minGapSeconds * decoderConfig.sampleRate / windowFrames);
+
+    // The frames are already decoded.
+    if (cachedFile && cachedFile->channels == channels) {
+        const float* pFrames = (const float*)cachedFile->data.data();
+
+        while (!stopScanning.load() && result->totalFrames < cachedFile->frameCount) {
+            ma_uint64 framesToScan = std::min((ma_uint64)chunkFrames, cachedFile->frameCount - result->totalFrames);
+            scanWindows(state, pFrames + result->totalFrames * channels, framesToScan, channels, *result);
+            result->totalFrames += framesToScan;
+        }
+    }
+    else {
+        ma_decoder_config config = decoderConfig;
+        config.channels = channels;
+        // Half of the cores, the file is being played meanwhile.
+        ParallelDecoder decoder(config, std::max(1u, std::thread::hardware_concurrency() / 2));
+
+        if (!decoder.open(result->fileName)) {
+            return;
+        }
+
+        std::vector<float> frames(chunkFrames * channels);
+
+        while (!stopScanning.load()) {
+            ma_uint64 framesRead = 0;
+            decoder.read(frames.data(), chunkFrames, &framesRead);
+
+            if (framesRead == 0) {
+                break;
+            }
+
+            scanWindows(state, frames.data(), framesRead, channels, *result);
+            result->totalFrames += framesRead;
+        }
+    }
+
+    if (stopScanning.load() || result->totalFrames == 0) {
+        return;
+    }
+
+    if (state.found) {
+        result->start = state.firstAudible * windowFrames;
+        result->end = std::min((state.lastAudible + 1) * windowFrames, result->totalFrames);
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    double rate = decoderConfig.sampleRate;
+    printf("Silence scan: Lead-in %.2f s, tail %.2f s, %zu gap(s) (%.0f ms).\n", result->start / rate,
+           (result->totalFrames - result->end) / rate, result->gaps.size(), elapsed * 1000.0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Replace a possible previous result of the file.
+        results.remove_if([&result](const std::shared_ptr<const Result>& entry) {
+            return entry->fileName == result->fileName;
+        });
+
+        results.push_front(result);
+
+        if (results.size() > maxResults) {
+            results.pop_back();
+        }
+    }
+
+    if (handler != nullptr) {
+        Fl::awake(handler, pHandlerData);
+    }
+}
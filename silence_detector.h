@@ -0,0 +1,100 @@
+#ifndef SILENCE_DETECTOR_H
+#define SILENCE_DETECTOR_H
+
+#include <string>
+#include <iostream>
+#include <filesystem>
+#include <atomic>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <FL/Fl.H>
+#include "../libraries/miniaudio.h"
+#include "pcm_cache.h"
+#include "parallel_decoder.h"
+
+/*
+ * The SilenceDetector class finds where the audible content of a file starts and
+ * ends, along with the long silent gaps in between.
+ * The file is scanned on a background thread (from the PCM cache when the file is
+ * cached, decoded in parallel otherwise) in windows of windowFrames. The peak of each window is
+ * computed by an SSE kernel over the interleaved samples, then compared to the
+ * threshold with some hysteresis: The sound starts above the threshold and only
+ * stops below the threshold minus hysteresisDb. Silent runs shorter than the minimum
+ * gap duration are part of the sound.
+ * The results are kept per file (and per threshold) and the application is informed
+ * through Fl::awake once a scan is done.
+ */
+class SilenceDetector {
+    public:
+        struct Gap {
+            ma_uint64 start;
+            ma_uint64 end;
+        };
+        // Structure that holds the scan result of a file, in frames.
+        struct Result {
+            std::string fileName;
+            // Used to detect files modified since they were scanned.
+            std::filesystem::file_time_type lastWriteTime;
+            float thresholdDb = 0.0f;
+            ma_uint64 totalFrames = 0;
+            // First and last audible frames (end excluded). Both are zero if the file is silent.
+            ma_uint64 start = 0;
+            ma_uint64 end = 0;
+            std::vector<Gap> gaps;
+
+            bool isSilent() const { return end <= start; }
+        };
+
+        // 10ms at 44100Hz.
+        static constexpr ma_uint32 windowFrames = 441;
+        static constexpr float hysteresisDb = 6.0f;
+        // Shorter silent runs are part of the sound.
+        static constexpr double minGapSeconds = 2.0;
+
+    private:
+        ma_decoder_config decoderConfig;
+        Fl_Awake_Handler handler;
+        void* pHandlerData;
+        std::mutex mutex;
+        // The most recent result comes first.
+        std::list<std::shared_ptr<const Result>> results;
+        std::atomic<float> thresholdDb = -60.0f;
+        std::thread scanThread;
+        std::atomic<bool> stopScanning = false;
+        static constexpr size_t maxResults = 64;
+        // Number of frames decoded at once (a multiple of the window).
+        static constexpr ma_uint32 chunkFrames = windowFrames * 40;
+        // Scan state carried over from a chunk to the next.
+        struct State {
+            float openLevel;
+            float closeLevel;
+            ma_uint64 minGapWindows;
+            ma_uint64 window = 0;
+            bool audible = false;
+            bool found = false;
+            ma_uint64 firstAudible = 0;
+            ma_uint64 lastAudible = 0;
+            // Start of the current silent run.
+            ma_uint64 silenceStart = 0;
+        };
+        void run(std::shared_ptr<Result> result, ma_uint32 channels, std::shared_ptr<PcmCache::Entry> cachedFile);
+        void stopScanThread();
+        static void scanWindows(State& state, const float* pFrames, ma_uint64 frameCount, ma_uint32 channels, Result& result);
+
+    public:
+        SilenceDetector(const ma_decoder_config& config, Fl_Awake_Handler handler, void* data);
+        ~SilenceDetector();
+
+        std::shared_ptr<const Result> find(const std::string& fileName);
+        void request(const std::string& fileName, ma_uint32 channels, std::shared_ptr<PcmCache::Entry> cachedFile = nullptr);
+        void setThreshold(float decibels);
+        static float getPeak(const float* pSamples, size_t sampleCount);
+
+        // Getters.
+        float getThreshold() { return thresholdDb.load(); }
+};
+
+#endif // SILENCE_DETECTOR_H
@@ -0,0 +1,439 @@
+#include <cmath>
+#include <algorithm>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "spectrogram.h"
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Fast log2 (about 0.01 error), largely enough for 8 bit levels.
+ */
+static inline float fastLog2(float x)
+{
+    ma_uint32 bits;
+    memcpy(&bits, &x, sizeof(bits));
+    float exponent = (float)((int)((bits >> 23) & 0xFF) - 128);
+    // Mantissa within [1, 2), the polynomial approximates log2(mantissa) + 1.
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    float mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+
+    return exponent + (-0.34484843f * mantissa + 2.02466578f) * mantissa - 0.67487759f;
+}
+
+/*
+ * Constructor: The handler is called on the GUI thread as the computation goes on.
+ */
+Spectrogram::Spectrogram(Fl_Awake_Handler handler, void* data) : handler(handler), pHandlerData(data) {
+    window.resize(fftSize);
+
+    // Hann window, normalized so that a full scale sine peaks at 0 dBFS.
+    for (ma_uint32 i = 0; i < fftSize; i++) {
+        window[i] = (float)((1.0 - cos(2.0 * M_PI * i / fftSize)) * 2.0 / fftSize);
+    }
+}
+
+Spectrogram::~Spectrogram() {
+    stop();
+}
+
+/*
+ * Cancels and waits for a possible computation in progress.
+ */
+void Spectrogram::stop()
+{
+    stopWorkers.store(true);
+
+    if (setupThread.joinable()) {
+        setupThread.join();
+    }
+
+    stopWorkers.store(false);
+}
+
+/*
+ * Starts computing the spectrogram of the given file in the background.
+ */
+void Spectrogram::start(const std::string& fileName)
+{
+    stop();
+
+    this->fileName = fileName;
+    ready.store(false);
+    tiles.clear();
+    completedChunks.store(0);
+    failedChunks.store(0);
+    nextChunk.store(0);
+    elapsed.store(0.0);
+    startTime = std::chrono::steady_clock::now();
+    setupThread = std::thread(&Spectrogram::setup, this);
+}
+
+/*
+ * Gets the file length then computes the chunks along with the other workers.
+ * Note: This function is run in a thread.
+ */
+void Spectrogram::setup()
+{
+    Tracer::Scope trace("Spectrogram");
+    ma_decoder decoder;
+    // Mono, at the file sample rate.
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, 0);
+
+    if (ma_decoder_init_file(fileName.c_str(), &config, &decoder) != MA_SUCCESS) {
+        std::cerr << "Spectrogram: Failed to open '" << fileName << "'." << std::endl;
+        return;
+    }
+
+    totalFrames = 0;
+    ma_decoder_get_length_in_pcm_frames(&decoder, &totalFrames);
+    sampleRate = decoder.outputSampleRate;
+    ma_decoder_uninit(&decoder);
+
+    if (totalFrames == 0 || sampleRate == 0) {
+        return;
+    }
+
+    // A quarter of the block at least, more for the long files.
+    hop = std::max((ma_uint64)fftSize / 4, (totalFrames + maxColumns - 1) / maxColumns);
+    columnCount = (totalFrames + hop - 1) / hop;
+    // Half overlapping blocks cover the whole hop.
+    subBlocks = (hop + fftSize / 2 - 1) / (fftSize / 2);
+    subHop = hop / subBlocks;
+    chunkCount = (columnCount + chunkColumns - 1) / chunkColumns;
+    levels.assign(columnCount * rows, 0);
+    chunkDone.reset(new std::atomic<bool>[chunkCount]);
+
+    for (ma_uint64 i = 0; i < chunkCount; i++) {
+        chunkDone[i].store(false);
+    }
+
+    ready.store(true, std::memory_order_release);
+
+    // Leave a core to the playback.
+    unsigned int workerCount = std::max(1u, std::thread::hardware_concurrency() - 1);
+
+    for (unsigned int i = 1; i < workerCount; i++) {
+        workers.emplace_back(&Spectrogram::runWorker, this);
+    }
+
+    runWorker();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    workers.clear();
+
+    if (!stopWorkers.load()) {
+        elapsed.store(std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+        printf("Spectrogram: %llu columns computed in %.2f s by %u workers.\n", (unsigned long long)columnCount,
+               elapsed.load(), workerCount);
+
+        if (failedChunks.load() > 0) {
+            std::cerr << "Spectrogram: " << failedChunks.load() << " chunk(s) of '" << fileName << "' couldn't be decoded." << std::endl;
+        }
+
+        notify(true);
+    }
+}
+
+/*
+ * Takes the chunks one after another until there are none left.
+ * Note: This function is run in a thread.
+ */
+void Spectrogram::runWorker()
+{
+    // Below the playback and the GUI threads.
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+    Tracer::setThreadName("Spectrogram worker");
+
+    ma_decoder decoder;
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, 1, 0);
+    // Seek table, so that the MP3 chunks are reached without decoding what comes before.
+    config.seekPointCount = 1024;
+
+    if (ma_decoder_init_file(fileName.c_str(), &config, &decoder) != MA_SUCCESS) {
+        return;
+    }
+
+    Fft fft(fftSize);
+    std::vector<float> frames;
+    std::vector<float> power(fftSize / 2);
+    std::vector<float> peakPower(fftSize / 2);
+
+    while (!stopWorkers.load()) {
+        ma_uint64 chunk = nextChunk.fetch_add(1);
+
+        if (chunk >= chunkCount) {
+            break;
+        }
+
+        // The columns are left at the floor level, the other chunks may still be fine.
+        if (!computeChunk(decoder, fft, chunk, frames, power, peakPower)) {
+            failedChunks.fetch_add(1);
+        }
+
+        chunkDone[chunk].store(true, std::memory_order_release);
+        completedChunks.fetch_add(1);
+        notify(false);
+    }
+
+    ma_decoder_uninit(&decoder);
+}
+
+/*
+ * Decodes the frames of the given chunk and stores the levels of its columns.
+ * Returns false if the frames can't be decoded.
+ */
+bool Spectrogram::computeChunk(ma_decoder& decoder, Fft& fft, ma_uint64 chunk, std::vector<float>& frames, std::vector<float>& power,
+                               std::vector<float>& peakPower)
+{
+    Tracer::Scope trace("Spectrogram chunk");
+    ma_uint64 firstColumn = chunk * chunkColumns;
+    ma_uint64 lastColumn = std::min(firstColumn + chunkColumns, columnCount);
+    // The blocks are centered on their part of the column, the first one starts before the file.
+    ma_int64 start = (ma_int64)(firstColumn * hop + subHop / 2) - (ma_int64)fftSize / 2;
+    ma_uint64 frameCount = (lastColumn - firstColumn - 1) * hop + (subBlocks - 1) * subHop + fftSize;
+    ma_uint64 padding = (start < 0) ? (ma_uint64)-start : 0;
+
+    frames.assign(frameCount, 0.0f);
+
+    if (ma_decoder_seek_to_pcm_frame(&decoder, (ma_uint64)std::max(start, (ma_int64)0)) != MA_SUCCESS) {
+        return false;
+    }
+
+    // The frames past the end are left silent.
+    ma_uint64 framesRead = 0;
+    ma_decoder_read_pcm_frames(&decoder, frames.data() + padding, frameCount - padding, &framesRead);
+
+    std::vector<float> block(fftSize);
+    const float scale = 10.0f / fastLog2(10.0f) * 255.0f / -floorDb;
+
+    for (ma_uint64 column = firstColumn; column < lastColumn; column++) {
+        uchar* pLevels = levels.data() + column * rows;
+
+        for (ma_uint64 subBlock = 0; subBlock < subBlocks; subBlock++) {
+            const float* pFrames = frames.data() + (column - firstColumn) * hop + subBlock * subHop;
+            ma_uint32 i = 0;
+
+#if defined(__SSE__)
+            for (; i < fftSize; i += 4) {
+                _mm_storeu_ps(block.data() + i, _mm_mul_ps(_mm_loadu_ps(pFrames + i), _mm_loadu_ps(window.data() + i)));
+            }
+#endif
+
+            for (; i < fftSize; i++) {
+                block[i] = pFrames[i] * window[i];
+            }
+
+            // The first block is transformed straight into the peaks.
+            fft.powerSpectrum(block.data(), (subBlock == 0) ? peakPower.data() : power.data());
+
+            for (ma_uint32 bin = 0; subBlock > 0 && bin < fftSize / 2; bin++) {
+                peakPower[bin] = std::max(peakPower[bin], power[bin]);
+            }
+        }
+
+        // Two bins per row, the highest wins (eg: a hum line stays visible).
+        for (ma_uint32 row = 0; row < rows; row++) {
+            float value = std::max(peakPower[row * 2], peakPower[row * 2 + 1]) + 1e-20f;
+            float level = (fastLog2(value) * scale) + 255.0f;
+            pLevels[row] = (uchar)std::clamp(level, 0.0f, 255.0f);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Informs the application about the progress (ten times a second at most).
+ */
+void Spectrogram::notify(bool force)
+{
+    if (handler == nullptr) {
+        return;
+    }
+
+    long long now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    long long last = lastNotification.load();
+
+    if (force || (now - last >= 100 && lastNotification.compare_exchange_strong(last, now))) {
+        Fl::awake(handler, pHandlerData);
+    }
+}
+
+/*
+ * Returns the 256 RGB colors of the levels, from black to white through blue, red and yellow.
+ */
+const uchar* Spectrogram::getPalette()
+{
+    static uchar palette[256 * 3];
+    static bool initialized = false;
+
+    if (!initialized) {
+        const float stops[][4] = {{0, 0, 0, 0}, {0.25f, 0, 0, 160}, {0.5f, 170, 0, 140}, {0.75f, 255, 110, 0}, {0.92f, 255, 230, 40}, {1, 255, 255, 255}};
+
+        for (int i = 0; i < 256; i++) {
+            float position = i / 255.0f;
+            int s = 0;
+
+            while (s < 4 && position > stops[s + 1][0]) {
+                s++;
+            }
+
+            float t = (position - stops[s][0]) / (stops[s + 1][0] - stops[s][0]);
+
+            for (int c = 0; c < 3; c++) {
+                palette[i * 3 + c] = (uchar)(stops[s][c + 1] + t * (stops[s + 1][c + 1] - stops[s][c + 1]));
+            }
+        }
+
+        initialized = true;
+    }
+
+    return palette;
+}
+
+/*
+ * Renders the tile from the levels of the completed chunks. The other columns are gray.
+ */
+void Spectrogram::renderTile(Tile& tile)
+{
+    Tracer::Scope trace("Render spectrogram tile");
+    const uchar* pPalette = getPalette();
+    tile.pixels.assign((size_t)tileWidth * tile.height * 3, 0);
+    tile.stamp = completedChunks.load();
+    tile.complete = true;
+
+    for (int x = 0; x < tileWidth; x++) {
+        ma_uint64 pixel = (ma_uint64)tile.index * tileWidth + x;
+        // Columns covered by the pixel.
+        ma_uint64 first = (tile.zoom >= 0) ? pixel << tile.zoom : pixel >> -tile.zoom;
+        ma_uint64 last = (tile.zoom >= 0) ? std::min(first + ((ma_uint64)1 << tile.zoom), columnCount) : first + 1;
+
+        if (first >= columnCount) {
+            break;
+        }
+
+        bool done = true;
+
+        for (ma_uint64 chunk = first / chunkColumns; chunk <= (last - 1) / chunkColumns; chunk++) {
+            done = done && chunkDone[chunk].load(std::memory_order_acquire);
+        }
+
+        if (!done) {
+            tile.complete = false;
+
+            for (int y = 0; y < tile.height; y++) {
+                memset(tile.pixels.data() + ((size_t)y * tileWidth + x) * 3, 40, 3);
+            }
+
+            continue;
+        }
+
+        for (int y = 0; y < tile.height; y++) {
+            // The low frequencies at the bottom.
+            ma_uint32 rowLow = (ma_uint32)((ma_uint64)(tile.height - 1 - y) * rows / tile.height);
+            ma_uint32 rowHigh = std::max(rowLow + 1, (ma_uint32)((ma_uint64)(tile.height - y) * rows / tile.height));
+            uchar level = 0;
+
+            for (ma_uint64 column = first; column < last; column++) {
+                const uchar* pLevels = levels.data() + column * rows;
+
+                for (ma_uint32 row = rowLow; row < rowHigh; row++) {
+                    level = std::max(level, pLevels[row]);
+                }
+            }
+
+            memcpy(tile.pixels.data() + ((size_t)y * tileWidth + x) * 3, pPalette + level * 3, 3);
+        }
+    }
+}
+
+/*
+ * Returns the given tile, rendered if it isn't cached or if more chunks have been
+ * completed since. Returns nullptr while the file length isn't known.
+ * Note: Must be called from the GUI thread.
+ */
+const Spectrogram::Tile* Spectrogram::getTile(int zoom, int index, int height)
+{
+    if (!isReady() || height <= 0) {
+        return nullptr;
+    }
+
+    for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+        if (it->zoom != zoom || it->index != index || it->height != height) {
+            continue;
+        }
+
+        // Move the tile to the front (ie: most recently used).
+        tiles.splice(tiles.begin(), tiles, it);
+
+        if (!tiles.front().complete && tiles.front().stamp != completedChunks.load()) {
+            renderTile(tiles.front());
+        }
+
+        return &tiles.front();
+    }
+
+    tiles.push_front({zoom, index, height, 0, false, {}});
+    renderTile(tiles.front());
+
+    if (tiles.size() > maxTiles) {
+        tiles.pop_back();
+    }
+
+    return &tiles.front();
+}
+
+/*
+ * Computes the spectrogram of the given files and reports the time taken.
+ * Usage: Player --bench-spectrogram FILE...
+ */
+int Spectrogram::benchmark(const std::vector<std::string>& files)
+{
+    if (files.empty()) {
+        std::cerr << "Usage: Player --bench-spectrogram FILE..." << std::endl;
+        return 1;
+    }
+
+    // Single threaded transform rate first.
+    Fft fft(fftSize);
+    std::vector<float> block(fftSize), power(fftSize / 2);
+
+    for (ma_uint32 i = 0; i < fftSize; i++) {
+        block[i] = sinf(i * 0.1f);
+    }
+
+    const int transforms = 20000;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < transforms; i++) {
+        block[i % fftSize] += 1e-6f;
+        fft.powerSpectrum(block.data(), power.data());
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("FFT %u: %.2f us per transform\n", fftSize, seconds * 1e6 / transforms);
+
+    for (const std::string& file : files) {
+        Spectrogram spectrogram(nullptr, nullptr);
+        spectrogram.start(file);
+        spectrogram.setupThread.join();
+
+        if (!spectrogram.isComplete()) {
+            std::cerr << "Failed to compute the spectrogram of '" << file << "'." << std::endl;
+            continue;
+        }
+
+        double duration = (double)spectrogram.totalFrames / spectrogram.sampleRate;
+        printf("%s: %.0f s of audio, %llu columns in %.2f s (%.0fx real time)\n", file.c_str(), duration,
+               (unsigned long long)spectrogram.columnCount, spectrogram.getElapsed(), duration / spectrogram.getElapsed());
+    }
+
+    return 0;
+}
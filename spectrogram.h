@@ -0,0 +1,122 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <string>
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <FL/Fl.H>
+#include "../libraries/miniaudio.h"
+#include "tracer.h"
+#include "fft.h"
+
+/*
+ * The Spectrogram class computes the spectrogram of a whole file in the background.
+ * The file is split into chunks of columns which are decoded (mixed down to mono, at
+ * the file sample rate) and transformed by a pool of workers, one per core but one,
+ * running at a lower priority so that the playback isn't disturbed. Each worker has
+ * its own decoder and seeks to the chunks it takes.
+ * A column is the power spectrum of a Hann windowed block of fftSize frames, folded
+ * into rows and stored as 8 bit levels (dB). The number of columns is capped, ie: the
+ * hop grows with the file length. Once the hop exceeds half a block, a column is made
+ * of several half overlapping blocks and keeps the highest power of each bin, so that
+ * every frame is analysed (eg: a short click in a long file).
+ * A chunk whose frames can't be decoded is left at the floor level.
+ * The columns are rendered into RGB tiles for a given zoom level, kept in a small
+ * cache. A tile only made of completed chunks is never rendered again.
+ */
+class Spectrogram {
+    public:
+        static constexpr ma_uint32 fftSize = 4096;
+        // Two FFT bins per row.
+        static constexpr ma_uint32 rows = fftSize / 4;
+        // Columns rendered per tile.
+        static constexpr int tileWidth = 256;
+        // Levels from -120 dBFS (0) to 0 dBFS (255).
+        static constexpr float floorDb = -120.0f;
+        // Zoom levels, ie: columns per pixel from 1/8 to 2^maxZoom.
+        static constexpr int minZoom = -3;
+        static constexpr int maxZoom = 7;
+
+        struct Tile {
+            int zoom;
+            int index;
+            int height;
+            // Number of completed chunks when rendered, used to refresh partial tiles.
+            ma_uint64 stamp;
+            bool complete;
+            std::vector<uchar> pixels;
+        };
+
+    private:
+        std::string fileName;
+        ma_uint32 sampleRate = 0;
+        ma_uint64 totalFrames = 0;
+        ma_uint64 columnCount = 0;
+        ma_uint64 hop = 0;
+        // Blocks per column and their spacing.
+        ma_uint64 subBlocks = 1;
+        ma_uint64 subHop = 0;
+        // Levels, column after column.
+        std::vector<uchar> levels;
+        // Set once the columns of the chunk are stored.
+        std::unique_ptr<std::atomic<bool>[]> chunkDone;
+        ma_uint64 chunkCount = 0;
+        std::atomic<ma_uint64> nextChunk = 0;
+        std::atomic<ma_uint64> completedChunks = 0;
+        // Chunks that couldn't be decoded (counted as completed).
+        std::atomic<ma_uint64> failedChunks = 0;
+        std::atomic<bool> stopWorkers = false;
+        // Sets the file up then spawns the workers (and becomes one of them).
+        std::thread setupThread;
+        std::vector<std::thread> workers;
+        // Set once the file length is known and the levels are allocated.
+        std::atomic<bool> ready = false;
+        std::chrono::steady_clock::time_point startTime;
+        std::atomic<double> elapsed = 0.0;
+        std::atomic<long long> lastNotification = 0;
+        Fl_Awake_Handler handler;
+        void* pHandlerData;
+        // The most recently used tile comes first.
+        std::list<Tile> tiles;
+        static constexpr size_t maxTiles = 64;
+        std::vector<float> window;
+        static constexpr ma_uint64 maxColumns = 32768;
+        static constexpr ma_uint64 chunkColumns = tileWidth;
+        static const uchar* getPalette();
+        void setup();
+        void runWorker();
+        void notify(bool force);
+        bool computeChunk(ma_decoder& decoder, Fft& fft, ma_uint64 chunk, std::vector<float>& frames, std::vector<float>& power,
+                          std::vector<float>& peakPower);
+        void renderTile(Tile& tile);
+
+    public:
+        Spectrogram(Fl_Awake_Handler handler, void* data);
+        ~Spectrogram();
+
+        void start(const std::string& fileName);
+        void stop();
+        const Tile* getTile(int zoom, int index, int height);
+
+        // Getters.
+        const std::string& getFileName() { return fileName; }
+        bool isReady() { return ready.load(std::memory_order_acquire); }
+        ma_uint32 getSampleRate() { return isReady() ? sampleRate : 0; }
+        ma_uint64 getColumnCount() { return isReady() ? columnCount : 0; }
+        ma_uint64 getHop() { return isReady() ? hop : 0; }
+        bool isComplete() { return isReady() && completedChunks.load() == chunkCount; }
+        ma_uint64 getFailedChunks() { return failedChunks.load(); }
+        float getProgress() { return isReady() && chunkCount ? (float)completedChunks.load() / chunkCount : 0.0f; }
+        double getElapsed() { return elapsed.load(); }
+
+        static int benchmark(const std::vector<std::string>& files);
+};
+
+#endif // SPECTROGRAM_H
@@ -0,0 +1,251 @@
+#include "main.h"
+
+
+SpectrogramView::SpectrogramView(int x, int y, int w, int h, Spectrogram* spectrogram)
+    : Fl_Widget(x, y, w, h), spectrogram(spectrogram) {
+}
+
+double SpectrogramView::getTotalPixels()
+{
+    return columnToPixel((double)spectrogram->getColumnCount());
+}
+
+double SpectrogramView::pixelToColumn(double pixel)
+{
+    return ldexp(pixel, zoom);
+}
+
+double SpectrogramView::columnToPixel(double column)
+{
+    return ldexp(column, -zoom);
+}
+
+void SpectrogramView::clampOffset()
+{
+    offset = std::max(0.0, std::min(offset, getTotalPixels() - w()));
+}
+
+/*
+ * Picks the closest zoom showing the whole file.
+ */
+void SpectrogramView::fit()
+{
+    zoom = Spectrogram::minZoom;
+
+    while (zoom < Spectrogram::maxZoom && getTotalPixels() > w()) {
+        zoom++;
+    }
+
+    offset = 0.0;
+    fitted = true;
+}
+
+/*
+ * Called when a new file is computed.
+ */
+void SpectrogramView::reset()
+{
+    fitted = false;
+    position = -1.0;
+    redraw();
+}
+
+/*
+ * Moves the playhead, only redrawn if it moves by a pixel at least.
+ */
+void SpectrogramView::setPosition(double seconds)
+{
+    ma_uint64 hop = spectrogram->getHop();
+
+    if (hop == 0) {
+        return;
+    }
+
+    double pixel = columnToPixel(seconds * spectrogram->getSampleRate() / hop);
+    double previous = columnToPixel(position * spectrogram->getSampleRate() / hop);
+    position = seconds;
+
+    if ((int)pixel != (int)previous) {
+        redraw();
+    }
+}
+
+void SpectrogramView::draw()
+{
+    Tracer::Scope trace("Spectrogram draw");
+    fl_push_clip(x(), y(), w(), h());
+    fl_color(FL_BLACK);
+    fl_rectf(x(), y(), w(), h());
+    fl_font(0, 12);
+
+    if (!spectrogram->isReady()) {
+        fl_color(FL_WHITE);
+        fl_draw("Reading the file...", x() + 10, y() + 20);
+        fl_pop_clip();
+        return;
+    }
+
+    if (!fitted) {
+        fit();
+    }
+
+    // Visible tiles.
+    int first = (int)(offset / Spectrogram::tileWidth);
+    int last = (int)((offset + w()) / Spectrogram::tileWidth);
+
+    for (int index = first; index <= last; index++) {
+        const Spectrogram::Tile* pTile = spectrogram->getTile(zoom, index, h());
+
+        if (pTile != nullptr) {
+            int left = x() + (int)(index * Spectrogram::tileWidth - offset);
+            fl_draw_image(pTile->pixels.data(), left, y(), Spectrogram::tileWidth, h());
+        }
+    }
+
+    // A line every 5 kHz.
+    double nyquist = spectrogram->getSampleRate() / 2.0;
+    char label[40];
+    fl_color(FL_WHITE);
+
+    for (int frequency = 5000; frequency < nyquist; frequency += 5000) {
+        int top = y() + h() - (int)(frequency / nyquist * h());
+        fl_line(x(), top, x() + 6, top);
+        snprintf(label, sizeof(label), "%d kHz", frequency / 1000);
+        fl_draw(label, x() + 8, top + 4);
+    }
+
+    if (spectrogram->isComplete()) {
+        snprintf(label, sizeof(label), "Computed in %.2f s", spectrogram->getElapsed());
+    }
+    else {
+        snprintf(label, sizeof(label), "Computing %.0f%%", spectrogram->getProgress() * 100.0f);
+    }
+
+    fl_draw(label, x() + w() - 130, y() + 16);
+
+    // Playhead
+    if (position >= 0.0) {
+        int playhead = x() + (int)(columnToPixel(position * spectrogram->getSampleRate() / spectrogram->getHop()) - offset);
+        fl_color(FL_GREEN);
+        fl_line(playhead, y(), playhead, y() + h());
+    }
+
+    fl_pop_clip();
+}
+
+int SpectrogramView::handle(int event)
+{
+    switch (event) {
+        // Needed to receive the mouse wheel events.
+        case FL_ENTER:
+        case FL_LEAVE:
+            return 1;
+
+        case FL_PUSH:
+            dragX = Fl::event_x();
+            dragOffset = offset;
+            dragged = false;
+            return 1;
+
+        case FL_DRAG:
+            if (spectrogram->isReady()) {
+                offset = dragOffset - (Fl::event_x() - dragX);
+                clampOffset();
+                dragged = true;
+                redraw();
+            }
+
+            return 1;
+
+        case FL_RELEASE:
+            // A click (ie: no drag) asks for a seek.
+            if (!dragged && spectrogram->isReady()) {
+                double column = pixelToColumn(offset + Fl::event_x() - x());
+                clickedSeconds = column * spectrogram->getHop() / spectrogram->getSampleRate();
+                do_callback();
+            }
+
+            return 1;
+
+        case FL_MOUSEWHEEL: {
+            if (!spectrogram->isReady() || Fl::event_dy() == 0) {
+                return 1;
+            }
+
+            // Keep the column under the pointer in place.
+            int pointer = Fl::event_x() - x();
+            double column = pixelToColumn(offset + pointer);
+            zoom = std::clamp(zoom + (Fl::event_dy() > 0 ? 1 : -1), (int)Spectrogram::minZoom, (int)Spectrogram::maxZoom);
+            offset = columnToPixel(column) - pointer;
+            clampOffset();
+            redraw();
+            return 1;
+        }
+    }
+
+    return Fl_Widget::handle(event);
+}
+
+/*
+ * Opens the spectrogram window and computes the spectrogram of the loaded file.
+ */
+void Application::spectrogram_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (app->spectrogramWnd == 0) {
+        app->spectrogram = new Spectrogram(spectrogram_progress_cb, app);
+        app->spectrogramWnd = new Fl_Double_Window(800, 300, "Spectrogram");
+        app->spectrogramView = new SpectrogramView(0, 0, 800, 300, app->spectrogram);
+        app->spectrogramView->callback(spectrogram_seek_cb, app);
+        app->spectrogramWnd->end();
+        app->spectrogramWnd->resizable(app->spectrogramView);
+    }
+
+    app->spectrogramWnd->show();
+    app->updateSpectrogram();
+}
+
+/*
+ * Computes the spectrogram of the loaded file if the window is open.
+ */
+void Application::updateSpectrogram()
+{
+    if (spectrogramWnd == 0 || !spectrogramWnd->shown() || !audio->isFileLoaded()) {
+        return;
+    }
+
+    std::string fileName = audio->getOriginalFileFormat()["fileName"];
+
+    if (fileName != spectrogram->getFileName()) {
+        spectrogram->start(fileName);
+        spectrogramView->reset();
+    }
+}
+
+/*
+ * Redraws the spectrogram as the chunks are computed.
+ * Note: This function is called on the GUI thread through Fl::awake.
+ */
+void Application::spectrogram_progress_cb(void *data)
+{
+    Application* app = (Application*) data;
+    app->spectrogramView->redraw();
+}
+
+/*
+ * Moves the playback to the position clicked on the spectrogram.
+ */
+void Application::spectrogram_seek_cb(Fl_Widget *w, void *data)
+{
+    Application* app = (Application*) data;
+
+    if (!app->audio->isFileLoaded()) {
+        return;
+    }
+
+    double seconds = std::min(app->spectrogramView->getClickedSeconds(), app->audio->getTotalSeconds());
+    app->audio->setCursor(seconds);
+    app->getSlider("time")->value(seconds);
+    time_cb(app->getNullWidget(), app);
+}
@@ -0,0 +1,46 @@
+#ifndef SPECTROGRAM_VIEW_H
+#define SPECTROGRAM_VIEW_H
+#include <FL/Fl.H>
+#include <FL/Fl_Widget.H>
+#include <FL/fl_draw.H>
+#include "spectrogram.h"
+
+
+/*
+ * Displays the spectrogram tiles, the frequencies and the playhead.
+ * The mouse wheel zooms around the pointer, dragging scrolls and a click calls the
+ * widget callback (see getClickedSeconds).
+ */
+class SpectrogramView : public Fl_Widget
+{
+        Spectrogram* spectrogram;
+        // Columns per pixel is 2^zoom.
+        int zoom = 0;
+        // Left pixel at the current zoom.
+        double offset = 0.0;
+        // Zoomed to fit once the file length is known.
+        bool fitted = false;
+        double position = -1.0;
+        double clickedSeconds = 0.0;
+        int dragX = 0;
+        double dragOffset = 0.0;
+        bool dragged = false;
+        double getTotalPixels();
+        double pixelToColumn(double pixel);
+        double columnToPixel(double column);
+        void clampOffset();
+        void fit();
+
+    public:
+        SpectrogramView(int x, int y, int w, int h, Spectrogram* spectrogram);
+
+        void draw() override;
+        int handle(int event) override;
+        void reset();
+        void setPosition(double seconds);
+
+        // Getters.
+        double getClickedSeconds() { return clickedSeconds; }
+};
+
+#endif
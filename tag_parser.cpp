@@ -0,0 +1,1067 @@
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include "tag_parser.h"
+
+static ma_uint32 readLe16(const ma_uint8* p) { return p[0] | (p[1] << 8); }
+static ma_uint32 readLe32(const ma_uint8* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((ma_uint32)p[3] << 24); }
+static ma_uint32 readBe24(const ma_uint8* p) { return (p[0] << 16) | (p[1] << 8) | p[2]; }
+static ma_uint32 readBe32(const ma_uint8* p) { return ((ma_uint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+// ID3v2 sizes use 7 bits per byte.
+static ma_uint32 readSyncsafe(const ma_uint8* p) { return ((p[0] & 0x7f) << 21) | ((p[1] & 0x7f) << 14) | ((p[2] & 0x7f) << 7) | (p[3] & 0x7f); }
+
+/*
+ * Removes the trailing nulls and spaces (eg: fixed size ID3v1 and RIFF fields).
+ */
+static std::string trim(std::string text)
+{
+    size_t end = text.find('\0');
+
+    if (end != std::string::npos) {
+        text.resize(end);
+    }
+
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\0')) {
+        text.pop_back();
+    }
+
+    return text;
+}
+
+/*
+ * Returns the uncompressed sample format matching the given sample size.
+ */
+static ma_format getIntegerFormat(ma_uint32 bitsPerSample)
+{
+    switch (bitsPerSample) {
+        case 8: return ma_format_u8;
+        case 16: return ma_format_s16;
+        case 24: return ma_format_s24;
+        case 32: return ma_format_s32;
+    }
+
+    return ma_format_unknown;
+}
+
+TagParser::MappedFile::~MappedFile() {
+    if (pHead) {
+        munmap((void*)pHead, headSize);
+    }
+
+    if (pTail) {
+        munmap((void*)pTail, tailSize);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool TagParser::MappedFile::open(const char* fileName)
+{
+    fd = ::open(fileName, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+
+    if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0) {
+        return false;
+    }
+
+    size = (ma_uint64)status.st_size;
+    headSize = (size_t)std::min(size, (ma_uint64)prefixBytes);
+    void* pMap = mmap(NULL, headSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (pMap == MAP_FAILED) {
+        headSize = 0;
+        return false;
+    }
+
+    pHead = (const ma_uint8*)pMap;
+
+    return true;
+}
+
+/*
+ * Maps the end of the file (page aligned).
+ */
+bool TagParser::MappedFile::mapTail()
+{
+    ma_uint64 pageSize = (ma_uint64)sysconf(_SC_PAGESIZE);
+    tailOffset = (size > tailBytes) ? (size - tailBytes) / pageSize * pageSize : 0;
+    tailSize = (size_t)(size - tailOffset);
+    void* pMap = mmap(NULL, tailSize, PROT_READ, MAP_PRIVATE, fd, (off_t)tailOffset);
+
+    if (pMap == MAP_FAILED) {
+        tailSize = 0;
+        return false;
+    }
+
+    pTail = (const ma_uint8*)pMap;
+
+    return true;
+}
+
+/*
+ * Returns a pointer to count bytes at the given offset, nullptr if they are beyond the end of the file.
+ */
+const ma_uint8* TagParser::MappedFile::at(ma_uint64 offset, ma_uint64 count)
+{
+    if (offset > size || count > size - offset) {
+        return nullptr;
+    }
+
+    if (offset + count <= headSize) {
+        return pHead + offset;
+    }
+
+    // Within the last bytes.
+    if (offset + tailBytes >= size && (pTail || mapTail()) && offset >= tailOffset) {
+        return pTail + (offset - tailOffset);
+    }
+
+    // Extend the prefix, only the pages actually read are loaded.
+    size_t newSize = (size_t)std::min(size, std::max(offset + count, (ma_uint64)headSize * 4));
+    munmap((void*)pHead, headSize);
+    void* pMap = mmap(NULL, newSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (pMap == MAP_FAILED) {
+        pHead = nullptr;
+        headSize = 0;
+        return nullptr;
+    }
+
+    pHead = (const ma_uint8*)pMap;
+    headSize = newSize;
+
+    return pHead + offset;
+}
+
+/*
+ * Converts an ID3v2 text (Latin-1, UTF-16 with BOM, UTF-16BE or UTF-8) to UTF-8.
+ * Only the first value is kept (ID3v2.4 separates the values with nulls).
+ */
+std::string TagParser::decodeText(const ma_uint8* pData, size_t size, int encoding)
+{
+    std::string text;
+
+    if (encoding == 3) {
+        text.assign((const char*)pData, size);
+        return trim(text);
+    }
+
+    if (encoding == 0) {
+        for (size_t i = 0; i < size && pData[i] != 0; i++) {
+            if (pData[i] < 0x80) {
+                text += (char)pData[i];
+            }
+            else {
+                text += (char)(0xC0 | (pData[i] >> 6));
+                text += (char)(0x80 | (pData[i] & 0x3F));
+            }
+        }
+
+        return trim(text);
+    }
+
+    // UTF-16: Big endian unless a BOM says otherwise.
+    bool bigEndian = true;
+    size_t i = 0;
+
+    if (encoding == 1 && size >= 2) {
+        if (pData[0] == 0xFF && pData[1] == 0xFE) {
+            bigEndian = false;
+            i = 2;
+        }
+        else if (pData[0] == 0xFE && pData[1] == 0xFF) {
+            i = 2;
+        }
+    }
+
+    for (; i + 1 < size; i += 2) {
+        ma_uint32 unit = bigEndian ? (pData[i] << 8) | pData[i + 1] : pData[i] | (pData[i + 1] << 8);
+
+        if (unit == 0) {
+            break;
+        }
+
+        ma_uint32 codePoint = unit;
+
+        // Surrogate pair.
+        if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < size) {
+            ma_uint32 low = bigEndian ? (pData[i + 2] << 8) | pData[i + 3] : pData[i + 2] | (pData[i + 3] << 8);
+            codePoint = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+            i += 2;
+        }
+
+        if (codePoint < 0x80) {
+            text += (char)codePoint;
+        }
+        else if (codePoint < 0x800) {
+            text += (char)(0xC0 | (codePoint >> 6));
+            text += (char)(0x80 | (codePoint & 0x3F));
+        }
+        else if (codePoint < 0x10000) {
+            text += (char)(0xE0 | (codePoint >> 12));
+            text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            text += (char)(0x80 | (codePoint & 0x3F));
+        }
+        else {
+            text += (char)(0xF0 | (codePoint >> 18));
+            text += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+            text += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+            text += (char)(0x80 | (codePoint & 0x3F));
+        }
+    }
+
+    return trim(text);
+}
+
+/*
+ * Parses the ID3v2 tag at the given offset. Returns the tag size (zero if there is none).
+ * Note: Tags unsynchronised as a whole (ID3v2.2/2.3) and compressed or encrypted
+ *       frames are skipped.
+ */
+ma_uint64 TagParser::parseId3v2(MappedFile& file, ma_uint64 offset, Tags& tags)
+{
+    const ma_uint8* pHeader = file.at(offset, 10);
+
+    if (pHeader == nullptr || memcmp(pHeader, "ID3", 3) != 0) {
+        return 0;
+    }
+
+    ma_uint32 major = pHeader[3];
+    ma_uint32 flags = pHeader[5];
+    ma_uint32 size = readSyncsafe(pHeader + 6);
+    ma_uint64 tagSize = 10 + (ma_uint64)size + ((flags & 0x10) ? 10 : 0);
+
+    if (major < 2 || major > 4 || (major < 4 && (flags & 0x80))) {
+        return tagSize;
+    }
+
+    ma_uint64 bodyOffset = offset + 10;
+    const ma_uint8* pBody = file.at(bodyOffset, size);
+
+    if (pBody == nullptr) {
+        return tagSize;
+    }
+
+    size_t position = 0;
+
+    // Skip the extended header.
+    if ((flags & 0x40) && major > 2 && size >= 4) {
+        position = (major == 3) ? 4 + readBe32(pBody) : readSyncsafe(pBody);
+    }
+
+    const size_t idLength = (major == 2) ? 3 : 4;
+    const size_t headerLength = (major == 2) ? 6 : 10;
+    bool hasFrontCover = false;
+
+    while (position + headerLength <= size) {
+        const ma_uint8* pFrame = pBody + position;
+
+        // Padding.
+        if (pFrame[0] == 0) {
+            break;
+        }
+
+        ma_uint32 frameSize = (major == 2) ? readBe24(pFrame + 3) : (major == 3) ? readBe32(pFrame + 4) : readSyncsafe(pFrame + 4);
+        ma_uint32 frameFlags = (major == 2) ? 0 : (pFrame[8] << 8) | pFrame[9];
+
+        if (frameSize > size - position - headerLength) {
+            break;
+        }
+
+        const ma_uint8* pData = pFrame + headerLength;
+        size_t dataSize = frameSize;
+        position += headerLength + frameSize;
+
+        bool isSkipped = (major == 3) ? (frameFlags & 0x00C0) : (major == 4) ? (frameFlags & 0x000E) : false;
+
+        if (isSkipped || dataSize < 2) {
+            continue;
+        }
+
+        // ID3v2.3 grouping byte, ID3v2.4 grouping byte and data length indicator.
+        size_t extra = (major == 3 && (frameFlags & 0x0020)) ? 1 : 0;
+        extra += (major == 4 && (frameFlags & 0x0040)) ? 1 : 0;
+        extra += (major == 4 && (frameFlags & 0x0001)) ? 4 : 0;
+
+        if (extra >= dataSize) {
+            continue;
+        }
+
+        pData += extra;
+        dataSize -= extra;
+        std::string id((const char*)pFrame, idLength);
+
+        if (id == "TIT2" || id == "TT2") {
+            tags.title = decodeText(pData + 1, dataSize - 1, pData[0]);
+        }
+        else if (id == "TPE1" || id == "TP1") {
+            tags.artist = decodeText(pData + 1, dataSize - 1, pData[0]);
+        }
+        else if (id == "TALB" || id == "TAL") {
+            tags.album = decodeText(pData + 1, dataSize - 1, pData[0]);
+        }
+        else if ((id == "APIC" || id == "PIC") && !hasFrontCover) {
+            int encoding = pData[0];
+            size_t i = 1;
+            std::string mimeType;
+
+            if (id == "PIC") {
+                // Image format, eg: "JPG".
+                mimeType = (dataSize >= 4) ? "image/" + std::string((const char*)pData + 1, 3) : "";
+                i = 4;
+            }
+            else {
+                while (i < dataSize && pData[i] != 0) {
+                    mimeType += (char)pData[i++];
+                }
+
+                i++;
+            }
+
+            if (i >= dataSize) {
+                continue;
+            }
+
+            int pictureType = pData[i++];
+
+            // Description, null terminated (two bytes in UTF-16).
+            if (encoding == 1 || encoding == 2) {
+                while (i + 1 < dataSize && (pData[i] != 0 || pData[i + 1] != 0)) {
+                    i += 2;
+                }
+
+                i += 2;
+            }
+            else {
+                while (i < dataSize && pData[i] != 0) {
+                    i++;
+                }
+
+                i++;
+            }
+
+            if (i >= dataSize) {
+                continue;
+            }
+
+            tags.artOffset = bodyOffset + (pData - pBody) + i;
+            tags.artSize = dataSize - i;
+            tags.artMimeType = mimeType;
+            // Type 3 is the front cover.
+            hasFrontCover = (pictureType == 3);
+        }
+    }
+
+    return tagSize;
+}
+
+/*
+ * Fills the missing title, artist and album from a possible ID3v1 tag.
+ */
+void TagParser::parseId3v1(MappedFile& file, Tags& tags)
+{
+    const ma_uint8* pTag = (file.size >= 128) ? file.at(file.size - 128, 128) : nullptr;
+
+    if (pTag == nullptr || memcmp(pTag, "TAG", 3) != 0) {
+        return;
+    }
+
+    std::string* fields[] = {&tags.title, &tags.artist, &tags.album};
+
+    for (int i = 0; i < 3; i++) {
+        if (fields[i]->empty()) {
+            *fields[i] = decodeText(pTag + 3 + i * 30, 30, 0);
+        }
+    }
+}
+
+/*
+ * Parses a Vorbis comment block (used by both FLAC and Ogg Vorbis).
+ */
+void TagParser::parseVorbisComments(const ma_uint8* pData, size_t size, Tags& tags)
+{
+    if (pData == nullptr || size < 8) {
+        return;
+    }
+
+    size_t position = 4 + (size_t)readLe32(pData);
+
+    if (position + 4 > size) {
+        return;
+    }
+
+    ma_uint32 count = readLe32(pData + position);
+    position += 4;
+
+    for (ma_uint32 i = 0; i < count && position + 4 <= size; i++) {
+        size_t length = readLe32(pData + position);
+        position += 4;
+
+        if (length > size - position) {
+            break;
+        }
+
+        const char* pComment = (const char*)pData + position;
+        position += length;
+        const char* pEqual = (const char*)memchr(pComment, '=', length);
+
+        if (pEqual == nullptr) {
+            continue;
+        }
+
+        size_t keyLength = pEqual - pComment;
+        std::string value(pEqual + 1, length - keyLength - 1);
+
+        if (keyLength == 5 && strncasecmp(pComment, "TITLE", 5) == 0) {
+            tags.title = value;
+        }
+        else if (keyLength == 6 && strncasecmp(pComment, "ARTIST", 6) == 0) {
+            tags.artist = value;
+        }
+        else if (keyLength == 5 && strncasecmp(pComment, "ALBUM", 5) == 0) {
+            tags.album = value;
+        }
+    }
+}
+
+/*
+ * Parses the fmt, data, LIST INFO and id3 chunks of a WAV file.
+ */
+bool TagParser::parseRiff(MappedFile& file, Tags& tags)
+{
+    ma_uint32 formatTag = 0;
+    ma_uint32 byteRate = 0;
+    ma_uint64 dataSize = 0;
+    ma_uint64 offset = 12;
+
+    // A few chunks at most in practice.
+    for (int chunk = 0; chunk < 256 && offset + 8 <= file.size; chunk++) {
+        const ma_uint8* pChunk = file.at(offset, 8);
+
+        if (pChunk == nullptr) {
+            return false;
+        }
+
+        ma_uint64 chunkSize = readLe32(pChunk + 4);
+        ma_uint64 body = offset + 8;
+        char id[4];
+        memcpy(id, pChunk, 4);
+
+        if (memcmp(id, "fmt ", 4) == 0 && chunkSize >= 16) {
+            const ma_uint8* pFormat = file.at(body, std::min(chunkSize, (ma_uint64)40));
+
+            if (pFormat == nullptr) {
+                return false;
+            }
+
+            formatTag = readLe16(pFormat);
+            tags.channels = readLe16(pFormat + 2);
+            tags.sampleRate = readLe32(pFormat + 4);
+            byteRate = readLe32(pFormat + 8);
+            tags.bitsPerSample = readLe16(pFormat + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE: The actual format comes first in the sub format GUID.
+            if (formatTag == 0xFFFE && chunkSize >= 26) {
+                formatTag = readLe16(pFormat + 24);
+            }
+        }
+        else if (memcmp(id, "data", 4) == 0) {
+            // The size may be left unset by streaming writers.
+            dataSize = (chunkSize == 0 || chunkSize == 0xFFFFFFFF || chunkSize > file.size - body) ? file.size - body : chunkSize;
+        }
+        else if (memcmp(id, "LIST", 4) == 0 && chunkSize >= 4) {
+            const ma_uint8* pList = file.at(body, chunkSize);
+
+            if (pList != nullptr && memcmp(pList, "INFO", 4) == 0) {
+                size_t position = 4;
+
+                while (position + 8 <= chunkSize) {
+                    size_t length = readLe32(pList + position + 4);
+
+                    if (length > chunkSize - position - 8) {
+                        break;
+                    }
+
+                    std::string value = trim(std::string((const char*)pList + position + 8, length));
+
+                    if (memcmp(pList + position, "INAM", 4) == 0) {
+                        tags.title = value;
+                    }
+                    else if (memcmp(pList + position, "IART", 4) == 0) {
+                        tags.artist = value;
+                    }
+                    else if (memcmp(pList + position, "IPRD", 4) == 0) {
+                        tags.album = value;
+                    }
+
+                    position += 8 + length + (length & 1);
+                }
+            }
+        }
+        else if (memcmp(id, "id3 ", 4) == 0 || memcmp(id, "ID3 ", 4) == 0) {
+            parseId3v2(file, body, tags);
+        }
+
+        // Chunks are word aligned.
+        offset = body + chunkSize + (chunkSize & 1);
+    }
+
+    if (tags.channels == 0 || tags.sampleRate == 0) {
+        return false;
+    }
+
+    if (formatTag == 3) {
+        tags.codec = "WAV float " + std::to_string(tags.bitsPerSample) + "-bit";
+        tags.format = (tags.bitsPerSample == 32) ? ma_format_f32 : ma_format_unknown;
+    }
+    else if (formatTag == 1) {
+        tags.codec = "WAV PCM " + std::to_string(tags.bitsPerSample) + "-bit";
+        tags.format = getIntegerFormat(tags.bitsPerSample);
+    }
+    else {
+        char codec[32];
+        snprintf(codec, sizeof(codec), "WAV (format 0x%04X)", formatTag);
+        tags.codec = codec;
+    }
+
+    if (byteRate > 0) {
+        tags.duration = (double)dataSize / byteRate;
+        tags.bitrate = byteRate * 8 / 1000;
+    }
+
+    return true;
+}
+
+/*
+ * Parses the metadata blocks of a FLAC stream starting at the given offset.
+ */
+bool TagParser::parseFlac(MappedFile& file, ma_uint64 offset, Tags& tags)
+{
+    ma_uint64 totalSamples = 0;
+    bool isLast = false;
+    bool hasFrontCover = false;
+    offset += 4;
+
+    while (!isLast) {
+        const ma_uint8* pHeader = file.at(offset, 4);
+
+        if (pHeader == nullptr) {
+            return false;
+        }
+
+        isLast = pHeader[0] & 0x80;
+        int type = pHeader[0] & 0x7F;
+        ma_uint32 length = readBe24(pHeader + 1);
+        ma_uint64 body = offset + 4;
+        offset = body + length;
+
+        // STREAMINFO
+        if (type == 0 && length >= 34) {
+            const ma_uint8* pInfo = file.at(body, 34);
+
+            // Truncated file.
+            if (pInfo == nullptr) {
+                return false;
+            }
+
+            tags.sampleRate = (pInfo[10] << 12) | (pInfo[11] << 4) | (pInfo[12] >> 4);
+            tags.channels = ((pInfo[12] >> 1) & 0x07) + 1;
+            tags.bitsPerSample = (((pInfo[12] & 0x01) << 4) | (pInfo[13] >> 4)) + 1;
+            totalSamples = ((ma_uint64)(pInfo[13] & 0x0F) << 32) | readBe32(pInfo + 14);
+        }
+        // VORBIS_COMMENT
+        else if (type == 4) {
+            parseVorbisComments(file.at(body, length), length, tags);
+        }
+        // PICTURE
+        else if (type == 6 && !hasFrontCover && length >= 32) {
+            const ma_uint8* pPicture = file.at(body, length);
+
+            if (pPicture == nullptr) {
+                continue;
+            }
+
+            ma_uint32 pictureType = readBe32(pPicture);
+            size_t position = 4;
+            ma_uint32 mimeLength = readBe32(pPicture + position);
+
+            if (mimeLength > length - 32) {
+                continue;
+            }
+
+            std::string mimeType((const char*)pPicture + position + 4, mimeLength);
+            position += 4 + mimeLength;
+            ma_uint32 descriptionLength = readBe32(pPicture + position);
+
+            // Description, then width, height, depth, colors and the data length.
+            if (descriptionLength > length - position - 28) {
+                continue;
+            }
+
+            position += 4 + descriptionLength + 16;
+            ma_uint32 dataLength = readBe32(pPicture + position);
+            position += 4;
+
+            if (dataLength <= length - position) {
+                tags.artOffset = body + position;
+                tags.artSize = dataLength;
+                tags.artMimeType = mimeType;
+                hasFrontCover = (pictureType == 3);
+            }
+        }
+    }
+
+    if (tags.sampleRate == 0) {
+        return false;
+    }
+
+    tags.codec = "FLAC " + std::to_string(tags.bitsPerSample) + "-bit";
+    // Decoded as float, whatever the sample size.
+    tags.format = ma_format_f32;
+
+    if (totalSamples > 0) {
+        tags.duration = (double)totalSamples / tags.sampleRate;
+        tags.bitrate = (ma_uint32)((file.size - std::min(offset, file.size)) * 8 / tags.duration / 1000);
+    }
+
+    return true;
+}
+
+/*
+ * Parses the identification and comment headers of an Ogg Vorbis stream, and the
+ * last page for the duration.
+ */
+bool TagParser::parseOgg(MappedFile& file, Tags& tags)
+{
+    ma_uint64 offset = 0;
+    ma_uint32 serial = 0;
+    int packetIndex = 0;
+    // Spans of the current packet within the file, copied only if the packet spans pages.
+    std::vector<std::pair<ma_uint64, size_t>> spans;
+    ma_uint32 nominalBitrate = 0;
+
+    // The headers come within the first pages.
+    for (int page = 0; page < 64 && packetIndex < 2; page++) {
+        const ma_uint8* pPage = file.at(offset, 27);
+
+        if (pPage == nullptr || memcmp(pPage, "OggS", 4) != 0) {
+            return false;
+        }
+
+        ma_uint32 pageSerial = readLe32(pPage + 14);
+        ma_uint32 segmentCount = pPage[26];
+        const ma_uint8* pSegments = file.at(offset + 27, segmentCount);
+
+        if (pSegments == nullptr) {
+            return false;
+        }
+
+        if (page == 0) {
+            serial = pageSerial;
+        }
+
+        ma_uint64 dataOffset = offset + 27 + segmentCount;
+        ma_uint64 pageSize = 27 + segmentCount;
+        std::vector<ma_uint32> lacing(pSegments, pSegments + segmentCount);
+
+        for (ma_uint32 segment = 0; segment < segmentCount; segment++) {
+            pageSize += lacing[segment];
+        }
+
+        // Other multiplexed streams are ignored.
+        if (pageSerial != serial) {
+            offset += pageSize;
+            continue;
+        }
+
+        for (ma_uint32 segment = 0; segment < segmentCount && packetIndex < 2; segment++) {
+            if (!spans.empty() && spans.back().first + spans.back().second == dataOffset) {
+                spans.back().second += lacing[segment];
+            }
+            else {
+                spans.push_back({dataOffset, lacing[segment]});
+            }
+
+            dataOffset += lacing[segment];
+
+            // A lacing value below 255 ends the packet.
+            if (lacing[segment] == 255) {
+                continue;
+            }
+
+            std::string assembled;
+            const ma_uint8* pPacket = nullptr;
+            size_t packetSize = 0;
+
+            if (spans.size() == 1) {
+                pPacket = file.at(spans[0].first, spans[0].second);
+                packetSize = spans[0].second;
+            }
+            else {
+                for (const auto& span : spans) {
+                    const ma_uint8* pSpan = file.at(span.first, span.second);
+
+                    if (pSpan != nullptr) {
+                        assembled.append((const char*)pSpan, span.second);
+                    }
+                }
+
+                pPacket = (const ma_uint8*)assembled.data();
+                packetSize = assembled.size();
+            }
+
+            spans.clear();
+
+            if (pPacket == nullptr) {
+                return false;
+            }
+
+            if (packetIndex == 0) {
+                if (packetSize < 30 || memcmp(pPacket, "\x01vorbis", 7) != 0) {
+                    return false;
+                }
+
+                tags.channels = pPacket[11];
+                tags.sampleRate = readLe32(pPacket + 12);
+                nominalBitrate = readLe32(pPacket + 20);
+            }
+            else if (packetSize > 7 && memcmp(pPacket, "\x03vorbis", 7) == 0) {
+                parseVorbisComments(pPacket + 7, packetSize - 7, tags);
+            }
+
+            packetIndex++;
+        }
+
+        offset += pageSize;
+    }
+
+    if (tags.sampleRate == 0) {
+        return false;
+    }
+
+    tags.codec = "Vorbis";
+    tags.format = ma_format_f32;
+
+    // The granule position of the last page is the total number of samples.
+    ma_uint64 searchStart = (file.size > tailBytes) ? file.size - tailBytes : 0;
+    const ma_uint8* pTail = file.at(searchStart, file.size - searchStart);
+
+    for (ma_int64 i = (ma_int64)(file.size - searchStart) - 27; pTail != nullptr && i >= 0; i--) {
+        if (memcmp(pTail + i, "OggS", 4) == 0 && readLe32(pTail + i + 14) == serial) {
+            ma_uint64 granule = (ma_uint64)readLe32(pTail + i + 6) | ((ma_uint64)readLe32(pTail + i + 10) << 32);
+
+            if (granule != (ma_uint64)-1) {
+                tags.duration = (double)granule / tags.sampleRate;
+            }
+
+            break;
+        }
+    }
+
+    if (tags.duration > 0.0) {
+        tags.bitrate = (ma_uint32)(file.size * 8 / tags.duration / 1000);
+    }
+    else {
+        tags.bitrate = nominalBitrate / 1000;
+    }
+
+    return true;
+}
+
+/*
+ * Parses the first MPEG audio frame found from the given offset, along with a
+ * possible Xing/Info or VBRI header giving the number of frames of VBR files.
+ */
+bool TagParser::parseMpeg(MappedFile& file, ma_uint64 offset, Tags& tags)
+{
+    // Kbps, by MPEG-1 layer I, II, III then MPEG-2/2.5 layer I, II/III.
+    static const ma_uint32 bitrates[5][15] = {
+        {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+    };
+    static const ma_uint32 sampleRates[3] = {44100, 48000, 32000};
+
+    // Junk may come before the first frame.
+    const ma_uint64 searchLength = std::min((ma_uint64)prefixBytes, file.size - std::min(offset, file.size));
+    const ma_uint8* pData = file.at(offset, searchLength);
+
+    if (pData == nullptr) {
+        return false;
+    }
+
+    for (size_t i = 0; i + 4 <= searchLength; i++) {
+        const ma_uint8* p = pData + i;
+
+        if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) {
+            continue;
+        }
+
+        // 3 = MPEG-1, 2 = MPEG-2, 0 = MPEG-2.5.
+        int version = (p[1] >> 3) & 0x03;
+        // 3 = layer I, 2 = layer II, 1 = layer III.
+        int layer = (p[1] >> 1) & 0x03;
+        int bitrateIndex = p[2] >> 4;
+        int sampleRateIndex = (p[2] >> 2) & 0x03;
+
+        if (version == 1 || layer == 0 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3) {
+            continue;
+        }
+
+        bool isMpeg1 = (version == 3);
+        int row = isMpeg1 ? 3 - layer : (layer == 3 ? 3 : 4);
+        ma_uint32 bitrate = bitrates[row][bitrateIndex];
+        ma_uint32 sampleRate = sampleRates[sampleRateIndex] >> (isMpeg1 ? 0 : (version == 2 ? 1 : 2));
+        ma_uint32 padding = (p[2] >> 1) & 0x01;
+        bool isMono = (p[3] >> 6) == 3;
+        ma_uint32 samplesPerFrame = (layer == 3) ? 384 : (layer == 1 && !isMpeg1) ? 576 : 1152;
+        ma_uint32 frameLength = (layer == 3) ? (12 * bitrate * 1000 / sampleRate + padding) * 4
+                                             : samplesPerFrame / 8 * bitrate * 1000 / sampleRate + padding;
+
+        // A sync word within the data, unless the next frame starts right after.
+        if (i + frameLength + 2 <= searchLength && (pData[i + frameLength] != 0xFF || (pData[i + frameLength + 1] & 0xE0) != 0xE0)) {
+            continue;
+        }
+
+        tags.channels = isMono ? 1 : 2;
+        tags.sampleRate = sampleRate;
+        tags.format = ma_format_f32;
+        tags.codec = (layer == 1) ? "MP3" : (layer == 2) ? "MP2" : "MP1";
+
+        ma_uint64 frameOffset = offset + i;
+        ma_uint64 audioBytes = file.size - frameOffset;
+        ma_uint32 frameCount = 0;
+
+        // Xing/Info header after the side info, or VBRI 32 bytes after the header.
+        ma_uint32 sideInfo = isMpeg1 ? (isMono ? 17 : 32) : (isMono ? 9 : 17);
+        const ma_uint8* pXing = (layer == 1) ? file.at(frameOffset + 4 + sideInfo, 12) : nullptr;
+
+        if (pXing != nullptr && (memcmp(pXing, "Xing", 4) == 0 || memcmp(pXing, "Info", 4) == 0)) {
+            if (readBe32(pXing + 4) & 0x01) {
+                frameCount = readBe32(pXing + 8);
+            }
+
+            tags.codec += (memcmp(pXing, "Xing", 4) == 0) ? " (VBR)" : "";
+        }
+        else {
+            const ma_uint8* pVbri = (layer == 1) ? file.at(frameOffset + 36, 18) : nullptr;
+
+            if (pVbri != nullptr && memcmp(pVbri, "VBRI", 4) == 0) {
+                frameCount = readBe32(pVbri + 14);
+                tags.codec += " (VBR)";
+            }
+        }
+
+        if (frameCount > 0) {
+            tags.duration = (double)frameCount * samplesPerFrame / sampleRate;
+            tags.bitrate = (ma_uint32)(audioBytes * 8 / tags.duration / 1000);
+        }
+        else {
+            // Constant bitrate.
+            const ma_uint8* pId3v1 = (file.size >= 128) ? file.at(file.size - 128, 3) : nullptr;
+            audioBytes -= (pId3v1 != nullptr && memcmp(pId3v1, "TAG", 3) == 0) ? std::min(audioBytes, (ma_uint64)128) : 0;
+            tags.bitrate = bitrate;
+            tags.duration = (double)audioBytes * 8 / (bitrate * 1000.0);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Reads the stream properties and the tags of the given file. Returns false if
+ * the format isn't recognized or the headers are broken.
+ */
+bool TagParser::parse(const char* fileName, Tags& tags)
+{
+    MappedFile file;
+    tags = Tags();
+
+    if (!file.open(fileName)) {
+        return false;
+    }
+
+    const ma_uint8* pHeader = file.at(0, 12);
+
+    if (pHeader == nullptr) {
+        return false;
+    }
+
+    if (memcmp(pHeader, "RIFF", 4) == 0 && memcmp(pHeader + 8, "WAVE", 4) == 0) {
+        return parseRiff(file, tags);
+    }
+
+    if (memcmp(pHeader, "OggS", 4) == 0) {
+        return parseOgg(file, tags);
+    }
+
+    // ID3v2 tags, possibly several, before a FLAC or MPEG stream.
+    ma_uint64 offset = 0;
+    ma_uint64 tagSize;
+
+    while ((tagSize = parseId3v2(file, offset, tags)) > 0) {
+        offset += tagSize;
+    }
+
+    const ma_uint8* pMagic = file.at(offset, 4);
+
+    if (pMagic != nullptr && memcmp(pMagic, "fLaC", 4) == 0) {
+        return parseFlac(file, offset, tags);
+    }
+
+    if (!parseMpeg(file, offset, tags)) {
+        return false;
+    }
+
+    parseId3v1(file, tags);
+
+    return true;
+}
+
+/*
+ * Parses truncated files: Synthetic headers announcing more bytes than the file
+ * holds, and the given files cut at various lengths. Returns the number of files
+ * parsed (ie: without crashing).
+ */
+static size_t parseTruncatedFiles(const std::vector<std::string>& files)
+{
+    std::filesystem::path fileName = std::filesystem::temp_directory_path() / "audioplayer-truncated";
+    std::vector<std::vector<char>> contents;
+
+    // STREAMINFO announcing 34 bytes, only 10 of them present.
+    contents.push_back({'f', 'L', 'a', 'C', (char)0x80, 0, 0, 34, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    // WAV whose first chunk header is cut.
+    contents.push_back({'R', 'I', 'F', 'F', 100, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't'});
+    // fmt chunk announcing 16 bytes, only 4 of them present.
+    contents.push_back({'R', 'I', 'F', 'F', 100, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 2, 0});
+
+    // A few of the actual files, cut in the headers and in the middle.
+    for (size_t i = 0; i < std::min(files.size(), (size_t)10); i++) {
+        std::ifstream input(files[i], std::ios::binary);
+        std::vector<char> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        for (size_t length : {(size_t)13, (size_t)64, (size_t)512, (size_t)4096, data.size() / 2}) {
+            if (length < data.size()) {
+                contents.emplace_back(data.begin(), data.begin() + length);
+            }
+        }
+    }
+
+    size_t parsed = 0;
+
+    for (const std::vector<char>& content : contents) {
+        {
+            std::ofstream output(fileName, std::ios::binary | std::ios::trunc);
+            output.write(content.data(), content.size());
+        }
+
+        TagParser::Tags tags;
+        TagParser::parse(fileName.c_str(), tags);
+        parsed++;
+    }
+
+    std::filesystem::remove(fileName);
+
+    return parsed;
+}
+
+/*
+ * Parses the given files (directories are searched recursively) over and over, and
+ * reports the number of files parsed per second against a decoder initialization.
+ * Truncated copies are parsed first, which must not crash.
+ * Usage: Player --bench-tags PATH...
+ */
+int TagParser::benchmark(const std::vector<std::string>& paths)
+{
+    const std::vector<std::string> extensions = {".wav", ".mp3", ".flac", ".ogg"};
+    std::vector<std::string> files;
+
+    auto isAudioFile = [&extensions](const std::filesystem::path& path) {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+    };
+
+    for (const std::string& path : paths) {
+        std::error_code error;
+
+        if (std::filesystem::is_directory(path, error)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(path, error)) {
+                if (entry.is_regular_file() && isAudioFile(entry.path())) {
+                    files.push_back(entry.path().string());
+                }
+            }
+        }
+        else if (isAudioFile(path)) {
+            files.push_back(path);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "Usage: Player --bench-tags PATH..." << std::endl;
+        return 1;
+    }
+
+    const double runSeconds = 2.0;
+    size_t parsed = 0, withTitle = 0, withArt = 0;
+
+    // Once for the statistics.
+    for (const std::string& fileName : files) {
+        Tags tags;
+
+        if (parse(fileName.c_str(), tags)) {
+            parsed++;
+            withTitle += tags.title.empty() ? 0 : 1;
+            withArt += (tags.artSize > 0) ? 1 : 0;
+        }
+    }
+
+    printf("%zu files, %zu parsed, %zu with a title, %zu with a picture\n", files.size(), parsed, withTitle, withArt);
+    printf("%zu truncated files parsed without crashing\n", parseTruncatedFiles(files));
+
+    for (bool useDecoder : {false, true}) {
+        ma_uint64 count = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+
+        while (elapsed < runSeconds) {
+            const std::string& fileName = files[count % files.size()];
+
+            if (useDecoder) {
+                ma_decoder decoder;
+                ma_decoder_config config = ma_decoder_config_init_default();
+
+                if (ma_decoder_init_file(fileName.c_str(), &config, &decoder) == MA_SUCCESS) {
+                    ma_uint64 length;
+                    ma_decoder_get_length_in_pcm_frames(&decoder, &length);
+                    ma_decoder_uninit(&decoder);
+                }
+            }
+            else {
+                Tags tags;
+                parse(fileName.c_str(), tags);
+            }
+
+            count++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        printf("%s: %.0f files per second\n", useDecoder ? "Decoder probe" : "Tag parser", count / elapsed);
+    }
+
+    return 0;
+}
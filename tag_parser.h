@@ -0,0 +1,81 @@
+#ifndef TAG_PARSER_H
+#define TAG_PARSER_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The TagParser class reads the stream properties and the tags of a file straight
+ * from its headers, without creating any decoder: ID3v2/ID3v1 and the first MPEG
+ * frame (Xing/VBRI included) for MP3, the metadata blocks for FLAC, the Vorbis
+ * headers for Ogg and the fmt/data/LIST INFO chunks for WAV.
+ * The file is memory mapped: A small prefix and the tail are mapped first, and the
+ * prefix is only extended when a header lies further (eg: after a large cover art),
+ * so that a few pages are read per file. The headers are parsed in place.
+ */
+class TagParser {
+    public:
+        struct Tags {
+            std::string title;
+            std::string artist;
+            std::string album;
+            // Eg: "FLAC 24-bit", "MP3 (VBR)".
+            std::string codec;
+            ma_uint32 channels = 0;
+            ma_uint32 sampleRate = 0;
+            ma_uint32 bitsPerSample = 0;
+            // The sample format the decoder outputs natively.
+            ma_format format = ma_format_unknown;
+            // In seconds, zero if unknown.
+            double duration = 0.0;
+            // Average bitrate in kbps, zero if unknown.
+            ma_uint32 bitrate = 0;
+            // Embedded picture (front cover preferred) within the file, artSize is zero if none.
+            ma_uint64 artOffset = 0;
+            ma_uint64 artSize = 0;
+            std::string artMimeType;
+        };
+
+    private:
+        // Read-only view of the file. The pointers returned by at() are only valid
+        // until the next call, as the prefix may be remapped.
+        class MappedFile {
+            private:
+                int fd = -1;
+                const ma_uint8* pHead = nullptr;
+                size_t headSize = 0;
+                const ma_uint8* pTail = nullptr;
+                ma_uint64 tailOffset = 0;
+                size_t tailSize = 0;
+                bool mapTail();
+
+            public:
+                ma_uint64 size = 0;
+
+                ~MappedFile();
+
+                bool open(const char* fileName);
+                const ma_uint8* at(ma_uint64 offset, ma_uint64 count);
+        };
+
+        // Prefix mapped first, covers the headers of most files.
+        static constexpr size_t prefixBytes = 64 * 1024;
+        // Tail mapped for ID3v1 and the last Ogg page.
+        static constexpr size_t tailBytes = 64 * 1024;
+        static bool parseRiff(MappedFile& file, Tags& tags);
+        static bool parseFlac(MappedFile& file, ma_uint64 offset, Tags& tags);
+        static bool parseOgg(MappedFile& file, Tags& tags);
+        static bool parseMpeg(MappedFile& file, ma_uint64 offset, Tags& tags);
+        static ma_uint64 parseId3v2(MappedFile& file, ma_uint64 offset, Tags& tags);
+        static void parseId3v1(MappedFile& file, Tags& tags);
+        static void parseVorbisComments(const ma_uint8* pData, size_t size, Tags& tags);
+        static std::string decodeText(const ma_uint8* pData, size_t size, int encoding);
+
+    public:
+        static bool parse(const char* fileName, Tags& tags);
+        static int benchmark(const std::vector<std::string>& paths);
+};
+
+#endif // TAG_PARSER_H
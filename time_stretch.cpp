@@ -0,0 +1,322 @@
+#include <iostream>
+#include <chrono>
+#include "time_stretch.h"
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Constructor: Sets the WSOLA parameters according to the sample rate and
+ * allocates the buffers.
+ */
+TimeStretch::TimeStretch(ma_uint32 channels, ma_uint32 sampleRate) : channels(channels), sampleRate(sampleRate) {
+    // About 20ms frames, overlapped by half.
+    frameLength = (sampleRate > 48000) ? 2048 : 1024;
+    outputHop = frameLength / 2;
+    tolerance = frameLength / 4;
+
+    // Periodic Hann window, the overlapped windows sum to one.
+    window.resize(frameLength);
+
+    for (ma_uint32 i = 0; i < frameLength; i++) {
+        window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / frameLength);
+    }
+
+    // Enough room for the frame, the tolerance on both sides and the largest hop.
+    inputCapacity = frameLength * 4;
+    inputBuffer.resize(inputCapacity * channels);
+    overlapBuffer.resize(frameLength * channels);
+    outputBuffer.resize(outputHop * channels);
+}
+
+/*
+ * Drops all of the buffered frames. Must be called from the thread calling process().
+ */
+void TimeStretch::reset()
+{
+    inputFrames = 0;
+    analysisPosition = 0.0;
+    templateStart = -1;
+    outputAvailable = 0;
+    outputPosition = 0;
+    std::fill(overlapBuffer.begin(), overlapBuffer.end(), 0.0f);
+    active = false;
+}
+
+/*
+ * Computes both the dot product of the two given sample arrays and the energy of
+ * the second one. This is the hot spot of the frame search, hence the SIMD paths.
+ */
+void TimeStretch::correlate(const float* pA, const float* pB, size_t count, float& product, float& energy)
+{
+    size_t i = 0;
+    float sumAB = 0.0f;
+    float sumBB = 0.0f;
+
+#if defined(__AVX__)
+    __m256 ab = _mm256_setzero_ps();
+    __m256 bb = _mm256_setzero_ps();
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_loadu_ps(pA + i);
+        __m256 b = _mm256_loadu_ps(pB + i);
+        ab = _mm256_add_ps(ab, _mm256_mul_ps(a, b));
+        bb = _mm256_add_ps(bb, _mm256_mul_ps(b, b));
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, ab);
+    sumAB = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    _mm256_storeu_ps(lanes, bb);
+    sumBB = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+#elif defined(__SSE__)
+    __m128 ab = _mm_setzero_ps();
+    __m128 bb = _mm_setzero_ps();
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 a = _mm_loadu_ps(pA + i);
+        __m128 b = _mm_loadu_ps(pB + i);
+        ab = _mm_add_ps(ab, _mm_mul_ps(a, b));
+        bb = _mm_add_ps(bb, _mm_mul_ps(b, b));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, ab);
+    sumAB = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_ps(lanes, bb);
+    sumBB = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+    // Remaining samples (or the whole array without SIMD).
+    for (; i < count; i++) {
+        sumAB += pA[i] * pB[i];
+        sumBB += pB[i] * pB[i];
+    }
+
+    product = sumAB;
+    energy = sumBB;
+}
+
+/*
+ * Returns the frame start, around the nominal one, that best continues the previous frame.
+ */
+ma_int64 TimeStretch::findBestStart(ma_int64 nominal)
+{
+    if (templateStart < 0) {
+        return nominal;
+    }
+
+    // The natural continuation of the previous frame over the overlapped part.
+    const float* pTemplate = inputBuffer.data() + templateStart * channels;
+    size_t count = (size_t)(frameLength - outputHop) * channels;
+    ma_int64 low = std::max((ma_int64)0, nominal - (ma_int64)tolerance);
+    ma_int64 high = nominal + tolerance;
+    ma_int64 best = nominal;
+    float bestScore = -INFINITY;
+
+    auto score = [&](ma_int64 start) {
+        float product, energy;
+        // Interleaved channels are correlated all at once.
+        correlate(pTemplate, inputBuffer.data() + start * channels, count, product, energy);
+        // Normalized so that loud candidates are not favoured.
+        float value = product / sqrtf(energy + 1e-9f);
+
+        if (value > bestScore) {
+            bestScore = value;
+            best = start;
+        }
+    };
+
+    // Coarse search, then refine around the best candidate.
+    const ma_int64 coarseStep = 4;
+
+    for (ma_int64 start = low; start <= high; start += coarseStep) {
+        score(start);
+    }
+
+    ma_int64 coarseBest = best;
+
+    for (ma_int64 start = std::max(low, coarseBest - coarseStep + 1); start <= std::min(high, coarseBest + coarseStep - 1); start++) {
+        if (start != coarseBest) {
+            score(start);
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Adds a new frame to the output and makes an output hop available.
+ */
+void TimeStretch::step(float stepSpeed, ReadProc read, void* pUserData)
+{
+    ma_int64 nominal = (ma_int64)llround(analysisPosition);
+    ma_uint32 framesNeeded = (ma_uint32)(nominal + tolerance + frameLength);
+
+    // Pull the source frames the search may need.
+    while (inputFrames < framesNeeded) {
+        ma_uint32 framesRead = read(pUserData, inputBuffer.data() + inputFrames * channels, framesNeeded - inputFrames);
+
+        // End of the source, pad with silence.
+        if (framesRead == 0) {
+            std::fill(inputBuffer.begin() + inputFrames * channels, inputBuffer.begin() + framesNeeded * channels, 0.0f);
+            inputFrames = framesNeeded;
+            break;
+        }
+
+        inputFrames += framesRead;
+    }
+
+    ma_int64 start = findBestStart(nominal);
+    const float* pFrame = inputBuffer.data() + start * channels;
+
+    // Overlap-add the windowed frame.
+    for (ma_uint32 i = 0; i < frameLength; i++) {
+        for (ma_uint32 c = 0; c < channels; c++) {
+            overlapBuffer[i * channels + c] += window[i] * pFrame[i * channels + c];
+        }
+    }
+
+    // The first hop is complete.
+    size_t hopSamples = (size_t)outputHop * channels;
+    std::copy(overlapBuffer.begin(), overlapBuffer.begin() + hopSamples, outputBuffer.begin());
+    std::copy(overlapBuffer.begin() + hopSamples, overlapBuffer.end(), overlapBuffer.begin());
+    std::fill(overlapBuffer.end() - hopSamples, overlapBuffer.end(), 0.0f);
+    outputAvailable = outputHop;
+    outputPosition = 0;
+
+    templateStart = start + outputHop;
+    analysisPosition += outputHop * stepSpeed;
+
+    // Discard the frames that are no longer needed (ie: before the next template and search).
+    ma_int64 keep = std::min(templateStart, (ma_int64)analysisPosition - (ma_int64)tolerance);
+
+    if (keep > 0) {
+        std::copy(inputBuffer.begin() + keep * channels, inputBuffer.begin() + inputFrames * channels, inputBuffer.begin());
+        inputFrames -= (ma_uint32)keep;
+        analysisPosition -= keep;
+        templateStart -= keep;
+    }
+}
+
+/*
+ * Resizes the buffers for a new channel count (eg: a file with another layout).
+ * Note: Must not be called while process() may run.
+ */
+void TimeStretch::setChannels(ma_uint32 count)
+{
+    if (count == channels) {
+        return;
+    }
+
+    channels = count;
+    inputBuffer.assign(inputCapacity * channels, 0.0f);
+    overlapBuffer.assign(frameLength * channels, 0.0f);
+    outputBuffer.assign(outputHop * channels, 0.0f);
+    reset();
+}
+
+/*
+ * Fills the output with frameCount frames played at the current speed.
+ * Source frames are pulled through the given read function as needed.
+ * Note: The stretcher is bypassed at normal speed until it's first used.
+ */
+ma_uint32 TimeStretch::process(float* pOutput, ma_uint32 frameCount, ReadProc read, void* pUserData)
+{
+    if (resetRequested.exchange(false, std::memory_order_acquire)) {
+        reset();
+    }
+
+    float stepSpeed = speed.load(std::memory_order_relaxed);
+
+    if (!active && stepSpeed == 1.0f) {
+        return read(pUserData, pOutput, frameCount);
+    }
+
+    active = true;
+    ma_uint32 framesDone = 0;
+
+    while (framesDone < frameCount) {
+        if (outputAvailable == 0) {
+            step(stepSpeed, read, pUserData);
+        }
+
+        ma_uint32 framesToCopy = std::min(outputAvailable, frameCount - framesDone);
+        memcpy(pOutput + framesDone * channels, outputBuffer.data() + outputPosition * channels, framesToCopy * channels * sizeof(float));
+        outputPosition += framesToCopy;
+        outputAvailable -= framesToCopy;
+        framesDone += framesToCopy;
+    }
+
+    return frameCount;
+}
+
+/*
+ * Returns the number of source frames read ahead of the next output frame,
+ * used to keep the playback position in source time.
+ */
+double TimeStretch::getBufferedFrames()
+{
+    if (!active) {
+        return 0.0;
+    }
+
+    return inputFrames - analysisPosition + outputAvailable * speed.load(std::memory_order_relaxed);
+}
+
+/*
+ * Measures the stretching throughput on stereo 96kHz material.
+ * Usage: Player --bench-stretch
+ */
+void TimeStretch::benchmark()
+{
+    const ma_uint32 rate = 96000;
+    const ma_uint32 blockFrames = 512;
+    const double outputSeconds = 60.0;
+
+    // Ten seconds of a chord with some noise, played in a loop.
+    struct Source {
+        std::vector<float> frames;
+        size_t position = 0;
+    } source;
+
+    source.frames.resize(rate * 10 * 2);
+
+    for (size_t i = 0; i < source.frames.size() / 2; i++) {
+        float t = (float)i / rate;
+        float value = 0.3f * sinf(2.0f * (float)M_PI * 220.0f * t) + 0.2f * sinf(2.0f * (float)M_PI * 277.2f * t)
+                      + 0.05f * ((float)rand() / RAND_MAX - 0.5f);
+        source.frames[i * 2] = value;
+        source.frames[i * 2 + 1] = -value;
+    }
+
+    auto read = [](void* pUserData, float* pFrames, ma_uint32 frameCount) -> ma_uint32 {
+        Source* pSource = (Source*)pUserData;
+
+        for (ma_uint32 i = 0; i < frameCount * 2; i++) {
+            pFrames[i] = pSource->frames[pSource->position];
+            pSource->position = (pSource->position + 1) % pSource->frames.size();
+        }
+
+        return frameCount;
+    };
+
+    std::vector<float> output(blockFrames * 2);
+    const float speeds[] = {0.5f, 0.75f, 1.25f, 1.5f, 2.0f};
+
+    printf("Time stretch benchmark: stereo %u Hz, %u frame blocks\n", rate, blockFrames);
+
+    for (float value : speeds) {
+        TimeStretch stretch(2, rate);
+        stretch.setSpeed(value);
+        ma_uint64 blocks = (ma_uint64)(outputSeconds * rate / blockFrames);
+        auto start = std::chrono::steady_clock::now();
+
+        for (ma_uint64 i = 0; i < blocks; i++) {
+            stretch.process(output.data(), blockFrames, read, &source);
+        }
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("  %.2fx: %.1fx realtime (%.3f s for %.0f s of output)\n", value, outputSeconds / elapsed, elapsed, outputSeconds);
+    }
+}
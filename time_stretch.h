@@ -0,0 +1,72 @@
+#ifndef TIME_STRETCH_H
+#define TIME_STRETCH_H
+
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "../libraries/miniaudio.h"
+
+/*
+ * The TimeStretch class changes the playback speed while preserving the pitch
+ * (WSOLA: Waveform Similarity Overlap-Add).
+ * Frames are cut from the source with a Hann window and overlap-added at a fixed
+ * output hop, while the source is read at speed times that hop. Each frame is
+ * moved within a small tolerance to the position that best matches the natural
+ * continuation of the previous frame, which avoids phase cancellation.
+ * All of the buffers are allocated up front so that process() can be called
+ * from the audio callback.
+ */
+class TimeStretch {
+    public:
+        // Function used to pull source frames. Returns the number of frames read.
+        typedef ma_uint32 (*ReadProc)(void* pUserData, float* pFrames, ma_uint32 frameCount);
+
+    private:
+        ma_uint32 channels;
+        ma_uint32 sampleRate;
+        // Frame length, output hop and seek tolerance (in frames).
+        ma_uint32 frameLength;
+        ma_uint32 outputHop;
+        ma_uint32 tolerance;
+        std::vector<float> window;
+        std::vector<float> inputBuffer;
+        ma_uint32 inputCapacity;
+        ma_uint32 inputFrames = 0;
+        // Nominal start of the next frame within the input buffer.
+        double analysisPosition = 0.0;
+        // Start of the natural continuation of the previous frame (ie: previous start
+        // plus the output hop) within the input buffer, -1 before the first frame.
+        ma_int64 templateStart = -1;
+        std::vector<float> overlapBuffer;
+        std::vector<float> outputBuffer;
+        ma_uint32 outputAvailable = 0;
+        ma_uint32 outputPosition = 0;
+        std::atomic<float> speed = 1.0f;
+        std::atomic<bool> resetRequested = false;
+        bool active = false;
+        void step(float stepSpeed, ReadProc read, void* pUserData);
+        ma_int64 findBestStart(ma_int64 nominal);
+
+    public:
+        static constexpr float minSpeed = 0.5f;
+        static constexpr float maxSpeed = 2.0f;
+
+        TimeStretch(ma_uint32 channels, ma_uint32 sampleRate);
+
+        void setSpeed(float value) { speed.store(std::clamp(value, minSpeed, maxSpeed), std::memory_order_relaxed); }
+        float getSpeed() { return speed.load(std::memory_order_relaxed); }
+        // Drops the buffered frames on the next call to process() (eg: after a seek).
+        void requestReset() { resetRequested.store(true, std::memory_order_release); }
+        void reset();
+        void setChannels(ma_uint32 count);
+        ma_uint32 process(float* pOutput, ma_uint32 frameCount, ReadProc read, void* pUserData);
+        double getBufferedFrames();
+        bool isActive() { return active; }
+
+        static void correlate(const float* pA, const float* pB, size_t count, float& product, float& energy);
+        static void benchmark();
+};
+
+#endif // TIME_STRETCH_H
@@ -0,0 +1,327 @@
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "tracer.h"
+
+// Origin of the timestamps.
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+/*
+ * Gives the buffer back once the thread ends, so that the short lived threads
+ * (eg: the spectrogram workers) don't pile buffers up. The events are kept until
+ * the buffer is taken over.
+ */
+struct BufferOwner {
+    void* pBuffer = nullptr;
+    void (*release)(void*) = nullptr;
+
+    ~BufferOwner() {
+        if (pBuffer != nullptr) {
+            release(pBuffer);
+        }
+    }
+};
+
+static thread_local BufferOwner bufferOwner;
+static thread_local const char* currentThreadName = nullptr;
+
+std::uint32_t Tracer::getThreadId()
+{
+    static thread_local std::uint32_t threadId = (std::uint32_t)syscall(SYS_gettid);
+
+    return threadId;
+}
+
+std::uint64_t Tracer::getTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/*
+ * Returns the buffer of the calling thread, claimed on its first event among the
+ * buffers allocated beforehand. Returns nullptr if they're all in use.
+ * Note: Neither locks nor allocates (eg: first callback of a new device thread).
+ */
+Tracer::Buffer* Tracer::getBuffer()
+{
+    if (bufferOwner.pBuffer != nullptr) {
+        return (Buffer*)bufferOwner.pBuffer;
+    }
+
+    int count = bufferCount.load(std::memory_order_acquire);
+
+    for (int i = 0; i < count; i++) {
+        bool expected = false;
+
+        if (!buffers[i]->inUse.load(std::memory_order_relaxed)
+            && buffers[i]->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            bufferOwner.pBuffer = buffers[i];
+            bufferOwner.release = [](void* pBuffer) {
+                ((Buffer*)pBuffer)->inUse.store(false, std::memory_order_release);
+            };
+
+            return buffers[i];
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Allocates the buffers, enough for the threads of the application (ie: the
+ * workers scale with the CPU count).
+ * Note: The mutex must be held.
+ */
+void Tracer::allocateBuffers()
+{
+    int count = bufferCount.load(std::memory_order_relaxed);
+    int needed = std::min(maxBuffers, 16 + 2 * (int)std::thread::hardware_concurrency());
+
+    for (int i = count; i < needed; i++) {
+        buffers[i] = new Buffer();
+    }
+
+    bufferCount.store(std::max(count, needed), std::memory_order_release);
+}
+
+/*
+ * Appends an event to the buffer of the calling thread.
+ * Only the owning thread writes into a buffer: The event is filled, then published
+ * by increasing the count.
+ */
+void Tracer::record(const char* name, char phase)
+{
+    Buffer* pBuffer = getBuffer();
+
+    // More threads than buffers.
+    if (pBuffer == nullptr) {
+        droppedEvents.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::uint64_t index = pBuffer->count.load(std::memory_order_relaxed);
+    Slot& slot = pBuffer->slots[index % capacity];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.timestamp.store(getTimestamp(), std::memory_order_relaxed);
+    slot.threadId.store(getThreadId(), std::memory_order_relaxed);
+    slot.phase.store(phase, std::memory_order_relaxed);
+    pBuffer->count.store(index + 1, std::memory_order_release);
+}
+
+/*
+ * Turns tracing on or off. The events recorded previously are dropped when tracing
+ * is turned on, they are kept for the export when it's turned off.
+ */
+void Tracer::setEnabled(bool enable)
+{
+    if (enable && !enabled.load()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        allocateBuffers();
+
+        for (int i = 0; i < bufferCount.load(std::memory_order_relaxed); i++) {
+            buffers[i]->count.store(0, std::memory_order_relaxed);
+        }
+
+        droppedEvents.store(0, std::memory_order_relaxed);
+    }
+
+    enabled.store(enable);
+}
+
+/*
+ * Names the calling thread in the exported traces.
+ */
+void Tracer::setThreadName(const char* name)
+{
+    // Cheap enough to be called on every audio callback.
+    if (currentThreadName == name) {
+        return;
+    }
+
+    currentThreadName = name;
+    std::uint32_t threadId = getThreadId();
+    int count = std::min(threadNameCount.load(std::memory_order_acquire), maxThreadNames);
+
+    // Renamed, or a thread id reused by the system.
+    for (int i = 0; i < count; i++) {
+        if (threadNames[i].threadId.load(std::memory_order_relaxed) == threadId) {
+            threadNames[i].name.store(name, std::memory_order_release);
+            return;
+        }
+    }
+
+    // The id is stored first, the entry is only read once the name is set.
+    int index = threadNameCount.fetch_add(1, std::memory_order_acq_rel);
+
+    if (index < maxThreadNames) {
+        threadNames[index].threadId.store(threadId, std::memory_order_relaxed);
+        threadNames[index].name.store(name, std::memory_order_release);
+    }
+}
+
+/*
+ * Writes the events recorded so far into the given file, in the Chrome trace event
+ * format. Can be called while the threads are recording.
+ */
+bool Tracer::exportJson(const std::string& fileName, size_t* pEventCount)
+{
+    std::vector<Event> events;
+    std::map<std::uint32_t, std::string> names;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int nameCount = std::min(threadNameCount.load(std::memory_order_acquire), maxThreadNames);
+
+        for (int i = 0; i < nameCount; i++) {
+            const char* name = threadNames[i].name.load(std::memory_order_acquire);
+
+            if (name != nullptr) {
+                names[threadNames[i].threadId.load(std::memory_order_relaxed)] = name;
+            }
+        }
+
+        for (int b = 0; b < bufferCount.load(std::memory_order_acquire); b++) {
+            Buffer* pBuffer = buffers[b];
+            std::uint64_t last = pBuffer->count.load(std::memory_order_acquire);
+            std::uint64_t first = last > capacity ? last - capacity : 0;
+            size_t offset = events.size();
+
+            for (std::uint64_t i = first; i < last; i++) {
+                const Slot& slot = pBuffer->slots[i % capacity];
+                events.push_back({slot.name.load(std::memory_order_relaxed), slot.timestamp.load(std::memory_order_relaxed),
+                                  slot.threadId.load(std::memory_order_relaxed), slot.phase.load(std::memory_order_relaxed)});
+            }
+
+            // Drop the oldest events which may have been overwritten during the copy.
+            std::uint64_t count = pBuffer->count.load(std::memory_order_acquire);
+
+            if (count > first + capacity) {
+                std::uint64_t overwritten = std::min(count - capacity - first, last - first);
+                events.erase(events.begin() + offset, events.begin() + offset + overwritten);
+            }
+        }
+    }
+
+    FILE* pFile = fopen(fileName.c_str(), "w");
+
+    if (pFile == nullptr) {
+        std::perror(fileName.c_str());
+        return false;
+    }
+
+    fprintf(pFile, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+
+    for (const auto& name : names) {
+        fprintf(pFile, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                separator, (int)getpid(), name.first, name.second.c_str());
+        separator = ",\n";
+    }
+
+    // Open scopes per thread, an end whose begin has been overwritten is dropped.
+    std::map<std::uint32_t, int> depths;
+    size_t eventCount = 0;
+
+    for (const Event& event : events) {
+        int& depth = depths[event.threadId];
+
+        if (event.phase == 'E') {
+            if (depth == 0) {
+                continue;
+            }
+
+            depth--;
+        }
+        else {
+            depth++;
+        }
+
+        fprintf(pFile, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %u}", separator,
+                event.name, event.phase, event.timestamp / 1000.0, (int)getpid(), event.threadId);
+        separator = ",\n";
+        eventCount++;
+    }
+
+    fprintf(pFile, "\n]}\n");
+    bool written = (ferror(pFile) == 0);
+    written = (fclose(pFile) == 0) && written;
+
+    if (pEventCount != nullptr) {
+        *pEventCount = eventCount;
+    }
+
+    return written;
+}
+
+/*
+ * Exports the events into a new file of the working directory, named after the
+ * process id. Returns the file name, or an empty string if it couldn't be written.
+ */
+std::string Tracer::exportToNewFile()
+{
+    std::string fileName = "trace-" + std::to_string(getpid()) + "-" + std::to_string(++exportedFiles) + ".json";
+    size_t eventCount = 0;
+
+    if (!exportJson(fileName, &eventCount)) {
+        return "";
+    }
+
+    printf("Trace: %zu events written to %s\n", eventCount, fileName.c_str());
+
+    if (droppedEvents.load(std::memory_order_relaxed) > 0) {
+        printf("Trace: %llu events dropped (more threads than buffers)\n",
+               (unsigned long long)droppedEvents.load(std::memory_order_relaxed));
+    }
+
+    return fileName;
+}
+
+/*
+ * Waits for the given signal: Starts tracing if it's off, exports the events otherwise.
+ * Note: This function is run in a thread.
+ */
+void Tracer::waitForSignal(int signal)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signal);
+    setThreadName("Trace signal");
+
+    while (true) {
+        int received;
+
+        if (sigwait(&signals, &received) != 0) {
+            return;
+        }
+
+        if (!isEnabled()) {
+            setEnabled(true);
+            printf("Trace: Started, send the signal again to export the events.\n");
+        }
+        else {
+            exportToNewFile();
+        }
+    }
+}
+
+/*
+ * Lets the given signal (eg: kill -USR1 PID) start tracing or export the events.
+ * The signal is handled by a dedicated thread, so that the file isn't written from
+ * a signal handler.
+ * Note: Must be called before any other thread is created, as they inherit the
+ *       blocked signal.
+ */
+void Tracer::exportOnSignal(int signal)
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signal);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    std::thread(&Tracer::waitForSignal, signal).detach();
+}
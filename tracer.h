@@ -0,0 +1,124 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <string>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+
+/*
+ * The Tracer class records the begin and end of the main operations of each thread
+ * (audio callback, decoder reads, seeks, file loading, GUI callbacks...) and exports
+ * them in the Chrome trace event format (see chrome://tracing or ui.perfetto.dev).
+ * Each thread writes into its own ring buffer, without lock nor allocation, so that
+ * the audio callback is not disturbed: The buffers are allocated when tracing is
+ * turned on, and each thread claims one on its first event. The oldest events are
+ * overwritten once a buffer is full.
+ * When tracing is off, a Scope costs a relaxed atomic load.
+ */
+class Tracer {
+    public:
+        // Traces the lifetime of the object, ie: a block of code.
+        class Scope {
+                const char* name;
+                bool active;
+
+            public:
+                // The name must be a string literal (ie: only the pointer is stored).
+                Scope(const char* name) : name(name), active(isEnabled()) {
+                    if (active) {
+                        record(name, 'B');
+                    }
+                }
+                // Also names the calling thread, for the threads not created by the application.
+                Scope(const char* name, const char* threadName) : name(name), active(isEnabled()) {
+                    if (active) {
+                        setThreadName(threadName);
+                        record(name, 'B');
+                    }
+                }
+                ~Scope() {
+                    // Ended even if tracing has been turned off meanwhile.
+                    if (active) {
+                        record(name, 'E');
+                    }
+                }
+        };
+
+    private:
+        struct Event {
+            const char* name;
+            // Nanoseconds since the start of the program.
+            std::uint64_t timestamp;
+            std::uint32_t threadId;
+            char phase;
+        };
+        // An event as stored in a buffer, the exporting thread may read it while
+        // the owning thread overwrites it (the copy is then dropped).
+        struct Slot {
+            std::atomic<const char*> name;
+            std::atomic<std::uint64_t> timestamp;
+            std::atomic<std::uint32_t> threadId;
+            std::atomic<char> phase;
+        };
+        // Events kept per thread (about 400 KB).
+        static constexpr std::uint64_t capacity = 16384;
+        struct Buffer {
+            // Claimed by a thread, given back once it ends (its events are kept
+            // until the buffer is taken over).
+            std::atomic<bool> inUse = false;
+            // Total number of events written, the last capacity ones are kept.
+            std::atomic<std::uint64_t> count = 0;
+            Slot slots[capacity];
+        };
+        // Threads traced at once, at most. The events of the other ones are dropped.
+        static constexpr int maxBuffers = 128;
+        // Static storage, thus zeroed.
+        struct ThreadName {
+            std::atomic<std::uint32_t> threadId;
+            // String literal, nullptr until the entry is set.
+            std::atomic<const char*> name;
+        };
+        static constexpr int maxThreadNames = 256;
+        static inline std::atomic<bool> enabled = false;
+        // Guards the buffer allocation and the export, never locked while recording.
+        static inline std::mutex mutex;
+        // Only the first bufferCount ones are set, published with bufferCount.
+        static inline Buffer* buffers[maxBuffers] = {};
+        static inline std::atomic<int> bufferCount = 0;
+        static inline std::atomic<std::uint64_t> droppedEvents = 0;
+        static inline ThreadName threadNames[maxThreadNames];
+        static inline std::atomic<int> threadNameCount = 0;
+        static void allocateBuffers();
+        static inline std::atomic<int> exportedFiles = 0;
+        static Buffer* getBuffer();
+        static void record(const char* name, char phase);
+        static std::uint32_t getThreadId();
+        static std::uint64_t getTimestamp();
+        static void waitForSignal(int signal);
+
+    public:
+        static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+        static void setEnabled(bool enable);
+        // For the spans which aren't a block of code.
+        static void begin(const char* name) {
+            if (isEnabled()) {
+                record(name, 'B');
+            }
+        }
+        static void end(const char* name) {
+            if (isEnabled()) {
+                record(name, 'E');
+            }
+        }
+        // The name must be a string literal.
+        static void setThreadName(const char* name);
+        static bool exportJson(const std::string& fileName, size_t* pEventCount = nullptr);
+        static std::string exportToNewFile();
+        static void exportOnSignal(int signal);
+};
+
+#endif // TRACER_H